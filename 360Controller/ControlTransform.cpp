@@ -0,0 +1,229 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+
+    ControlTransform.cpp - user settings applied to input reports
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifdef KERNEL
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSBoolean.h>
+#include <libkern/c++/OSNumber.h>
+#endif
+#include "ControlTransform.h"
+
+#ifdef KERNEL
+static const char *bindingKeys[CONTROL_BUTTONS] = {
+    "BindingUp", "BindingDown", "BindingLeft", "BindingRight",
+    "BindingStart", "BindingBack", "BindingLSC", "BindingRSC",
+    "BindingLB", "BindingRB", "BindingGuide",
+    "BindingA", "BindingB", "BindingX", "BindingY",
+};
+#endif
+
+// This returns the abs() value of a short, swapping it if necessary
+static inline XBox360_SShort getAbsolute(XBox360_SShort value)
+{
+    XBox360_SShort reverse;
+
+#ifdef __LITTLE_ENDIAN__
+    reverse=value;
+#elif __BIG_ENDIAN__
+    reverse=((value&0xFF00)>>8)|((value&0x00FF)<<8);
+#else
+#error Unknown CPU byte order
+#endif
+    return (reverse<0)?~reverse:reverse;
+}
+
+// Stretches an axis outside the deadzone so it covers the full range again
+static inline XBox360_SShort rescaleAxis(XBox360_SShort value, const CONTROL_STICK_KERNEL *kernel)
+{
+    UInt32 scaled = (UInt32)(((UInt64)(getAbsolute(value) - kernel->deadzone) * kernel->scale) >> 16);
+    if (scaled > 32767) scaled = 32767;
+    return (value < 0) ? ~(XBox360_SShort)scaled : (XBox360_SShort)scaled;
+}
+
+// No deadzone, only inversion
+static void stickInvert(XBOX360_HAT *hat, const CONTROL_STICK_KERNEL *kernel)
+{
+    hat->x ^= kernel->xorX;
+    hat->y ^= kernel->xorY;
+}
+
+// Each axis has its own deadzone
+static void stickAxial(XBOX360_HAT *hat, const CONTROL_STICK_KERNEL *kernel)
+{
+    stickInvert(hat, kernel);
+    if (getAbsolute(hat->x) < kernel->deadzone) hat->x = 0;
+    if (getAbsolute(hat->y) < kernel->deadzone) hat->y = 0;
+}
+
+static void stickAxialRescale(XBOX360_HAT *hat, const CONTROL_STICK_KERNEL *kernel)
+{
+    stickInvert(hat, kernel);
+    hat->x = (getAbsolute(hat->x) < kernel->deadzone) ? 0 : rescaleAxis(hat->x, kernel);
+    hat->y = (getAbsolute(hat->y) < kernel->deadzone) ? 0 : rescaleAxis(hat->y, kernel);
+}
+
+// The stick is only centred if both axes are inside the deadzone
+static void stickRelative(XBOX360_HAT *hat, const CONTROL_STICK_KERNEL *kernel)
+{
+    stickInvert(hat, kernel);
+    if ((getAbsolute(hat->x) < kernel->deadzone) && (getAbsolute(hat->y) < kernel->deadzone)) {
+        hat->x = 0;
+        hat->y = 0;
+    }
+}
+
+static void stickRelativeRescale(XBOX360_HAT *hat, const CONTROL_STICK_KERNEL *kernel)
+{
+    stickInvert(hat, kernel);
+    if ((getAbsolute(hat->x) < kernel->deadzone) && (getAbsolute(hat->y) < kernel->deadzone)) {
+        hat->x = 0;
+        hat->y = 0;
+    } else {
+        hat->x = (getAbsolute(hat->x) > kernel->deadzone) ? rescaleAxis(hat->x, kernel) : 0;
+        hat->y = (getAbsolute(hat->y) > kernel->deadzone) ? rescaleAxis(hat->y, kernel) : 0;
+    }
+}
+
+// Default settings
+void ControlTransform::reset(void)
+{
+    left.invertX = left.invertY = false;
+    right.invertX = right.invertY = false;
+    left.deadzone = right.deadzone = 0;
+    left.relative = right.relative = false;
+    left.deadOff = right.deadOff = false;
+    // Controller Specific
+    xoneRumbleType = 0;
+    // Bindings, each button to its own bit, skipping the unused bit 11
+    for (int i = 0; i < CONTROL_BUTTONS; i++)
+    {
+        mapping[i] = (i < 11) ? i : i + 1;
+    }
+    compile();
+}
+
+#ifdef KERNEL
+// Read the settings from the registry
+void ControlTransform::readSettings(OSDictionary *dataDictionary)
+{
+    OSBoolean *value = NULL;
+    OSNumber *number = NULL;
+
+    if (dataDictionary == NULL) return;
+    value = OSDynamicCast(OSBoolean, dataDictionary->getObject("InvertLeftX"));
+    if (value != NULL) left.invertX = value->getValue();
+    value = OSDynamicCast(OSBoolean, dataDictionary->getObject("InvertLeftY"));
+    if (value != NULL) left.invertY = value->getValue();
+    value = OSDynamicCast(OSBoolean, dataDictionary->getObject("InvertRightX"));
+    if (value != NULL) right.invertX = value->getValue();
+    value = OSDynamicCast(OSBoolean, dataDictionary->getObject("InvertRightY"));
+    if (value != NULL) right.invertY = value->getValue();
+    number = OSDynamicCast(OSNumber, dataDictionary->getObject("DeadzoneLeft"));
+    if (number != NULL) left.deadzone = number->unsigned32BitValue();
+    number = OSDynamicCast(OSNumber, dataDictionary->getObject("DeadzoneRight"));
+    if (number != NULL) right.deadzone = number->unsigned32BitValue();
+    value = OSDynamicCast(OSBoolean, dataDictionary->getObject("RelativeLeft"));
+    if (value != NULL) left.relative = value->getValue();
+    value = OSDynamicCast(OSBoolean, dataDictionary->getObject("RelativeRight"));
+    if (value != NULL) right.relative = value->getValue();
+    value = OSDynamicCast(OSBoolean, dataDictionary->getObject("DeadOffLeft"));
+    if (value != NULL) left.deadOff = value->getValue();
+    value = OSDynamicCast(OSBoolean, dataDictionary->getObject("DeadOffRight"));
+    if (value != NULL) right.deadOff = value->getValue();
+//    number = OSDynamicCast(OSNumber, dataDictionary->getObject("ControllerType")); // No use currently.
+    number = OSDynamicCast(OSNumber, dataDictionary->getObject("XoneRumbleType"));
+    if (number != NULL) xoneRumbleType = number->unsigned8BitValue();
+    for (int i = 0; i < CONTROL_BUTTONS; i++)
+    {
+        number = OSDynamicCast(OSNumber, dataDictionary->getObject(bindingKeys[i]));
+        if (number != NULL) mapping[i] = number->unsigned32BitValue();
+    }
+    compile();
+
+#if 0
+    IOLog("ControlTransform preferences loaded:\n  invertLeft X: %s, Y: %s\n   invertRight X: %s, Y:%s\n  deadzone Left: %d, Right: %d\n\n",
+            left.invertX?"True":"False",left.invertY?"True":"False",
+            right.invertX?"True":"False",right.invertY?"True":"False",
+            left.deadzone,right.deadzone);
+#endif
+}
+#endif
+
+// Picks the stick function and precomputes its constants
+void ControlTransform::compileStick(CONTROL_STICK_KERNEL *kernel, const CONTROL_STICK *stick)
+{
+    XBox360_SShort clamped = stick->deadzone;
+
+    kernel->xorX = stick->invertX ? ~0 : 0;
+    kernel->xorY = stick->invertY ? 0 : ~0;
+    kernel->deadzone = stick->deadzone;
+    if (clamped < 0) clamped = 0;
+    if (clamped > 32766) clamped = 32766;
+    kernel->scale = (UInt32)((32767ULL << 16) / (32767 - clamped));
+
+    if (stick->deadzone == 0)
+        kernel->apply = stickInvert;
+    else if (stick->relative)
+        kernel->apply = stick->deadOff ? stickRelativeRescale : stickRelative;
+    else
+        kernel->apply = stick->deadOff ? stickAxialRescale : stickAxial;
+}
+
+// Rebuilds the lookup tables after the settings have changed
+void ControlTransform::compile(void)
+{
+    compileStick(&leftKernel, &left);
+    compileStick(&rightKernel, &right);
+
+    // Each byte of the button field maps through its own table
+    for (int value = 0; value < 256; value++)
+    {
+        XBox360_Short low = 0, high = 0;
+
+        for (int bit = 0; bit < 8; bit++)
+        {
+            if ((value & (1 << bit)) == 0)
+                continue;
+            // Low byte, bits 0-7 use bindings 0-7
+            if (mapping[bit] < 16)
+                low |= 1 << mapping[bit];
+            // High byte, bits 8-10 use bindings 8-10 and 12-15 use 11-14
+            if (bit < 3) {
+                if (mapping[bit + 8] < 16)
+                    high |= 1 << mapping[bit + 8];
+            } else if (bit > 3) {
+                if (mapping[bit + 7] < 16)
+                    high |= 1 << mapping[bit + 7];
+            }
+        }
+        buttonsLow[value] = low;
+        buttonsHigh[value] = high;
+    }
+}
+
+// Adjusts the report for any settings specified by the user
+void ControlTransform::apply(XBOX360_IN_REPORT *report) const
+{
+    leftKernel.apply(&report->left, &leftKernel);
+    rightKernel.apply(&report->right, &rightKernel);
+    report->buttons = buttonsLow[report->buttons & 0xFF] | buttonsHigh[(report->buttons >> 8) & 0xFF];
+}
@@ -0,0 +1,90 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+
+    ControlTransform.h - user settings applied to input reports
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef __CONTROLTRANSFORM_H__
+#define __CONTROLTRANSFORM_H__
+
+#ifdef KERNEL
+#include <libkern/c++/OSDictionary.h>
+#else
+// Built into transformbench without the kernel, which only needs the fixed width types
+#include <stdint.h>
+#include <string.h>
+typedef uint8_t     UInt8;
+typedef uint16_t    UInt16;
+typedef uint32_t    UInt32;
+typedef uint64_t    UInt64;
+typedef int16_t     SInt16;
+// Only Apple's compilers say which way round a short is stored
+#if !defined(__LITTLE_ENDIAN__) && !defined(__BIG_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define __LITTLE_ENDIAN__ 1
+#endif
+#endif
+#include "ControlStruct.h"
+
+#define kDriverSettingKey       "DeviceData"
+
+// Number of remappable buttons (bit 11 of the report is never used)
+#define CONTROL_BUTTONS         15
+
+// Settings for one analog stick, as read from the registry
+typedef struct CONTROL_STICK {
+    bool invertX, invertY;
+    short deadzone;
+    bool relative;
+    bool deadOff;
+} CONTROL_STICK;
+
+// Compiled form of the settings for one analog stick
+typedef struct CONTROL_STICK_KERNEL {
+    void (*apply)(XBOX360_HAT *hat, const struct CONTROL_STICK_KERNEL *kernel);
+    XBox360_SShort xorX, xorY;      // ~0 where the axis is inverted
+    XBox360_SShort deadzone;
+    UInt32 scale;                   // 16.16 factor stretching (deadzone..32767] back to (0..32767]
+} CONTROL_STICK_KERNEL;
+
+// The settings shared by the wired and wireless drivers, compiled once per
+// change into lookup tables so that each report costs a handful of operations
+class ControlTransform
+{
+public:
+    void reset(void);
+#ifdef KERNEL
+    void readSettings(OSDictionary *dataDictionary);
+#endif
+    void compile(void);
+
+    void apply(XBOX360_IN_REPORT *report) const;
+
+    // Settings
+    CONTROL_STICK left, right;
+    UInt8 xoneRumbleType;
+    UInt8 mapping[CONTROL_BUTTONS];
+
+private:
+    CONTROL_STICK_KERNEL leftKernel, rightKernel;
+    XBox360_Short buttonsLow[256], buttonsHigh[256];
+
+    static void compileStick(CONTROL_STICK_KERNEL *kernel, const CONTROL_STICK *stick);
+};
+
+#endif // __CONTROLTRANSFORM_H__
@@ -99,6 +99,18 @@ IOReturn Xbox360ControllerClass::setReport(IOMemoryDescriptor *report,IOHIDRepor
 			// IOLog("Set rumble: big(%d) little(%d)\n", rumble.big, rumble.little);
 		}
             return kIOReturnSuccess;
+        case 0x03:  // Set force feedback with trigger motors, which this controller doesn't have
+            if((data[1]!=report->getLength()) || (data[1]!=0x06)) return kIOReturnUnsupported;
+		{
+			XBOX360_OUT_RUMBLE rumble;
+			
+			Xbox360_Prepare(rumble,outRumble);
+			report->readBytes(2,data,2);
+			rumble.big=data[0];
+			rumble.little=data[1];
+			GetOwner(this)->QueueWrite(&rumble,sizeof(rumble));
+		}
+            return kIOReturnSuccess;
         case 0x01:  // Set LEDs
             if((data[1]!=report->getLength())||(data[1]!=0x03)) return kIOReturnUnsupported;
 		{
@@ -131,7 +143,6 @@ IOReturn Xbox360ControllerClass::handleReport(IOMemoryDescriptor * descriptor, I
             XBOX360_IN_REPORT *report=(XBOX360_IN_REPORT*)desc->getBytesNoCopy();
             if ((report->header.command==inReport) && (report->header.size==sizeof(XBOX360_IN_REPORT))) {
                 GetOwner(this)->fiddleReport(desc);
-                remapButtons(report);
             }
         }
     }
@@ -223,33 +234,6 @@ OSNumber* Xbox360ControllerClass::newLocationIDNumber() const
     return (location != 0) ? OSNumber::withNumber(location, 32) : 0;
 }
 
-void Xbox360ControllerClass::remapButtons(void *buffer)
-{
-    XBOX360_IN_REPORT *report360 = (XBOX360_IN_REPORT*)buffer;
-    UInt16 new_buttons = 0;
-
-    new_buttons |= ((report360->buttons & 1) == 1) << GetOwner(this)->mapping[0];
-    new_buttons |= ((report360->buttons & 2) == 2) << GetOwner(this)->mapping[1];
-    new_buttons |= ((report360->buttons & 4) == 4) << GetOwner(this)->mapping[2];
-    new_buttons |= ((report360->buttons & 8) == 8) << GetOwner(this)->mapping[3];
-    new_buttons |= ((report360->buttons & 16) == 16) << GetOwner(this)->mapping[4];
-    new_buttons |= ((report360->buttons & 32) == 32) << GetOwner(this)->mapping[5];
-    new_buttons |= ((report360->buttons & 64) == 64) << GetOwner(this)->mapping[6];
-    new_buttons |= ((report360->buttons & 128) == 128) << GetOwner(this)->mapping[7];
-    new_buttons |= ((report360->buttons & 256) == 256) << GetOwner(this)->mapping[8];
-    new_buttons |= ((report360->buttons & 512) == 512) << GetOwner(this)->mapping[9];
-    new_buttons |= ((report360->buttons & 1024) == 1024) << GetOwner(this)->mapping[10];
-    new_buttons |= ((report360->buttons & 4096) == 4096) << GetOwner(this)->mapping[11];
-    new_buttons |= ((report360->buttons & 8192) == 8192) << GetOwner(this)->mapping[12];
-    new_buttons |= ((report360->buttons & 16384) == 16384) << GetOwner(this)->mapping[13];
-    new_buttons |= ((report360->buttons & 32768) == 32768) << GetOwner(this)->mapping[14];
-    
-//    IOLog("BUTTON PACKET - %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d, %d\n", GetOwner(this)->mapping[0], GetOwner(this)->mapping[1], GetOwner(this)->mapping[2], GetOwner(this)->mapping[3], GetOwner(this)->mapping[4], GetOwner(this)->mapping[5], GetOwner(this)->mapping[6], GetOwner(this)->mapping[7], GetOwner(this)->mapping[8], GetOwner(this)->mapping[9], GetOwner(this)->mapping[10], GetOwner(this)->mapping[11], GetOwner(this)->mapping[12], GetOwner(this)->mapping[13], GetOwner(this)->mapping[14]);
-    
-    report360->buttons = new_buttons;
-}
-
-
 /*
  * Xbox original controller.
  * Convert reports to Xbox 360 controller format and fake product ids
@@ -389,6 +373,17 @@ IOReturn XboxOriginalControllerClass::setReport(IOMemoryDescriptor *report,IOHID
             // IOLog("Set rumble: big(%d) little(%d)\n", rumble.big, rumble.little);
         }
             return kIOReturnSuccess;
+        case 0x03:  // Set force feedback with trigger motors, which this controller doesn't have
+            if((data[1]!=report->getLength()) || (data[1]!=0x06)) return kIOReturnUnsupported;
+        {
+            XBOX_OUT_RUMBLE rumble;
+            Xbox360_Prepare(rumble,outRumble);
+            report->readBytes(2,data,2);
+            rumble.left=data[0];
+            rumble.right=data[1];
+            GetOwner(this)->QueueWrite(&rumble,sizeof(rumble));
+        }
+            return kIOReturnSuccess;
         case 0x01:  // Set LEDs
             if((data[1]!=report->getLength())||(data[1]!=0x03)) return kIOReturnUnsupported;
             // No leds
@@ -433,7 +428,7 @@ typedef struct {
     UInt8 mode; // So far always 0x00
     UInt8 rumbleMask; // So far always 0x0F
     UInt8 trigL, trigR;
-    UInt8 little, big;
+    UInt8 big, little;
     UInt8 length; // Length of time to rumble
     UInt8 period; // Period of time between pulses. DO NOT INCLUDE WHEN SUBSTRUCTURE IS 0x09
 } PACKED XBOXONE_OUT_RUMBLE;
@@ -536,48 +531,54 @@ IOReturn XboxOneControllerClass::handleReport(IOMemoryDescriptor * descriptor, I
     return ret;
 }
 
+// Triggers the game didn't set rumble along with the motors, if the user has asked for that
+static void fillRumble(XBOXONE_OUT_RUMBLE *rumble, UInt8 rumbleType, UInt8 big, UInt8 little, UInt8 trigL, UInt8 trigR)
+{
+    rumble->command = 0x09;
+    rumble->reserved1 = 0x08;
+    rumble->reserved2 = 0x00;
+    rumble->substructure = 0x09;
+    rumble->mode = 0x00;
+    rumble->rumbleMask = 0x0F;
+    rumble->length = 0x80;
+
+    rumble->trigL = trigL;
+    rumble->trigR = trigR;
+    rumble->big = big;
+    rumble->little = little;
+    if (trigL != 0 || trigR != 0)
+        return;
+    if (rumbleType == 1) // Trigger
+    {
+        rumble->trigL = big / 2.0;
+        rumble->trigR = little / 2.0;
+        rumble->big = 0x00;
+        rumble->little = 0x00;
+    }
+    else if (rumbleType == 2) // Both
+    {
+        rumble->trigL = big / 2.0;
+        rumble->trigR = little / 2.0;
+    }
+}
+
 IOReturn XboxOneControllerClass::setReport(IOMemoryDescriptor *report,IOHIDReportType reportType,IOOptionBits options)
 {
 //    IOLog("Xbox One Controller - setReport\n");
-    unsigned char data[4];
+    unsigned char data[6];
     report->readBytes(0, &data, 4);
 //    IOLog("Attempting to send: %d %d %d %d\n",((unsigned char*)data)[0], ((unsigned char*)data)[1], ((unsigned char*)data)[2], ((unsigned char*)data)[3]);
-    UInt8 rumbleType;
+    XBOXONE_OUT_RUMBLE rumble;
     switch(data[0])//(header.command)
     {
         case 0x00:  // Set force feedback
-            XBOXONE_OUT_RUMBLE rumble;
-            rumble.command = 0x09;
-            rumble.reserved1 = 0x08;
-            rumble.reserved2 = 0x00;
-            rumble.substructure = 0x09;
-            rumble.mode = 0x00;
-            rumble.rumbleMask = 0x0F;
-            rumble.length = 0x80;
-            
-            rumbleType = GetOwner(this)->xoneRumbleType;
-            if (rumbleType == 0) // Default
-            {
-                rumble.trigL = 0x00;
-                rumble.trigR = 0x00;
-                rumble.little = data[2];
-                rumble.big = data[3];
-            }
-            else if (rumbleType == 1) // Trigger
-            {
-                rumble.trigL = data[2] / 2.0;
-                rumble.trigR = data[3] / 2.0;
-                rumble.little = 0x00;
-                rumble.big = 0x00;
-            }
-            else if (rumbleType == 2) // Both
-            {
-                rumble.trigL = data[2] / 2.0;
-                rumble.trigR = data[3] / 2.0;
-                rumble.little = data[2];
-                rumble.big = data[3];
-            }
-            
+            fillRumble(&rumble, GetOwner(this)->transform.xoneRumbleType, data[2], data[3], 0x00, 0x00);
+            GetOwner(this)->QueueWrite(&rumble,11);
+            return kIOReturnSuccess;
+        case 0x03:  // Set force feedback with trigger motors, all four in the one packet
+            if ((data[1] != report->getLength()) || (data[1] != 0x06)) return kIOReturnUnsupported;
+            report->readBytes(0, &data, 6);
+            fillRumble(&rumble, GetOwner(this)->transform.xoneRumbleType, data[2], data[3], data[4], data[5]);
             GetOwner(this)->QueueWrite(&rumble,11);
             return kIOReturnSuccess;
         case 0x01: // Unsupported LED
@@ -54,8 +54,6 @@ public:
     virtual OSNumber* newVendorIDNumber() const;
 	
     virtual OSNumber* newLocationIDNumber() const;
-    
-    virtual void remapButtons(void *buffer);
 };
 
 
@@ -26,6 +26,7 @@
 #include <IOKit/hid/IOHIDDevice.h>
 #include <IOKit/usb/IOUSBDevice.h>
 #include <IOKit/usb/IOUSBInterface.h>
+#include "ControlTransform.h"
 
 class Xbox360ControllerClass;
 class ChatPadKeyboardClass;
@@ -45,8 +46,6 @@ private:
     
 	void SerialReadComplete(void *parameter, IOReturn status, UInt32 bufferSizeRemaining);
 
-    void readSettings(void);
-
 	static void ChatPadTimerActionWrapper(OSObject *owner, IOTimerEventSource *sender);
 	void ChatPadTimerAction(IOTimerEventSource *sender);
 	void SendToggle(void);
@@ -99,18 +98,9 @@ protected:
     UInt8 chatpadInit[2];
     CONTROLLER_TYPE controllerType;
 
-    // Settings
-    bool invertLeftX,invertLeftY;
-    bool invertRightX,invertRightY;
-    short deadzoneLeft,deadzoneRight;
-    bool relativeLeft,relativeRight;
-    bool deadOffLeft, deadOffRight;
-    
 public:
-    // Controller specific
-    UInt8 xoneRumbleType;
-
-    UInt8 mapping[15];
+    // Settings
+    ControlTransform transform;
     
     // this is from the IORegistryEntry - no provider yet
     virtual bool init(OSDictionary *propTable);
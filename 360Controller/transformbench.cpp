@@ -0,0 +1,211 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+
+    transformbench.cpp - checks and times the report transform outside the kernel
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+// The wired and wireless drivers both pass every report through ControlTransform::apply, so
+// this is the per-report cost of either. Each group of settings is run over the same random
+// reports through the transform and through the wired driver's fiddleReport and remapButtons
+// as they were before the transform was shared, checking they agree and timing both. Build it
+// without the kernel with:
+//
+//   c++ -O2 -o transformbench transformbench.cpp ControlTransform.cpp
+//
+// The old code rescaled the sticks past the deadzone in floating point, which the transform
+// does in 16.16 fixed point, so rescaled axes may be one out. Anything else that differs, or an
+// axis further out, fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ControlTransform.h"
+
+#define BENCH_REPORTS   4096        // Distinct reports, played over and over
+#define BENCH_ROUNDS    1000        // Times each is transformed
+
+typedef struct {
+    const char *name;
+    CONTROL_STICK left, right;
+    bool swapped;                   // Bindings reversed instead of the defaults
+} BENCH_SETTINGS;
+
+static const BENCH_SETTINGS settings[] = {
+    {"defaults",                {false, false, 0, false, false},    {false, false, 0, false, false},    false},
+    {"inverted, rebound",       {true, true, 0, false, false},      {true, false, 0, false, false},     true},
+    {"axial deadzone",          {false, false, 8000, false, false}, {false, false, 4000, false, false}, false},
+    {"relative deadzone",       {false, false, 8000, true, false},  {false, false, 4000, true, false},  false},
+    {"axial rescaled",          {true, false, 8000, false, true},   {false, true, 4000, false, true},   false},
+    {"relative rescaled",       {false, false, 8000, true, true},   {true, true, 4000, true, true},     true},
+};
+
+// Same as ControlTransform's, on a little endian machine
+static inline XBox360_SShort getAbsolute(XBox360_SShort value)
+{
+    return (value < 0) ? ~value : value;
+}
+
+// fiddleReport's handling of one stick past its deadzone
+static XBox360_SShort oldRescale(XBox360_SShort value, short deadzone)
+{
+    const UInt16 max16 = 32767;
+    float maxVal = max16 - deadzone;
+    float val = getAbsolute(value);
+    XBox360_SShort scaled = max16 * (val - deadzone) / maxVal;
+
+    return (value < 0) ? ~scaled : scaled;
+}
+
+static void oldStick(XBOX360_HAT *hat, const CONTROL_STICK *stick)
+{
+    if (stick->invertX) hat->x = ~hat->x;
+    if (!stick->invertY) hat->y = ~hat->y;
+    if (stick->deadzone == 0)
+        return;
+    if (stick->relative) {
+        if ((getAbsolute(hat->x) < stick->deadzone) && (getAbsolute(hat->y) < stick->deadzone)) {
+            hat->x = 0;
+            hat->y = 0;
+        } else if (stick->deadOff) {
+            hat->x = (getAbsolute(hat->x) > stick->deadzone) ? oldRescale(hat->x, stick->deadzone) : 0;
+            hat->y = (getAbsolute(hat->y) > stick->deadzone) ? oldRescale(hat->y, stick->deadzone) : 0;
+        }
+    } else {
+        if (getAbsolute(hat->x) < stick->deadzone) hat->x = 0;
+        else if (stick->deadOff) hat->x = oldRescale(hat->x, stick->deadzone);
+        if (getAbsolute(hat->y) < stick->deadzone) hat->y = 0;
+        else if (stick->deadOff) hat->y = oldRescale(hat->y, stick->deadzone);
+    }
+}
+
+// fiddleReport then remapButtons, with bit 11 of the report never read
+static void oldApply(XBOX360_IN_REPORT *report, const ControlTransform *transform)
+{
+    XBox360_Short buttons = 0;
+
+    oldStick(&report->left, &transform->left);
+    oldStick(&report->right, &transform->right);
+    for (int i = 0, bit = 0; i < CONTROL_BUTTONS; i++, bit++)
+    {
+        if (bit == 11) bit++;
+        buttons |= ((report->buttons >> bit) & 1) << transform->mapping[i];
+    }
+    report->buttons = buttons;
+}
+
+// Where the results go, so the loops aren't optimised away
+static volatile unsigned long sink;
+
+static double now(void)
+{
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static int axisDifference(XBox360_SShort a, XBox360_SShort b)
+{
+    return abs((int)a - (int)b);
+}
+
+int main(int argc, char **argv)
+{
+    static XBOX360_IN_REPORT reports[BENCH_REPORTS], expected[BENCH_REPORTS], work[BENCH_REPORTS];
+    UInt32 seed = 12345;
+    int failed = 0;
+
+    // The sticks are spread evenly, so deadzones and full deflection are both well covered
+    for (int i = 0; i < BENCH_REPORTS; i++)
+    {
+        UInt16 *words = (UInt16 *)&reports[i];
+        for (size_t j = 0; j < sizeof(XBOX360_IN_REPORT) / sizeof(UInt16); j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            words[j] = (UInt16)(seed >> 16);
+        }
+    }
+
+    for (size_t s = 0; s < sizeof(settings) / sizeof(settings[0]); s++)
+    {
+        ControlTransform transform;
+        int offByOne = 0, worst = 0, buttons = 0;
+        unsigned long checksum = 0;
+
+        transform.reset();
+        transform.left = settings[s].left;
+        transform.right = settings[s].right;
+        if (settings[s].swapped) {
+            for (int i = 0; i < CONTROL_BUTTONS; i++)
+                transform.mapping[i] = (14 - i < 11) ? 14 - i : 15 - i;
+        }
+        transform.compile();
+
+        for (int i = 0; i < BENCH_REPORTS; i++)
+        {
+            expected[i] = work[i] = reports[i];
+            oldApply(&expected[i], &transform);
+            transform.apply(&work[i]);
+            if (work[i].buttons != expected[i].buttons)
+                buttons++;
+            const XBox360_SShort got[4] = {work[i].left.x, work[i].left.y, work[i].right.x, work[i].right.y};
+            const XBox360_SShort want[4] = {expected[i].left.x, expected[i].left.y, expected[i].right.x, expected[i].right.y};
+            for (int axis = 0; axis < 4; axis++)
+            {
+                int difference = axisDifference(got[axis], want[axis]);
+                if (difference == 1)
+                    offByOne++;
+                if (difference > worst)
+                    worst = difference;
+            }
+        }
+
+        double started = now();
+        for (int round = 0; round < BENCH_ROUNDS; round++)
+        {
+            for (int i = 0; i < BENCH_REPORTS; i++)
+            {
+                work[i] = reports[i];
+                oldApply(&work[i], &transform);
+                checksum += work[i].buttons + (UInt16)work[i].left.x;
+            }
+        }
+        double oldTime = now() - started;
+        started = now();
+        for (int round = 0; round < BENCH_ROUNDS; round++)
+        {
+            for (int i = 0; i < BENCH_REPORTS; i++)
+            {
+                work[i] = reports[i];
+                transform.apply(&work[i]);
+                checksum += work[i].buttons + (UInt16)work[i].left.x;
+            }
+        }
+        double newTime = now() - started;
+
+        printf("%-20s %5.2f ns per report, %5.2f ns before, %d buttons differ, %d axes one out, %d at most\n",
+               settings[s].name, newTime * 1e9 / BENCH_REPORTS / BENCH_ROUNDS, oldTime * 1e9 / BENCH_REPORTS / BENCH_ROUNDS,
+               buttons, offByOne, worst);
+        sink = checksum;
+        if (buttons > 0 || worst > 1)
+            failed = 1;
+    }
+    return failed;
+}
@@ -24,26 +24,29 @@
  */
 
 #include "Feedback360.h"
-#include <mach/mach.h>
-#include <mach/mach_time.h>
+#include <libkern/OSAtomic.h>
+#include <limits.h>
+#include <unistd.h>
 using std::max;
 using std::min;
 
 #define LoopGranularity 10000 // Microseconds
 
-double CurrentTimeUsingMach()
-{
-    mach_timebase_info_data_t info = {0};
-	if (mach_timebase_info(&info) != KERN_SUCCESS) {
-		//FIXME: why would this fail/set to fail more gracefully.
-        return -1.0;
-	}
-	
-    uint64_t start = mach_absolute_time();
-
-    uint64_t nanos = start * info.numer / info.denom;
-    return (double)nanos / NSEC_PER_SEC;
-}
+// Everything the controllers in a process share, made when the first one starts. Each tick of
+// the timer ticks every device that's due, and every motor change from it goes in one send
+static struct {
+    dispatch_once_t     Once;
+    dispatch_queue_t    Queue;
+    dispatch_queue_t    SendQueue;
+    dispatch_source_t   Timer;
+    bool                TimerSuspended;
+    bool                TimerSleeping;  // Set to fire at the next deadline instead of every tick
+    UInt32              TimerPeriod;    // Microseconds between ticks the timer was last set to
+    volatile int32_t    SendsPosted;    // Set while a SendProc is queued
+    volatile int32_t    Traces;         // Traces opened, to number their files
+    Feedback360Scheduler *Scheduler;    // Only changed on both queues at once, so either can read it
+    Feedback360Clock    *Clock;         // The first device's, which every device in the process must share
+} Shared;
 
 static IOCFPlugInInterface functionMap360_IOCFPlugInInterface = {
     // Padding required for COM
@@ -81,11 +84,11 @@ static IOForceFeedbackDeviceInterface functionMap360_IOForceFeedbackDeviceInterf
     &Feedback360::sStopEffect
 };
 
-Feedback360::Feedback360() : fRefCount(1),  EffectIndex(1), Stopped(true),
-Paused(false), PausedTime(0), LastTime(0), Gain(10000), PrvLeftLevel(0),
-PrvRightLevel(0), Actuator(true), Manual(false)
+Feedback360::Feedback360(Feedback360Clock *theClock) : fRefCount(1), Mixer(LoopGranularity),
+InputStale(false), Manual(false), CommandsPosted(0), CommandsPublished(0), Trace(NULL)
 {
-    EffectList = Feedback360EffectVector();
+    Clock = (theClock != NULL) ? theClock : Feedback360DefaultClock();
+    OpenTrace();
 
     iIOCFPlugInInterface.pseudoVTable = (IUnknownVTbl *) &functionMap360_IOCFPlugInInterface;
     iIOCFPlugInInterface.obj = this;
@@ -100,10 +103,31 @@ PrvRightLevel(0), Actuator(true), Manual(false)
 
 Feedback360::~Feedback360()
 {
+    delete Trace;
     CFPlugInRemoveInstanceForFactory(FactoryID);
     CFRelease(FactoryID);
 }
 
+//----------------------------------------------------------------------------------------------
+// OpenTrace - with FEEDBACK360_TRACE set, every call from the game is recorded for ffreplay, to
+// <FEEDBACK360_TRACE>-<process>-<n>.ff360 with one file for each device the process opens
+//----------------------------------------------------------------------------------------------
+void Feedback360::OpenTrace(void)
+{
+    const char *Prefix = getenv("FEEDBACK360_TRACE");
+    char Path[PATH_MAX];
+
+    if (Prefix == NULL || *Prefix == '\0')
+        return;
+    snprintf(Path, sizeof(Path), "%s-%d-%d.ff360", Prefix, (int)getpid(), (int)OSAtomicIncrement32(&Shared.Traces));
+    Trace = new Feedback360TraceWriter(Clock->Now());
+    if (!Trace->Open(Path)) {
+        fprintf(stderr, "Xbox360Controller FF plugin: Can't write trace %s\n", Path);
+        delete Trace;
+        Trace = NULL;
+    }
+}
+
 HRESULT Feedback360::QueryInterface(REFIID iid, LPVOID *ppv)
 {
     CFUUIDRef interface = CFUUIDCreateFromUUIDBytes(kCFAllocatorDefault, iid);
@@ -178,54 +202,39 @@ HRESULT Feedback360::SetProperty(FFProperty property, void *value)
     }
 
     UInt32 NewGain = *((UInt32*)value);
-    __block HRESULT Result = FF_OK;
+    HRESULT Result = FF_OK;
+    Feedback360Command Command = {COMMAND_GAIN};
 
-    dispatch_sync(Queue, ^{
-        if (1 <= NewGain && NewGain <= 10000)
-        {
-            Gain = NewGain;
-        } else {
-            Gain = max((UInt32)1, min(NewGain, (UInt32)10000));
-            Result = FF_TRUNCATED;
-        }
-    });
+    if (NewGain < 1 || NewGain > 10000)
+    {
+        NewGain = max((UInt32)1, min(NewGain, (UInt32)10000));
+        Result = FF_TRUNCATED;
+    }
+    Command.Value = NewGain;
+    PostCommand(Command);
 
     return Result;
 }
 
 HRESULT Feedback360::StartEffect(FFEffectDownloadID EffectHandle, FFEffectStartFlag Mode, UInt32 Count)
 {
-    dispatch_sync(Queue, ^{
-        for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
-        {
-            if (effectIterator->Handle == EffectHandle)
-            {
-                effectIterator->Status  = FFEGES_PLAYING;
-                effectIterator->PlayCount = Count;
-                effectIterator->StartTime = CurrentTimeUsingMach();
-                Stopped = false;
-            } else {
-                if (Mode & FFES_SOLO) {
-                    effectIterator->Status = NULL;
-                }
-            }
-        }
-    });
+    if (!Mixer.Contains(EffectHandle)) {
+        return FFERR_INVALIDDOWNLOADID;
+    }
+
+    Feedback360Command Command = {COMMAND_START, EffectHandle, Count, Mode, Clock->Now()};
+    PostCommand(Command);
     return FF_OK;
 }
 
 HRESULT Feedback360::StopEffect(UInt32 EffectHandle)
 {
-    dispatch_sync(Queue, ^{
-        for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
-        {
-            if (effectIterator->Handle == EffectHandle)
-            {
-                effectIterator->Status = NULL;
-                break;
-            }
-        }
-    });
+    if (!Mixer.Contains(EffectHandle)) {
+        return FFERR_INVALIDDOWNLOADID;
+    }
+
+    Feedback360Command Command = {COMMAND_STOP, EffectHandle, 0, 0, Clock->Now()};
+    PostCommand(Command);
     return FF_OK;
 }
 
@@ -239,128 +248,12 @@ HRESULT Feedback360::DownloadEffect(CFUUIDRef EffectType, FFEffectDownloadID *Ef
     }
 
     dispatch_sync(Queue, ^{
-        Feedback360Effect *Effect = NULL;
-        if (*EffectHandle == 0) {
-            EffectList.push_back(Feedback360Effect(EffectIndex++));
-            Effect = &(EffectList.back());
-            *EffectHandle = Effect->Handle;
-        } else {
-            for (LONG Index = 0; Index < EffectList.size(); Index++) {
-                if (EffectList[Index].Handle == *EffectHandle) {
-                    Effect = &(EffectList[Index]);
-                    break;
-                }
-            }
-        }
-
-        if (Effect == NULL || Result == -1) {
-            Result = FFERR_INTERNAL;
-        }
-        else {
-            Effect->Type = EffectType;
-            Effect->DiEffect.dwFlags = DiEffect->dwFlags;
-
-            if( Flags & FFEP_DURATION )
-            {
-                Effect->DiEffect.dwDuration = DiEffect->dwDuration;
-            }
-
-            if( Flags & FFEP_SAMPLEPERIOD )
-            {
-                Effect->DiEffect.dwSamplePeriod = DiEffect->dwSamplePeriod;
-            }
-
-            if( Flags & FFEP_GAIN )
-            {
-                Effect->DiEffect.dwGain = DiEffect->dwGain;
-            }
-
-            if( Flags & FFEP_TRIGGERBUTTON )
-            {
-                Effect->DiEffect.dwTriggerButton = DiEffect->dwTriggerButton;
-            }
-
-            if( Flags & FFEP_TRIGGERREPEATINTERVAL )
-            {
-                Effect->DiEffect.dwTriggerRepeatInterval = DiEffect->dwTriggerRepeatInterval;
-            }
-
-            if( Flags & FFEP_AXES )
-            {
-                Effect->DiEffect.cAxes  = DiEffect->cAxes;
-                Effect->DiEffect.rgdwAxes = NULL;
-            }
-
-            if( Flags & FFEP_DIRECTION )
-            {
-                Effect->DiEffect.cAxes   = DiEffect->cAxes;
-                Effect->DiEffect.rglDirection = NULL;
-            }
-
-            if( ( Flags & FFEP_ENVELOPE ) && DiEffect->lpEnvelope != NULL )
-            {
-                memcpy( &Effect->DiEnvelope, DiEffect->lpEnvelope, sizeof( FFENVELOPE ) );
-                if( Effect->DiEffect.dwDuration - Effect->DiEnvelope.dwFadeTime
-                   < Effect->DiEnvelope.dwAttackTime )
-                {
-                    Effect->DiEnvelope.dwFadeTime = Effect->DiEnvelope.dwAttackTime;
-                }
-                Effect->DiEffect.lpEnvelope = &Effect->DiEnvelope;
-            }
-
-            Effect->DiEffect.cbTypeSpecificParams = DiEffect->cbTypeSpecificParams;
-
-            if( Flags & FFEP_TYPESPECIFICPARAMS )
-            {
-                if(CFEqual(EffectType, kFFEffectType_CustomForce_ID)) {
-                    memcpy(
-                           &Effect->DiCustomForce
-                           ,DiEffect->lpvTypeSpecificParams
-                           ,DiEffect->cbTypeSpecificParams );
-                    Effect->DiEffect.lpvTypeSpecificParams = &Effect->DiCustomForce;
-                }
-
-                else if(CFEqual(EffectType, kFFEffectType_ConstantForce_ID)) {
-                    memcpy(
-                           &Effect->DiConstantForce
-                           ,DiEffect->lpvTypeSpecificParams
-                           ,DiEffect->cbTypeSpecificParams );
-                    Effect->DiEffect.lpvTypeSpecificParams = &Effect->DiConstantForce;
-                }
-                else if(CFEqual(EffectType, kFFEffectType_Square_ID) || CFEqual(EffectType, kFFEffectType_Sine_ID) || CFEqual(EffectType, kFFEffectType_Triangle_ID) || CFEqual(EffectType, kFFEffectType_SawtoothUp_ID) || CFEqual(EffectType, kFFEffectType_SawtoothDown_ID) ) {
-                    memcpy(
-                           &Effect->DiPeriodic
-                           ,DiEffect->lpvTypeSpecificParams
-                           ,DiEffect->cbTypeSpecificParams );
-                    Effect->DiEffect.lpvTypeSpecificParams = &Effect->DiPeriodic;
-                }
-                else if(CFEqual(EffectType, kFFEffectType_RampForce_ID)) {
-                    memcpy(
-                           &Effect->DiRampforce
-                           ,DiEffect->lpvTypeSpecificParams
-                           ,DiEffect->cbTypeSpecificParams );
-                    Effect->DiEffect.lpvTypeSpecificParams = &Effect->DiRampforce;
-                }
-            }
-
-            if( Flags & FFEP_STARTDELAY )
-            {
-                Effect->DiEffect.dwStartDelay = DiEffect->dwStartDelay;
-            }
-
-            if( Flags & FFEP_START )
-            {
-                Effect->Status  = FFEGES_PLAYING;
-                Effect->PlayCount = 1;
-                Effect->StartTime = CurrentTimeUsingMach();
-            }
-
-            if( Flags & FFEP_NORESTART )
-            {
-                ;
-            }
-            Result = FF_OK;
-        }
+        ApplyCommands();
+        Result = Mixer.Download(EffectType, EffectHandle, DiEffect, Flags, Clock->Now());
+        PublishStatus();
+        // It may have started, or its deadline may have moved
+        if (Result == FF_OK)
+            WakeTimer();
     });
     return Result;
 }
@@ -372,30 +265,16 @@ HRESULT Feedback360::GetForceFeedbackState(ForceFeedbackDeviceState *DeviceState
         return FFERR_INVALIDPARAM;
     }
 
+    // Games poll this every frame, so unless they are waiting on a command of their own it is
+    // answered from the snapshot without going through the queue
+    if (StatusPublished()) {
+        DeviceState->dwState = Mixer.Snapshot()->GetState();
+        DeviceState->dwLoad  = 0;
+        return FF_OK;
+    }
     dispatch_sync(Queue, ^{
-        DeviceState->dwState = NULL;
-        if( EffectList.size() == 0 )
-        {
-            DeviceState->dwState |= FFGFFS_EMPTY;
-        }
-        if( Stopped == true )
-        {
-            DeviceState->dwState |= FFGFFS_STOPPED;
-        }
-        if( Paused == true )
-        {
-            DeviceState->dwState |= FFGFFS_PAUSED;
-        }
-        if (Actuator == true)
-        {
-            DeviceState->dwState |= FFGFFS_ACTUATORSON;
-        } else {
-            DeviceState->dwState |= FFGFFS_ACTUATORSOFF;
-        }
-        DeviceState->dwState |= FFGFFS_POWERON;
-        DeviceState->dwState |= FFGFFS_SAFETYSWITCHOFF;
-        DeviceState->dwState |= FFGFFS_USERFFSWITCHON;
-
+        ApplyCommands();
+        DeviceState->dwState = Mixer.Snapshot()->GetState();
         DeviceState->dwLoad  = 0;
     });
 
@@ -408,13 +287,13 @@ HRESULT Feedback360::GetForceFeedbackCapabilities(FFCAPABILITIES *capabilities)
     capabilities->ffSpecVer.minorAndBugRev=kFFPlugInAPIMinorAndBugRev;
     capabilities->ffSpecVer.stage=kFFPlugInAPIStage;
     capabilities->ffSpecVer.nonRelRev=kFFPlugInAPINonRelRev;
-    capabilities->supportedEffects=FFCAP_ET_CUSTOMFORCE|FFCAP_ET_CONSTANTFORCE|FFCAP_ET_RAMPFORCE|FFCAP_ET_SQUARE|FFCAP_ET_SINE|FFCAP_ET_TRIANGLE|FFCAP_ET_SAWTOOTHUP|FFCAP_ET_SAWTOOTHDOWN;
+    capabilities->supportedEffects=FFCAP_ET_CUSTOMFORCE|FFCAP_ET_CONSTANTFORCE|FFCAP_ET_RAMPFORCE|FFCAP_ET_SQUARE|FFCAP_ET_SINE|FFCAP_ET_TRIANGLE|FFCAP_ET_SAWTOOTHUP|FFCAP_ET_SAWTOOTHDOWN|FFCAP_ET_SPRING|FFCAP_ET_DAMPER|FFCAP_ET_INERTIA|FFCAP_ET_FRICTION;
     capabilities->emulatedEffects=0;
     capabilities->subType=FFCAP_ST_VIBRATION;
     capabilities->numFfAxes=2;
     capabilities->ffAxes[0]=FFJOFS_X;
     capabilities->ffAxes[1]=FFJOFS_Y;
-    capabilities->storageCapacity=256;
+    capabilities->storageCapacity=EFFECT_CAPACITY;
     capabilities->playbackCapacity=1;
     capabilities->driverVer.majorRev=FeedbackDriverVersionMajor;
     capabilities->driverVer.minorAndBugRev=FeedbackDriverVersionMinor;
@@ -433,52 +312,9 @@ HRESULT Feedback360::GetForceFeedbackCapabilities(FFCAPABILITIES *capabilities)
 
 HRESULT Feedback360::SendForceFeedbackCommand(FFCommandFlag state)
 {
-    __block HRESULT Result = FF_OK;
+    Feedback360Command Command = {COMMAND_DEVICE, 0, state, 0, Clock->Now()};
 
-    dispatch_sync(Queue, ^{
-        switch (state) {
-            case FFSFFC_RESET:
-                EffectList.clear();
-                Stopped = true;
-                Paused = false;
-                break;
-
-            case FFSFFC_STOPALL:
-                for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
-                {
-                    effectIterator->Status = NULL;
-                }
-                Stopped = true;
-                Paused = false;
-                break;
-
-            case FFSFFC_PAUSE:
-                Paused  = true;
-                PausedTime = CurrentTimeUsingMach();
-                break;
-
-            case FFSFFC_CONTINUE:
-                for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
-                {
-                    effectIterator->StartTime += ( CurrentTimeUsingMach() - PausedTime );
-                }
-                Paused = false;
-                break;
-
-            case FFSFFC_SETACTUATORSON:
-                Actuator = true;
-                break;
-
-            case FFSFFC_SETACTUATORSOFF:
-                Actuator = false;
-                break;
-
-            default:
-                Result = FFERR_INVALIDPARAM;
-                break;
-        }
-    });
-    //return Result;
+    PostCommand(Command);
     return FF_OK;
 }
 
@@ -502,17 +338,52 @@ HRESULT Feedback360::InitializeTerminate(NumVersion APIversion, io_object_t hidD
             // fprintf(stderr,"Feedback: Failed to initialise\n");
             return FFERR_NOINTERFACE;
         }
-        Queue = dispatch_queue_create("com.mice.driver.Feedback360", NULL);
-        Timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, Queue);
-        dispatch_source_set_timer(Timer, dispatch_walltime(NULL, 0), LoopGranularity*1000, 10);
-        dispatch_set_context(Timer, this);
-        dispatch_source_set_event_handler_f(Timer, EffectProc);
-        dispatch_resume(Timer);
+        // Without input, condition effects play nothing
+        if (Device_OpenInput(&this->device))
+            Mixer.SetInput(&Input);
+        // Nothing ticks the mixer until the device is added below
+        if (IOObjectConformsTo(hidDevice, "XboxOneControllerClass"))
+            Mixer.SetControllerType(CONTROLLER_XBOXONE);
+        else if (IOObjectConformsTo(hidDevice, "XboxOriginalControllerClass"))
+            Mixer.SetControllerType(CONTROLLER_ORIGINAL);
+        else
+            Mixer.SetControllerType(CONTROLLER_XBOX360);
+        dispatch_once(&Shared.Once, ^{
+            Shared.Queue = dispatch_queue_create("com.mice.driver.Feedback360", NULL);
+            Shared.SendQueue = dispatch_queue_create("com.mice.driver.Feedback360.Send", NULL);
+            Shared.Scheduler = new Feedback360Scheduler(LoopGranularity);
+            Shared.Clock = Clock;
+            // Sources start suspended, and the timer stays that way until a device needs a tick
+            Shared.Timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, Shared.Queue);
+            Shared.TimerSuspended = true;
+            dispatch_source_set_event_handler_f(Shared.Timer, SchedulerProc);
+        });
+        Queue = Shared.Queue;
+        SendQueue = Shared.SendQueue;
+
+        __block bool Added = false;
+        dispatch_sync(Queue, ^{
+            dispatch_sync(SendQueue, ^{
+                Added = Shared.Scheduler->Add(this, EffectProc, Mixer.TickPeriod, Shared.Clock->Now());
+            });
+            if (Added)
+                WakeTimer();
+        });
+        if (!Added) {
+            Device_Finalise(&this->device);
+            return FFERR_OUTOFMEMORY;
+        }
     }
     else {
         dispatch_sync(Queue, ^{
-            dispatch_source_cancel(Timer);
-            SetForce(0, 0);
+            ApplyCommands();
+            static const unsigned char Off[FF_CHANNELS] = {0};
+            SetForce(Off);
+            // Let the motors stop before the device leaves the send list and the link goes away.
+            // The timer carries on, and suspends itself once no device is left to tick
+            dispatch_sync(SendQueue, ^{
+                Shared.Scheduler->Remove(this);
+            });
             Device_Finalise(&this->device);
         });
 
@@ -524,118 +395,331 @@ HRESULT Feedback360::DestroyEffect(FFEffectDownloadID EffectHandle)
 {
     __block HRESULT Result = FF_OK;
     dispatch_sync(Queue, ^{
-        for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
-        {
-            if (effectIterator->Handle == EffectHandle)
-            {
-                EffectList.erase(effectIterator);
-                break;
-            }
-        }
+        ApplyCommands();
+        Result = Mixer.Destroy(EffectHandle);
+        PublishStatus();
     });
     return Result;
 }
 
 HRESULT Feedback360::Escape(FFEffectDownloadID downloadID, FFEFFESCAPE *escape)
 {
-    if (downloadID!=0) return FFERR_UNSUPPORTED;
+    // Only streaming is sent to an effect, everything else is for the device
+    if ((downloadID!=0) != (escape->dwCommand==0x05 || escape->dwCommand==0x06)) return FFERR_UNSUPPORTED;
     if (escape->dwSize < sizeof(FFEFFESCAPE)) return FFERR_INVALIDPARAM;
     escape->cbOutBuffer=0;
+
+    Feedback360Command Command = {COMMAND_ESCAPE, downloadID, escape->dwCommand};
     switch (escape->dwCommand) {
         case 0x00:  // Control motors
-            if(escape->cbInBuffer!=1) return FFERR_INVALIDPARAM;
-            dispatch_sync(Queue, ^{
-                Manual=((unsigned char*)escape->lpvInBuffer)[0]!=0x00;
-            });
-            break;
-            
-        case 0x01:  // Set motors
-            if (escape->cbInBuffer!=2) return FFERR_INVALIDPARAM;
-            dispatch_sync(Queue, ^{
-                if(Manual) {
-                    unsigned char *data=(unsigned char *)escape->lpvInBuffer;
-                    unsigned char buf[]={0x00,0x04,data[0],data[1]};
-                    Device_Send(&this->device,buf,sizeof(buf));
-                }
-            });
-            break;
-            
         case 0x02:  // Set LED
+        case 0x04:  // Render ahead
+        case 0x08:  // Motor overdrive
             if (escape->cbInBuffer!=1) return FFERR_INVALIDPARAM;
-        {
-            dispatch_sync(Queue, ^{
-                unsigned char *data=(unsigned char *)escape->lpvInBuffer;
-                unsigned char buf[]={0x01,0x03,data[0]};
-                Device_Send(&this->device,buf,sizeof(buf));
-            });
-        }
+            Command.Data[0]=((unsigned char*)escape->lpvInBuffer)[0];
             break;
-            
+
+        case 0x01:  // Set motors, the big ones and optionally the triggers
+            if (escape->cbInBuffer!=2 && escape->cbInBuffer!=FF_CHANNELS) return FFERR_INVALIDPARAM;
+            memcpy(Command.Data, escape->lpvInBuffer, escape->cbInBuffer);
+            break;
+
         case 0x03:  // Power off
+            break;
+
+        case 0x05:  // Stream custom force samples
+            if (escape->cbInBuffer!=1) return FFERR_INVALIDPARAM;
+            if (!Mixer.Contains(downloadID)) return FFERR_INVALIDDOWNLOADID;
+            Command.Data[0]=((unsigned char*)escape->lpvInBuffer)[0];
+            break;
+
+        case 0x06:  // Stream audio
         {
+            // The audio is turned into samples before returning, so the buffer can be reused
+            if (escape->cbInBuffer % (AUDIO_RUMBLE_CHANNELS * sizeof(SInt16)) != 0) return FFERR_INVALIDPARAM;
+            __block HRESULT Result = FF_OK;
             dispatch_sync(Queue, ^{
-                unsigned char buf[] = {0x02, 0x02};
-                Device_Send(&this->device, buf, sizeof(buf));
+                ApplyCommands();
+                Result = Mixer.AppendAudio(downloadID, (const SInt16 *)escape->lpvInBuffer, escape->cbInBuffer / (AUDIO_RUMBLE_CHANNELS * sizeof(SInt16)));
             });
+            return Result;
         }
+
+        case 0x07:  // Tick rate, in ticks per second
+        {
+            DWORD Rate;
+            if (escape->cbInBuffer!=sizeof(Rate)) return FFERR_INVALIDPARAM;
+            memcpy(&Rate, escape->lpvInBuffer, sizeof(Rate));
+            if (Rate < 1000000 / TICK_PERIOD_MAX || Rate > 1000000 / TICK_PERIOD_MIN) return FFERR_INVALIDPARAM;
+            memcpy(Command.Data, &Rate, sizeof(Rate));
             break;
-            
+        }
+
         default:
             fprintf(stderr, "Xbox360Controller FF plugin: Unknown escape (%i)\n", (int)escape->dwCommand);
             return FFERR_UNSUPPORTED;
     }
+    PostCommand(Command);
     return FF_OK;
 }
 
-void Feedback360::SetForce(LONG LeftLevel, LONG RightLevel)
+void Feedback360::SetForce(const unsigned char *Levels)
+{
+    //fprintf(stderr, "LS: %d; RS: %d\n", Levels[CHANNEL_BIG], Levels[CHANNEL_LITTLE]);
+    if (!Manual) PostForce(Levels);
+}
+
+// Leave the levels for SendProc, which is only queued if the mailbox was empty and no other
+// device has one waiting. If it was full the waiting SendProc picks up these levels instead
+void Feedback360::PostForce(const unsigned char *Levels)
+{
+    if (SendMailbox.Post(Levels) && OSAtomicCompareAndSwap32Barrier(0, 1, &Shared.SendsPosted))
+        dispatch_async_f(SendQueue, NULL, SendProc);
+}
+
+// Empty every device's mailbox and send whatever was in them, so a tick that changes the
+// motors on several controllers queues one block for all of them
+void Feedback360::SendProc(void *params)
 {
-    //fprintf(stderr, "LS: %d; RS: %d\n", (unsigned char)MIN( 255, LeftLevel * Gain / 10000 ), (unsigned char)MIN( 255, RightLevel * Gain / 10000 ));
-    unsigned char buf[] = {0x00, 0x04, (unsigned char)min(SCALE_MAX, LeftLevel * (LONG)Gain / 10000 ), (unsigned char)min(SCALE_MAX, RightLevel * (LONG)Gain / 10000 )};
-    if (!Manual) Device_Send(&device, buf, sizeof(buf));
+    // Cleared first, so levels posted while sending always queue another SendProc
+    OSAtomicCompareAndSwap32Barrier(1, 0, &Shared.SendsPosted);
+    for (UInt32 Index = 0; Index < Shared.Scheduler->Size(); Index++)
+    {
+        Feedback360 *cThis = (Feedback360 *)Shared.Scheduler->Context(Index);
+        unsigned char Levels[FF_CHANNELS];
+
+        if (cThis->SendMailbox.Take(Levels)) {
+            // All four motors in one report, drivers without trigger motors ignore the last two
+            unsigned char buf[] = {0x03, 0x06, Levels[CHANNEL_BIG], Levels[CHANNEL_LITTLE],
+                Levels[CHANNEL_TRIGGER_LEFT], Levels[CHANNEL_TRIGGER_RIGHT]};
+            Device_Send(&cThis->device, buf, sizeof(buf));
+        }
+    }
 }
 
-void Feedback360::EffectProc( void *params )
+// Fire first at Start and then every tick of the fastest device
+// Must be called on Queue
+static void SetTimer(dispatch_time_t Start)
+{
+    Shared.TimerPeriod = Shared.Scheduler->TickPeriod;
+    dispatch_source_set_timer(Shared.Timer, Start, (uint64_t)Shared.TimerPeriod * 1000, 10);
+}
+
+// Have this device ticked straight away, restarting the timer if every device went idle or
+// the tick period has changed
+// Must be called on Queue
+void Feedback360::WakeTimer(void)
+{
+    Shared.Scheduler->Wake(this, Shared.Clock->Now());
+    if (Shared.TimerSuspended || Shared.TimerSleeping || Shared.TimerPeriod != Shared.Scheduler->TickPeriod) {
+        SetTimer(dispatch_walltime(NULL, 0));
+        Shared.TimerSleeping = false;
+    }
+    if (Shared.TimerSuspended) {
+        Shared.TimerSuspended = false;
+        dispatch_resume(Shared.Timer);
+    }
+}
+
+// Ticks every device that's due. If none is due again within a tick, the timer sleeps until
+// the first one is, or is suspended if all of them are waiting for a call. A device leaving
+// or changing its tick rate can change the tick, which the timer follows from here
+void Feedback360::SchedulerProc(void *params)
+{
+    // The same clock the devices are added and woken with, so their deadlines compare
+    double CurrentTime = Shared.Clock->Now();
+    double Next = Shared.Scheduler->Run(CurrentTime);
+
+    Shared.TimerSleeping = false;
+    if (Next == DBL_MAX) {
+        Shared.TimerSuspended = true;
+        dispatch_suspend(Shared.Timer);
+    } else if (Next > CurrentTime + Shared.Scheduler->TickPeriod / 1000000.) {
+        Shared.TimerSleeping = true;
+        SetTimer(dispatch_time(DISPATCH_TIME_NOW, (int64_t)((Next - CurrentTime) * NSEC_PER_SEC)));
+    } else if (Shared.TimerPeriod != Shared.Scheduler->TickPeriod) {
+        SetTimer(dispatch_time(DISPATCH_TIME_NOW, (int64_t)Shared.Scheduler->TickPeriod * 1000));
+    }
+}
+
+// Queue a command for the effect loop, which picks it up at its next tick or from CommandProc,
+// whichever comes first. Only if the queue is full does this wait for the effect loop
+void Feedback360::PostCommand(const Feedback360Command &Command)
+{
+    if (!Commands.Push(Command)) {
+        Feedback360Command Waiting = Command;
+        dispatch_sync(Queue, ^{
+            ApplyCommands();
+            ApplyCommand(Waiting);
+            PublishStatus();
+        });
+        return;
+    }
+    // The timer may be suspended, so make sure something will look at the queue soon
+    if (OSAtomicCompareAndSwap32Barrier(0, 1, &CommandsPosted))
+        dispatch_async_f(Queue, this, CommandProc);
+}
+
+void Feedback360::CommandProc(void *params)
 {
     Feedback360 *cThis = (Feedback360 *)params;
+    cThis->ApplyCommands();
+}
 
-    LONG LeftLevel = 0;
-    LONG RightLevel = 0;
-    LONG Gain  = cThis->Gain;
-    LONG CalcResult = 0;
+// Carry out everything queued so far, in order
+// Must be called on Queue
+void Feedback360::ApplyCommands(void)
+{
+    Feedback360Command Command;
 
-    if (cThis->Actuator == true)
-    {
-        for (Feedback360EffectIterator effectIterator = cThis->EffectList.begin(); effectIterator != cThis->EffectList.end(); ++effectIterator)
-        {
-            if((CurrentTimeUsingMach() - cThis->LastTime*1000*1000) >= effectIterator->DiEffect.dwSamplePeriod) {
-                CalcResult = effectIterator->Calc(&LeftLevel, &RightLevel);
+    // Cleared first, so a command pushed while draining always queues another CommandProc
+    OSAtomicCompareAndSwap32Barrier(1, 0, &CommandsPosted);
+    while (Commands.Pop(&Command))
+        ApplyCommand(Command);
+    PublishStatus();
+}
+
+// Brings the mixer's status snapshot up to date with every command applied so far
+// Must be called on Queue
+void Feedback360::PublishStatus(void)
+{
+    Mixer.Publish();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    CommandsPublished = Commands.Popped();
+}
+
+// True when nothing this thread posted is still waiting, so the snapshot already has its
+// effect and a query can read it without going through Queue
+bool Feedback360::StatusPublished(void) const
+{
+    bool Published = (Commands.Pushed() == CommandsPublished);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return Published;
+}
+
+// Must be called on Queue
+void Feedback360::ApplyCommand(const Feedback360Command &Command)
+{
+    switch (Command.Type) {
+        case COMMAND_START:
+            Mixer.Start(Command.Handle, Command.Flags, Command.Value, Command.Time);
+            WakeTimer();
+            break;
+
+        case COMMAND_STOP:
+            Mixer.Stop(Command.Handle, Command.Time);
+            break;
+
+        case COMMAND_GAIN:
+            Mixer.SetGain(Command.Value);
+            break;
+
+        case COMMAND_DEVICE:
+            Mixer.Command(Command.Value, Command.Time);
+            if (Command.Value == FFSFFC_CONTINUE)
+                WakeTimer();
+            break;
+
+        case COMMAND_ESCAPE:
+            switch (Command.Value) {
+                case 0x00:  // Control motors
+                    Manual = Command.Data[0] != 0x00;
+                    break;
+
+                case 0x01:  // Set motors
+                    if (Manual)
+                        PostForce(Command.Data);
+                    break;
+
+                case 0x02:  // Set LED
+                    dispatch_sync(SendQueue, ^{
+                        unsigned char buf[]={0x01,0x03,Command.Data[0]};
+                        Device_Send(&this->device,buf,sizeof(buf));
+                    });
+                    break;
+
+                case 0x03:  // Power off
+                    dispatch_sync(SendQueue, ^{
+                        unsigned char buf[] = {0x02, 0x02};
+                        Device_Send(&this->device, buf, sizeof(buf));
+                    });
+                    break;
+
+                case 0x04:  // Render ahead
+                    Mixer.SetRenderAhead(Command.Data[0]);
+                    break;
+
+                case 0x05:  // Stream custom force samples
+                    Mixer.SetStreaming(Command.Handle, Command.Data[0] != 0x00);
+                    break;
+
+                case 0x07:  // Tick rate
+                {
+                    DWORD Rate;
+                    memcpy(&Rate, Command.Data, sizeof(Rate));
+                    Mixer.SetTickPeriod(1000000 / Rate);
+                    // The send queue only reads which devices there are, so needn't wait for this
+                    Shared.Scheduler->SetPeriod(this, Mixer.TickPeriod);
+                    WakeTimer();
+                    break;
+                }
+
+                case 0x08:  // Motor overdrive
+                    Mixer.SetOverdrive(Command.Data[0] != 0x00);
+                    break;
             }
-        }
+            break;
     }
+}
 
-    if ((cThis->PrvLeftLevel != LeftLevel || cThis->PrvRightLevel != RightLevel) && (CalcResult != -1))
+double Feedback360::EffectProc( void *params, double CurrentTime )
+{
+    Feedback360 *cThis = (Feedback360 *)params;
+    unsigned char Levels[FF_CHANNELS];
+
+    // Anything the game asked for since the last tick comes first
+    cThis->ApplyCommands();
+
+    // Draining the input queue is only reading shared memory, so it's cheap to do every tick.
+    // After the loop has been idle the queue may have filled and dropped the newest changes,
+    // so the axes are read from the device instead, before anything uses them
+    Feedback360InputState State;
+    if (cThis->device.queue != NULL) {
+        bool Changed = cThis->InputStale ? Device_RefreshInput(&cThis->device, State.Position)
+                                         : Device_ReadInput(&cThis->device, State.Position);
+        cThis->InputStale = false;
+        if (Changed || !cThis->Input.Valid())
+        {
+            State.Time = CurrentTime;
+            cThis->Input.Publish(State);
+        }
+    }
+    if (cThis->Mixer.Tick(CurrentTime, Levels))
     {
-        //fprintf(stderr, "PL: %d, PR: %d; L: %d, R: %d; \n", cThis->PrvLeftLevel, cThis->PrvRightLevel, LeftLevel, RightLevel);
-        cThis->SetForce((unsigned char)min(SCALE_MAX, LeftLevel * Gain / 10000),(unsigned char)min(SCALE_MAX, RightLevel * Gain / 10000 ));
+        cThis->SetForce(Levels);
+    }
 
-        cThis->PrvLeftLevel = LeftLevel;
-        cThis->PrvRightLevel = RightLevel;
+    // Nothing playing and the motors are off, so no ticks are needed until the next effect
+    // starts, or until one is started if none are waiting
+    if (cThis->Mixer.Idle()) {
+        cThis->InputStale = true;
+        return cThis->Mixer.NextDeadline();
     }
+    return CurrentTime + cThis->Mixer.TickPeriod / 1000000.;
 }
 
 HRESULT Feedback360::GetEffectStatus(FFEffectDownloadID EffectHandle, FFEffectStatusFlag *Status)
 {
+    __block HRESULT Result = FF_OK;
+
+    // As for GetForceFeedbackState, only a command still waiting needs the queue
+    if (StatusPublished())
+        return Mixer.Snapshot()->GetEffectStatus(EffectHandle, Status);
     dispatch_sync(Queue, ^{
-        for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
-        {
-            if (effectIterator->Handle == EffectHandle)
-            {
-                *Status = effectIterator->Status;
-                break;
-            }
-        }
+        ApplyCommands();
+        Result = Mixer.Snapshot()->GetEffectStatus(EffectHandle, Status);
     });
-    return FF_OK;
+    return Result;
 }
 
 HRESULT Feedback360::GetVersion(ForceFeedbackVersion *version)
@@ -692,32 +776,58 @@ HRESULT Feedback360::sGetVersion(void * self, ForceFeedbackVersion * version)
 
 HRESULT Feedback360::sInitializeTerminate(void * self, NumVersion forceFeedbackAPIVersion, io_object_t hidDevice, boolean_t begin)
 {
-    return Feedback360::getThis(self)->InitializeTerminate(forceFeedbackAPIVersion, hidDevice, begin);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->InitializeTerminate(forceFeedbackAPIVersion, hidDevice, begin);
+    if (obj->Trace) obj->Trace->Initialize(Time, Result, begin);
+    return Result;
 }
 
+// Calls are timed from when they're made, and recorded with what they returned once they have
 HRESULT Feedback360::sDestroyEffect(void * self, FFEffectDownloadID downloadID)
 {
-    return Feedback360::getThis(self)->DestroyEffect(downloadID);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->DestroyEffect(downloadID);
+    if (obj->Trace) obj->Trace->Destroy(Time, Result, downloadID);
+    return Result;
 }
 
 HRESULT Feedback360::sDownloadEffect(void * self, CFUUIDRef effectType, FFEffectDownloadID *pDownloadID, FFEFFECT * pEffect, FFEffectParameterFlag flags)
 {
-    return Feedback360::getThis(self)->DownloadEffect(effectType, pDownloadID, pEffect, flags);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    FFEffectDownloadID Handle = *pDownloadID;
+    HRESULT Result = obj->DownloadEffect(effectType, pDownloadID, pEffect, flags);
+    if (obj->Trace) obj->Trace->Download(Time, Result, effectType, Handle, *pDownloadID, pEffect, flags);
+    return Result;
 }
 
 HRESULT Feedback360::sEscape(void * self, FFEffectDownloadID downloadID, FFEFFESCAPE * pEscape)
 {
-    return Feedback360::getThis(self)->Escape(downloadID, pEscape);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->Escape(downloadID, pEscape);
+    if (obj->Trace) obj->Trace->Escape(Time, Result, downloadID, pEscape->dwCommand, pEscape->lpvInBuffer, pEscape->cbInBuffer);
+    return Result;
 }
 
 HRESULT Feedback360::sGetEffectStatus(void * self, FFEffectDownloadID downloadID, FFEffectStatusFlag * pStatusCode)
 {
-    return Feedback360::getThis(self)->GetEffectStatus(downloadID, pStatusCode);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->GetEffectStatus(downloadID, pStatusCode);
+    if (obj->Trace) obj->Trace->Status(Time, Result, downloadID, (Result == FF_OK) ? *pStatusCode : 0);
+    return Result;
 }
 
 HRESULT Feedback360::sGetForceFeedbackState(void * self, ForceFeedbackDeviceState * pDeviceState)
 {
-    return Feedback360::getThis(self)->GetForceFeedbackState(pDeviceState);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->GetForceFeedbackState(pDeviceState);
+    if (obj->Trace) obj->Trace->State(Time, Result, (Result == FF_OK) ? pDeviceState->dwState : 0);
+    return Result;
 }
 
 HRESULT Feedback360::sGetForceFeedbackCapabilities(void * self, FFCAPABILITIES * capabilities)
@@ -727,22 +837,38 @@ HRESULT Feedback360::sGetForceFeedbackCapabilities(void * self, FFCAPABILITIES *
 
 HRESULT Feedback360::sSendForceFeedbackCommand(void * self, FFCommandFlag state)
 {
-    return Feedback360::getThis(self)->SendForceFeedbackCommand(state);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->SendForceFeedbackCommand(state);
+    if (obj->Trace) obj->Trace->Command(Time, Result, state);
+    return Result;
 }
 
 HRESULT Feedback360::sSetProperty(void * self, FFProperty property, void * pValue)
 {
-    return Feedback360::getThis(self)->SetProperty(property, pValue);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->SetProperty(property, pValue);
+    if (obj->Trace) obj->Trace->Property(Time, Result, property, pValue);
+    return Result;
 }
 
 HRESULT Feedback360::sStartEffect(void * self, FFEffectDownloadID downloadID, FFEffectStartFlag mode, UInt32 iterations)
 {
-    return Feedback360::getThis(self)->StartEffect(downloadID, mode, iterations);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->StartEffect(downloadID, mode, iterations);
+    if (obj->Trace) obj->Trace->Start(Time, Result, downloadID, mode, iterations);
+    return Result;
 }
 
 HRESULT Feedback360::sStopEffect(void * self, UInt32 downloadID)
 {
-    return Feedback360::getThis(self)->StopEffect(downloadID);
+    Feedback360 *obj = Feedback360::getThis(self);
+    double Time = obj->Trace ? obj->Clock->Now() : 0;
+    HRESULT Result = obj->StopEffect(downloadID);
+    if (obj->Trace) obj->Trace->Stop(Time, Result, downloadID);
+    return Result;
 }
 
 // External factory function
@@ -28,10 +28,14 @@
 
 #include <ForceFeedback/IOForceFeedbackLib.h>
 #include <IOKit/IOCFPlugIn.h>
-#include <vector>
 
 #include "devlink.h"
-#include "Feedback360Effect.h"
+#include "Feedback360Mixer.h"
+#include "Feedback360CommandQueue.h"
+#include "Feedback360SendMailbox.h"
+#include "Feedback360Clock.h"
+#include "Feedback360Scheduler.h"
+#include "Feedback360Trace.h"
 
 #define FeedbackDriverVersionMajor      1
 #define FeedbackDriverVersionMinor      0
@@ -42,7 +46,7 @@ class Feedback360 : IUnknown
 {
 public:
     // constructor/destructor
-    Feedback360(void);
+    Feedback360(Feedback360Clock *theClock = NULL);
     virtual ~Feedback360(void);
 
 private:
@@ -89,8 +93,6 @@ public:
     virtual ULONG   Release(void);
 
 private:
-    typedef std::vector<Feedback360Effect> Feedback360EffectVector;
-    typedef Feedback360EffectVector::iterator Feedback360EffectIterator;
     // helper function
     static inline Feedback360 *getThis (void *self) { return (Feedback360 *) ((Xbox360InterfaceMap *) self)->obj; }
 
@@ -99,29 +101,48 @@ private:
     Xbox360InterfaceMap iIOForceFeedbackDeviceInterface;
     DeviceLink          device;
 
-    // GCD queue and timer
+    // Read once per call or tick, and handed down to whatever needs the time
+    Feedback360Clock    *Clock;
+
+    // GCD queues, shared by every controller in the process. One timer on Queue ticks them all
     dispatch_queue_t    Queue;
-    dispatch_source_t   Timer;
 
-    // effects handling
-    Feedback360EffectVector EffectList;
-    UInt32              EffectIndex;
+    // Motor levels are sent from their own queue, so a slow report never holds up Queue.
+    // The mailbox only ever holds the newest levels, older ones are dropped unsent
+    dispatch_queue_t    SendQueue;
+    Feedback360SendMailbox SendMailbox;
 
-    DWORD   Gain;
-    bool    Actuator;
+    // Calls that don't need anything back are queued for the effect loop instead of waiting for it
+    Feedback360CommandQueue Commands;
+    volatile int32_t    CommandsPosted; // Set while a CommandProc is queued
+    volatile int32_t    CommandsPublished;  // Popped position the mixer's snapshot is up to date with
+
+    // effects handling
+    Feedback360Mixer    Mixer;
+    Feedback360InputSnapshot Input;     // Published by the effect loop for condition effects
+    bool                InputStale;     // The effect loop went idle, so the input queue may have overflowed
 
-    LONG            PrvLeftLevel, PrvRightLevel;
-    bool            Stopped;
-    bool            Paused;
     bool            Manual;
-    double          LastTime;
-    double          PausedTime;
     CFUUIDRef       FactoryID;
 
-    void            SetForce(LONG LeftLevel, LONG RightLevel);
-
-    // event loop func
-    static void EffectProc( void *params );
+    // Set when FEEDBACK360_TRACE asks for calls to be recorded
+    Feedback360TraceWriter *Trace;
+    void            OpenTrace(void);
+
+    void            SetForce(const unsigned char *Levels);     // FF_CHANNELS levels
+    void            PostForce(const unsigned char *Levels);
+    static void     SendProc(void *params);
+    void            WakeTimer(void);
+    static void     SchedulerProc(void *params);
+    void            PostCommand(const Feedback360Command &Command);
+    void            ApplyCommands(void);
+    void            ApplyCommand(const Feedback360Command &Command);
+    static void     CommandProc(void *params);
+    void            PublishStatus(void);
+    bool            StatusPublished(void) const;
+
+    // event loop func, called by the scheduler
+    static double EffectProc( void *params, double CurrentTime );
     
     // actual member functions ultimately called by the FF API (through the static functions)
     virtual IOReturn Probe ( CFDictionaryRef propertyTable, io_service_t service, SInt32 * order );
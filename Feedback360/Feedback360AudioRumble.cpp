@@ -0,0 +1,152 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360AudioRumble.cpp - motor levels worked out from game audio
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <math.h>
+#include <algorithm>
+#include "Feedback360AudioRumble.h"
+using std::max;
+using std::min;
+
+Feedback360AudioRumble::Feedback360AudioRumble(void)
+{
+    Configure(48000, 2, 10000);
+}
+
+//----------------------------------------------------------------------------------------------
+// Configure - sets the audio format and the period of the pairs, and starts over
+//----------------------------------------------------------------------------------------------
+void Feedback360AudioRumble::Configure(UInt32 theSampleRate, UInt32 theChannels, UInt32 thePairPeriod)
+{
+    SampleRate = max(theSampleRate, (UInt32)1);
+    Channels = max(theChannels, (UInt32)1);
+    PairPeriod = max(thePairPeriod, (UInt32)1);
+
+    // At least one frame per pair, however short the period
+    UInt64 Frames = (UInt64)SampleRate * PairPeriod;
+    FramesPerPair = (UInt32)max(Frames / 1000000, (UInt64)1);
+    FramesRemainder = (Frames >= 1000000) ? (UInt32)(Frames % 1000000) : 0;
+
+    MixScale = 65536 / Channels;
+    CrossoverAlpha = (SInt32)((1 - exp(-2 * M_PI * AUDIO_CROSSOVER / SampleRate)) * 65536);
+    AttackRate = (float)(1 - exp(-(PairPeriod / 1000.) / AUDIO_ATTACK));
+    ReleaseRate = (float)(1 - exp(-(PairPeriod / 1000.) / AUDIO_RELEASE));
+    Reset();
+}
+
+void Feedback360AudioRumble::Reset(void)
+{
+    FramesLeft = FramesPerPair;
+    FramesCarry = 0;
+    LowState = 0;
+    Peak[0] = Peak[1] = 0;
+    Envelope[0] = Envelope[1] = 0;
+}
+
+//----------------------------------------------------------------------------------------------
+// Process - a pair is written each time a sample period of audio has been seen
+//----------------------------------------------------------------------------------------------
+UInt32 Feedback360AudioRumble::Process(const SInt16 *Pcm, UInt32 Frames, LONG *Pairs)
+{
+    UInt32 Count = 0;
+
+    while (Frames > 0)
+    {
+        UInt32 Block = min(min(Frames, FramesLeft), (UInt32)AUDIO_BLOCK);
+
+        Mixdown(Pcm, Block);
+        Split(Block);
+        Pcm += Block * Channels;
+        Frames -= Block;
+        FramesLeft -= Block;
+
+        if (FramesLeft == 0) {
+            Follow(&Pairs[2 * Count++]);
+            FramesCarry += FramesRemainder;
+            FramesLeft = FramesPerPair + FramesCarry / 1000000;
+            FramesCarry %= 1000000;
+        }
+    }
+    return Count;
+}
+
+// Averages the channels into Mono. Mono and stereo get loops of their own the compiler can vectorize
+void Feedback360AudioRumble::Mixdown(const SInt16 *Pcm, UInt32 Frames)
+{
+    if (Channels == 1) {
+        for (UInt32 Frame = 0; Frame < Frames; Frame++)
+            Mono[Frame] = Pcm[Frame];
+    } else if (Channels == 2) {
+        for (UInt32 Frame = 0; Frame < Frames; Frame++)
+            Mono[Frame] = (Pcm[2 * Frame] + Pcm[2 * Frame + 1]) >> 1;
+    } else {
+        for (UInt32 Frame = 0; Frame < Frames; Frame++)
+        {
+            SInt32 Sum = 0;
+            for (UInt32 Channel = 0; Channel < Channels; Channel++)
+                Sum += Pcm[Frame * Channels + Channel];
+            Mono[Frame] = (Sum * MixScale) >> 16;
+        }
+    }
+}
+
+// Splits Mono into the two bands and keeps the peak of each. Only the crossover filter
+// depends on the frame before, the rest is branch free so it vectorizes
+void Feedback360AudioRumble::Split(UInt32 Frames)
+{
+    SInt32 State = LowState;
+    for (UInt32 Frame = 0; Frame < Frames; Frame++)
+    {
+        State += (SInt32)(((SInt64)((Mono[Frame] << 8) - State) * CrossoverAlpha) >> 16);
+        Low[Frame] = State >> 8;
+    }
+    LowState = State;
+
+    SInt32 LowPeak = Peak[0], HighPeak = Peak[1];
+    for (UInt32 Frame = 0; Frame < Frames; Frame++)
+    {
+        SInt32 LowLevel = Low[Frame];
+        SInt32 HighLevel = Mono[Frame] - Low[Frame];
+        LowLevel = (LowLevel < 0) ? -LowLevel : LowLevel;
+        HighLevel = (HighLevel < 0) ? -HighLevel : HighLevel;
+        LowPeak = (LowLevel > LowPeak) ? LowLevel : LowPeak;
+        HighPeak = (HighLevel > HighPeak) ? HighLevel : HighPeak;
+    }
+    Peak[0] = LowPeak;
+    Peak[1] = HighPeak;
+}
+
+// Moves each band's envelope towards its peak, quickly up and slowly down, and writes
+// the levels on the custom force scale
+void Feedback360AudioRumble::Follow(LONG *Pair)
+{
+    for (UInt32 Band = 0; Band < 2; Band++)
+    {
+        float Target = Peak[Band] * (10000.f / 32768.f);
+        float Rate = (Target > Envelope[Band]) ? AttackRate : ReleaseRate;
+        Envelope[Band] += (Target - Envelope[Band]) * Rate;
+        Pair[Band] = min((LONG)10000, (LONG)(Envelope[Band] + 0.5f));
+        Peak[Band] = 0;
+    }
+}
@@ -0,0 +1,87 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360AudioRumble.h - motor levels worked out from game audio
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360AudioRumble_h
+#define Feedback360_Feedback360AudioRumble_h
+
+#include "Feedback360Headless.h"
+
+// Frames worked on at once, sized to stay in the L1 cache
+#define AUDIO_BLOCK             256
+
+// Where the big motor's band ends and the little motor's begins
+#define AUDIO_CROSSOVER         150.0   // Hz
+
+// How fast the levels follow the audio
+#define AUDIO_ATTACK            5.0     // Milliseconds
+#define AUDIO_RELEASE           60.0    // Milliseconds
+
+// Turns 16 bit PCM into custom force sample pairs, the big motor following the low band and
+// the little motor the high band. Each pair covers one sample period of audio, and the
+// audio can be handed over in pieces of any size
+class Feedback360AudioRumble
+{
+public:
+    Feedback360AudioRumble(void);
+
+    void Configure(UInt32 theSampleRate, UInt32 theChannels, UInt32 thePairPeriod);
+    void Reset(void);
+
+    // Pairs written is at most MaxPairs(Frames)
+    UInt32 MaxPairs(UInt32 Frames) const { return Frames / FramesPerPair + 1; }
+    UInt32 Process(const SInt16 *Pcm, UInt32 Frames, LONG *Pairs);
+
+    UInt32 SampleRate;
+    UInt32 Channels;
+    UInt32 PairPeriod;  // Microseconds
+
+private:
+    //disable copy constructor
+    Feedback360AudioRumble(Feedback360AudioRumble &src);
+    void operator = (Feedback360AudioRumble &src);
+
+    void Mixdown(const SInt16 *Pcm, UInt32 Frames);
+    void Split(UInt32 Frames);
+    void Follow(LONG *Pair);
+
+    // Set by Configure
+    UInt32  FramesPerPair;      // Rounded down, the remainder is spread out
+    UInt32  FramesRemainder;    // Millionths of a frame per pair
+    SInt32  MixScale;           // Q16, one over the channel count
+    SInt32  CrossoverAlpha;     // Q16
+    float   AttackRate, ReleaseRate;
+
+    // State carried between calls
+    UInt32  FramesLeft;         // Until the next pair
+    UInt32  FramesCarry;        // Millionths of a frame
+    SInt32  LowState;           // Low band, Q8
+    SInt32  Peak[2];            // Low, high band since the last pair
+    float   Envelope[2];
+
+    SInt32  Mono[AUDIO_BLOCK];
+    SInt32  Low[AUDIO_BLOCK];
+};
+
+#endif
@@ -0,0 +1,64 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Clock.cpp - where the effect loop gets the time from
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <time.h>
+#include "Feedback360Clock.h"
+
+#ifdef __APPLE__
+Feedback360MachClock::Feedback360MachClock(void)
+{
+    mach_timebase_info_data_t info = {0};
+
+    // Only fails for a bad pointer, but fall back to nanoseconds rather than dividing by zero
+    if (mach_timebase_info(&info) != KERN_SUCCESS || info.denom == 0) {
+        info.numer = 1;
+        info.denom = 1;
+    }
+    Scale = (double)info.numer / info.denom / 1000 / 1000 / 1000;
+}
+
+double Feedback360MachClock::Now(void)
+{
+    return mach_absolute_time() * Scale;
+}
+#else
+double Feedback360MonotonicClock::Now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1000. / 1000. / 1000.;
+}
+#endif
+
+Feedback360Clock *Feedback360DefaultClock(void)
+{
+#ifdef __APPLE__
+    static Feedback360MachClock clock;
+#else
+    static Feedback360MonotonicClock clock;
+#endif
+    return &clock;
+}
@@ -0,0 +1,79 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Clock.h - where the effect loop gets the time from
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360Clock_h
+#define Feedback360_Feedback360Clock_h
+
+#include <stdint.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+// Seconds since some fixed point, never going backwards
+class Feedback360Clock
+{
+public:
+    virtual ~Feedback360Clock(void) {}
+    virtual double Now(void) = 0;
+};
+
+#ifdef __APPLE__
+// mach_absolute_time, with the timebase looked up once
+class Feedback360MachClock : public Feedback360Clock
+{
+public:
+    Feedback360MachClock(void);
+    virtual double Now(void);
+
+private:
+    double Scale;   // Seconds per tick
+};
+#else
+// clock_gettime(CLOCK_MONOTONIC), for building the effects anywhere else
+class Feedback360MonotonicClock : public Feedback360Clock
+{
+public:
+    virtual double Now(void);
+};
+#endif
+
+// Only moves when told to, so effects can be played back exactly
+class Feedback360ManualClock : public Feedback360Clock
+{
+public:
+    Feedback360ManualClock(double Start = 0) : Time(Start) {}
+    virtual double Now(void) { return Time; }
+
+    void Set(double NewTime) { Time = NewTime; }
+    void Advance(double Seconds) { Time += Seconds; }
+
+private:
+    double Time;
+};
+
+// The best clock for this platform, shared by everything that isn't given one
+Feedback360Clock *Feedback360DefaultClock(void);
+
+#endif
@@ -0,0 +1,78 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360CommandQueue.cpp - calls from game threads waiting for the effect loop
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "Feedback360CommandQueue.h"
+
+Feedback360CommandQueue::Feedback360CommandQueue(void) : Tail(0), Head(0)
+{
+    for (int32_t Index = 0; Index < COMMAND_QUEUE_SIZE; Index++)
+        Cells[Index].Sequence = Index;
+}
+
+//----------------------------------------------------------------------------------------------
+// Push - may be called from any thread, returns false when the queue is full
+//----------------------------------------------------------------------------------------------
+bool Feedback360CommandQueue::Push(const Feedback360Command &Command)
+{
+    for (;;)
+    {
+        int32_t Position = Tail;
+        Cell *Slot = &Cells[Position & (COMMAND_QUEUE_SIZE - 1)];
+        int32_t Sequence = Slot->Sequence;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        // Positions wrap, so only the difference is meaningful
+        int32_t Difference = (int32_t)((UInt32)Sequence - (UInt32)Position);
+        if (Difference < 0)
+            return false;
+        // Claim the position, then publish the command by moving the sequence on
+        if (Difference == 0 && __sync_bool_compare_and_swap(&Tail, Position, (int32_t)((UInt32)Position + 1)))
+        {
+            Slot->Command = Command;
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            Slot->Sequence = (int32_t)((UInt32)Position + 1);
+            return true;
+        }
+    }
+}
+
+//----------------------------------------------------------------------------------------------
+// Pop - effect loop only, returns false when nothing has been published yet
+//----------------------------------------------------------------------------------------------
+bool Feedback360CommandQueue::Pop(Feedback360Command *Command)
+{
+    Cell *Slot = &Cells[Head & (COMMAND_QUEUE_SIZE - 1)];
+    int32_t Sequence = Slot->Sequence;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (Sequence != (int32_t)((UInt32)Head + 1))
+        return false;
+    *Command = Slot->Command;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    // Free the cell for the push one lap later
+    Slot->Sequence = (int32_t)((UInt32)Head + COMMAND_QUEUE_SIZE);
+    Head = (int32_t)((UInt32)Head + 1);
+    return true;
+}
@@ -0,0 +1,80 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360CommandQueue.h - calls from game threads waiting for the effect loop
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360CommandQueue_h
+#define Feedback360_Feedback360CommandQueue_h
+
+#include "Feedback360Headless.h"
+
+// Commands that can be waiting at once, must be a power of two
+#define COMMAND_QUEUE_SIZE  64
+
+#define COMMAND_START       0x00    // Handle, Value is the count, Flags the start flags
+#define COMMAND_STOP        0x01    // Handle
+#define COMMAND_GAIN        0x02    // Value is the gain, already clamped
+#define COMMAND_DEVICE      0x03    // Value is the FFCommandFlag
+#define COMMAND_ESCAPE      0x04    // Value is the escape command, Data its input
+
+typedef struct {
+    UInt32              Type;
+    FFEffectDownloadID  Handle;
+    UInt32              Value;
+    UInt32              Flags;
+    double              Time;       // When the call was made
+    unsigned char       Data[4];
+} Feedback360Command;
+
+// Any number of threads can push without blocking, only the effect loop pops
+class Feedback360CommandQueue
+{
+public:
+    Feedback360CommandQueue(void);
+
+    bool Push(const Feedback360Command &Command);
+    bool Pop(Feedback360Command *Command);
+
+    // How many commands have been pushed and popped, wrapping, so another thread can tell
+    // whether everything pushed before it looked has been popped since
+    int32_t Pushed(void) const { return Tail; }
+    int32_t Popped(void) const { return Head; }
+
+private:
+    //disable copy constructor
+    Feedback360CommandQueue(Feedback360CommandQueue &src);
+    void operator = (Feedback360CommandQueue &src);
+
+    // A cell's sequence says whose turn it is: equal to the push position when it is free,
+    // one past it once it holds a command
+    typedef struct {
+        volatile int32_t    Sequence;
+        Feedback360Command  Command;
+    } Cell;
+
+    Cell                Cells[COMMAND_QUEUE_SIZE];
+    volatile int32_t    Tail;   // Next position to push
+    int32_t             Head;   // Next position to pop
+};
+
+#endif
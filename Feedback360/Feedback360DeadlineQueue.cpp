@@ -0,0 +1,124 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360DeadlineQueue.cpp - when each effect next starts or ends
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <float.h>
+#include "Feedback360DeadlineQueue.h"
+
+Feedback360DeadlineQueue::Feedback360DeadlineQueue(void) : Count(0)
+{
+    for (UInt32 Slot = 0; Slot < EFFECT_CAPACITY; Slot++)
+        Position[Slot] = NO_DEADLINE;
+}
+
+//----------------------------------------------------------------------------------------------
+// Set - adds a deadline for the effect, or moves the one it already has
+//----------------------------------------------------------------------------------------------
+void Feedback360DeadlineQueue::Set(FFEffectDownloadID Handle, double Time)
+{
+    UInt32 Slot = Handle & EFFECT_SLOT_MASK;
+    UInt32 Index = Position[Slot];
+
+    if (Index == NO_DEADLINE)
+        Index = Count++;
+    Heap[Index].Time = Time;
+    Heap[Index].Handle = Handle;
+    Place(Index);
+    SiftUp(Index);
+    SiftDown(Index);
+}
+
+//----------------------------------------------------------------------------------------------
+// Cancel - the last entry fills the gap and is moved to where it belongs
+//----------------------------------------------------------------------------------------------
+void Feedback360DeadlineQueue::Cancel(FFEffectDownloadID Handle)
+{
+    UInt32 Slot = Handle & EFFECT_SLOT_MASK;
+    UInt32 Index = Position[Slot];
+
+    if (Index == NO_DEADLINE)
+        return;
+    Position[Slot] = NO_DEADLINE;
+    if (Index == --Count)
+        return;
+    Heap[Index] = Heap[Count];
+    Place(Index);
+    SiftUp(Index);
+    SiftDown(Index);
+}
+
+void Feedback360DeadlineQueue::Clear(void)
+{
+    while (Count > 0)
+        Cancel(Heap[0].Handle);
+}
+
+double Feedback360DeadlineQueue::NextTime(void) const
+{
+    return (Count == 0) ? DBL_MAX : Heap[0].Time;
+}
+
+// Records where an entry now sits
+void Feedback360DeadlineQueue::Place(UInt32 Index)
+{
+    Position[Heap[Index].Handle & EFFECT_SLOT_MASK] = Index;
+}
+
+// After either sift the entry at Index is in order with the rest, so calling both is safe
+void Feedback360DeadlineQueue::SiftUp(UInt32 Index)
+{
+    while (Index > 0)
+    {
+        UInt32 Parent = (Index - 1) / 2;
+        if (Heap[Parent].Time <= Heap[Index].Time)
+            break;
+        Entry Swap = Heap[Parent];
+        Heap[Parent] = Heap[Index];
+        Heap[Index] = Swap;
+        Place(Parent);
+        Place(Index);
+        Index = Parent;
+    }
+}
+
+void Feedback360DeadlineQueue::SiftDown(UInt32 Index)
+{
+    for (;;)
+    {
+        UInt32 Smallest = Index;
+        UInt32 Child = 2 * Index + 1;
+        if (Child < Count && Heap[Child].Time < Heap[Smallest].Time)
+            Smallest = Child;
+        if (Child + 1 < Count && Heap[Child + 1].Time < Heap[Smallest].Time)
+            Smallest = Child + 1;
+        if (Smallest == Index)
+            break;
+        Entry Swap = Heap[Smallest];
+        Heap[Smallest] = Heap[Index];
+        Heap[Index] = Swap;
+        Place(Smallest);
+        Place(Index);
+        Index = Smallest;
+    }
+}
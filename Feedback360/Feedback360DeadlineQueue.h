@@ -0,0 +1,67 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360DeadlineQueue.h - when each effect next starts or ends
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360DeadlineQueue_h
+#define Feedback360_Feedback360DeadlineQueue_h
+
+#include "Feedback360EffectMap.h"
+
+#define NO_DEADLINE 0xFFFF
+
+// At most one deadline per effect, kept in a binary heap so the earliest is always on top
+class Feedback360DeadlineQueue
+{
+public:
+    Feedback360DeadlineQueue(void);
+
+    void Set(FFEffectDownloadID Handle, double Time);
+    void Cancel(FFEffectDownloadID Handle);
+    void Clear(void);
+
+    bool Empty(void) const { return Count == 0; }
+    double NextTime(void) const;                    // DBL_MAX when empty
+    FFEffectDownloadID NextHandle(void) const { return Heap[0].Handle; }
+    void Pop(void) { Cancel(Heap[0].Handle); }
+
+private:
+    //disable copy constructor
+    Feedback360DeadlineQueue(Feedback360DeadlineQueue &src);
+    void operator = (Feedback360DeadlineQueue &src);
+
+    void Place(UInt32 Index);
+    void SiftUp(UInt32 Index);
+    void SiftDown(UInt32 Index);
+
+    typedef struct {
+        double              Time;
+        FFEffectDownloadID  Handle;
+    } Entry;
+
+    Entry       Heap[EFFECT_CAPACITY];
+    UInt16      Position[EFFECT_CAPACITY];  // Index in Heap by effect slot, NO_DEADLINE if none
+    UInt32      Count;
+};
+
+#endif
@@ -23,6 +23,7 @@
     Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include <stdlib.h>
 #include "Feedback360Effect.h"
 using std::max;
 using std::min;
@@ -30,248 +31,646 @@ using std::min;
 //----------------------------------------------------------------------------------------------
 // CEffect
 //----------------------------------------------------------------------------------------------
-Feedback360Effect::Feedback360Effect() : Type(NULL), Status(0), PlayCount(0),
-StartTime(0), Index(0), LastTime(0), Handle(0), DiEffect({0}), DiEnvelope({0}),
-DiCustomForce({0}), DiConstantForce({0}), DiPeriodic({0}), DiRampforce({0})
+Feedback360Effect::Feedback360Effect() : Samples(NULL), SampleCapacity(0)
 {
-    
+    Reset(0);
+}
+
+Feedback360Effect::~Feedback360Effect()
+{
+    free(Samples);
 }
 
-Feedback360Effect::Feedback360Effect(FFEffectDownloadID theHand) : Feedback360Effect()
+// The sample buffer is kept for whichever effect uses the slot next
+void Feedback360Effect::Reset(FFEffectDownloadID theHand)
 {
+    Type = NULL;
     Handle = theHand;
+    memset(&DiEffect, 0, sizeof(DiEffect));
+    memset(&DiEnvelope, 0, sizeof(DiEnvelope));
+    memset(&DiParams, 0, sizeof(DiParams));
+    memset(Axes, 0, sizeof(Axes));
+    memset(Direction, 0, sizeof(Direction));
+    Status = 0;
+    PlayCount = 0;
+    StartTime = 0;
+    LastTime = 0;
+    SampledTime = -DBL_MAX;
+    memset(SampledLevels, 0, sizeof(SampledLevels));
+    Index = 0;
+    SampleFirst = 0;
+    SampleCount = 0;
+    Streaming = false;
+    Compile();
 }
 
-Feedback360Effect::Feedback360Effect(const Feedback360Effect &src) : Type(src.Type),
-Handle(src.Handle), Status(src.Status), PlayCount(src.PlayCount),
-StartTime(src.StartTime), Index(src.Index), LastTime(src.LastTime)
+//----------------------------------------------------------------------------------------------
+// CopySamples - Count is in LONGs, two per pair. Replaces the samples, or adds to them when
+// streaming. Anything past CUSTOM_SAMPLES_MAX is dropped and reported as truncated
+//----------------------------------------------------------------------------------------------
+HRESULT Feedback360Effect::CopySamples(const LONG *Data, DWORD Count)
 {
-    memcpy(&DiEffect, &src.DiEffect, sizeof(FFEFFECT));
-    memcpy(&DiEnvelope, &src.DiEnvelope, sizeof(FFENVELOPE));
-    memcpy(&DiCustomForce, &src.DiCustomForce, sizeof(FFCUSTOMFORCE));
-    memcpy(&DiConstantForce, &src.DiConstantForce, sizeof(FFCONSTANTFORCE));
-    memcpy(&DiPeriodic, &src.DiPeriodic, sizeof(FFPERIODIC));
-    memcpy(&DiRampforce, &src.DiRampforce, sizeof(FFRAMPFORCE));
+    UInt32 Pairs = Count / 2;
+    HRESULT Result = FF_OK;
+
+    if (!Streaming) {
+        SampleFirst = 0;
+        SampleCount = 0;
+        Index = 0;
+    }
+    if (Pairs > CUSTOM_SAMPLES_MAX - SampleCount) {
+        Pairs = CUSTOM_SAMPLES_MAX - SampleCount;
+        Result = FF_TRUNCATED;
+    }
+    if (Pairs == 0 || Data == NULL)
+        return Result;
+    if (SampleCount + Pairs > SampleCapacity && !GrowSamples(SampleCount + Pairs))
+        return FFERR_OUTOFMEMORY;
+
+    // At most two runs, either side of the end of the ring
+    UInt32 Mask = SampleCapacity - 1;
+    UInt32 Position = (SampleFirst + SampleCount) & Mask;
+    UInt32 Run = min(Pairs, SampleCapacity - Position);
+    memcpy(&Samples[2 * Position], Data, Run * 2 * sizeof(LONG));
+    memcpy(&Samples[0], &Data[2 * Run], (Pairs - Run) * 2 * sizeof(LONG));
+    SampleCount += Pairs;
+
+    DiParams.CustomForce.rglForceData = Samples;
+    DiParams.CustomForce.cSamples = SampleCount * 2;
+    return Result;
+}
+
+// Moves the samples to a bigger ring, starting at its beginning
+bool Feedback360Effect::GrowSamples(UInt32 Pairs)
+{
+    UInt32 Capacity = max(SampleCapacity, (UInt32)64);
+    while (Capacity < Pairs)
+        Capacity *= 2;
+
+    LONG *Grown = (LONG *)malloc(Capacity * 2 * sizeof(LONG));
+    if (Grown == NULL)
+        return false;
+    for (UInt32 Pair = 0; Pair < SampleCount; Pair++)
+    {
+        UInt32 From = (SampleFirst + Pair) & (SampleCapacity - 1);
+        Grown[2 * Pair] = Samples[2 * From];
+        Grown[2 * Pair + 1] = Samples[2 * From + 1];
+    }
+    free(Samples);
+    Samples = Grown;
+    SampleCapacity = Capacity;
+    SampleFirst = 0;
+    return true;
+}
+
+// The pair to play now, or NULL if a stream has run dry
+const LONG *Feedback360Effect::NextSample(void)
+{
+    if (SampleCount == 0)
+        return NULL;
+
+    const LONG *Pair = &Samples[2 * ((SampleFirst + Index) & (SampleCapacity - 1))];
+    if (Streaming) {
+        SampleFirst = (SampleFirst + 1) & (SampleCapacity - 1);
+        SampleCount--;
+    } else {
+        Index = (Index + 1) % SampleCount;
+    }
+    return Pair;
 }
 
 //----------------------------------------------------------------------------------------------
-// Calc
+// Kernels - one per effect type, returning the magnitude before the effect gain
 //----------------------------------------------------------------------------------------------
-LONG Feedback360Effect::Calc(LONG *LeftLevel, LONG *RightLevel)
+
+// Envelope and ramp rates are fractions where this is all of it
+#define RATE_ONE    (1 << 16)
+
+static inline LONG ApplyEnvelope(LONG Magnitude, LONG NormalRate, SInt64 EnvelopeLevel)
 {
-    CFTimeInterval Duration = 0;
-    if(DiEffect.dwDuration != FF_INFINITE) {
+    return (LONG)(( (SInt64)Magnitude * NormalRate + EnvelopeLevel ) / RATE_ONE);
+}
+
+// The part of Time that is still to come out of a span whose Scale is 2^32 over its length
+static inline LONG RateOf(UInt64 Time, UInt64 Scale)
+{
+    return (LONG)((Time * Scale) >> 16);
+}
+
+// One period of sine, scaled to 32767, with an extra entry so interpolation can read one past the end
+#define SINE_TABLE_BITS 8
+#define SINE_TABLE_SIZE (1 << SINE_TABLE_BITS)
+
+static class SineTable
+{
+public:
+    SineTable()
+    {
+        for (int i = 0; i <= SINE_TABLE_SIZE; i++)
+            Values[i] = (SInt16)lrint(32767 * sin(i * 2 * M_PI / SINE_TABLE_SIZE));
+    }
+
+    // Sine of a phase where 2^32 is a whole period, scaled to 32767
+    inline LONG operator () (UInt32 PhasePos) const
+    {
+        UInt32 Index = PhasePos >> (32 - SINE_TABLE_BITS);
+        LONG Fraction = (PhasePos >> (16 - SINE_TABLE_BITS)) & 0xFFFF;
+        LONG Low = Values[Index];
+        return Low + (((Values[Index + 1] - Low) * Fraction) >> 16);
+    }
+
+private:
+    SInt16 Values[SINE_TABLE_SIZE + 1];
+} Sine;
+
+// The periodic waveforms, each from the phase to a value where 2^31 is the full magnitude
+static inline SInt64 WaveSquare(UInt32 PhasePos)
+{
+    // First half is positive, second half negative
+    return (SInt64)(1 - 2 * (SInt64)(PhasePos >> 31)) << 31;
+}
+
+static inline SInt64 WaveTriangle(UInt32 PhasePos)
+{
+    // Starts at the negative peak and reaches the positive one half way through
+    SInt64 Distance = (SInt64)PhasePos - 0x80000000LL;
+    return (0x40000000LL - llabs(Distance)) * 2;
+}
+
+static inline SInt64 WaveSawtoothUp(UInt32 PhasePos)
+{
+    return (SInt64)PhasePos - 0x80000000LL;
+}
+
+static LONG KernelNone(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel)
+{
+    return 0;
+}
+
+static LONG KernelConstant(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel)
+{
+    return ApplyEnvelope(Effect->DiParams.ConstantForce.lMagnitude, NormalRate, EnvelopeLevel);
+}
+
+static LONG KernelRamp(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel)
+{
+    LONG Rate = RateOf(Effect->DurationUs - PositionUs, Effect->RampScale);
+    LONG Magnitude = (LONG)(( (SInt64)Effect->DiParams.RampForce.lStart * Rate
+                      + (SInt64)Effect->DiParams.RampForce.lEnd * ( RATE_ONE - Rate ) ) / RATE_ONE);
+    return ApplyEnvelope(Magnitude, NormalRate, EnvelopeLevel);
+}
+
+static LONG KernelSquare(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel)
+{
+    LONG Magnitude = ApplyEnvelope(Effect->DiParams.Periodic.dwMagnitude, NormalRate, EnvelopeLevel);
+    return (LONG)((Magnitude * WaveSquare(PhasePos)) >> 31) + Effect->DiParams.Periodic.lOffset;
+}
+
+static LONG KernelSine(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel)
+{
+    LONG Magnitude = ApplyEnvelope(Effect->DiParams.Periodic.dwMagnitude, NormalRate, EnvelopeLevel);
+    return (LONG)(((SInt64)Magnitude * Sine(PhasePos)) >> 15) + Effect->DiParams.Periodic.lOffset;
+}
+
+static LONG KernelTriangle(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel)
+{
+    LONG Magnitude = ApplyEnvelope(Effect->DiParams.Periodic.dwMagnitude, NormalRate, EnvelopeLevel);
+    return (LONG)((Magnitude * WaveTriangle(PhasePos)) >> 31) + Effect->DiParams.Periodic.lOffset;
+}
+
+static LONG KernelSawtoothUp(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel)
+{
+    LONG Magnitude = ApplyEnvelope(Effect->DiParams.Periodic.dwMagnitude, NormalRate, EnvelopeLevel);
+    return (LONG)((Magnitude * WaveSawtoothUp(PhasePos)) >> 31) + Effect->DiParams.Periodic.lOffset;
+}
+
+static LONG KernelSawtoothDown(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel)
+{
+    LONG Magnitude = ApplyEnvelope(Effect->DiParams.Periodic.dwMagnitude, NormalRate, EnvelopeLevel);
+    return (LONG)((Magnitude * -WaveSawtoothUp(PhasePos)) >> 31) + Effect->DiParams.Periodic.lOffset;
+}
+
+//----------------------------------------------------------------------------------------------
+// Compile - resolves the type and everything that doesn't change while playing
+//----------------------------------------------------------------------------------------------
+void Feedback360Effect::Compile(void)
+{
+    if (Type == NULL)                                           Kind = NO_EFFECT;
+    else if (CFEqual(Type, kFFEffectType_ConstantForce_ID))     Kind = CONSTANT_FORCE;
+    else if (CFEqual(Type, kFFEffectType_RampForce_ID))         Kind = RAMP_FORCE;
+    else if (CFEqual(Type, kFFEffectType_Square_ID))            Kind = SQUARE;
+    else if (CFEqual(Type, kFFEffectType_Sine_ID))              Kind = SINE;
+    else if (CFEqual(Type, kFFEffectType_Triangle_ID))          Kind = TRIANGLE;
+    else if (CFEqual(Type, kFFEffectType_SawtoothUp_ID))        Kind = SAWTOOTH_UP;
+    else if (CFEqual(Type, kFFEffectType_SawtoothDown_ID))      Kind = SAWTOOTH_DOWN;
+    else if (CFEqual(Type, kFFEffectType_CustomForce_ID))       Kind = CUSTOM_FORCE;
+    else if (CFEqual(Type, kFFEffectType_Spring_ID))            Kind = SPRING;
+    else if (CFEqual(Type, kFFEffectType_Damper_ID))            Kind = DAMPER;
+    else if (CFEqual(Type, kFFEffectType_Inertia_ID))           Kind = INERTIA;
+    else if (CFEqual(Type, kFFEffectType_Friction_ID))          Kind = FRICTION;
+    else                                                        Kind = NO_EFFECT;
+
+    switch (Kind) {
+        case CONSTANT_FORCE:    Kernel = KernelConstant;        break;
+        case RAMP_FORCE:        Kernel = KernelRamp;            break;
+        case SQUARE:            Kernel = KernelSquare;          break;
+        case SINE:              Kernel = KernelSine;            break;
+        case TRIANGLE:          Kernel = KernelTriangle;        break;
+        case SAWTOOTH_UP:       Kernel = KernelSawtoothUp;      break;
+        case SAWTOOTH_DOWN:     Kernel = KernelSawtoothDown;    break;
+        default:                Kernel = KernelNone;            break;
+    }
+
+    if (DiEffect.dwDuration != FF_INFINITE) {
         Duration = max(1., DiEffect.dwDuration / 1000.) / 1000.;
+        DurationUs = max( (DWORD)1000, DiEffect.dwDuration );
     } else {
         Duration = DBL_MAX;
+        DurationUs = UINT64_MAX;
+    }
+    StartDelay = DiEffect.dwStartDelay / 1000. / 1000.;
+    PlayStartUs = 0;
+
+    // Worked out to the microsecond, with the divisions done here rather than every tick
+    HasEnvelope = DiEffect.lpEnvelope != NULL;
+    AttackUs = max( (DWORD)1, DiEnvelope.dwAttackTime );
+    FadeUs = max( (DWORD)1, DiEnvelope.dwFadeTime );
+    FadePosUs = (DurationUs > FadeUs) ? DurationUs - FadeUs : 0;
+    AttackScale = (1ULL << 32) / AttackUs;
+    FadeScale = (1ULL << 32) / FadeUs;
+    RampScale = (DurationUs != UINT64_MAX) ? (1ULL << 32) / DurationUs : 0;
+
+    // The phase is a fixed point fraction of the period, so it wraps around by itself
+    PhaseStep = ~0ULL / max( (DWORD)1, DiParams.Periodic.dwPeriod );
+    PhaseOffset = (UInt32)(((UInt64)( DiParams.Periodic.dwPhase % 36000 ) << 32) / 36000);
+
+    // Gain and the scaling to SCALE_MAX in one multiply, gains above 10000 being out of range.
+    // Rounded up, so the full magnitude at the full gain is still SCALE_MAX
+    LevelScale = ((((UInt64)min( DiEffect.dwGain, (DWORD)10000 ) * SCALE_MAX) << 32) + 10000 * 10000 - 1) / (10000 * 10000);
+
+    ConditionCount = min( DiEffect.cbTypeSpecificParams / (DWORD)sizeof( FFCONDITION ), (DWORD)FF_CHANNELS );
+    CompileChannels();
+}
+
+// The motor each axis drives, or FF_CHANNELS for axes without one
+static UInt32 AxisChannel(DWORD Axis)
+{
+    switch (Axis) {
+        case FFJOFS_X:  return CHANNEL_BIG;
+        case FFJOFS_Y:  return CHANNEL_LITTLE;
+        case FFJOFS_Z:  return CHANNEL_TRIGGER_LEFT;
+        case FFJOFS_RZ: return CHANNEL_TRIGGER_RIGHT;
+        default:        return FF_CHANNELS;
+    }
+}
+
+//----------------------------------------------------------------------------------------------
+// CompileChannels - effects without axes play on both big motors as they always have. Otherwise
+// each axis drives its own motor, with a cartesian direction giving each its share, the largest
+// getting the full level. Other directions can't be split between motors, so all get the full level
+//----------------------------------------------------------------------------------------------
+void Feedback360Effect::CompileChannels(void)
+{
+    static const DWORD DefaultAxes[] = {FFJOFS_X, FFJOFS_Y};
+    const DWORD *EffectAxes = Axes;
+    UInt32 Count = min(DiEffect.cAxes, (DWORD)FF_CHANNELS);
+    LONG Largest = 0;
+
+    if (Count == 0 || DiEffect.rgdwAxes == NULL) {
+        EffectAxes = DefaultAxes;
+        Count = 2;
+    } else if ((DiEffect.dwFlags & FFEFF_CARTESIAN) && DiEffect.rglDirection != NULL) {
+        for (UInt32 Axis = 0; Axis < Count; Axis++)
+            Largest = max(Largest, (LONG)abs(Direction[Axis]));
+    }
+
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        Weight[Channel] = 0;
+    AxisCount = Count;
+    for (UInt32 Axis = 0; Axis < Count; Axis++)
+    {
+        UInt32 Channel = AxisChannel(EffectAxes[Axis]);
+        AxisChannels[Axis] = (UInt8)Channel;
+        if (Channel == FF_CHANNELS)
+            continue;
+        LONG Share = (Largest > 0) ? (LONG)((SInt64)abs(Direction[Axis]) * 10000 / Largest) : 10000;
+        Weight[Channel] = max(Weight[Channel], Share);
+    }
+
+    // Only the channels with a share are visited when rendering
+    ChannelCount = 0;
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+    {
+        WeightScale[Channel] = (UInt32)((((UInt64)Weight[Channel] << 16) + 10000 - 1) / 10000);
+        if (Weight[Channel] > 0)
+            Channels[ChannelCount++] = (UInt8)Channel;
+    }
+
+    // Custom force pairs go to the first two axes, or the big motors if there aren't two
+    SampleChannel[0] = CHANNEL_BIG;
+    SampleChannel[1] = CHANNEL_LITTLE;
+    for (UInt32 Axis = 0; Axis < 2 && Axis < Count; Axis++)
+    {
+        if (AxisChannels[Axis] != FF_CHANNELS)
+            SampleChannel[Axis] = AxisChannels[Axis];
+    }
+}
+
+// The size of the force for how far Metric is past the condition's dead band, at most the
+// saturation on that side
+static LONG ConditionForce(const FFCONDITION *Condition, LONG Metric)
+{
+    SInt64 Distance = (SInt64)Metric - Condition->lOffset;
+
+    if (Distance > Condition->lDeadBand)
+        return (LONG)min( (SInt64)Condition->dwPositiveSaturation, (SInt64)llabs( (Distance - Condition->lDeadBand) * Condition->lPositiveCoefficient / 10000 ) );
+    if (Distance < -Condition->lDeadBand)
+        return (LONG)min( (SInt64)Condition->dwNegativeSaturation, (SInt64)llabs( (Distance + Condition->lDeadBand) * Condition->lNegativeCoefficient / 10000 ) );
+    return 0;
+}
+
+//----------------------------------------------------------------------------------------------
+// CalcCondition - each axis reads its own stick or trigger and drives its own motor. Motors
+// can't push back, so the size of the force is played as rumble, whichever way it points.
+// Friction is the coefficient itself, for as long as the axis is moving past the dead band
+//----------------------------------------------------------------------------------------------
+void Feedback360Effect::CalcCondition(const Feedback360Motion *Motion, LONG *Levels)
+{
+    if (Motion == NULL || ConditionCount == 0)
+        return;
+
+    for (UInt32 Axis = 0; Axis < AxisCount; Axis++)
+    {
+        UInt32 Channel = AxisChannels[Axis];
+        if (Channel == FF_CHANNELS)
+            continue;
+
+        const FFCONDITION *Condition = &DiParams.Condition[min(Axis, ConditionCount - 1)];
+        LONG Force;
+        switch (Kind) {
+            case SPRING:
+                Force = ConditionForce(Condition, Motion->Position[Channel]);
+                break;
+            case DAMPER:
+                Force = ConditionForce(Condition, Motion->Velocity[Channel]);
+                break;
+            case INERTIA:
+                Force = ConditionForce(Condition, Motion->Acceleration[Channel]);
+                break;
+            default:
+            {
+                LONG Velocity = Motion->Velocity[Channel] - Condition->lOffset;
+                if (Velocity > Condition->lDeadBand)
+                    Force = min( (LONG)Condition->dwPositiveSaturation, (LONG)abs(Condition->lPositiveCoefficient) );
+                else if (Velocity < -Condition->lDeadBand)
+                    Force = min( (LONG)Condition->dwNegativeSaturation, (LONG)abs(Condition->lNegativeCoefficient) );
+                else
+                    Force = 0;
+                break;
+            }
+        }
+
+        LONG Level = (LONG)((SInt64)Force * DiEffect.dwGain / 10000);
+        Levels[Channel] += min( SCALE_MAX, Level * SCALE_MAX / 10000 );
     }
-    double BeginTime = StartTime + ( DiEffect.dwStartDelay / 1000. / 1000.);
+}
+
+//----------------------------------------------------------------------------------------------
+// Calc
+//----------------------------------------------------------------------------------------------
+LONG Feedback360Effect::Calc(double CurrentTime, LONG *Levels, const Feedback360Motion *Motion)
+{
+    double BeginTime = StartTime + StartDelay;
     double EndTime  = DBL_MAX;
-    if (PlayCount != -1)
+    if (PlayCount != FF_INFINITE)
     {
         EndTime = BeginTime + Duration * PlayCount;
     }
-    double CurrentTime = CurrentTimeUsingMach();
 
     if (Status == FFEGES_PLAYING && BeginTime <= CurrentTime && CurrentTime <= EndTime)
     {
-        // Used for force calculation
-        LONG NormalLevel;
-        LONG WorkLeftLevel;
-        LONG WorkRightLevel;
-
-        // Used for envelope calculation
-        LONG NormalRate;
-        LONG AttackLevel;
-        LONG FadeLevel;
-
-        CalcEnvelope((ULONG)(Duration*1000)
-                     ,(ULONG)(fmod(CurrentTime - BeginTime, Duration)*1000)
-                     ,&NormalRate
-                     ,&AttackLevel
-                     ,&FadeLevel);
+        // Conditions have no envelope or waveform, only the controller's motion
+        if (IsCondition()) {
+            CalcCondition(Motion, Levels);
+            return 0;
+        }
+
+        UInt64 PositionUs = Position(CurrentTime);
 
         // CustomForce allows setting each channel separately
-        if(CFEqual(Type, kFFEffectType_CustomForce_ID)) {
-            if((CurrentTimeUsingMach() - LastTime)*1000*1000 < DiCustomForce.dwSamplePeriod) {
+        if (Kind == CUSTOM_FORCE) {
+            LONG WorkLeftLevel;
+            LONG WorkRightLevel;
+            LONG NormalRate;
+            SInt64 EnvelopeLevel;
+
+            CalcEnvelope(PositionUs, &NormalRate, &EnvelopeLevel);
+            if((CurrentTime - LastTime)*1000*1000 < DiParams.CustomForce.dwSamplePeriod) {
                 return -1;
             }
             else {
-                WorkLeftLevel = ((DiCustomForce.rglForceData[2*Index] * NormalRate + AttackLevel + FadeLevel) / 100) * DiEffect.dwGain / 10000;
-                WorkRightLevel = ((DiCustomForce.rglForceData[2*Index + 1] * NormalRate + AttackLevel + FadeLevel) / 100) * DiEffect.dwGain / 10000;
+                const LONG *Pair = NextSample();
+                if (Pair == NULL) {
+                    WorkLeftLevel = 0;
+                    WorkRightLevel = 0;
+                } else {
+                    WorkLeftLevel = ApplyEnvelope(Pair[0], NormalRate, EnvelopeLevel) * (LONG)DiEffect.dwGain / 10000;
+                    WorkRightLevel = ApplyEnvelope(Pair[1], NormalRate, EnvelopeLevel) * (LONG)DiEffect.dwGain / 10000;
+                }
                 //fprintf(stderr, "L:%d; R:%d\n", WorkLeftLevel, WorkRightLevel);
-                Index = (Index + 1) % (DiCustomForce.cSamples/2);
-                LastTime = CurrentTimeUsingMach();
+                LastTime = CurrentTime;
             }
+            Levels[SampleChannel[0]] += min( SCALE_MAX, WorkLeftLevel * SCALE_MAX / 10000 );
+            Levels[SampleChannel[1]] += min( SCALE_MAX, WorkRightLevel * SCALE_MAX / 10000 );
         }
-        // Regular commands treat controller as a single output (both channels are together as one)
+        // Regular commands have one level, shared out between the channels of the effect's axes
         else {
-            CalcForce(
-                      (ULONG)(Duration*1000)
-                      ,(ULONG)(fmod(CurrentTime - BeginTime, Duration)*1000)
-                      ,NormalRate
-                      ,AttackLevel
-                      ,FadeLevel
-                      ,&NormalLevel );
-            //fprintf(stderr, "DeltaT %f\n", CurrentTime - BeginTime);
-            //fprintf(stderr, "Duration %f; NormalRate: %d; AttackLevel: %d; FadeLevel: %d\n", Duration, NormalRate, AttackLevel, FadeLevel);
-
-            WorkLeftLevel = (NormalLevel > 0) ? NormalLevel : -NormalLevel;
-            WorkRightLevel = (NormalLevel > 0) ? NormalLevel : -NormalLevel;
-        }
-        WorkLeftLevel = min( SCALE_MAX, WorkLeftLevel * SCALE_MAX / 10000 );
-        WorkRightLevel = min( SCALE_MAX, WorkRightLevel * SCALE_MAX / 10000 );
+            LONG NormalLevel = Level<true>(PositionUs, Kernel);
 
-        *LeftLevel = *LeftLevel + WorkLeftLevel;
-        *RightLevel = *RightLevel + WorkRightLevel;
+            for (UInt32 Used = 0; Used < ChannelCount; Used++)
+                Levels[Channels[Used]] += (NormalLevel * WeightScale[Channels[Used]]) >> 16;
+        }
     }
     return 0;
 }
 
 //----------------------------------------------------------------------------------------------
-// CalcEnvelope
+// Render - adds the levels of a regular effect for Ticks ticks, Period microseconds apart from
+// BlockStart, to Levels, which has a row of ticks for each channel. The position is stepped
+// from tick to tick rather than worked out from the time, so a block costs little more than
+// its kernels
 //----------------------------------------------------------------------------------------------
-void Feedback360Effect::CalcEnvelope(ULONG Duration, ULONG CurrentPos, LONG *NormalRate, LONG *AttackLevel, LONG *FadeLevel)
+void Feedback360Effect::Render(double BlockStart, UInt32 Period, UInt32 Ticks, LONG (*Levels)[RENDER_AHEAD_MAX])
 {
-	if( ( DiEffect.dwFlags & FFEP_ENVELOPE ) && DiEffect.lpEnvelope != NULL )
-	{
-        // Calculate attack factor
-		LONG	AttackRate	= 0;
-		ULONG	AttackTime	= max( (DWORD)1, DiEnvelope.dwAttackTime / 1000 );
-		if (CurrentPos < AttackTime)
-        {
-			AttackRate	= ( AttackTime - CurrentPos ) * 100 / AttackTime;
-		}
+    double BeginTime = StartTime + StartDelay;
+    double EndTime  = DBL_MAX;
+    double Step = Period * 1e-6;
+    UInt32 First = 0;
+    UInt32 Last = Ticks;
 
-        // Calculate fade factor
-        LONG	FadeRate	= 0;
-		ULONG	FadeTime	= max( (DWORD)1, DiEnvelope.dwFadeTime / 1000 );
-		ULONG	FadePos		= Duration - FadeTime;
-		if (FadePos < CurrentPos)
-        {
-			FadeRate	= ( CurrentPos - FadePos ) * 100 / FadeTime;
-		}
+    if (Status != FFEGES_PLAYING)
+        return;
+    if (PlayCount != FF_INFINITE)
+    {
+        EndTime = BeginTime + Duration * PlayCount;
+    }
 
-		*NormalRate		= 100 - AttackRate - FadeRate;
-		*AttackLevel	= DiEnvelope.dwAttackLevel * AttackRate;
-		*FadeLevel		= DiEnvelope.dwFadeLevel * FadeRate;
-	} else {
-		*NormalRate		= 100;
-		*AttackLevel	= 0;
-		*FadeLevel		= 0;
-	}
+    // Only the ticks inside the play time, timed the same way as the block
+    while (First < Last && BlockStart + First * Step < BeginTime)
+        First++;
+    while (Last > First && BlockStart + (Last - 1) * Step > EndTime)
+        Last--;
+    if (First == Last)
+        return;
+
+    UInt64 PositionUs = Position(BlockStart + First * Step);
+    switch (Kind) {
+        case CONSTANT_FORCE:    RenderTicks<KernelConstant>(PositionUs, Period, First, Last, Levels);       break;
+        case RAMP_FORCE:        RenderTicks<KernelRamp>(PositionUs, Period, First, Last, Levels);           break;
+        case SQUARE:            RenderTicks<KernelSquare>(PositionUs, Period, First, Last, Levels);         break;
+        case SINE:              RenderTicks<KernelSine>(PositionUs, Period, First, Last, Levels);           break;
+        case TRIANGLE:          RenderTicks<KernelTriangle>(PositionUs, Period, First, Last, Levels);       break;
+        case SAWTOOTH_UP:       RenderTicks<KernelSawtoothUp>(PositionUs, Period, First, Last, Levels);     break;
+        case SAWTOOTH_DOWN:     RenderTicks<KernelSawtoothDown>(PositionUs, Period, First, Last, Levels);   break;
+    }
 }
 
-void Feedback360Effect::CalcForce(ULONG Duration, ULONG CurrentPos, LONG NormalRate, LONG AttackLevel, LONG FadeLevel, LONG * NormalLevel)
+// Made once per kernel, so each loop calls its kernel directly and can inline it. The ticks go
+// in runs that stay in one section of the envelope, and runs between the attack and the fade
+// leave the envelope out altogether
+template <Feedback360Kernel Wave>
+void Feedback360Effect::RenderTicks(UInt64 PositionUs, UInt32 Period, UInt32 First, UInt32 Last, LONG (*Levels)[RENDER_AHEAD_MAX])
 {
-    LONG Magnitude = 0;
-    LONG Period;
-    LONG R;
-    LONG Rate;
-
-    if (CFEqual(Type, kFFEffectType_ConstantForce_ID)) {
-        Magnitude	= DiConstantForce.lMagnitude;
-        Magnitude	= ( Magnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
-    }
-    else if (CFEqual(Type, kFFEffectType_Square_ID)) {
-        Period	= max( (DWORD)1, ( DiPeriodic.dwPeriod / 1000 ) );
-        R		= ( CurrentPos%Period) * 360 / Period;
-        R	= ( R + ( DiPeriodic.dwPhase / 100 ) ) % 360;
-
-        Magnitude	= DiPeriodic.dwMagnitude;
-        Magnitude	= ( Magnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
+    LONG Run[RENDER_AHEAD_MAX];
+    UInt32 Tick = First;
 
-        if (180 <= R)
+    while (Tick < Last)
+    {
+        // A run ends before the first tick in the next section or the next play
+        UInt64 Until = DurationUs;
+        bool Steady = !HasEnvelope;
+        if (HasEnvelope && PositionUs < AttackUs) {
+            Until = AttackUs;
+        } else if (HasEnvelope && PositionUs <= FadePosUs) {
+            Until = FadePosUs + 1;
+            Steady = true;
+        }
+        UInt32 Count = Last - Tick;
+        if (Until - PositionUs <= (UInt64)Count * Period)
+            Count = (UInt32)((Until - PositionUs - 1) / Period + 1);
+
+        if (Steady)
+            RenderRun<Wave, false>(PositionUs, Period, Count, Run);
+        else
+            RenderRun<Wave, true>(PositionUs, Period, Count, Run);
+
+        // Shared out afterwards, as adding to Levels in the loop above would mean reading the
+        // effect's parameters again after every tick. Channels getting all of it are only adds
+        for (UInt32 Used = 0; Used < ChannelCount; Used++)
         {
-            Magnitude = Magnitude * -1;
+            LONG *Row = &Levels[Channels[Used]][Tick];
+            UInt32 Scale = WeightScale[Channels[Used]];
+            if (Scale == (1 << 16)) {
+                for (UInt32 Step = 0; Step < Count; Step++)
+                    Row[Step] += Run[Step];
+            } else {
+                for (UInt32 Step = 0; Step < Count; Step++)
+                    Row[Step] += (LONG)((Run[Step] * Scale) >> 16);
+            }
         }
 
-        Magnitude	= Magnitude + DiPeriodic.lOffset;
+        Tick += Count;
+        PositionUs += (UInt64)Count * Period;
+        if (PositionUs >= DurationUs) {
+            UInt64 Plays = (Period < DurationUs) ? 1 : PositionUs / DurationUs;
+            PositionUs -= Plays * DurationUs;
+            PlayStartUs += Plays * DurationUs;
+        }
     }
-    else if (CFEqual(Type, kFFEffectType_Sine_ID)) {
-        Period	= max( (DWORD)1, ( DiPeriodic.dwPeriod / 1000 ) );
-        R		= (CurrentPos%Period) * 360 / Period;
-        R		= ( R + ( DiPeriodic.dwPhase / 100 ) ) % 360;
-
-        Magnitude	= DiPeriodic.dwMagnitude;
-        Magnitude	= ( Magnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
+}
 
-        Magnitude	= ( int)( Magnitude * sin( R * M_PI / 180.0 ) );
+// The levels of Count ticks, Period microseconds apart
+template <Feedback360Kernel Wave, bool Enveloped>
+inline void Feedback360Effect::RenderRun(UInt64 PositionUs, UInt32 Period, UInt32 Count, LONG *Run)
+{
+    for (UInt32 Step = 0; Step < Count; Step++, PositionUs += Period)
+        Run[Step] = Level<Enveloped>(PositionUs, Wave);
+}
 
-        Magnitude	= Magnitude + DiPeriodic.lOffset;
+//----------------------------------------------------------------------------------------------
+// Position - microseconds into the play CurrentTime is in. Ticks nearly always land in the
+// same play as the last one, or the next, so the division is only done when they don't
+//----------------------------------------------------------------------------------------------
+UInt64 Feedback360Effect::Position(double CurrentTime)
+{
+    UInt64 ElapsedUs = (UInt64)((CurrentTime - BeginTime()) * 1000 * 1000);
+    UInt64 PositionUs = ElapsedUs - PlayStartUs;
+
+    if (ElapsedUs >= PlayStartUs && PositionUs < DurationUs)
+        return PositionUs;
+    if (ElapsedUs >= PlayStartUs && PositionUs - DurationUs < DurationUs) {
+        PlayStartUs += DurationUs;
+        return PositionUs - DurationUs;
     }
-    else if (CFEqual(Type, kFFEffectType_Triangle_ID)) {
-        Period	= max( (DWORD)1, ( DiPeriodic.dwPeriod / 1000 ) );
-        R		= (CurrentPos%Period) * 360 / Period;
-        R		= ( R + ( DiPeriodic.dwPhase / 100 ) ) % 360;
-
-        Magnitude	= DiPeriodic.dwMagnitude;
-        Magnitude	= ( Magnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
-
-        if (0 <= R && R < 90)
-        {
-            Magnitude	= -Magnitude * ( 90 - R ) / 90;
-        }
-        if (90 <= R && R < 180)
-        {
-            Magnitude	= Magnitude * ( R - 90 ) / 90;
-        }
-        if (180 <= R && R < 270)
-        {
-            Magnitude	= Magnitude * ( 90 - ( R - 180 ) ) / 90;
-        }
-        if (270 <= R && R < 360)
-        {
-            Magnitude	= -Magnitude * ( R - 270 ) / 90;
-        }
+    PositionUs = ElapsedUs % DurationUs;
+    PlayStartUs = ElapsedUs - PositionUs;
+    return PositionUs;
+}
 
-        Magnitude	= Magnitude + DiPeriodic.lOffset;
-    }
-    else if(CFEqual(Type, kFFEffectType_SawtoothUp_ID)) {
-        Period	= max( (DWORD)1, ( DiPeriodic.dwPeriod / 1000 ) );
-        R		= (CurrentPos%Period) * 360 / Period;
-        R		= ( R + ( DiPeriodic.dwPhase / 100 ) ) % 360;
+//----------------------------------------------------------------------------------------------
+// Level - the level of a regular effect at a position, from 0 to SCALE_MAX with its gain.
+// Without Enveloped, the position has to be between the attack and the fade
+//----------------------------------------------------------------------------------------------
+template <bool Enveloped>
+inline LONG Feedback360Effect::Level(UInt64 PositionUs, Feedback360Kernel Wave)
+{
+    UInt32 PhasePos = (UInt32)((PositionUs * PhaseStep) >> 32) + PhaseOffset;
+    LONG NormalRate = RATE_ONE;
+    SInt64 EnvelopeLevel = 0;
+
+    if (Enveloped)
+        CalcEnvelope(PositionUs, &NormalRate, &EnvelopeLevel);
+    LONG Magnitude = Wave(this, PositionUs, PhasePos, NormalRate, EnvelopeLevel);
+    Magnitude = (Magnitude > 0) ? Magnitude : -Magnitude;
+    return (LONG)min( (UInt64)SCALE_MAX, ((UInt64)Magnitude * LevelScale) >> 32 );
+}
 
-        Magnitude	= DiPeriodic.dwMagnitude;
-        Magnitude	= ( Magnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
+//----------------------------------------------------------------------------------------------
+// EndTime - when the last play finishes, DBL_MAX if it never does
+//----------------------------------------------------------------------------------------------
+double Feedback360Effect::EndTime(void) const
+{
+    if (DiEffect.dwDuration == FF_INFINITE || PlayCount == FF_INFINITE)
+        return DBL_MAX;
+    return BeginTime() + Duration * PlayCount;
+}
 
-        if (0 <= R && R < 180)
-        {
-            Magnitude	= -Magnitude * ( 180 - R ) / 180;
-        }
-        if (180 <= R && R < 360)
+//----------------------------------------------------------------------------------------------
+// CalcEnvelope - the share of the magnitude to use, and the level the attack and fade add,
+// both in RATE_ONE parts
+//----------------------------------------------------------------------------------------------
+inline void Feedback360Effect::CalcEnvelope(UInt64 PositionUs, LONG *NormalRate, SInt64 *EnvelopeLevel)
+{
+	if (HasEnvelope)
+	{
+        // Calculate attack factor
+		LONG	AttackRate	= 0;
+		if (PositionUs < AttackUs)
         {
-            Magnitude	= Magnitude * ( R - 180 ) / 180;
-        }
+			AttackRate	= RateOf( AttackUs - PositionUs, AttackScale );
+		}
 
-        Magnitude	= Magnitude + DiPeriodic.lOffset;
-    }
-    else if (CFEqual(Type, kFFEffectType_SawtoothDown_ID)) {
-        Period	= max( (DWORD)1, ( DiPeriodic.dwPeriod / 1000 ) );
-        R		= (CurrentPos%Period) * 360 / Period;
-        R		= ( R + ( DiPeriodic.dwPhase / 100 ) ) % 360;
-
-        Magnitude	= DiPeriodic.dwMagnitude;
-        Magnitude	= ( Magnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
-        if( 0 <= R && R < 180 )
-        {
-            Magnitude	= Magnitude * ( 180 - R ) / 180;
-        }
-        if( 180 <= R && R < 360 )
+        // Calculate fade factor
+        LONG	FadeRate	= 0;
+		if (FadePosUs < PositionUs)
         {
-            Magnitude	= -Magnitude * ( R - 180 ) / 180;
-        }
-
-        Magnitude	= Magnitude + DiPeriodic.lOffset;
-    }
-    else if (CFEqual(Type, kFFEffectType_RampForce_ID)) {
-        Rate		= ( Duration - CurrentPos ) * 100
-        / Duration;//MAX( 1, DiEffect.dwDuration / 1000 );
-
-        Magnitude	= ( DiRampforce.lStart * Rate
-                       + DiRampforce.lEnd * ( 100 - Rate ) ) / 100;
-        Magnitude	= ( Magnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
-    }
+			FadeRate	= RateOf( PositionUs - FadePosUs, FadeScale );
+		}
 
-    *NormalLevel = Magnitude * (LONG)DiEffect.dwGain / 10000;
+		*NormalRate		= RATE_ONE - AttackRate - FadeRate;
+		*EnvelopeLevel	= (SInt64)DiEnvelope.dwAttackLevel * AttackRate + (SInt64)DiEnvelope.dwFadeLevel * FadeRate;
+	} else {
+		*NormalRate		= RATE_ONE;
+		*EnvelopeLevel	= 0;
+	}
 }
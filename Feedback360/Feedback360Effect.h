@@ -28,9 +28,9 @@
 #ifndef Feedback360_Feedback360Effect_h
 #define Feedback360_Feedback360Effect_h
 
-#include <IOKit/IOCFPlugIn.h>
-#include <ForceFeedback/IOForceFeedbackLib.h>
+#include "Feedback360Headless.h"
 #include <math.h>
+#include <float.h>
 #include <string.h>
 #include <algorithm>
 
@@ -50,28 +50,70 @@
 #define	INERTIA			0x09
 #define	FRICTION		0x0A
 #define	CUSTOM_FORCE	0x0B
+#define	NO_EFFECT		0xFF
 
 #define SCALE_MAX (LONG)255
 
-double CurrentTimeUsingMach();
+// Motors an effect can drive, the order they are sent in
+#define CHANNEL_BIG             0
+#define CHANNEL_LITTLE          1
+#define CHANNEL_TRIGGER_LEFT    2
+#define CHANNEL_TRIGGER_RIGHT   3
+#define FF_CHANNELS             4
+
+// How the controller is moving, indexed like the channels, for condition effects. Positions are
+// the same as Feedback360InputState's. A velocity of 10000 covers the whole positive range in
+// 100 ms, and an acceleration of 10000 reaches that velocity in 100 ms
+typedef struct {
+    LONG    Position[FF_CHANNELS];
+    LONG    Velocity[FF_CHANNELS];
+    LONG    Acceleration[FF_CHANNELS];
+} Feedback360Motion;
+
+// Most ticks that can be rendered ahead at once
+#define RENDER_AHEAD_MAX    32
+
+// Most custom force samples an effect can hold, in left/right pairs
+#define CUSTOM_SAMPLES_MAX  (1 << 16)
+
+class Feedback360Effect;
+
+// Works out a regular effect's magnitude at a position, before its gain
+typedef LONG (*Feedback360Kernel)(const Feedback360Effect *Effect, UInt64 PositionUs, UInt32 PhasePos, LONG NormalRate, SInt64 EnvelopeLevel);
 
 class Feedback360Effect
 {
 public:
-    Feedback360Effect(FFEffectDownloadID theHand);
-    Feedback360Effect(const Feedback360Effect &src);
+    Feedback360Effect();
+    ~Feedback360Effect();
+    void Reset(FFEffectDownloadID theHand);
+    HRESULT CopySamples(const LONG *Data, DWORD Count);
+
+    void Compile(void);
+    LONG Calc(double CurrentTime, LONG *Levels, const Feedback360Motion *Motion);   // Adds to FF_CHANNELS levels
+    void Render(double BlockStart, UInt32 Period, UInt32 Ticks, LONG (*Levels)[RENDER_AHEAD_MAX]);
+    double BeginTime(void) const { return StartTime + StartDelay; }
+    double EndTime(void) const;
 
-    LONG Calc(LONG *LeftLevel, LONG *RightLevel);
+    bool IsCondition(void) const { return Kind == SPRING || Kind == DAMPER || Kind == INERTIA || Kind == FRICTION; }
+    // Depends on more than the time, or holds levels from an earlier tick, so isn't worked out ahead
+    bool Live(void) const { return Kind == CUSTOM_FORCE || IsCondition() || DiEffect.dwSamplePeriod != 0; }
 
 	CFUUIDRef		Type;
     FFEffectDownloadID Handle;
 
 	FFEFFECT		DiEffect;
     FFENVELOPE		DiEnvelope;
-	FFCONSTANTFORCE	DiConstantForce;
-    FFCUSTOMFORCE   DiCustomForce;
-	FFPERIODIC		DiPeriodic;
-	FFRAMPFORCE		DiRampforce;
+    // Only the member matching Type is valid
+    union {
+        FFCONSTANTFORCE	ConstantForce;
+        FFCUSTOMFORCE   CustomForce;
+        FFPERIODIC		Periodic;
+        FFRAMPFORCE		RampForce;
+        FFCONDITION     Condition[FF_CHANNELS];     // One per axis, or one for all of them
+    } DiParams;
+    DWORD           Axes[FF_CHANNELS];
+    LONG            Direction[FF_CHANNELS];
 
     DWORD			Status;
     DWORD			PlayCount;
@@ -80,10 +122,55 @@ public:
     double			LastTime;
     DWORD           Index;
 
+    // Effects with a sample period are only worked out that often, and hold these in between
+    double          SampledTime;    // -DBL_MAX until the first sample after starting, so it's due
+    LONG            SampledLevels[FF_CHANNELS];
+
+    // Custom force samples, copied from the game into a ring of left/right pairs
+    LONG            *Samples;
+    UInt32          SampleCapacity; // Pairs, a power of two
+    UInt32          SampleFirst;    // Pair played first
+    UInt32          SampleCount;    // Pairs held
+    bool            Streaming;      // Pairs are dropped once played, and downloads add to the end
+
+    // Set by Compile from the parameters above
+    UInt8           Kind;
+    Feedback360Kernel Kernel;
+    double          Duration;       // Seconds, DBL_MAX if infinite
+    double          StartDelay;     // Seconds
+    UInt64          DurationUs;     // UINT64_MAX if infinite
+    bool            HasEnvelope;
+    UInt64          AttackUs, FadeUs, FadePosUs;
+    UInt64          AttackScale, FadeScale, RampScale;  // 2^32 over the microseconds each covers
+    UInt64          PhaseStep;      // Phase advance per microsecond, 2^64 is a whole period
+    UInt32          PhaseOffset;    // 2^32 is a whole period
+    UInt64          LevelScale;     // From a kernel's magnitude to a level with the gain, 2^32 is one to one
+    LONG            Weight[FF_CHANNELS];    // Share of the level each channel gets, 10000 is all of it
+    UInt32          WeightScale[FF_CHANNELS];   // The same share, 2^16 is all of it
+    UInt8           Channels[FF_CHANNELS];      // Channels with a share, in order
+    UInt32          ChannelCount;
+    UInt8           SampleChannel[2];       // Channels the two halves of a custom force pair go to
+    UInt8           AxisChannels[FF_CHANNELS];  // Channel of each axis, FF_CHANNELS if it has none
+    UInt32          AxisCount;
+    UInt32          ConditionCount;
+
+    // Where the play the last tick was in started, so the next one rarely needs a division
+    UInt64          PlayStartUs;    // Microseconds after BeginTime, a whole number of durations
+
 private:
-    Feedback360Effect();
-    void CalcEnvelope(ULONG Duration, ULONG CurrentPos, LONG *NormalRate, LONG *AttackLevel, LONG *FadeLevel);
-    void CalcForce(ULONG Duration, ULONG CurrentPos, LONG NormalRate, LONG AttackLevel, LONG FadeLevel, LONG * NormalLevel);
+    // Effects live in a pool and DiEffect points into them, so they are never copied
+    Feedback360Effect(const Feedback360Effect &src);
+    void operator = (const Feedback360Effect &src);
+
+    void CalcEnvelope(UInt64 PositionUs, LONG *NormalRate, SInt64 *EnvelopeLevel);
+    UInt64 Position(double CurrentTime);
+    template <bool Enveloped> LONG Level(UInt64 PositionUs, Feedback360Kernel Wave);
+    template <Feedback360Kernel Wave> void RenderTicks(UInt64 PositionUs, UInt32 Period, UInt32 First, UInt32 Last, LONG (*Levels)[RENDER_AHEAD_MAX]);
+    template <Feedback360Kernel Wave, bool Enveloped> void RenderRun(UInt64 PositionUs, UInt32 Period, UInt32 Count, LONG *Run);
+    void CompileChannels(void);
+    void CalcCondition(const Feedback360Motion *Motion, LONG *Levels);
+    bool GrowSamples(UInt32 Pairs);
+    const LONG *NextSample(void);
 };
 
 #endif
@@ -0,0 +1,143 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360EffectMap.cpp - effects indexed by their download handle
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "Feedback360EffectMap.h"
+
+Feedback360EffectMap::Feedback360EffectMap(void) : LiveCount(0), FreeSlot(0), ActiveCount(0)
+{
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+    {
+        Generations[Index] = 0;
+        NextGenerations[Index] = 1;
+        Position[Index] = Index + 1;
+        ActivePosition[Index] = NOT_ACTIVE;
+    }
+}
+
+//----------------------------------------------------------------------------------------------
+// Add - creates an effect with a new handle, or returns NULL when the pool is full
+//----------------------------------------------------------------------------------------------
+Feedback360Effect *Feedback360EffectMap::Add(void)
+{
+    UInt32 Index = FreeSlot;
+
+    if (Index == EFFECT_CAPACITY)
+        return NULL;
+    FreeSlot = Position[Index];
+
+    Position[Index] = LiveCount;
+    Live[LiveCount++] = Index;
+    Generations[Index] = NextGenerations[Index];
+    Effects[Index].Reset(((FFEffectDownloadID)Generations[Index] << EFFECT_SLOT_BITS) | Index);
+    return &Effects[Index];
+}
+
+//----------------------------------------------------------------------------------------------
+// Find - returns NULL for unknown or destroyed handles, and for any handle on a free slot
+//----------------------------------------------------------------------------------------------
+Feedback360Effect *Feedback360EffectMap::Find(FFEffectDownloadID Handle)
+{
+    UInt32 Index = Handle & EFFECT_SLOT_MASK;
+    UInt32 Generation = Handle >> EFFECT_SLOT_BITS;
+
+    if (Index >= EFFECT_CAPACITY || Generation == 0 || Generations[Index] != Generation)
+        return NULL;
+    return &Effects[Index];
+}
+
+//----------------------------------------------------------------------------------------------
+// Contains - safe to call off the effect loop, though the handle may be destroyed straight after
+//----------------------------------------------------------------------------------------------
+bool Feedback360EffectMap::Contains(FFEffectDownloadID Handle) const
+{
+    UInt32 Index = Handle & EFFECT_SLOT_MASK;
+    UInt32 Generation = Handle >> EFFECT_SLOT_BITS;
+
+    return Index < EFFECT_CAPACITY && Generation != 0 && ((volatile const UInt16 *)Generations)[Index] == Generation;
+}
+
+//----------------------------------------------------------------------------------------------
+// Remove - the last entry of the live list moves into the gap, the effects themselves stay put
+//----------------------------------------------------------------------------------------------
+bool Feedback360EffectMap::Remove(FFEffectDownloadID Handle)
+{
+    UInt32 Index = Handle & EFFECT_SLOT_MASK;
+    UInt32 Generation = Handle >> EFFECT_SLOT_BITS;
+
+    if (Index >= EFFECT_CAPACITY || Generation == 0 || Generations[Index] != Generation)
+        return false;
+
+    Deactivate(&Effects[Index]);
+
+    UInt16 Gap = Position[Index];
+    Live[Gap] = Live[--LiveCount];
+    Position[Live[Gap]] = Gap;
+
+    // Generation 0 is skipped so a handle is never 0, which DownloadEffect treats as new,
+    // and is what marks the slot free
+    Generations[Index] = 0;
+    if (++NextGenerations[Index] == 0)
+        NextGenerations[Index] = 1;
+    Position[Index] = FreeSlot;
+    FreeSlot = Index;
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------
+// Activate - does nothing if the effect is already active
+//----------------------------------------------------------------------------------------------
+void Feedback360EffectMap::Activate(Feedback360Effect *Effect)
+{
+    UInt32 Index = Effect->Handle & EFFECT_SLOT_MASK;
+
+    if (ActivePosition[Index] != NOT_ACTIVE)
+        return;
+    ActivePosition[Index] = ActiveCount;
+    Active[ActiveCount++] = Index;
+}
+
+//----------------------------------------------------------------------------------------------
+// Deactivate - the last active effect moves into the gap
+//----------------------------------------------------------------------------------------------
+void Feedback360EffectMap::Deactivate(Feedback360Effect *Effect)
+{
+    UInt32 Index = Effect->Handle & EFFECT_SLOT_MASK;
+    UInt16 Gap = ActivePosition[Index];
+
+    if (Gap == NOT_ACTIVE)
+        return;
+    Active[Gap] = Active[--ActiveCount];
+    ActivePosition[Active[Gap]] = Gap;
+    ActivePosition[Index] = NOT_ACTIVE;
+}
+
+//----------------------------------------------------------------------------------------------
+// Clear - destroys every effect, outstanding handles become stale
+//----------------------------------------------------------------------------------------------
+void Feedback360EffectMap::Clear(void)
+{
+    while (LiveCount > 0)
+        Remove(Effects[Live[LiveCount - 1]].Handle);
+}
@@ -0,0 +1,101 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360EffectMap.h - effects indexed by their download handle
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360EffectMap_h
+#define Feedback360_Feedback360EffectMap_h
+
+#include "Feedback360Effect.h"
+
+// Number of effects that can be downloaded at once, reported as the storage capacity
+#define EFFECT_CAPACITY     256
+
+// A handle is the slot number in the low bits and the slot's generation in the
+// high bits, so a handle kept after DestroyEffect never finds the slot's next effect.
+// Handles never have generation 0, which marks a free slot, so no handle finds one
+#define EFFECT_SLOT_BITS    16
+#define EFFECT_SLOT_MASK    ((1 << EFFECT_SLOT_BITS) - 1)
+
+#define NOT_ACTIVE          0xFFFF
+
+class Feedback360EffectMap
+{
+public:
+    // Visits the effects in use, or only the active ones
+    class iterator
+    {
+    public:
+        iterator(Feedback360Effect *theEffects, const UInt16 *theList, UInt32 thePosition) : Effects(theEffects), List(theList), Position(thePosition) {}
+
+        Feedback360Effect &operator * (void) const { return Effects[List[Position]]; }
+        Feedback360Effect *operator -> (void) const { return &Effects[List[Position]]; }
+        iterator &operator ++ (void) { ++Position; return *this; }
+        bool operator == (const iterator &other) const { return Position == other.Position; }
+        bool operator != (const iterator &other) const { return Position != other.Position; }
+
+    private:
+        Feedback360Effect *Effects;
+        const UInt16 *List;
+        UInt32 Position;
+    };
+
+    Feedback360EffectMap(void);
+
+    Feedback360Effect *Add(void);
+    Feedback360Effect *Find(FFEffectDownloadID Handle);
+    bool Contains(FFEffectDownloadID Handle) const;
+    bool Remove(FFEffectDownloadID Handle);
+    void Clear(void);
+
+    // Active effects are the ones inside their play time, which the effect loop works out
+    void Activate(Feedback360Effect *Effect);
+    void Deactivate(Feedback360Effect *Effect);
+
+    iterator begin(void) { return iterator(Effects, Live, 0); }
+    iterator end(void) { return iterator(Effects, Live, LiveCount); }
+    size_t size(void) const { return LiveCount; }
+
+    iterator active_begin(void) { return iterator(Effects, Active, 0); }
+    iterator active_end(void) { return iterator(Effects, Active, ActiveCount); }
+    size_t active_size(void) const { return ActiveCount; }
+
+private:
+    //disable copy constructor
+    Feedback360EffectMap(Feedback360EffectMap &src);
+    void operator = (Feedback360EffectMap &src);
+
+    // Effects never move, so pointers to them and into them stay valid until removed
+    Feedback360Effect   Effects[EFFECT_CAPACITY];
+    UInt16              Generations[EFFECT_CAPACITY];       // Of the effect in the slot, 0 while free
+    UInt16              NextGenerations[EFFECT_CAPACITY];   // For the slot's next effect
+    UInt16              Live[EFFECT_CAPACITY];      // Slots in use, packed
+    UInt16              Position[EFFECT_CAPACITY];  // Index in Live while in use, next free slot otherwise
+    UInt32              LiveCount;
+    UInt32              FreeSlot;
+    UInt16              Active[EFFECT_CAPACITY];            // Active slots, packed
+    UInt16              ActivePosition[EFFECT_CAPACITY];    // Index in Active, NOT_ACTIVE if not
+    UInt32              ActiveCount;
+};
+
+#endif
@@ -0,0 +1,199 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Headless.h - the parts of the ForceFeedback API the effects need, for building them
+    without the Apple frameworks
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360Headless_h
+#define Feedback360_Feedback360Headless_h
+
+#ifdef __APPLE__
+
+#include <IOKit/IOCFPlugIn.h>
+#include <ForceFeedback/IOForceFeedbackLib.h>
+
+#else
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t     UInt8;
+typedef uint16_t    UInt16;
+typedef uint32_t    UInt32;
+typedef uint64_t    UInt64;
+typedef int8_t      SInt8;
+typedef int16_t     SInt16;
+typedef int32_t     SInt32;
+typedef int64_t     SInt64;
+
+typedef UInt32      DWORD;
+typedef SInt32      LONG;
+typedef UInt32      ULONG;
+typedef SInt32      HRESULT;
+typedef void        *LPVOID;
+
+// Effect types are only ever compared, so any distinct pointers will do
+typedef const struct __CFUUID *CFUUIDRef;
+static inline bool CFEqual(CFUUIDRef a, CFUUIDRef b) { return a == b; }
+
+#define kFFEffectType_ConstantForce_ID  ((CFUUIDRef)1)
+#define kFFEffectType_RampForce_ID      ((CFUUIDRef)2)
+#define kFFEffectType_Square_ID         ((CFUUIDRef)3)
+#define kFFEffectType_Sine_ID           ((CFUUIDRef)4)
+#define kFFEffectType_Triangle_ID       ((CFUUIDRef)5)
+#define kFFEffectType_SawtoothUp_ID     ((CFUUIDRef)6)
+#define kFFEffectType_SawtoothDown_ID   ((CFUUIDRef)7)
+#define kFFEffectType_Spring_ID         ((CFUUIDRef)8)
+#define kFFEffectType_Damper_ID         ((CFUUIDRef)9)
+#define kFFEffectType_Inertia_ID        ((CFUUIDRef)10)
+#define kFFEffectType_Friction_ID       ((CFUUIDRef)11)
+#define kFFEffectType_CustomForce_ID    ((CFUUIDRef)12)
+
+typedef UInt32      FFEffectDownloadID;
+typedef UInt32      FFEffectParameterFlag;
+typedef UInt32      FFEffectStatusFlag;
+typedef UInt32      FFEffectStartFlag;
+typedef UInt32      FFCommandFlag;
+
+typedef struct FFENVELOPE {
+    DWORD   dwSize;
+    DWORD   dwAttackLevel;
+    DWORD   dwAttackTime;
+    DWORD   dwFadeLevel;
+    DWORD   dwFadeTime;
+} FFENVELOPE;
+
+typedef struct FFCONSTANTFORCE {
+    LONG    lMagnitude;
+} FFCONSTANTFORCE;
+
+typedef struct FFRAMPFORCE {
+    LONG    lStart;
+    LONG    lEnd;
+} FFRAMPFORCE;
+
+typedef struct FFPERIODIC {
+    DWORD   dwMagnitude;
+    LONG    lOffset;
+    DWORD   dwPhase;
+    DWORD   dwPeriod;
+} FFPERIODIC;
+
+typedef struct FFCUSTOMFORCE {
+    DWORD   cChannels;
+    DWORD   dwSamplePeriod;
+    DWORD   cSamples;
+    LONG    *rglForceData;
+} FFCUSTOMFORCE;
+
+typedef struct FFCONDITION {
+    LONG    lOffset;
+    LONG    lPositiveCoefficient;
+    LONG    lNegativeCoefficient;
+    DWORD   dwPositiveSaturation;
+    DWORD   dwNegativeSaturation;
+    LONG    lDeadBand;
+} FFCONDITION;
+
+typedef struct FFEFFECT {
+    DWORD       dwSize;
+    DWORD       dwFlags;
+    DWORD       dwDuration;
+    DWORD       dwSamplePeriod;
+    DWORD       dwGain;
+    DWORD       dwTriggerButton;
+    DWORD       dwTriggerRepeatInterval;
+    DWORD       cAxes;
+    DWORD       *rgdwAxes;
+    LONG        *rglDirection;
+    FFENVELOPE  *lpEnvelope;
+    DWORD       cbTypeSpecificParams;
+    void        *lpvTypeSpecificParams;
+    DWORD       dwStartDelay;
+} FFEFFECT;
+
+#define FF_OK                       0
+#define FF_TRUNCATED                0x00000008
+#define FFERR_DEVICEFULL            ((HRESULT)0x80040201)
+#define FFERR_INVALIDDOWNLOADID     ((HRESULT)0x80040203)
+#define FFERR_UNSUPPORTED           ((HRESULT)0x80004001)
+#define FFERR_INTERNAL              ((HRESULT)0x8000FFFF)
+#define FFERR_INVALIDPARAM          ((HRESULT)0x80070057)
+#define FFERR_OUTOFMEMORY           ((HRESULT)0x8007000E)
+
+#define FF_INFINITE                 0xFFFFFFFF
+
+#define FFEP_DURATION               0x00000001
+#define FFEP_SAMPLEPERIOD           0x00000002
+#define FFEP_GAIN                   0x00000004
+#define FFEP_TRIGGERBUTTON          0x00000008
+#define FFEP_TRIGGERREPEATINTERVAL  0x00000010
+#define FFEP_AXES                   0x00000020
+#define FFEP_DIRECTION              0x00000040
+#define FFEP_ENVELOPE               0x00000080
+#define FFEP_TYPESPECIFICPARAMS     0x00000100
+#define FFEP_STARTDELAY             0x00000200
+#define FFEP_ALLPARAMS              0x000003FF
+#define FFEP_START                  0x20000000
+#define FFEP_NORESTART              0x40000000
+#define FFEP_NODOWNLOAD             0x80000000
+
+#define FFEFF_OBJECTIDS             0x00000001
+#define FFEFF_OBJECTOFFSETS         0x00000002
+#define FFEFF_CARTESIAN             0x00000010
+#define FFEFF_POLAR                 0x00000020
+#define FFEFF_SPHERICAL             0x00000040
+
+#define FFJOFS_X                    0
+#define FFJOFS_Y                    4
+#define FFJOFS_Z                    8
+#define FFJOFS_RX                   12
+#define FFJOFS_RY                   16
+#define FFJOFS_RZ                   20
+
+#define FFES_SOLO                   0x00000001
+
+#define FFEGES_PLAYING              0x00000001
+
+#define FFSFFC_RESET                0x00000001
+#define FFSFFC_STOPALL              0x00000002
+#define FFSFFC_PAUSE                0x00000004
+#define FFSFFC_CONTINUE             0x00000008
+#define FFSFFC_SETACTUATORSON       0x00000010
+#define FFSFFC_SETACTUATORSOFF      0x00000020
+
+#define FFPROP_FFGAIN               1
+#define FFPROP_AUTOCENTER           3
+
+#define FFGFFS_EMPTY                0x00000001
+#define FFGFFS_STOPPED              0x00000002
+#define FFGFFS_PAUSED               0x00000004
+#define FFGFFS_ACTUATORSON          0x00000010
+#define FFGFFS_ACTUATORSOFF         0x00000020
+#define FFGFFS_POWERON              0x00000040
+#define FFGFFS_SAFETYSWITCHOFF      0x00000200
+#define FFGFFS_USERFFSWITCHON       0x00000400
+
+#endif
+
+#endif
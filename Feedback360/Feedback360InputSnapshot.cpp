@@ -0,0 +1,66 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360InputSnapshot.cpp - the latest controller input, shared without locks
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "Feedback360InputSnapshot.h"
+
+Feedback360InputSnapshot::Feedback360InputSnapshot(void) : Sequence(0), Time(0)
+{
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        Position[Channel] = 0;
+}
+
+//----------------------------------------------------------------------------------------------
+// Publish - only ever called from one thread at a time
+//----------------------------------------------------------------------------------------------
+void Feedback360InputSnapshot::Publish(const Feedback360InputState &State)
+{
+    // Only stores need ordering here and loads in Read, which costs nothing on x86. A full
+    // barrier each side would cost more than the rest of a tick at high tick rates
+    Sequence = Sequence + 1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    Time = State.Time;
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        Position[Channel] = State.Position[Channel];
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    Sequence = Sequence + 1;
+}
+
+//----------------------------------------------------------------------------------------------
+// Read - copies the state, trying again if a publish started or finished while copying
+//----------------------------------------------------------------------------------------------
+void Feedback360InputSnapshot::Read(Feedback360InputState *State) const
+{
+    UInt32 Before, After;
+
+    do {
+        Before = Sequence;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        State->Time = Time;
+        for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+            State->Position[Channel] = Position[Channel];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        After = Sequence;
+    } while ((Before & 1) != 0 || Before != After);
+}
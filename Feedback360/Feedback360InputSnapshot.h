@@ -0,0 +1,63 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360InputSnapshot.h - the latest controller input, shared without locks
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360InputSnapshot_h
+#define Feedback360_Feedback360InputSnapshot_h
+
+#include "Feedback360Effect.h"
+
+// Axis positions, indexed like the channels their axes drive: the left stick's X and Y, then
+// the left and right triggers. Sticks go from -10000 to 10000, triggers from 0 to 10000
+typedef struct {
+    double  Time;   // Seconds, when the positions were read
+    LONG    Position[FF_CHANNELS];
+} Feedback360InputState;
+
+// A sequence lock: one thread publishes, any number read, and neither ever waits on a lock
+// or makes a system call. A reader that overlaps a publish just reads again
+class Feedback360InputSnapshot
+{
+public:
+    Feedback360InputSnapshot(void);
+
+    void Publish(const Feedback360InputState &State);
+    void Read(Feedback360InputState *State) const;
+
+    // False until the first publish
+    bool Valid(void) const { return Sequence != 0; }
+    // Changes with every publish, so a reader can tell there is nothing new without reading
+    UInt32 Version(void) const { return Sequence; }
+
+private:
+    //disable copy constructor
+    Feedback360InputSnapshot(Feedback360InputSnapshot &src);
+    void operator = (Feedback360InputSnapshot &src);
+
+    volatile UInt32 Sequence;   // Odd while a publish is under way
+    volatile double Time;
+    volatile LONG   Position[FF_CHANNELS];
+};
+
+#endif
@@ -0,0 +1,635 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Mixer.cpp - plays the downloaded effects and mixes them into motor levels
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "Feedback360Mixer.h"
+using std::max;
+using std::min;
+
+Feedback360Mixer::Feedback360Mixer(UInt32 theTickPeriod) : TickPeriod(0),
+Gain(10000), MixedGain(10000), Actuator(true), Stopped(true),
+Paused(false), PausedTime(0),
+RenderAhead(0), RenderCount(0), RenderAheadSet(false), RenderValid(false), RenderStart(0), RenderRate(0), RenderLive(0),
+Input(NULL), MotionValid(false), MotionAtRest(false), MotionVersion(0), MotionTime(0),
+StatusStale(true), AudioHandle(0)
+{
+    memset(PrvLevels, 0, sizeof(PrvLevels));
+    memset(Mixed, 0, sizeof(Mixed));
+    memset(&Motion, 0, sizeof(Motion));
+    SetTickPeriod(theTickPeriod);
+    Publish();
+}
+
+//----------------------------------------------------------------------------------------------
+// Download - creates the effect if the handle is 0, otherwise updates it
+//----------------------------------------------------------------------------------------------
+HRESULT Feedback360Mixer::Download(CFUUIDRef EffectType, FFEffectDownloadID *EffectHandle, FFEFFECT *DiEffect, FFEffectParameterFlag Flags, double CurrentTime)
+{
+    Feedback360Effect *Effect = NULL;
+    if (*EffectHandle == 0) {
+        Effect = EffectList.Add();
+        if (Effect == NULL) {
+            return FFERR_DEVICEFULL;
+        }
+        *EffectHandle = Effect->Handle;
+    } else {
+        Effect = EffectList.Find(*EffectHandle);
+    }
+
+    if (Effect == NULL) {
+        return FFERR_INTERNAL;
+    }
+
+    // Streamed samples only need adding to the end, nothing else about the effect changes
+    if (Effect->Streaming && (Flags & FFEP_ALLPARAMS) == FFEP_TYPESPECIFICPARAMS && DiEffect->lpvTypeSpecificParams != NULL) {
+        if (DiEffect->cbTypeSpecificParams < sizeof(FFCUSTOMFORCE)) {
+            return FFERR_INVALIDPARAM;
+        }
+        const FFCUSTOMFORCE *CustomForce = (const FFCUSTOMFORCE *)DiEffect->lpvTypeSpecificParams;
+        return Effect->CopySamples(CustomForce->rglForceData, CustomForce->cSamples);
+    }
+
+    HRESULT Result = FF_OK;
+    Effect->Type = EffectType;
+    Effect->DiEffect.dwFlags = DiEffect->dwFlags;
+
+    if( Flags & FFEP_DURATION )
+    {
+        Effect->DiEffect.dwDuration = DiEffect->dwDuration;
+    }
+
+    if( Flags & FFEP_SAMPLEPERIOD )
+    {
+        Effect->DiEffect.dwSamplePeriod = DiEffect->dwSamplePeriod;
+    }
+
+    if( Flags & FFEP_GAIN )
+    {
+        Effect->DiEffect.dwGain = DiEffect->dwGain;
+    }
+
+    if( Flags & FFEP_TRIGGERBUTTON )
+    {
+        Effect->DiEffect.dwTriggerButton = DiEffect->dwTriggerButton;
+    }
+
+    if( Flags & FFEP_TRIGGERREPEATINTERVAL )
+    {
+        Effect->DiEffect.dwTriggerRepeatInterval = DiEffect->dwTriggerRepeatInterval;
+    }
+
+    // Axes past the number of channels can't drive anything, so aren't kept
+    if( ( Flags & FFEP_AXES ) && DiEffect->rgdwAxes != NULL )
+    {
+        Effect->DiEffect.cAxes = min( DiEffect->cAxes, (DWORD)FF_CHANNELS );
+        memcpy( Effect->Axes, DiEffect->rgdwAxes, Effect->DiEffect.cAxes * sizeof( DWORD ) );
+        Effect->DiEffect.rgdwAxes = Effect->Axes;
+    }
+
+    if( ( Flags & FFEP_DIRECTION ) && DiEffect->rglDirection != NULL )
+    {
+        Effect->DiEffect.cAxes = min( DiEffect->cAxes, (DWORD)FF_CHANNELS );
+        memcpy( Effect->Direction, DiEffect->rglDirection, Effect->DiEffect.cAxes * sizeof( LONG ) );
+        Effect->DiEffect.rglDirection = Effect->Direction;
+    }
+
+    // Without an envelope given, any the effect had before is dropped
+    if( ( Flags & FFEP_ENVELOPE ) && DiEffect->lpEnvelope == NULL )
+    {
+        Effect->DiEffect.lpEnvelope = NULL;
+    }
+    else if( Flags & FFEP_ENVELOPE )
+    {
+        memcpy( &Effect->DiEnvelope, DiEffect->lpEnvelope, sizeof( FFENVELOPE ) );
+        if( Effect->DiEffect.dwDuration - Effect->DiEnvelope.dwFadeTime
+           < Effect->DiEnvelope.dwAttackTime )
+        {
+            Effect->DiEnvelope.dwFadeTime = Effect->DiEnvelope.dwAttackTime;
+        }
+        Effect->DiEffect.lpEnvelope = &Effect->DiEnvelope;
+    }
+
+    Effect->DiEffect.cbTypeSpecificParams = DiEffect->cbTypeSpecificParams;
+
+    if( Flags & FFEP_TYPESPECIFICPARAMS )
+    {
+        if(CFEqual(EffectType, kFFEffectType_CustomForce_ID)) {
+            // The game's sample array is copied, so it can be freed or reused once this returns
+            FFCUSTOMFORCE CustomForce;
+            memset(&CustomForce, 0, sizeof(CustomForce));
+            memcpy(
+                   &CustomForce
+                   ,DiEffect->lpvTypeSpecificParams
+                   ,min( (size_t)DiEffect->cbTypeSpecificParams, sizeof( CustomForce ) ) );
+            Effect->DiParams.CustomForce.cChannels = CustomForce.cChannels;
+            Effect->DiParams.CustomForce.dwSamplePeriod = CustomForce.dwSamplePeriod;
+            Result = Effect->CopySamples(CustomForce.rglForceData, CustomForce.cSamples);
+            if (Result != FF_OK && Result != FF_TRUNCATED) {
+                return Result;
+            }
+            Effect->DiEffect.lpvTypeSpecificParams = &Effect->DiParams.CustomForce;
+        }
+
+        else if(CFEqual(EffectType, kFFEffectType_ConstantForce_ID)) {
+            memcpy(
+                   &Effect->DiParams.ConstantForce
+                   ,DiEffect->lpvTypeSpecificParams
+                   ,min( (size_t)DiEffect->cbTypeSpecificParams, sizeof( Effect->DiParams.ConstantForce ) ) );
+            Effect->DiEffect.lpvTypeSpecificParams = &Effect->DiParams.ConstantForce;
+        }
+        else if(CFEqual(EffectType, kFFEffectType_Square_ID) || CFEqual(EffectType, kFFEffectType_Sine_ID) || CFEqual(EffectType, kFFEffectType_Triangle_ID) || CFEqual(EffectType, kFFEffectType_SawtoothUp_ID) || CFEqual(EffectType, kFFEffectType_SawtoothDown_ID) ) {
+            memcpy(
+                   &Effect->DiParams.Periodic
+                   ,DiEffect->lpvTypeSpecificParams
+                   ,min( (size_t)DiEffect->cbTypeSpecificParams, sizeof( Effect->DiParams.Periodic ) ) );
+            Effect->DiEffect.lpvTypeSpecificParams = &Effect->DiParams.Periodic;
+        }
+        else if(CFEqual(EffectType, kFFEffectType_Spring_ID) || CFEqual(EffectType, kFFEffectType_Damper_ID) || CFEqual(EffectType, kFFEffectType_Inertia_ID) || CFEqual(EffectType, kFFEffectType_Friction_ID)) {
+            memcpy(
+                   Effect->DiParams.Condition
+                   ,DiEffect->lpvTypeSpecificParams
+                   ,min( (size_t)DiEffect->cbTypeSpecificParams, sizeof( Effect->DiParams.Condition ) ) );
+            Effect->DiEffect.lpvTypeSpecificParams = Effect->DiParams.Condition;
+        }
+        else if(CFEqual(EffectType, kFFEffectType_RampForce_ID)) {
+            memcpy(
+                   &Effect->DiParams.RampForce
+                   ,DiEffect->lpvTypeSpecificParams
+                   ,min( (size_t)DiEffect->cbTypeSpecificParams, sizeof( Effect->DiParams.RampForce ) ) );
+            Effect->DiEffect.lpvTypeSpecificParams = &Effect->DiParams.RampForce;
+        }
+    }
+
+    if( Flags & FFEP_STARTDELAY )
+    {
+        Effect->DiEffect.dwStartDelay = DiEffect->dwStartDelay;
+    }
+
+    // Everything that doesn't change while playing is worked out once, here
+    Effect->Compile();
+    // Only a custom force streams, so downloading another type over one stops it
+    if (Effect->Kind != CUSTOM_FORCE) {
+        Effect->Streaming = false;
+    }
+    RenderValid = false;
+
+    if( Flags & FFEP_START )
+    {
+        Effect->Status  = FFEGES_PLAYING;
+        Effect->PlayCount = 1;
+        Effect->StartTime = CurrentTime;
+        Effect->SampledTime = -DBL_MAX;
+    }
+    // The duration or start delay may have changed
+    Schedule(Effect, CurrentTime);
+
+    if( Flags & FFEP_NORESTART )
+    {
+        ;
+    }
+    return Result;
+}
+
+HRESULT Feedback360Mixer::Destroy(FFEffectDownloadID EffectHandle)
+{
+    Deadlines.Cancel(EffectHandle);
+    RenderValid = false;
+    if (!EffectList.Remove(EffectHandle)) {
+        return FFERR_INVALIDDOWNLOADID;
+    }
+    StatusSnapshot.Forget(EffectHandle);
+    StatusStale = true;
+    return FF_OK;
+}
+
+HRESULT Feedback360Mixer::GetEffectStatus(FFEffectDownloadID EffectHandle, FFEffectStatusFlag *Status)
+{
+    Feedback360Effect *Effect = EffectList.Find(EffectHandle);
+    if (Effect == NULL) {
+        return FFERR_INVALIDDOWNLOADID;
+    }
+    *Status = Effect->Status;
+    return FF_OK;
+}
+
+//----------------------------------------------------------------------------------------------
+// Publish - does nothing unless anything changed since the last one, so ticks can call it freely
+//----------------------------------------------------------------------------------------------
+void Feedback360Mixer::Publish(void)
+{
+    if (!StatusStale)
+        return;
+    for (Feedback360EffectIterator effectIterator = EffectList.begin(); effectIterator != EffectList.end(); ++effectIterator)
+        StatusSnapshot.PublishEffect(effectIterator->Handle, effectIterator->Status);
+    StatusSnapshot.PublishState(GetState());
+    StatusStale = false;
+}
+
+DWORD Feedback360Mixer::GetState(void)
+{
+    DWORD State = 0;
+
+    if( EffectList.size() == 0 )
+    {
+        State |= FFGFFS_EMPTY;
+    }
+    if( Stopped == true )
+    {
+        State |= FFGFFS_STOPPED;
+    }
+    if( Paused == true )
+    {
+        State |= FFGFFS_PAUSED;
+    }
+    if (Actuator == true)
+    {
+        State |= FFGFFS_ACTUATORSON;
+    } else {
+        State |= FFGFFS_ACTUATORSOFF;
+    }
+    State |= FFGFFS_POWERON;
+    State |= FFGFFS_SAFETYSWITCHOFF;
+    State |= FFGFFS_USERFFSWITCHON;
+    return State;
+}
+
+//----------------------------------------------------------------------------------------------
+// Start - the handle may have been destroyed since the caller checked it, which is ignored
+//----------------------------------------------------------------------------------------------
+void Feedback360Mixer::Start(FFEffectDownloadID EffectHandle, FFEffectStartFlag Mode, UInt32 Count, double CurrentTime)
+{
+    Feedback360Effect *Effect = EffectList.Find(EffectHandle);
+    if (Effect == NULL)
+        return;
+    if (Mode & FFES_SOLO) {
+        for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
+        {
+            effectIterator->Status = 0;
+            Schedule(&*effectIterator, CurrentTime);
+        }
+    }
+    Effect->Status  = FFEGES_PLAYING;
+    Effect->PlayCount = Count;
+    Effect->StartTime = CurrentTime;
+    Effect->SampledTime = -DBL_MAX;
+    Schedule(Effect, CurrentTime);
+    Stopped = false;
+}
+
+void Feedback360Mixer::Stop(FFEffectDownloadID EffectHandle, double CurrentTime)
+{
+    Feedback360Effect *Effect = EffectList.Find(EffectHandle);
+    if (Effect != NULL) {
+        Effect->Status = 0;
+        Schedule(Effect, CurrentTime);
+    }
+}
+
+void Feedback360Mixer::SetGain(DWORD NewGain)
+{
+    Gain = NewGain;
+    RenderValid = false;
+}
+
+void Feedback360Mixer::Command(FFCommandFlag State, double CurrentTime)
+{
+    RenderValid = false;
+    StatusStale = true;
+    switch (State) {
+        case FFSFFC_RESET:
+            EffectList.Clear();
+            StatusSnapshot.Clear();
+            Deadlines.Clear();
+            Stopped = true;
+            Paused = false;
+            break;
+
+        case FFSFFC_STOPALL:
+            for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
+            {
+                effectIterator->Status = 0;
+                Schedule(&*effectIterator, CurrentTime);
+            }
+            Stopped = true;
+            Paused = false;
+            break;
+
+        case FFSFFC_PAUSE:
+            Paused  = true;
+            PausedTime = CurrentTime;
+            break;
+
+        case FFSFFC_CONTINUE:
+            for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
+            {
+                effectIterator->StartTime += ( CurrentTime - PausedTime );
+            }
+            Paused = false;
+            for (Feedback360EffectIterator effectIterator = EffectList.begin() ; effectIterator != EffectList.end(); ++effectIterator)
+            {
+                Schedule(&*effectIterator, CurrentTime);
+            }
+            break;
+
+        case FFSFFC_SETACTUATORSON:
+            Actuator = true;
+            break;
+
+        case FFSFFC_SETACTUATORSOFF:
+            Actuator = false;
+            break;
+    }
+}
+
+//----------------------------------------------------------------------------------------------
+// SetStreaming - custom force samples are played once and dropped, and later downloads of only
+// the type specific parameters add samples instead of replacing them. Only a custom force has
+// samples, so any other effect is refused
+//----------------------------------------------------------------------------------------------
+HRESULT Feedback360Mixer::SetStreaming(FFEffectDownloadID EffectHandle, bool Streaming)
+{
+    Feedback360Effect *Effect = EffectList.Find(EffectHandle);
+    if (Effect == NULL) {
+        return FFERR_INVALIDDOWNLOADID;
+    }
+    if (Effect->Kind != CUSTOM_FORCE) {
+        return FFERR_INVALIDPARAM;
+    }
+    Effect->Streaming = Streaming;
+    Effect->Index = 0;
+    return FF_OK;
+}
+
+//----------------------------------------------------------------------------------------------
+// AppendAudio - adds the rumble for interleaved PCM in the AUDIO_RUMBLE_ format to a streaming
+// custom force, one pair per sample period. Switching effects starts the audio over
+//----------------------------------------------------------------------------------------------
+HRESULT Feedback360Mixer::AppendAudio(FFEffectDownloadID EffectHandle, const SInt16 *Pcm, UInt32 Frames)
+{
+    Feedback360Effect *Effect = EffectList.Find(EffectHandle);
+    if (Effect == NULL) {
+        return FFERR_INVALIDDOWNLOADID;
+    }
+    if (Effect->Kind != CUSTOM_FORCE || !Effect->Streaming) {
+        return FFERR_INVALIDPARAM;
+    }
+
+    UInt32 Period = Effect->DiParams.CustomForce.dwSamplePeriod;
+    if (Period == 0)
+        Period = TickPeriod;
+    if (EffectHandle != AudioHandle || Period != Audio.PairPeriod) {
+        Audio.Configure(AUDIO_RUMBLE_RATE, AUDIO_RUMBLE_CHANNELS, Period);
+        AudioHandle = EffectHandle;
+    }
+
+    // A block at a time, as a block never makes more than one pair per frame
+    LONG Pairs[2 * (AUDIO_BLOCK + 1)];
+    HRESULT Result = FF_OK;
+    while (Frames > 0)
+    {
+        UInt32 Count = min(Frames, (UInt32)AUDIO_BLOCK);
+        UInt32 Written = Audio.Process(Pcm, Count, Pairs);
+        Result = Effect->CopySamples(Pairs, Written * 2);
+        if (Result != FF_OK)
+            return Result;
+        Pcm += Count * AUDIO_RUMBLE_CHANNELS;
+        Frames -= Count;
+    }
+    return Result;
+}
+
+void Feedback360Mixer::SetRenderAhead(UInt32 Ticks)
+{
+    RenderAhead = min((UInt32)RENDER_AHEAD_MAX, Ticks);
+    RenderAheadSet = true;
+    RenderValid = false;
+}
+
+//----------------------------------------------------------------------------------------------
+// SetTickPeriod - clamped to TICK_PERIOD_MIN and TICK_PERIOD_MAX. Faster ticks are rendered
+// ahead, so each one is only a copy, unless the game has picked how far ahead to go
+//----------------------------------------------------------------------------------------------
+void Feedback360Mixer::SetTickPeriod(UInt32 Period)
+{
+    TickPeriod = max((UInt32)TICK_PERIOD_MIN, min(Period, (UInt32)TICK_PERIOD_MAX));
+    if (!RenderAheadSet)
+        RenderAhead = (TickPeriod * 2 <= RENDER_AHEAD_SPAN) ? min((UInt32)RENDER_AHEAD_MAX, (UInt32)RENDER_AHEAD_SPAN / TickPeriod) : 0;
+    RenderRate = 1000. * 1000. / TickPeriod;
+    RenderValid = false;
+    Overdrive.SetTickPeriod(TickPeriod);
+}
+
+//----------------------------------------------------------------------------------------------
+// Schedule - makes the effect active only while it is inside its play time, with a deadline
+// for the next change. Effects that run out while paused keep playing, as continuing moves
+// their start time
+//----------------------------------------------------------------------------------------------
+void Feedback360Mixer::Schedule(Feedback360Effect *Effect, double CurrentTime)
+{
+    RenderValid = false;
+    StatusStale = true;
+    if (Effect->Status != FFEGES_PLAYING) {
+        EffectList.Deactivate(Effect);
+        Deadlines.Cancel(Effect->Handle);
+    } else if (CurrentTime < Effect->BeginTime()) {
+        EffectList.Deactivate(Effect);
+        Deadlines.Set(Effect->Handle, Effect->BeginTime());
+    } else if (CurrentTime < Effect->EndTime()) {
+        EffectList.Activate(Effect);
+        if (Effect->EndTime() == DBL_MAX)
+            Deadlines.Cancel(Effect->Handle);
+        else
+            Deadlines.Set(Effect->Handle, Effect->EndTime());
+    } else {
+        if (!Paused)
+            Effect->Status = 0;
+        EffectList.Deactivate(Effect);
+        Deadlines.Cancel(Effect->Handle);
+    }
+}
+
+//----------------------------------------------------------------------------------------------
+// RenderBlock - the levels of every active effect but live ones for the next RenderCount ticks
+//----------------------------------------------------------------------------------------------
+void Feedback360Mixer::RenderBlock(double StartTime)
+{
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        memset(RenderLevels[Channel], 0, RenderCount * sizeof(RenderLevels[0][0]));
+    RenderLive = 0;
+    for (Feedback360EffectIterator effectIterator = EffectList.active_begin(); effectIterator != EffectList.active_end(); ++effectIterator)
+    {
+        if (effectIterator->Live()) {
+            RenderLive++;
+            continue;
+        }
+        effectIterator->Render(StartTime, TickPeriod, RenderCount, RenderLevels);
+    }
+    RenderStart = StartTime;
+    RenderValid = true;
+}
+
+//----------------------------------------------------------------------------------------------
+// Tick
+//----------------------------------------------------------------------------------------------
+bool Feedback360Mixer::Tick(double CurrentTime, unsigned char *Output)
+{
+    LONG Levels[FF_CHANNELS] = {0};
+    LONG CalcResult = 0;
+
+    // Start effects whose delay is over and retire the ones that have finished
+    while (Deadlines.NextTime() <= CurrentTime)
+    {
+        Feedback360Effect *Effect = EffectList.Find(Deadlines.NextHandle());
+        Deadlines.Pop();
+        if (Effect != NULL)
+            Schedule(Effect, CurrentTime);
+    }
+    // Nothing later in the tick changes an effect's status
+    Publish();
+
+    UpdateMotion(CurrentTime);
+
+    if (Actuator == true)
+    {
+        if (RenderAhead > 0)
+        {
+            LONG Tick = (LONG)((CurrentTime - RenderStart) * RenderRate + 0.5);
+            if (!RenderValid || Tick < 0 || Tick >= (LONG)RenderCount)
+            {
+                // Any change throws the rest of the block away, so blocks start short after one
+                // and grow while the effects stay the same
+                RenderCount = RenderValid ? min(RenderAhead, RenderCount * 2) : max((UInt32)1, RenderAhead / 4);
+                RenderBlock(CurrentTime);
+                Tick = 0;
+            }
+            for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+                Levels[Channel] = RenderLevels[Channel][Tick];
+        }
+        // Custom forces step through their samples as they are played and conditions follow
+        // the controller, so they are never rendered ahead. Without any, the block is all there is
+        if (RenderAhead == 0 || RenderLive > 0)
+        {
+            for (Feedback360EffectIterator effectIterator = EffectList.active_begin(); effectIterator != EffectList.active_end(); ++effectIterator)
+            {
+                if (RenderAhead > 0 && !effectIterator->Live())
+                    continue;
+                if (effectIterator->DiEffect.dwSamplePeriod == 0) {
+                    CalcResult = effectIterator->Calc(CurrentTime, Levels, &Motion);
+                    continue;
+                }
+                // Compared to the nearest microsecond, so ticks that land on the period aren't missed
+                if ((CurrentTime - effectIterator->SampledTime) * 1000 * 1000 + 0.5 >= effectIterator->DiEffect.dwSamplePeriod) {
+                    LONG Sampled[FF_CHANNELS] = {0};
+                    if (effectIterator->Calc(CurrentTime, Sampled, &Motion) != -1) {
+                        memcpy(effectIterator->SampledLevels, Sampled, sizeof(Sampled));
+                        effectIterator->SampledTime = CurrentTime;
+                    }
+                }
+                for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+                    Levels[Channel] += effectIterator->SampledLevels[Channel];
+            }
+        }
+    }
+
+    bool Changed = false;
+    // A new gain changes what the motors should do even when the effects haven't
+    if ((memcmp(PrvLevels, Levels, sizeof(Levels)) != 0 || Gain != MixedGain) && (CalcResult != -1))
+    {
+        for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+            Mixed[Channel] = (unsigned char)min(SCALE_MAX, Levels[Channel] * (LONG)Gain / 10000);
+        memcpy(PrvLevels, Levels, sizeof(Levels));
+        MixedGain = Gain;
+        Changed = true;
+    }
+
+    // Overdrive may send once more after the mix stops changing, when it switches back to the
+    // levels. It only ever sends 0 for a mix of 0, so the motors are still off whenever the
+    // mixer is idle
+    if (Overdrive.Enabled())
+        return Overdrive.Drive(CurrentTime, Mixed, Output);
+    if (Changed)
+        memcpy(Output, Mixed, sizeof(Mixed));
+    return Changed;
+}
+
+//----------------------------------------------------------------------------------------------
+// UpdateMotion - velocity and acceleration are estimated from how far the positions moved
+// since the last tick, smoothed as the input arrives in steps
+//----------------------------------------------------------------------------------------------
+void Feedback360Mixer::UpdateMotion(double CurrentTime)
+{
+    Feedback360InputState State;
+    double Elapsed = CurrentTime - MotionTime;
+
+    if (Input == NULL || !Input->Valid() || (MotionValid && Elapsed <= 0))
+        return;
+
+    // A controller at rest stays at rest until the input changes, without any reading or arithmetic
+    UInt32 Version = Input->Version();
+    MotionTime = CurrentTime;
+    if (MotionValid && MotionAtRest && Version == MotionVersion)
+        return;
+    MotionVersion = Version;
+    Input->Read(&State);
+    if (!MotionValid) {
+        memset(&Motion, 0, sizeof(Motion));
+        memcpy(Motion.Position, State.Position, sizeof(Motion.Position));
+        MotionValid = true;
+        MotionAtRest = true;
+        return;
+    }
+
+    if (MotionAtRest && memcmp(Motion.Position, State.Position, sizeof(Motion.Position)) == 0)
+        return;
+
+    // Velocity and acceleration are per 100 ms, not per second
+    // Divided once here rather than per channel, as at high tick rates this runs often
+    double Rate = Elapsed / (Elapsed + MOTION_SMOOTHING);
+    double PerElapsed = 1 / (Elapsed * 10);
+    MotionAtRest = true;
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+    {
+        double Velocity = (State.Position[Channel] - Motion.Position[Channel]) * PerElapsed;
+        Velocity = Motion.Velocity[Channel] + (Velocity - Motion.Velocity[Channel]) * Rate;
+        double Acceleration = (Velocity - Motion.Velocity[Channel]) * PerElapsed;
+        Acceleration = Motion.Acceleration[Channel] + (Acceleration - Motion.Acceleration[Channel]) * Rate;
+
+        Motion.Position[Channel] = State.Position[Channel];
+        Motion.Velocity[Channel] = (LONG)max(-1e9, min(1e9, Velocity));
+        Motion.Acceleration[Channel] = (LONG)max(-1e9, min(1e9, Acceleration));
+        MotionAtRest = MotionAtRest && Motion.Velocity[Channel] == 0 && Motion.Acceleration[Channel] == 0;
+    }
+}
+
+bool Feedback360Mixer::Idle(void) const
+{
+    if (EffectList.active_size() != 0)
+        return false;
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+    {
+        if (PrvLevels[Channel] != 0)
+            return false;
+    }
+    return true;
+}
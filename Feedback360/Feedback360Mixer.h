@@ -0,0 +1,147 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Mixer.h - plays the downloaded effects and mixes them into motor levels
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360Mixer_h
+#define Feedback360_Feedback360Mixer_h
+
+#include "Feedback360Effect.h"
+#include "Feedback360EffectMap.h"
+#include "Feedback360DeadlineQueue.h"
+#include "Feedback360AudioRumble.h"
+#include "Feedback360InputSnapshot.h"
+#include "Feedback360StatusSnapshot.h"
+#include "Feedback360Overdrive.h"
+
+// Fastest and slowest the effects can be ticked, in microseconds
+#define TICK_PERIOD_MIN                 1000
+#define TICK_PERIOD_MAX                 100000
+
+// Unless the game picks a block size, ticks closer together than half this many microseconds
+// are rendered ahead, in blocks of up to about this long
+#define RENDER_AHEAD_SPAN               32000
+
+// How quickly the estimated motion follows the input, in seconds
+#define MOTION_SMOOTHING                0.02
+
+// Format of the audio games stream to custom forces
+#define AUDIO_RUMBLE_RATE               48000
+#define AUDIO_RUMBLE_CHANNELS           2
+
+// Everything about playing effects that doesn't depend on a device or a run loop.
+// The caller passes the time in, ticks it and sends the levels it gets back
+class Feedback360Mixer
+{
+public:
+    Feedback360Mixer(UInt32 theTickPeriod);
+
+    HRESULT Download(CFUUIDRef EffectType, FFEffectDownloadID *EffectHandle, FFEFFECT *DiEffect, FFEffectParameterFlag Flags, double CurrentTime);
+    HRESULT Destroy(FFEffectDownloadID EffectHandle);
+    HRESULT GetEffectStatus(FFEffectDownloadID EffectHandle, FFEffectStatusFlag *Status);
+    DWORD GetState(void);      // FFGFFS_ flags
+    bool Contains(FFEffectDownloadID EffectHandle) const { return EffectList.Contains(EffectHandle); }
+
+    void Start(FFEffectDownloadID EffectHandle, FFEffectStartFlag Mode, UInt32 Count, double CurrentTime);
+    void Stop(FFEffectDownloadID EffectHandle, double CurrentTime);
+    void SetGain(DWORD NewGain);
+    void Command(FFCommandFlag State, double CurrentTime);
+    void SetRenderAhead(UInt32 Ticks);
+    void SetTickPeriod(UInt32 Period);
+    HRESULT SetStreaming(FFEffectDownloadID EffectHandle, bool Streaming);
+    HRESULT AppendAudio(FFEffectDownloadID EffectHandle, const SInt16 *Pcm, UInt32 Frames);
+    void SetOverdrive(bool Enabled) { Overdrive.SetEnabled(Enabled); }
+    void SetControllerType(UInt32 ControllerType) { Overdrive.SetControllerType(ControllerType); }
+
+    // Effect status and device state as of the last Publish, for other threads to read.
+    // Ticks publish on their own, anything else that changes them needs a Publish after
+    const Feedback360StatusSnapshot *Snapshot(void) const { return &StatusSnapshot; }
+    void Publish(void);
+
+    // Where condition effects read the controller's input from, NULL if they can't
+    void SetInput(const Feedback360InputSnapshot *theInput) { Input = theInput; MotionValid = false; }
+
+    // Works out the FF_CHANNELS levels at CurrentTime, returning false if there is nothing new to send
+    bool Tick(double CurrentTime, unsigned char *Levels);
+
+    // Nothing is playing and the motors are off, so ticks can stop until NextDeadline
+    bool Idle(void) const;
+    double NextDeadline(void) const { return Deadlines.NextTime(); }
+
+    UInt32 TickPeriod;  // Microseconds, set with SetTickPeriod
+
+private:
+    typedef Feedback360EffectMap::iterator Feedback360EffectIterator;
+
+    //disable copy constructor
+    Feedback360Mixer(Feedback360Mixer &src);
+    void operator = (Feedback360Mixer &src);
+
+    void            Schedule(Feedback360Effect *Effect, double CurrentTime);
+    void            RenderBlock(double StartTime);
+    void            UpdateMotion(double CurrentTime);
+
+    Feedback360EffectMap EffectList;
+    Feedback360DeadlineQueue Deadlines;     // When playing effects that aren't active start or end
+
+    DWORD   Gain;
+    DWORD   MixedGain;      // The gain Mixed was worked out with
+    bool    Actuator;
+
+    LONG            PrvLevels[FF_CHANNELS];
+    unsigned char   Mixed[FF_CHANNELS];     // PrvLevels with the gain, what the motors should do
+    bool            Stopped;
+    bool            Paused;
+    double          PausedTime;
+
+    // Render ahead, where the levels for the next few ticks are worked out at once
+    UInt32          RenderAhead;    // Most ticks per block, 0 to work out every tick as it comes
+    UInt32          RenderCount;    // Ticks in the current block
+    bool            RenderAheadSet; // Chosen by the game, rather than following the tick period
+    bool            RenderValid;    // Cleared whenever the effects change
+    double          RenderStart;
+    double          RenderRate;     // Ticks per second
+    UInt32          RenderLive;     // Active effects left to work out each tick
+    LONG            RenderLevels[FF_CHANNELS][RENDER_AHEAD_MAX];
+
+    // Motion worked out each tick from the input, for condition effects
+    const Feedback360InputSnapshot *Input;
+    Feedback360Motion   Motion;
+    bool                MotionValid;
+    bool                MotionAtRest;   // No velocity or acceleration, so unchanged input needs no work
+    UInt32              MotionVersion;  // Of the input last read
+    double              MotionTime;
+
+    // Copied out for other threads whenever an effect is scheduled or the device state changes
+    Feedback360StatusSnapshot   StatusSnapshot;
+    bool                        StatusStale;
+
+    // Audio turned into samples for one streaming custom force at a time
+    Feedback360AudioRumble  Audio;
+    FFEffectDownloadID      AudioHandle;
+
+    // Sends levels past the mixed ones while the motors catch up, when turned on
+    Feedback360Overdrive    Overdrive;
+};
+
+#endif
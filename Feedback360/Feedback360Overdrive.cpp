@@ -0,0 +1,179 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Overdrive.cpp - drives the motors past their levels so they get there sooner
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "Feedback360Overdrive.h"
+using std::max;
+using std::min;
+
+// Closer than this to the level, the speed is taken to be there
+#define OVERDRIVE_SETTLED   0.5
+
+// Rough estimates from the size of the motors and their weights, to be refined by measuring
+// real controllers. Every motor coasts down more slowly than it spins up, and only the Xbox One
+// controller has motors in its triggers
+static const Feedback360MotorModel MotorModels[CONTROLLER_TYPES][FF_CHANNELS] = {
+    // Xbox 360, wired and wireless
+    {{60000, 150000}, {30000, 80000}, {0, 0}, {0, 0}},
+    // Original Xbox
+    {{80000, 180000}, {40000, 100000}, {0, 0}, {0, 0}},
+    // Xbox One
+    {{50000, 120000}, {25000, 70000}, {15000, 40000}, {15000, 40000}},
+};
+
+const Feedback360MotorModel *Feedback360MotorModels(UInt32 ControllerType)
+{
+    return MotorModels[(ControllerType < CONTROLLER_TYPES) ? ControllerType : CONTROLLER_XBOX360];
+}
+
+double Feedback360MotorSpeed(const Feedback360MotorModel *Model, double Speed, double Level, double Seconds)
+{
+    UInt32 TimeConstant = (Level > Speed) ? Model->SpinUp : Model->SpinDown;
+
+    if (TimeConstant == 0)
+        return Level;
+    return Level + (Speed - Level) * exp(-Seconds * 1000 * 1000 / TimeConstant);
+}
+
+Feedback360Overdrive::Feedback360Overdrive(void) : Models(Feedback360MotorModels(CONTROLLER_XBOX360)),
+IsEnabled(false), TickPeriod(10000)
+{
+    Reset();
+}
+
+void Feedback360Overdrive::SetControllerType(UInt32 ControllerType)
+{
+    Models = Feedback360MotorModels(ControllerType);
+}
+
+void Feedback360Overdrive::SetTickPeriod(UInt32 Period)
+{
+    TickPeriod = max(Period, (UInt32)1);
+}
+
+//----------------------------------------------------------------------------------------------
+// SetEnabled - the model starts over from stopped motors when turned on, which at worst
+// overdrives a motor that was already turning for one spin up
+//----------------------------------------------------------------------------------------------
+void Feedback360Overdrive::SetEnabled(bool theEnabled)
+{
+    if (theEnabled && !IsEnabled)
+        Reset();
+    IsEnabled = theEnabled;
+}
+
+void Feedback360Overdrive::Reset(void)
+{
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        Speed[Channel] = 0;
+    memset(Sent, 0, sizeof(Sent));
+    memset(Target, 0, sizeof(Target));
+    LastTime = -1;
+    Switching = false;
+    SwitchTime = 0;
+}
+
+// Brings the speeds up to CurrentTime. What was sent is held in between, so one step covers
+// any number of ticks exactly
+void Feedback360Overdrive::Advance(double CurrentTime)
+{
+    if (LastTime >= 0 && CurrentTime > LastTime) {
+        for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+            Speed[Channel] = Feedback360MotorSpeed(&Models[Channel], Speed[Channel], Sent[Channel], CurrentTime - LastTime);
+    }
+    LastTime = CurrentTime;
+}
+
+//----------------------------------------------------------------------------------------------
+// Plan - the motor that takes longest to reach its level at full power or none sets how many
+// ticks the drives are held for, and the rest are driven just hard enough to arrive with it
+//----------------------------------------------------------------------------------------------
+void Feedback360Overdrive::Plan(double CurrentTime, unsigned char *Drives)
+{
+    double Longest = 0;
+
+    memcpy(Drives, Target, sizeof(Target));
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+    {
+        double Level = Target[Channel];
+        double Gap = Level - Speed[Channel];
+
+        if (Models[Channel].SpinUp == 0 || fabs(Gap) < OVERDRIVE_SETTLED || Level >= SCALE_MAX || Level <= 0)
+            continue;
+        if (Gap > 0)
+            Longest = max(Longest, Models[Channel].SpinUp * log((SCALE_MAX - Speed[Channel]) / (SCALE_MAX - Level)));
+        else
+            Longest = max(Longest, Models[Channel].SpinDown * log(Speed[Channel] / Level));
+    }
+    if (Longest == 0)
+        return;
+
+    // Held for whole ticks, never less than one, so every drive is a little under full power
+    UInt32 Ticks = max((UInt32)1, (UInt32)ceil(Longest / TickPeriod - 0.001));
+    double Held = (double)Ticks * TickPeriod;
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+    {
+        double Level = Target[Channel];
+        double Gap = Level - Speed[Channel];
+
+        if (Models[Channel].SpinUp == 0 || fabs(Gap) < OVERDRIVE_SETTLED || Level >= SCALE_MAX || Level <= 0)
+            continue;
+        double Covered = 1 - exp(-Held / ((Gap > 0) ? Models[Channel].SpinUp : Models[Channel].SpinDown));
+        double Drive = Speed[Channel] + Gap / Covered + 0.5;
+        Drives[Channel] = (unsigned char)max(0.0, min((double)SCALE_MAX, Drive));
+    }
+    Switching = memcmp(Drives, Target, sizeof(Target)) != 0;
+    SwitchTime = CurrentTime + Held / 1000 / 1000;
+}
+
+//----------------------------------------------------------------------------------------------
+// Drive - nothing is worked out on a tick that neither changes the levels nor is the one the
+// drives switch back to them on
+//----------------------------------------------------------------------------------------------
+bool Feedback360Overdrive::Drive(double CurrentTime, const unsigned char *Levels, unsigned char *Output)
+{
+    unsigned char Drives[FF_CHANNELS];
+
+    if (memcmp(Levels, Target, sizeof(Target)) != 0) {
+        Advance(CurrentTime);
+        memcpy(Target, Levels, sizeof(Target));
+        Switching = false;
+        Plan(CurrentTime, Drives);
+    } else if (Switching && CurrentTime >= SwitchTime - TickPeriod / 2. / 1000 / 1000) {
+        Advance(CurrentTime);
+        memcpy(Drives, Target, sizeof(Target));
+        Switching = false;
+    } else {
+        return false;
+    }
+
+    if (memcmp(Drives, Sent, sizeof(Sent)) == 0)
+        return false;
+    memcpy(Sent, Drives, sizeof(Sent));
+    memcpy(Output, Sent, sizeof(Sent));
+    return true;
+}
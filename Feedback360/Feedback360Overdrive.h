@@ -0,0 +1,91 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Overdrive.h - drives the motors past their levels so they get there sooner
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360Overdrive_h
+#define Feedback360_Feedback360Overdrive_h
+
+#include "Feedback360Effect.h"
+
+// Controllers with their own motor models, numbered as the driver's ControllerType setting
+#define CONTROLLER_XBOX360      0
+#define CONTROLLER_ORIGINAL     1
+#define CONTROLLER_XBOXONE      2
+#define CONTROLLER_TYPES        3
+
+// A motor's speed follows the level it is driven at with a lag, a first order model with one
+// time constant spinning up and a longer one coasting down. Speeds are on the scale of the
+// levels, so a motor driven at a level long enough spins at that level
+typedef struct {
+    UInt32  SpinUp;     // Microseconds to cover 63% of a step up, 0 for no motor
+    UInt32  SpinDown;   // The same for a step down
+} Feedback360MotorModel;
+
+// The models for FF_CHANNELS motors of a controller type
+const Feedback360MotorModel *Feedback360MotorModels(UInt32 ControllerType);
+
+// Speed after Seconds driven at Level, starting from Speed
+double Feedback360MotorSpeed(const Feedback360MotorModel *Model, double Speed, double Level, double Seconds);
+
+// Runs the model alongside the motors, and costs at most one report more than the mix for
+// each change of the levels. When they change, the motor furthest from its level is sent full
+// power, or none if it is slowing down, and the others whatever gets them to their levels in
+// the same whole number of ticks. At that tick the levels themselves are sent. Levels of full
+// power or none are sent straight away, as nothing would get there sooner
+class Feedback360Overdrive
+{
+public:
+    Feedback360Overdrive(void);
+
+    void SetControllerType(UInt32 ControllerType);
+    void SetTickPeriod(UInt32 Period);
+    void SetEnabled(bool theEnabled);
+    bool Enabled(void) const { return IsEnabled; }
+
+    // Works out the levels to send at CurrentTime for the mixed Levels, returning false if they
+    // are the same as the last ones
+    bool Drive(double CurrentTime, const unsigned char *Levels, unsigned char *Output);
+
+private:
+    //disable copy constructor
+    Feedback360Overdrive(Feedback360Overdrive &src);
+    void operator = (Feedback360Overdrive &src);
+
+    void Reset(void);
+    void Advance(double CurrentTime);
+    void Plan(double CurrentTime, unsigned char *Drives);
+
+    const Feedback360MotorModel *Models;
+    bool    IsEnabled;
+    UInt32  TickPeriod;     // Microseconds
+
+    double          Speed[FF_CHANNELS];     // Modelled, as of LastTime
+    unsigned char   Sent[FF_CHANNELS];      // Driving the motors since LastTime
+    unsigned char   Target[FF_CHANNELS];    // The mixed levels being driven towards
+    double          LastTime;
+    bool            Switching;              // Sent isn't Target, until SwitchTime
+    double          SwitchTime;
+};
+
+#endif
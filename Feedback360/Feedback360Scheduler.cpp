@@ -0,0 +1,129 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Scheduler.cpp - ticks every controller in the process from one timer
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <float.h>
+#include <algorithm>
+#include "Feedback360Scheduler.h"
+
+Feedback360Scheduler::Feedback360Scheduler(UInt32 theTickPeriod) : TickPeriod(theTickPeriod), Count(0), DefaultPeriod(theTickPeriod)
+{
+}
+
+//----------------------------------------------------------------------------------------------
+// Add - returns false if the device is already there or there's no room
+//----------------------------------------------------------------------------------------------
+bool Feedback360Scheduler::Add(void *Context, Feedback360TickProc Proc, UInt32 Period, double CurrentTime)
+{
+    if (Count == SCHEDULER_DEVICES_MAX || Find(Context) != Count)
+        return false;
+    Devices[Count].Context = Context;
+    Devices[Count].Proc = Proc;
+    Devices[Count].Due = CurrentTime;
+    Devices[Count].Period = Period;
+    Devices[Count].Periodic = false;
+    Count++;
+    UpdateTickPeriod();
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------
+// Remove - the last device moves into the gap
+//----------------------------------------------------------------------------------------------
+void Feedback360Scheduler::Remove(void *Context)
+{
+    UInt32 Index = Find(Context);
+
+    if (Index == Count)
+        return;
+    Devices[Index] = Devices[--Count];
+    UpdateTickPeriod();
+}
+
+//----------------------------------------------------------------------------------------------
+// SetPeriod - takes effect from the device's next tick
+//----------------------------------------------------------------------------------------------
+void Feedback360Scheduler::SetPeriod(void *Context, UInt32 Period)
+{
+    UInt32 Index = Find(Context);
+
+    if (Index == Count)
+        return;
+    Devices[Index].Period = Period;
+    UpdateTickPeriod();
+}
+
+//----------------------------------------------------------------------------------------------
+// Wake - does nothing for devices that aren't there
+//----------------------------------------------------------------------------------------------
+void Feedback360Scheduler::Wake(void *Context, double When)
+{
+    UInt32 Index = Find(Context);
+
+    if (Index != Count && When < Devices[Index].Due)
+        Devices[Index].Due = When;
+}
+
+//----------------------------------------------------------------------------------------------
+// Run - when a playing device is due, the other playing ones due before a tick of their own
+// from now are ticked early rather than getting wakeups of their own, so ones started at
+// different moments fall into step. Devices waiting for a deadline wait for it, as a tick
+// before it would only find them idle, and a run for one of those ticks nothing early
+//----------------------------------------------------------------------------------------------
+double Feedback360Scheduler::Run(double CurrentTime)
+{
+    double Next = DBL_MAX;
+    bool Early = false;
+
+    for (UInt32 Index = 0; Index < Count && !Early; Index++)
+        Early = Devices[Index].Periodic && Devices[Index].Due <= CurrentTime;
+
+    for (UInt32 Index = 0; Index < Count; Index++)
+    {
+        double Window = CurrentTime + Devices[Index].Period / 1000000.;
+        if (Devices[Index].Due <= CurrentTime || (Early && Devices[Index].Periodic && Devices[Index].Due < Window)) {
+            Devices[Index].Due = Devices[Index].Proc(Devices[Index].Context, CurrentTime);
+            Devices[Index].Periodic = Devices[Index].Due <= Window;
+        }
+        Next = std::min(Next, Devices[Index].Due);
+    }
+    return Next;
+}
+
+UInt32 Feedback360Scheduler::Find(void *Context) const
+{
+    UInt32 Index = 0;
+
+    while (Index < Count && Devices[Index].Context != Context)
+        Index++;
+    return Index;
+}
+
+// The timer has to keep up with the fastest device
+void Feedback360Scheduler::UpdateTickPeriod(void)
+{
+    TickPeriod = (Count == 0) ? DefaultPeriod : UINT32_MAX;
+    for (UInt32 Index = 0; Index < Count; Index++)
+        TickPeriod = std::min(TickPeriod, Devices[Index].Period);
+}
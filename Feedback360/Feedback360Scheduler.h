@@ -0,0 +1,82 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Scheduler.h - ticks every controller in the process from one timer
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360Scheduler_h
+#define Feedback360_Feedback360Scheduler_h
+
+#include "Feedback360Headless.h"
+
+// Most controllers one scheduler can tick
+#define SCHEDULER_DEVICES_MAX   32
+
+// Ticks a device at CurrentTime and returns when it next needs a tick: a tick period on while
+// it's playing, its next deadline while it's idle, or DBL_MAX if only a call can wake it
+typedef double (*Feedback360TickProc)(void *Context, double CurrentTime);
+
+// Keeps when each device is next due, and ticks all of the ones that are due together, so a
+// process with any number of controllers wakes once per tick. Doesn't own a timer: the caller
+// runs it, and sleeps until the time it gets back
+class Feedback360Scheduler
+{
+public:
+    Feedback360Scheduler(UInt32 theTickPeriod);
+
+    // The device is due straight away, and is ticked every Period microseconds while it plays.
+    // Add fails when the scheduler is full
+    bool Add(void *Context, Feedback360TickProc Proc, UInt32 Period, double CurrentTime);
+    void Remove(void *Context);
+    void SetPeriod(void *Context, UInt32 Period);
+
+    // Brings the device's next tick forward to When, if it wasn't already due by then
+    void Wake(void *Context, double When);
+
+    // Ticks every device that's due, returning when to run next, DBL_MAX if nothing needs to
+    double Run(double CurrentTime);
+
+    UInt32 Size(void) const { return Count; }
+    void *Context(UInt32 Index) const { return Devices[Index].Context; }
+
+    UInt32 TickPeriod;  // Microseconds, the shortest of the devices' periods, or the default without any
+
+private:
+    //disable copy constructor
+    Feedback360Scheduler(Feedback360Scheduler &src);
+    void operator = (Feedback360Scheduler &src);
+
+    UInt32 Find(void *Context) const;
+    void UpdateTickPeriod(void);
+
+    struct {
+        void                *Context;
+        Feedback360TickProc Proc;
+        double              Due;
+        UInt32              Period;     // Microseconds
+        bool                Periodic;   // Wanted the next tick a period on, so it can go early
+    } Devices[SCHEDULER_DEVICES_MAX];
+    UInt32 Count;
+    UInt32 DefaultPeriod;
+};
+
+#endif
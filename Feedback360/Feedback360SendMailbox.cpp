@@ -0,0 +1,59 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360SendMailbox.cpp - the newest motor levels, waiting to be sent
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "Feedback360SendMailbox.h"
+
+//----------------------------------------------------------------------------------------------
+// Post - may be called from any thread, replacing whatever levels haven't been taken yet
+//----------------------------------------------------------------------------------------------
+bool Feedback360SendMailbox::Post(const unsigned char *Levels)
+{
+    int64_t Packed = SEND_MAILBOX_FULL;
+    int64_t Previous;
+
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        Packed |= (int64_t)Levels[Channel] << (8 * Channel);
+    do {
+        Previous = Slot;
+    } while (!__sync_bool_compare_and_swap(&Slot, Previous, Packed));
+    return (Previous & SEND_MAILBOX_FULL) == 0;
+}
+
+//----------------------------------------------------------------------------------------------
+// Take - sender only, emptying the mailbox so the next post asks for another sender
+//----------------------------------------------------------------------------------------------
+bool Feedback360SendMailbox::Take(unsigned char *Levels)
+{
+    int64_t Packed;
+
+    do {
+        Packed = Slot;
+    } while (!__sync_bool_compare_and_swap(&Slot, Packed, (int64_t)0));
+    if ((Packed & SEND_MAILBOX_FULL) == 0)
+        return false;
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        Levels[Channel] = (unsigned char)(Packed >> (8 * Channel));
+    return true;
+}
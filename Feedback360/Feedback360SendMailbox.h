@@ -0,0 +1,56 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360SendMailbox.h - the newest motor levels, waiting to be sent
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360SendMailbox_h
+#define Feedback360_Feedback360SendMailbox_h
+
+#include "Feedback360Headless.h"
+#include "Feedback360Effect.h"
+
+// Set in the mailbox while it holds levels that haven't been sent yet, one byte per channel below it
+#define SEND_MAILBOX_FULL               (1LL << 32)
+
+// One slot, so posting never waits for a send and a slow link only ever gets the newest
+// levels. Any thread can post, only the sender takes
+class Feedback360SendMailbox
+{
+public:
+    Feedback360SendMailbox(void) : Slot(0) {}
+
+    // Returns true if the mailbox was empty, so nothing will pick these levels up until the
+    // caller gets a sender to take them
+    bool Post(const unsigned char *Levels);
+    // Returns false if nothing was posted since the last take
+    bool Take(unsigned char *Levels);
+
+private:
+    //disable copy constructor
+    Feedback360SendMailbox(Feedback360SendMailbox &src);
+    void operator = (Feedback360SendMailbox &src);
+
+    volatile int64_t    Slot;
+};
+
+#endif
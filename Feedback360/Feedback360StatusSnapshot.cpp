@@ -0,0 +1,89 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360StatusSnapshot.cpp - effect status and device state, readable from any thread
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "Feedback360StatusSnapshot.h"
+
+Feedback360StatusSnapshot::Feedback360StatusSnapshot(void) : State(0)
+{
+    Clear();
+}
+
+//----------------------------------------------------------------------------------------------
+// PublishEffect - the slot is only written when it changes, so readers polling it keep their
+// cached copy while effects play on unchanged
+//----------------------------------------------------------------------------------------------
+void Feedback360StatusSnapshot::PublishEffect(FFEffectDownloadID Handle, DWORD Status)
+{
+    UInt32 Word = (Handle & ~EFFECT_SLOT_MASK) | (Status & EFFECT_SLOT_MASK);
+    UInt32 Index = Handle & EFFECT_SLOT_MASK;
+
+    if (Index < EFFECT_CAPACITY && Slots[Index] != Word)
+        Slots[Index] = Word;
+}
+
+//----------------------------------------------------------------------------------------------
+// Forget - the handle stops being found, as generation 0 is never used
+//----------------------------------------------------------------------------------------------
+void Feedback360StatusSnapshot::Forget(FFEffectDownloadID Handle)
+{
+    UInt32 Index = Handle & EFFECT_SLOT_MASK;
+
+    if (Index < EFFECT_CAPACITY)
+        Slots[Index] = 0;
+}
+
+void Feedback360StatusSnapshot::Clear(void)
+{
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+        Slots[Index] = 0;
+}
+
+void Feedback360StatusSnapshot::PublishState(DWORD NewState)
+{
+    if (State != NewState)
+        State = NewState;
+}
+
+//----------------------------------------------------------------------------------------------
+// GetEffectStatus - the same results as the mixer's, as of its last publish
+//----------------------------------------------------------------------------------------------
+HRESULT Feedback360StatusSnapshot::GetEffectStatus(FFEffectDownloadID Handle, FFEffectStatusFlag *Status) const
+{
+    UInt32 Index = Handle & EFFECT_SLOT_MASK;
+
+    // Generation 0 is what an empty slot holds, and is never handed out
+    if (Index >= EFFECT_CAPACITY || (Handle >> EFFECT_SLOT_BITS) == 0)
+        return FFERR_INVALIDDOWNLOADID;
+    UInt32 Word = Slots[Index];
+    if (((Word ^ Handle) & ~EFFECT_SLOT_MASK) != 0)
+        return FFERR_INVALIDDOWNLOADID;
+    *Status = Word & EFFECT_SLOT_MASK;
+    return FF_OK;
+}
+
+DWORD Feedback360StatusSnapshot::GetState(void) const
+{
+    return State;
+}
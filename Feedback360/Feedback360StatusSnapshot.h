@@ -0,0 +1,57 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360StatusSnapshot.h - effect status and device state, readable from any thread
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360StatusSnapshot_h
+#define Feedback360_Feedback360StatusSnapshot_h
+
+#include "Feedback360EffectMap.h"
+
+// One thread publishes and any number read, without locks or waiting. Each slot is a single
+// word holding the generation of the effect in it and its status, so a query is one load and a
+// handle from an earlier generation is never mistaken for the slot's current effect
+class Feedback360StatusSnapshot
+{
+public:
+    Feedback360StatusSnapshot(void);
+
+    void PublishEffect(FFEffectDownloadID Handle, DWORD Status);
+    void Forget(FFEffectDownloadID Handle);
+    void Clear(void);
+    void PublishState(DWORD State);
+
+    HRESULT GetEffectStatus(FFEffectDownloadID Handle, FFEffectStatusFlag *Status) const;
+    DWORD GetState(void) const;
+
+private:
+    //disable copy constructor
+    Feedback360StatusSnapshot(Feedback360StatusSnapshot &src);
+    void operator = (Feedback360StatusSnapshot &src);
+
+    // The handle's generation bits with the status in the slot bits, 0 for an empty slot
+    volatile UInt32 Slots[EFFECT_CAPACITY];
+    volatile DWORD  State;  // FFGFFS_ flags
+};
+
+#endif
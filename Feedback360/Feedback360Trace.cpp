@@ -0,0 +1,503 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Trace.cpp - recording and reading traces of force feedback API calls
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include "Feedback360Trace.h"
+using std::min;
+
+// Which parts of a download were recorded, as the pointers for the rest may not be valid
+#define DOWNLOAD_EFFECT     0x01
+#define DOWNLOAD_AXES       0x02
+#define DOWNLOAD_DIRECTION  0x04
+#define DOWNLOAD_ENVELOPE   0x08
+#define DOWNLOAD_PARAMS     0x10
+
+// Effect types are recorded by their place in this list, 0 for any other
+static UInt8 TypeIndex(CFUUIDRef Type)
+{
+    if (Type == NULL)                                           return 0;
+    if (CFEqual(Type, kFFEffectType_ConstantForce_ID))          return 1;
+    if (CFEqual(Type, kFFEffectType_RampForce_ID))              return 2;
+    if (CFEqual(Type, kFFEffectType_Square_ID))                 return 3;
+    if (CFEqual(Type, kFFEffectType_Sine_ID))                   return 4;
+    if (CFEqual(Type, kFFEffectType_Triangle_ID))               return 5;
+    if (CFEqual(Type, kFFEffectType_SawtoothUp_ID))             return 6;
+    if (CFEqual(Type, kFFEffectType_SawtoothDown_ID))           return 7;
+    if (CFEqual(Type, kFFEffectType_Spring_ID))                 return 8;
+    if (CFEqual(Type, kFFEffectType_Damper_ID))                 return 9;
+    if (CFEqual(Type, kFFEffectType_Inertia_ID))                return 10;
+    if (CFEqual(Type, kFFEffectType_Friction_ID))               return 11;
+    if (CFEqual(Type, kFFEffectType_CustomForce_ID))            return 12;
+    return 0;
+}
+
+static CFUUIDRef TypeOf(UInt8 Index)
+{
+    switch (Index) {
+        case 1:     return kFFEffectType_ConstantForce_ID;
+        case 2:     return kFFEffectType_RampForce_ID;
+        case 3:     return kFFEffectType_Square_ID;
+        case 4:     return kFFEffectType_Sine_ID;
+        case 5:     return kFFEffectType_Triangle_ID;
+        case 6:     return kFFEffectType_SawtoothUp_ID;
+        case 7:     return kFFEffectType_SawtoothDown_ID;
+        case 8:     return kFFEffectType_Spring_ID;
+        case 9:     return kFFEffectType_Damper_ID;
+        case 10:    return kFFEffectType_Inertia_ID;
+        case 11:    return kFFEffectType_Friction_ID;
+        case 12:    return kFFEffectType_CustomForce_ID;
+        default:    return NULL;
+    }
+}
+
+static void PutUnsigned(std::vector<UInt8> &Record, UInt64 Value)
+{
+    while (Value >= 0x80)
+    {
+        Record.push_back((UInt8)(Value | 0x80));
+        Value >>= 7;
+    }
+    Record.push_back((UInt8)Value);
+}
+
+static void PutSigned(std::vector<UInt8> &Record, SInt64 Value)
+{
+    PutUnsigned(Record, ((UInt64)Value << 1) ^ (UInt64)(Value >> 63));
+}
+
+Feedback360TraceWriter::Feedback360TraceWriter(double theStart) : File(-1), Opened(theStart), Last(0)
+{
+    pthread_mutex_init(&Lock, NULL);
+}
+
+Feedback360TraceWriter::~Feedback360TraceWriter(void)
+{
+    if (File >= 0)
+        close(File);
+    pthread_mutex_destroy(&Lock);
+}
+
+bool Feedback360TraceWriter::Open(const char *Path)
+{
+    File = open(Path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (File < 0)
+        return false;
+    if (write(File, TRACE_MAGIC, TRACE_MAGIC_SIZE) != TRACE_MAGIC_SIZE) {
+        close(File);
+        File = -1;
+        return false;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------------------------
+// Write - calls from other threads can return in a different order to the one they were made
+// in, so a record never goes back before the one written ahead of it
+//----------------------------------------------------------------------------------------------
+void Feedback360TraceWriter::Write(double Time, std::vector<UInt8> &Record)
+{
+    std::vector<UInt8> Delta;
+    double Elapsed = (Time - Opened) * 1000 * 1000 + 0.5;
+    UInt64 Now = (Elapsed > 0) ? (UInt64)Elapsed : 0;
+
+    pthread_mutex_lock(&Lock);
+    if (Now < Last)
+        Now = Last;
+    PutUnsigned(Delta, Now - Last);
+    Last = Now;
+    Record.insert(Record.begin() + 1, Delta.begin(), Delta.end());
+    // A failed write leaves the trace cut short, which the reader reports
+    if (File >= 0 && write(File, &Record[0], Record.size()) != (ssize_t)Record.size()) {
+        close(File);
+        File = -1;
+    }
+    pthread_mutex_unlock(&Lock);
+}
+
+// Starts a record with everything but the time, which Write puts in
+void Feedback360TraceWriter::Begin(std::vector<UInt8> &Record, UInt8 Call, HRESULT Result, FFEffectDownloadID Handle)
+{
+    Record.push_back(Call);
+    PutSigned(Record, Result);
+    PutUnsigned(Record, Handle);
+}
+
+void Feedback360TraceWriter::Initialize(double Time, HRESULT Result, bool Starting)
+{
+    std::vector<UInt8> Record;
+
+    Begin(Record, TRACE_INITIALIZE, Result, 0);
+    PutUnsigned(Record, Starting ? 1 : 0);
+    Write(Time, Record);
+}
+
+//----------------------------------------------------------------------------------------------
+// Download - only what the flags say the plugin reads is recorded, as the game need not have
+// filled in the rest
+//----------------------------------------------------------------------------------------------
+void Feedback360TraceWriter::Download(double Time, HRESULT Result, CFUUIDRef Type, FFEffectDownloadID Handle, FFEffectDownloadID NewHandle, const FFEFFECT *Effect, FFEffectParameterFlag Flags)
+{
+    std::vector<UInt8> Record;
+    UInt8 Parts = 0;
+
+    if (Effect != NULL) {
+        Parts |= DOWNLOAD_EFFECT;
+        if ((Flags & FFEP_AXES) && Effect->rgdwAxes != NULL)
+            Parts |= DOWNLOAD_AXES;
+        if ((Flags & FFEP_DIRECTION) && Effect->rglDirection != NULL)
+            Parts |= DOWNLOAD_DIRECTION;
+        if ((Flags & FFEP_ENVELOPE) && Effect->lpEnvelope != NULL)
+            Parts |= DOWNLOAD_ENVELOPE;
+        if ((Flags & FFEP_TYPESPECIFICPARAMS) && Effect->lpvTypeSpecificParams != NULL)
+            Parts |= DOWNLOAD_PARAMS;
+    }
+
+    Begin(Record, TRACE_DOWNLOAD, Result, Handle);
+    PutUnsigned(Record, Flags);
+    PutUnsigned(Record, NewHandle);
+    Record.push_back(TypeIndex(Type));
+    Record.push_back(Parts);
+    if (Effect == NULL) {
+        Write(Time, Record);
+        return;
+    }
+
+    PutUnsigned(Record, Effect->dwFlags);
+    PutUnsigned(Record, Effect->dwDuration);
+    PutUnsigned(Record, Effect->dwSamplePeriod);
+    PutUnsigned(Record, Effect->dwGain);
+    PutUnsigned(Record, Effect->dwTriggerButton);
+    PutUnsigned(Record, Effect->dwTriggerRepeatInterval);
+    PutUnsigned(Record, Effect->dwStartDelay);
+    PutUnsigned(Record, Effect->cAxes);
+    PutUnsigned(Record, Effect->cbTypeSpecificParams);
+
+    // Axes past the number of channels are never read
+    DWORD Axes = min(Effect->cAxes, (DWORD)FF_CHANNELS);
+    for (DWORD Axis = 0; (Parts & DOWNLOAD_AXES) && Axis < Axes; Axis++)
+        PutUnsigned(Record, Effect->rgdwAxes[Axis]);
+    for (DWORD Axis = 0; (Parts & DOWNLOAD_DIRECTION) && Axis < Axes; Axis++)
+        PutSigned(Record, Effect->rglDirection[Axis]);
+    if (Parts & DOWNLOAD_ENVELOPE) {
+        PutUnsigned(Record, Effect->lpEnvelope->dwAttackLevel);
+        PutUnsigned(Record, Effect->lpEnvelope->dwAttackTime);
+        PutUnsigned(Record, Effect->lpEnvelope->dwFadeLevel);
+        PutUnsigned(Record, Effect->lpEnvelope->dwFadeTime);
+    }
+
+    if (Parts & DOWNLOAD_PARAMS) {
+        size_t Size = min((size_t)Effect->cbTypeSpecificParams, (size_t)TRACE_PARAMS_MAX);
+        if (Type != NULL && CFEqual(Type, kFFEffectType_CustomForce_ID)) {
+            // The samples are behind a pointer, so are copied out
+            FFCUSTOMFORCE CustomForce;
+            memset(&CustomForce, 0, sizeof(CustomForce));
+            memcpy(&CustomForce, Effect->lpvTypeSpecificParams, min(Size, sizeof(CustomForce)));
+            DWORD Samples = (CustomForce.rglForceData != NULL) ? CustomForce.cSamples : 0;
+            PutUnsigned(Record, CustomForce.cChannels);
+            PutUnsigned(Record, CustomForce.dwSamplePeriod);
+            PutUnsigned(Record, CustomForce.cSamples);
+            PutUnsigned(Record, Samples);
+            for (DWORD Sample = 0; Sample < Samples; Sample++)
+                PutSigned(Record, CustomForce.rglForceData[Sample]);
+        } else {
+            PutUnsigned(Record, Size);
+            Record.insert(Record.end(), (const UInt8 *)Effect->lpvTypeSpecificParams, (const UInt8 *)Effect->lpvTypeSpecificParams + Size);
+        }
+    }
+    Write(Time, Record);
+}
+
+void Feedback360TraceWriter::Destroy(double Time, HRESULT Result, FFEffectDownloadID Handle)
+{
+    std::vector<UInt8> Record;
+
+    Begin(Record, TRACE_DESTROY, Result, Handle);
+    Write(Time, Record);
+}
+
+void Feedback360TraceWriter::Start(double Time, HRESULT Result, FFEffectDownloadID Handle, FFEffectStartFlag Mode, UInt32 Count)
+{
+    std::vector<UInt8> Record;
+
+    Begin(Record, TRACE_START, Result, Handle);
+    PutUnsigned(Record, Mode);
+    PutUnsigned(Record, Count);
+    Write(Time, Record);
+}
+
+void Feedback360TraceWriter::Stop(double Time, HRESULT Result, FFEffectDownloadID Handle)
+{
+    std::vector<UInt8> Record;
+
+    Begin(Record, TRACE_STOP, Result, Handle);
+    Write(Time, Record);
+}
+
+void Feedback360TraceWriter::Command(double Time, HRESULT Result, FFCommandFlag State)
+{
+    std::vector<UInt8> Record;
+
+    Begin(Record, TRACE_COMMAND, Result, 0);
+    PutUnsigned(Record, State);
+    Write(Time, Record);
+}
+
+// Gain and autocentre are both a DWORD, anything else is recorded without its value
+void Feedback360TraceWriter::Property(double Time, HRESULT Result, UInt32 Property, const void *Value)
+{
+    std::vector<UInt8> Record;
+    DWORD Number = 0;
+
+    if (Value != NULL && (Property == FFPROP_FFGAIN || Property == FFPROP_AUTOCENTER))
+        memcpy(&Number, Value, sizeof(Number));
+    Begin(Record, TRACE_PROPERTY, Result, 0);
+    PutUnsigned(Record, Property);
+    PutUnsigned(Record, Number);
+    Write(Time, Record);
+}
+
+void Feedback360TraceWriter::Escape(double Time, HRESULT Result, FFEffectDownloadID Handle, DWORD EscapeCommand, const void *In, DWORD InSize)
+{
+    std::vector<UInt8> Record;
+
+    if (In == NULL)
+        InSize = 0;
+    Begin(Record, TRACE_ESCAPE, Result, Handle);
+    PutUnsigned(Record, EscapeCommand);
+    PutUnsigned(Record, InSize);
+    Record.insert(Record.end(), (const UInt8 *)In, (const UInt8 *)In + InSize);
+    Write(Time, Record);
+}
+
+void Feedback360TraceWriter::Status(double Time, HRESULT Result, FFEffectDownloadID Handle, FFEffectStatusFlag Status)
+{
+    std::vector<UInt8> Record;
+
+    Begin(Record, TRACE_STATUS, Result, Handle);
+    PutUnsigned(Record, Status);
+    Write(Time, Record);
+}
+
+void Feedback360TraceWriter::State(double Time, HRESULT Result, DWORD State)
+{
+    std::vector<UInt8> Record;
+
+    Begin(Record, TRACE_STATE, Result, 0);
+    PutUnsigned(Record, State);
+    Write(Time, Record);
+}
+
+Feedback360TraceReader::Feedback360TraceReader(void) : Position(0), Time(0), Bad(false)
+{
+}
+
+bool Feedback360TraceReader::Open(const char *Path)
+{
+    FILE *File = fopen(Path, "rb");
+    UInt8 Buffer[65536];
+    size_t Read;
+
+    if (File == NULL)
+        return false;
+    Bytes.clear();
+    while ((Read = fread(Buffer, 1, sizeof(Buffer), File)) > 0)
+        Bytes.insert(Bytes.end(), Buffer, Buffer + Read);
+    fclose(File);
+
+    Position = TRACE_MAGIC_SIZE;
+    Time = 0;
+    Bad = (Bytes.size() < TRACE_MAGIC_SIZE || memcmp(&Bytes[0], TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0);
+    return !Bad;
+}
+
+// Reads with the reader's position and bytes, setting Bad if they run out
+#define GET_UNSIGNED(Value) do { \
+        UInt64 Number = 0; \
+        for (UInt32 Shift = 0; ; Shift += 7) { \
+            if (Position >= Bytes.size() || Shift > 63) { Bad = true; return false; } \
+            UInt8 Byte = Bytes[Position++]; \
+            Number |= (UInt64)(Byte & 0x7F) << Shift; \
+            if ((Byte & 0x80) == 0) break; \
+        } \
+        Value = Number; \
+    } while (0)
+
+#define GET_SIGNED(Value) do { \
+        UInt64 Zigzag; \
+        GET_UNSIGNED(Zigzag); \
+        Value = (SInt64)(Zigzag >> 1) ^ -(SInt64)(Zigzag & 1); \
+    } while (0)
+
+#define GET_BYTE(Value) do { \
+        if (Position >= Bytes.size()) { Bad = true; return false; } \
+        Value = Bytes[Position++]; \
+    } while (0)
+
+bool Feedback360TraceReader::Next(Feedback360TraceCall *Call)
+{
+    UInt64 Elapsed, Size;
+
+    if (Bad || Position >= Bytes.size())
+        return false;
+    GET_BYTE(Call->Call);
+    GET_UNSIGNED(Elapsed);
+    GET_SIGNED(Call->Result);
+    GET_UNSIGNED(Call->Handle);
+    Time += Elapsed;
+    Call->Time = Time / 1000. / 1000.;
+    Call->NewHandle = 0;
+    Call->Value = 0;
+    Call->Count = 0;
+    Call->Type = NULL;
+    Call->HasEffect = false;
+    Call->Data.clear();
+
+    switch (Call->Call) {
+        case TRACE_INITIALIZE:
+        case TRACE_COMMAND:
+        case TRACE_STATUS:
+        case TRACE_STATE:
+            // One number, which is the value for some and what came back for the others
+            if (Call->Call == TRACE_STATUS || Call->Call == TRACE_STATE)
+                GET_UNSIGNED(Call->Count);
+            else
+                GET_UNSIGNED(Call->Value);
+            return true;
+
+        case TRACE_DESTROY:
+        case TRACE_STOP:
+            return true;
+
+        case TRACE_START:
+        case TRACE_PROPERTY:
+            GET_UNSIGNED(Call->Value);
+            GET_UNSIGNED(Call->Count);
+            return true;
+
+        case TRACE_ESCAPE:
+            GET_UNSIGNED(Call->Value);
+            GET_UNSIGNED(Size);
+            if (Size > Bytes.size() - Position) {
+                Bad = true;
+                return false;
+            }
+            Call->Data.assign(Bytes.begin() + Position, Bytes.begin() + Position + Size);
+            Position += Size;
+            return true;
+
+        case TRACE_DOWNLOAD:
+            return ReadDownload(Call);
+
+        default:
+            Bad = true;
+            return false;
+    }
+}
+
+//----------------------------------------------------------------------------------------------
+// ReadDownload - rebuilds the FFEFFECT, with the parts that weren't recorded left NULL
+//----------------------------------------------------------------------------------------------
+bool Feedback360TraceReader::ReadDownload(Feedback360TraceCall *Call)
+{
+    FFEFFECT *Effect = &Call->Effect;
+    UInt8 TypeIndex, Parts;
+    UInt64 Size, Samples;
+
+    GET_UNSIGNED(Call->Value);
+    GET_UNSIGNED(Call->NewHandle);
+    GET_BYTE(TypeIndex);
+    GET_BYTE(Parts);
+    Call->Type = TypeOf(TypeIndex);
+    Call->HasEffect = (Parts & DOWNLOAD_EFFECT) != 0;
+    if (!Call->HasEffect)
+        return true;
+
+    memset(Effect, 0, sizeof(*Effect));
+    Effect->dwSize = sizeof(*Effect);
+    GET_UNSIGNED(Effect->dwFlags);
+    GET_UNSIGNED(Effect->dwDuration);
+    GET_UNSIGNED(Effect->dwSamplePeriod);
+    GET_UNSIGNED(Effect->dwGain);
+    GET_UNSIGNED(Effect->dwTriggerButton);
+    GET_UNSIGNED(Effect->dwTriggerRepeatInterval);
+    GET_UNSIGNED(Effect->dwStartDelay);
+    GET_UNSIGNED(Effect->cAxes);
+    GET_UNSIGNED(Effect->cbTypeSpecificParams);
+
+    DWORD Axes = min(Effect->cAxes, (DWORD)FF_CHANNELS);
+    if (Parts & DOWNLOAD_AXES) {
+        for (DWORD Axis = 0; Axis < Axes; Axis++)
+            GET_UNSIGNED(Call->Axes[Axis]);
+        Effect->rgdwAxes = Call->Axes;
+    }
+    if (Parts & DOWNLOAD_DIRECTION) {
+        for (DWORD Axis = 0; Axis < Axes; Axis++)
+            GET_SIGNED(Call->Direction[Axis]);
+        Effect->rglDirection = Call->Direction;
+    }
+    if (Parts & DOWNLOAD_ENVELOPE) {
+        Call->Envelope.dwSize = sizeof(Call->Envelope);
+        GET_UNSIGNED(Call->Envelope.dwAttackLevel);
+        GET_UNSIGNED(Call->Envelope.dwAttackTime);
+        GET_UNSIGNED(Call->Envelope.dwFadeLevel);
+        GET_UNSIGNED(Call->Envelope.dwFadeTime);
+        Effect->lpEnvelope = &Call->Envelope;
+    }
+
+    if ((Parts & DOWNLOAD_PARAMS) && Call->Type != NULL && CFEqual(Call->Type, kFFEffectType_CustomForce_ID)) {
+        memset(&Call->CustomForce, 0, sizeof(Call->CustomForce));
+        GET_UNSIGNED(Call->CustomForce.cChannels);
+        GET_UNSIGNED(Call->CustomForce.dwSamplePeriod);
+        GET_UNSIGNED(Call->CustomForce.cSamples);
+        GET_UNSIGNED(Samples);
+        // Every sample takes at least a byte, which stops a bad count asking for too much
+        if (Samples > Bytes.size() - Position) {
+            Bad = true;
+            return false;
+        }
+        Call->Samples.resize(Samples);
+        for (UInt64 Sample = 0; Sample < Samples; Sample++)
+            GET_SIGNED(Call->Samples[Sample]);
+        Call->CustomForce.rglForceData = Samples > 0 ? &Call->Samples[0] : NULL;
+        // The count is read on its own, so a corrupt one mustn't reach past the samples read
+        Call->CustomForce.cSamples = (DWORD)min((UInt64)Call->CustomForce.cSamples, Samples);
+        Effect->lpvTypeSpecificParams = &Call->CustomForce;
+    } else if (Parts & DOWNLOAD_PARAMS) {
+        GET_UNSIGNED(Size);
+        if (Size > TRACE_PARAMS_MAX || Size > Bytes.size() - Position) {
+            Bad = true;
+            return false;
+        }
+        memset(Call->Params, 0, sizeof(Call->Params));
+        memcpy(Call->Params, &Bytes[Position], Size);
+        Position += Size;
+        Effect->lpvTypeSpecificParams = Call->Params;
+    }
+    return true;
+}
@@ -0,0 +1,143 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    Feedback360Trace.h - recording and reading traces of force feedback API calls
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Feedback360_Feedback360Trace_h
+#define Feedback360_Feedback360Trace_h
+
+#include <pthread.h>
+#include <vector>
+#include "Feedback360Effect.h"
+
+// A trace is TRACE_MAGIC followed by one record per call, in the order the calls returned:
+//
+//   call        1 byte, a TRACE_ code
+//   time        microseconds since the previous record, or since recording started
+//   result      the HRESULT the call returned
+//   arguments   depending on the call, see Feedback360TraceCall
+//
+// Numbers are LEB128 varints, signed ones zigzag encoded first, so most take a byte or two.
+// Custom force samples are numbers too, other type specific parameters are copied as they are
+#define TRACE_MAGIC         "FF360TR\1"
+#define TRACE_MAGIC_SIZE    8
+
+#define TRACE_INITIALIZE    0x01    // Value is begin
+#define TRACE_DOWNLOAD      0x02    // Value is the parameter flags, Handle the one passed in
+#define TRACE_DESTROY       0x03
+#define TRACE_START         0x04    // Value is the start flags, Count the iterations
+#define TRACE_STOP          0x05
+#define TRACE_COMMAND       0x06    // Value is the FFCommandFlag
+#define TRACE_PROPERTY      0x07    // Value is the FFProperty, Count the DWORD it was set to
+#define TRACE_ESCAPE        0x08    // Value is the escape command, Data its input
+#define TRACE_STATUS        0x09    // Count is the status returned
+#define TRACE_STATE         0x0A    // Count is the device state returned
+
+// Largest type specific parameters kept, the size of the conditions for every channel
+#define TRACE_PARAMS_MAX    (sizeof(FFCONDITION) * FF_CHANNELS)
+
+// One call read back. Effect and the pointers in it point into the call itself, so a call
+// is filled in place and not copied
+typedef struct {
+    UInt8               Call;
+    double              Time;       // Seconds since recording started
+    HRESULT             Result;
+    FFEffectDownloadID  Handle;
+    FFEffectDownloadID  NewHandle;  // For downloads, the handle after the call
+    UInt32              Value;
+    UInt32              Count;
+
+    // Downloads
+    CFUUIDRef           Type;       // NULL if the type wasn't one the plugin knows
+    bool                HasEffect;
+    FFEFFECT            Effect;
+    FFENVELOPE          Envelope;
+    DWORD               Axes[FF_CHANNELS];
+    LONG                Direction[FF_CHANNELS];
+    FFCUSTOMFORCE       CustomForce;
+    UInt8               Params[TRACE_PARAMS_MAX];
+    std::vector<LONG>   Samples;
+
+    // Escapes
+    std::vector<UInt8>  Data;
+} Feedback360TraceCall;
+
+// Records from any number of threads, each record written whole as its call returns
+class Feedback360TraceWriter
+{
+public:
+    Feedback360TraceWriter(double theStart);
+    ~Feedback360TraceWriter(void);
+
+    bool Open(const char *Path);
+
+    void Initialize(double Time, HRESULT Result, bool Starting);
+    void Download(double Time, HRESULT Result, CFUUIDRef Type, FFEffectDownloadID Handle, FFEffectDownloadID NewHandle, const FFEFFECT *Effect, FFEffectParameterFlag Flags);
+    void Destroy(double Time, HRESULT Result, FFEffectDownloadID Handle);
+    void Start(double Time, HRESULT Result, FFEffectDownloadID Handle, FFEffectStartFlag Mode, UInt32 Count);
+    void Stop(double Time, HRESULT Result, FFEffectDownloadID Handle);
+    void Command(double Time, HRESULT Result, FFCommandFlag State);
+    void Property(double Time, HRESULT Result, UInt32 Property, const void *Value);
+    void Escape(double Time, HRESULT Result, FFEffectDownloadID Handle, DWORD EscapeCommand, const void *In, DWORD InSize);
+    void Status(double Time, HRESULT Result, FFEffectDownloadID Handle, FFEffectStatusFlag Status);
+    void State(double Time, HRESULT Result, DWORD State);
+
+private:
+    //disable copy constructor
+    Feedback360TraceWriter(Feedback360TraceWriter &src);
+    void operator = (Feedback360TraceWriter &src);
+
+    void Begin(std::vector<UInt8> &Record, UInt8 Call, HRESULT Result, FFEffectDownloadID Handle);
+    void Write(double Time, std::vector<UInt8> &Record);
+
+    int             File;
+    pthread_mutex_t Lock;
+    double          Opened;     // Seconds on the clock when recording started
+    UInt64          Last;       // Microseconds since Opened of the last record
+};
+
+// Reads a whole trace into memory and hands back one call at a time
+class Feedback360TraceReader
+{
+public:
+    Feedback360TraceReader(void);
+
+    bool Open(const char *Path);
+    // False at the end, or at a record that is cut short or not understood, which Failed tells
+    bool Next(Feedback360TraceCall *Call);
+    bool Failed(void) const { return Bad; }
+
+private:
+    //disable copy constructor
+    Feedback360TraceReader(Feedback360TraceReader &src);
+    void operator = (Feedback360TraceReader &src);
+
+    bool ReadDownload(Feedback360TraceCall *Call);
+
+    std::vector<UInt8>  Bytes;
+    size_t              Position;
+    UInt64              Time;       // Microseconds since recording started
+    bool                Bad;
+};
+
+#endif
@@ -21,7 +21,9 @@
     Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include <stdlib.h>
 #include <IOKit/IOCFPlugIn.h>
+#include <IOKit/hid/IOHIDUsageTables.h>
 #include "devlink.h"
 
 // Initialise the link
@@ -36,12 +38,19 @@ bool Device_Initialise(DeviceLink *link,io_object_t device)
     (*plugInInterface)->Release(plugInInterface);
     if (ret!=kIOReturnSuccess) return false;
     (*link->interface)->open(link->interface, 0);
+    link->queue = NULL;
     return true;
 }
 
 // Finish the link
 void Device_Finalise(DeviceLink *link)
 {
+    if (link->queue != NULL) {
+        (*link->queue)->stop(link->queue);
+        (*link->queue)->dispose(link->queue);
+        (*link->queue)->Release(link->queue);
+        link->queue = NULL;
+    }
     (*link->interface)->close(link->interface);
     (*link->interface)->Release(link->interface);
     link->interface = NULL;
@@ -62,3 +71,118 @@ bool Device_Send(DeviceLink *link,void *data,int length)
         return res == kIOReturnSuccess;
     }
 }
+
+static SInt32 Device_DictionaryNumber(CFDictionaryRef dictionary,CFStringRef key)
+{
+    CFNumberRef number = (CFNumberRef)CFDictionaryGetValue(dictionary, key);
+    SInt32 value = 0;
+
+    if ((number != NULL) && (CFGetTypeID(number) == CFNumberGetTypeID()))
+        CFNumberGetValue(number, kCFNumberSInt32Type, &value);
+    return value;
+}
+
+// Start watching the axes. Only changes are queued, so the current values are read once here
+bool Device_OpenInput(DeviceLink *link)
+{
+    static const UInt32 usages[DEVICE_INPUTS] = {kHIDUsage_GD_X, kHIDUsage_GD_Y, kHIDUsage_GD_Z, kHIDUsage_GD_Rz};
+    CFArrayRef elements = NULL;
+    int found = 0;
+
+    if ((link->interface == NULL) || (link->queue != NULL)) return false;
+    if ((*link->interface)->copyMatchingElements(link->interface, NULL, &elements) != kIOReturnSuccess) return false;
+    for (CFIndex i = 0; i < CFArrayGetCount(elements); i++) {
+        CFDictionaryRef element = (CFDictionaryRef)CFArrayGetValueAtIndex(elements, i);
+        if (Device_DictionaryNumber(element, CFSTR(kIOHIDElementUsagePageKey)) != kHIDPage_GenericDesktop) continue;
+        SInt32 usage = Device_DictionaryNumber(element, CFSTR(kIOHIDElementUsageKey));
+        for (int j = 0; j < DEVICE_INPUTS; j++) {
+            if (usage != (SInt32)usages[j]) continue;
+            link->inputCookie[j] = (IOHIDElementCookie)(long)Device_DictionaryNumber(element, CFSTR(kIOHIDElementCookieKey));
+            link->inputMin[j] = Device_DictionaryNumber(element, CFSTR(kIOHIDElementMinKey));
+            link->inputMax[j] = Device_DictionaryNumber(element, CFSTR(kIOHIDElementMaxKey));
+            found |= 1 << j;
+        }
+    }
+    CFRelease(elements);
+    if (found != (1 << DEVICE_INPUTS) - 1) return false;
+
+    link->queue = (*link->interface)->allocQueue(link->interface);
+    if (link->queue == NULL) return false;
+    (*link->queue)->create(link->queue, 0, 32);
+    for (int j = 0; j < DEVICE_INPUTS; j++) {
+        IOHIDEventStruct event;
+        (*link->queue)->addElement(link->queue, link->inputCookie[j], 0);
+        link->inputValue[j] = 0;
+        if ((*link->interface)->getElementValue(link->interface, link->inputCookie[j], &event) == kIOReturnSuccess)
+            link->inputValue[j] = event.value;
+    }
+    (*link->queue)->start(link->queue);
+    return true;
+}
+
+// Give each axis from -10000 to 10000, or from 0 for axes that don't go negative
+static void Device_ScaleInput(DeviceLink *link,SInt32 *values)
+{
+    for (int j = 0; j < DEVICE_INPUTS; j++) {
+        SInt64 range = (SInt64)link->inputMax[j] - link->inputMin[j];
+        SInt64 offset = (SInt64)link->inputValue[j] - link->inputMin[j];
+        if (range <= 0)
+            values[j] = 0;
+        else if (link->inputMin[j] < 0)
+            values[j] = (SInt32)(offset * 20000 / range - 10000);
+        else
+            values[j] = (SInt32)(offset * 10000 / range);
+    }
+}
+
+// Empty the queue, returning true if any of it was for the axes
+static bool Device_DrainInput(DeviceLink *link,bool keep)
+{
+    static const AbsoluteTime zeroTime = {0, 0};
+    IOHIDEventStruct event;
+    bool changed = false;
+
+    while ((*link->queue)->getNextEvent(link->queue, &event, zeroTime, 0) == kIOReturnSuccess) {
+        for (int j = 0; j < DEVICE_INPUTS; j++) {
+            if (event.elementCookie != link->inputCookie[j]) continue;
+            if (keep)
+                link->inputValue[j] = event.value;
+            changed = true;
+        }
+        if ((event.longValueSize != 0) && (event.longValue != NULL))
+            free(event.longValue);
+    }
+    return changed;
+}
+
+// Take everything queued since the last read, giving each axis from -10000 to 10000, or from 0
+// for axes that don't go negative. Returns false if nothing has changed
+bool Device_ReadInput(DeviceLink *link,SInt32 *values)
+{
+    bool changed;
+
+    if (link->queue == NULL) return false;
+    changed = Device_DrainInput(link, true);
+    Device_ScaleInput(link, values);
+    return changed;
+}
+
+// Read the axes' current values straight from the device, as Device_ReadInput would have
+// given them. The queue only holds 32 changes, so after a while without reading it the newest
+// ones may have been dropped; what it holds is thrown away. Returns false if nothing has changed
+bool Device_RefreshInput(DeviceLink *link,SInt32 *values)
+{
+    bool changed = false;
+
+    if (link->queue == NULL) return false;
+    Device_DrainInput(link, false);
+    for (int j = 0; j < DEVICE_INPUTS; j++) {
+        IOHIDEventStruct event;
+        if ((*link->interface)->getElementValue(link->interface, link->inputCookie[j], &event) != kIOReturnSuccess) continue;
+        if (event.value != link->inputValue[j])
+            changed = true;
+        link->inputValue[j] = event.value;
+    }
+    Device_ScaleInput(link, values);
+    return changed;
+}
@@ -26,8 +26,16 @@
 #include <CoreFoundation/CoreFoundation.h>
 #include <IOKit/hid/IOHIDLib.h>
 
+// Axes read back from the device: the left stick's X and Y, then the triggers
+#define DEVICE_INPUTS   4
+
 typedef struct {
     IOHIDDeviceInterface121 **interface;
+    // Input, read from the HID queue the driver fills, which is shared memory
+    IOHIDQueueInterface **queue;
+    IOHIDElementCookie inputCookie[DEVICE_INPUTS];
+    SInt32 inputMin[DEVICE_INPUTS], inputMax[DEVICE_INPUTS];
+    SInt32 inputValue[DEVICE_INPUTS];
 } DeviceLink;
 
 bool Device_Initialise(DeviceLink *link,io_object_t device);
@@ -35,4 +43,8 @@ void Device_Finalise(DeviceLink *link);
 
 bool Device_Send(DeviceLink *link,void *data,int length);
 
+bool Device_OpenInput(DeviceLink *link);
+bool Device_ReadInput(DeviceLink *link,SInt32 *values);
+bool Device_RefreshInput(DeviceLink *link,SInt32 *values);
+
 #endif
@@ -0,0 +1,382 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    ffreplay.cpp - plays a trace of API calls recorded by the plugin back through the mixer
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+// Replays what a game did, as recorded by the plugin with FEEDBACK360_TRACE set, on a simulated
+// clock and as fast as it will go, so a change to the effect engine can be checked and timed
+// against real games anywhere. Build it without the Apple frameworks with:
+//
+//   c++ -O2 -o ffreplay ffreplay.cpp Feedback360Mixer.cpp Feedback360Effect.cpp
+//       Feedback360EffectMap.cpp Feedback360DeadlineQueue.cpp Feedback360Clock.cpp
+//       Feedback360AudioRumble.cpp Feedback360InputSnapshot.cpp
+//       Feedback360StatusSnapshot.cpp Feedback360Overdrive.cpp Feedback360Trace.cpp
+//
+// Calls are made at the first tick at or after when they were recorded, with the time they
+// were recorded at, which is what the plugin does with the calls it queues for its effect
+// loop. Handles are mapped from the ones recorded to the ones the mixer hands out, so a trace
+// still plays if the handles change. The motors are a stand-in for the device link, set by
+// ticks that change them and by escapes while the game controls the motors itself, and the
+// trace has one "<milliseconds> <big> <little> <left trigger> <right trigger>" line per tick
+// with what they were last set to, the same as fftrace's. A trace fftrace recorded with -w
+// plays back to the same motor trace fftrace writes for the script.
+//
+// Every result, status and state that comes back is compared with the one recorded, and the
+// number that differ is reported with the first MISMATCHES_SHOWN of them. Results that depend
+// on what the game passed but the trace doesn't keep, such as structure sizes, are taken from
+// the recording. Controller input isn't recorded, so condition effects play nothing, and nor is
+// the controller type, so motor overdrive uses the Xbox 360 controller's motor models.
+//
+// The time reported covers the calls and ticks, not loading the trace or writing the output.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <map>
+#include <vector>
+#include "Feedback360Mixer.h"
+#include "Feedback360Clock.h"
+#include "Feedback360Trace.h"
+
+#define DEFAULT_RATE        100     // Ticks per second, the same as the plugin
+#define DEFAULT_TAIL        1000    // Milliseconds played after the last call
+#define MISMATCHES_SHOWN    10
+
+// Stands in for the device link, keeping what was last sent instead of sending it
+typedef struct {
+    unsigned char   Levels[FF_CHANNELS];
+    UInt64          Reports;    // Of any kind, motors, LED or power off
+} ReplayLink;
+
+typedef struct {
+    Feedback360Mixer   *Mixer;
+    ReplayLink          Link;
+    bool                Running;    // Between initialize and terminate, when the plugin ticks
+    bool                Manual;     // The game sets the motors with escapes
+    std::map<FFEffectDownloadID, FFEffectDownloadID> Handles;  // Recorded to replayed
+    UInt64              Calls;
+    UInt64              Mismatches;
+} ReplayDevice;
+
+static const char *CallNames[] = {
+    "unknown", "initialize", "download", "destroy", "start", "stop", "command",
+    "property", "escape", "status", "state"
+};
+
+static void Usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-r ticks per second] [-t tail milliseconds] recording [trace|-]\n", name);
+    exit(1);
+}
+
+static FFEffectDownloadID Replayed(const ReplayDevice &Device, FFEffectDownloadID Recorded)
+{
+    std::map<FFEffectDownloadID, FFEffectDownloadID>::const_iterator Handle = Device.Handles.find(Recorded);
+    return (Handle != Device.Handles.end()) ? Handle->second : Recorded;
+}
+
+static void Send(ReplayDevice &Device, const unsigned char *Levels)
+{
+    memcpy(Device.Link.Levels, Levels, sizeof(Device.Link.Levels));
+    Device.Link.Reports++;
+}
+
+static void Compare(ReplayDevice &Device, const Feedback360TraceCall &Call, const char *What, UInt32 Recorded, UInt32 Replayed)
+{
+    if (Recorded == Replayed)
+        return;
+    if (Device.Mismatches++ < MISMATCHES_SHOWN)
+        fprintf(stderr, "call %llu at %.3f ms, %s: %s 0x%.8x, recorded 0x%.8x\n", (unsigned long long)Device.Calls,
+                Call.Time * 1000, CallNames[Call.Call], What, (unsigned int)Replayed, (unsigned int)Recorded);
+}
+
+//----------------------------------------------------------------------------------------------
+// Escape - mirrors the plugin's Escape and ApplyCommand. The plugin checks the escape structure
+// itself as well as its input, so one it turned down is skipped with the result recorded
+//----------------------------------------------------------------------------------------------
+static HRESULT Escape(ReplayDevice &Device, const Feedback360TraceCall &Call, FFEffectDownloadID Handle)
+{
+    Feedback360Mixer &Mixer = *Device.Mixer;
+    const std::vector<UInt8> &Data = Call.Data;
+
+    if (Call.Result != FF_OK)
+        return Call.Result;
+    switch (Call.Value) {
+        case 0x00:  // Control motors
+            Device.Manual = (Data.size() == 1 && Data[0] != 0x00);
+            break;
+
+        case 0x01:  // Set motors
+            if (Device.Manual && !Data.empty() && Data.size() <= FF_CHANNELS) {
+                unsigned char Levels[FF_CHANNELS] = {0};
+                memcpy(Levels, &Data[0], Data.size());
+                Send(Device, Levels);
+            }
+            break;
+
+        case 0x02:  // Set LED
+        case 0x03:  // Power off
+            Device.Link.Reports++;
+            break;
+
+        case 0x04:  // Render ahead
+            if (Data.size() == 1)
+                Mixer.SetRenderAhead(Data[0]);
+            break;
+
+        case 0x05:  // Stream custom force samples
+            if (!Mixer.Contains(Handle))
+                return FFERR_INVALIDDOWNLOADID;
+            if (Data.size() == 1)
+                Mixer.SetStreaming(Handle, Data[0] != 0x00);
+            break;
+
+        case 0x06:  // Stream audio, copied out as the recording needn't be aligned
+        {
+            std::vector<SInt16> Pcm(Data.size() / sizeof(SInt16));
+            if (!Pcm.empty())
+                memcpy(&Pcm[0], &Data[0], Pcm.size() * sizeof(SInt16));
+            return Mixer.AppendAudio(Handle, Pcm.empty() ? NULL : &Pcm[0], (UInt32)(Pcm.size() / AUDIO_RUMBLE_CHANNELS));
+        }
+
+        case 0x07:  // Tick rate
+        {
+            DWORD Rate;
+            if (Data.size() != sizeof(Rate))
+                break;
+            memcpy(&Rate, &Data[0], sizeof(Rate));
+            if (Rate >= 1000000 / TICK_PERIOD_MAX && Rate <= 1000000 / TICK_PERIOD_MIN)
+                Mixer.SetTickPeriod(1000000 / Rate);
+            break;
+        }
+
+        case 0x08:  // Motor overdrive
+            if (Data.size() == 1)
+                Mixer.SetOverdrive(Data[0] != 0x00);
+            break;
+    }
+    return FF_OK;
+}
+
+//----------------------------------------------------------------------------------------------
+// Apply - makes a recorded call the way the plugin would, and checks it comes back the same
+//----------------------------------------------------------------------------------------------
+static void Apply(ReplayDevice &Device, Feedback360TraceCall &Call)
+{
+    Feedback360Mixer &Mixer = *Device.Mixer;
+    FFEffectDownloadID Handle = Replayed(Device, Call.Handle);
+    HRESULT Result = FF_OK;
+    UInt32 Status = 0;
+
+    Device.Calls++;
+    switch (Call.Call) {
+        case TRACE_INITIALIZE:
+            // Only the recorded result says whether a device was there to start
+            Result = Call.Result;
+            if (Call.Value && Result == FF_OK) {
+                Device.Running = true;
+            } else if (!Call.Value && Device.Running) {
+                static const unsigned char Off[FF_CHANNELS] = {0};
+                if (!Device.Manual)
+                    Send(Device, Off);
+                Device.Running = false;
+            }
+            break;
+
+        case TRACE_DOWNLOAD:
+            if (Call.Value & FFEP_NODOWNLOAD)
+                break;
+            if (!Call.HasEffect) {
+                Result = Call.Result;
+                break;
+            }
+            Result = Mixer.Download(Call.Type, &Handle, &Call.Effect, Call.Value, Call.Time);
+            Mixer.Publish();
+            if (Call.Handle == 0 && Call.NewHandle != 0 && Handle != 0)
+                Device.Handles[Call.NewHandle] = Handle;
+            break;
+
+        case TRACE_DESTROY:
+            Result = Mixer.Destroy(Handle);
+            Mixer.Publish();
+            break;
+
+        case TRACE_START:
+            if (!Mixer.Contains(Handle))
+                Result = FFERR_INVALIDDOWNLOADID;
+            else
+                Mixer.Start(Handle, Call.Value, Call.Count, Call.Time);
+            break;
+
+        case TRACE_STOP:
+            if (!Mixer.Contains(Handle))
+                Result = FFERR_INVALIDDOWNLOADID;
+            else
+                Mixer.Stop(Handle, Call.Time);
+            break;
+
+        case TRACE_COMMAND:
+            Mixer.Command(Call.Value, Call.Time);
+            break;
+
+        case TRACE_PROPERTY:
+            if (Call.Value != FFPROP_FFGAIN) {
+                Result = FFERR_UNSUPPORTED;
+            } else {
+                DWORD Gain = Call.Count;
+                if (Gain < 1 || Gain > 10000) {
+                    Gain = (Gain < 1) ? 1 : 10000;
+                    Result = FF_TRUNCATED;
+                }
+                Mixer.SetGain(Gain);
+            }
+            break;
+
+        case TRACE_ESCAPE:
+            Result = Escape(Device, Call, Handle);
+            break;
+
+        case TRACE_STATUS:
+            Mixer.Publish();
+            Result = Mixer.Snapshot()->GetEffectStatus(Handle, &Status);
+            Compare(Device, Call, "status", Call.Count, Status);
+            break;
+
+        case TRACE_STATE:
+            // The structure's size is checked before anything else
+            Result = Call.Result;
+            if (Result == FF_OK) {
+                Mixer.Publish();
+                Compare(Device, Call, "state", Call.Count, Mixer.Snapshot()->GetState());
+            }
+            break;
+    }
+    Compare(Device, Call, "result", Call.Result, Result);
+}
+
+int main(int argc, char **argv)
+{
+    double Rate = DEFAULT_RATE;
+    double Tail = DEFAULT_TAIL;
+    int Option;
+
+    while ((Option = getopt(argc, argv, "r:t:")) != -1)
+    {
+        switch (Option) {
+            case 'r':
+                Rate = atof(optarg);
+                break;
+            case 't':
+                Tail = atof(optarg);
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+    if (optind >= argc || Rate < 1000000 / TICK_PERIOD_MAX || Rate > 1000000 / TICK_PERIOD_MIN || Tail < 0)
+        Usage(argv[0]);
+
+    Feedback360TraceReader Reader;
+    if (!Reader.Open(argv[optind])) {
+        fprintf(stderr, "%s: not a trace\n", argv[optind]);
+        return 1;
+    }
+
+    FILE *Trace = NULL;
+    if (optind + 1 < argc) {
+        Trace = (strcmp(argv[optind + 1], "-") == 0) ? stdout : fopen(argv[optind + 1], "w");
+        if (Trace == NULL) {
+            perror(argv[optind + 1]);
+            return 1;
+        }
+    }
+
+    // Calls point into their records, so are kept where they were read. The mixer is big
+    // enough that it is better off out of the stack
+    static Feedback360TraceCall Call;
+    static Feedback360Mixer Mixer((UInt32)(1000 * 1000 / Rate));
+    ReplayDevice Device;
+    Feedback360ManualClock Clock;
+    unsigned char Levels[FF_CHANNELS];
+    bool Pending = Reader.Next(&Call);
+    UInt64 LastCall = 0;
+    UInt64 Ticks = 0;
+
+    Device.Mixer = &Mixer;
+    memset(Device.Link.Levels, 0, sizeof(Device.Link.Levels));
+    Device.Link.Reports = 0;
+    Device.Running = true;
+    Device.Manual = false;
+    Device.Calls = 0;
+    Device.Mismatches = 0;
+
+    // Reading the clock can cost as much as a tick, so without a trace to write in between,
+    // the whole replay is timed at once
+    double Busy = 0;
+    double Started = Feedback360DefaultClock()->Now();
+
+    // Times are kept in microseconds, the trace's resolution, and a change of tick rate
+    // carries on from the tick it was made at
+    UInt64 Base = 0, Since = 0;
+    UInt32 Period = Mixer.TickPeriod;
+    for (UInt64 Time = 0; Pending || Time <= LastCall + (UInt64)(Tail * 1000); Time = Base + ++Since * Period)
+    {
+        if (Trace != NULL)
+            Started = Feedback360DefaultClock()->Now();
+        Clock.Set(Time / 1000000.);
+        while (Pending && (UInt64)(Call.Time * 1000000 + 0.5) <= Time)
+        {
+            Apply(Device, Call);
+            LastCall = Time;
+            Pending = Reader.Next(&Call);
+        }
+
+        if (Device.Running && Mixer.Tick(Clock.Now(), Levels) && !Device.Manual)
+            Send(Device, Levels);
+        Ticks++;
+        if (Mixer.TickPeriod != Period) {
+            Base = Time;
+            Since = 0;
+            Period = Mixer.TickPeriod;
+        }
+
+        if (Trace != NULL) {
+            Busy += Feedback360DefaultClock()->Now() - Started;
+            fprintf(Trace, "%.1f %d %d %d %d\n", Time / 1000., Device.Link.Levels[CHANNEL_BIG], Device.Link.Levels[CHANNEL_LITTLE],
+                    Device.Link.Levels[CHANNEL_TRIGGER_LEFT], Device.Link.Levels[CHANNEL_TRIGGER_RIGHT]);
+        }
+    }
+    if (Trace == NULL)
+        Busy = Feedback360DefaultClock()->Now() - Started;
+    if (Trace != NULL && Trace != stdout)
+        fclose(Trace);
+
+    if (Reader.Failed())
+        fprintf(stderr, "%s: cut short after %llu calls\n", argv[optind], (unsigned long long)Device.Calls);
+    fprintf(stderr, "%llu calls, %llu differed from the recording, %llu reports sent\n",
+            (unsigned long long)Device.Calls, (unsigned long long)Device.Mismatches, (unsigned long long)Device.Link.Reports);
+    fprintf(stderr, "%llu ticks in %.3f ms, %.0f ticks/s\n",
+            (unsigned long long)Ticks, Busy * 1000, Busy > 0 ? Ticks / Busy : 0.);
+    return (Reader.Failed() || Device.Mismatches > 0) ? 1 : 0;
+}
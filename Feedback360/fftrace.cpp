@@ -0,0 +1,2046 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    fftrace.cpp - plays an effect script through the mixer and writes the motor levels
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+// Runs the effect engine on a simulated clock, as fast as it will go, so changes to the mixer
+// can be profiled and compared anywhere. Build it without the Apple frameworks with:
+//
+//   c++ -O2 -o fftrace fftrace.cpp Feedback360Mixer.cpp Feedback360Effect.cpp
+//       Feedback360EffectMap.cpp Feedback360DeadlineQueue.cpp Feedback360Clock.cpp
+//       Feedback360AudioRumble.cpp Feedback360InputSnapshot.cpp Feedback360Scheduler.cpp
+//       Feedback360StatusSnapshot.cpp Feedback360Overdrive.cpp Feedback360Trace.cpp
+//       Feedback360CommandQueue.cpp Feedback360SendMailbox.cpp
+//
+// GCC only vectorizes the render-ahead loops at -O3, which clang does at -O2 like Xcode.
+//
+// The script has one call per line, "<milliseconds> <call> <arguments>", in time order:
+//
+//   0     download <name> <type> [duration=<ms>|inf] [delay=<ms>] [gain=<n>] [magnitude=<n>]
+//                 [offset=<n>] [phase=<n>] [period=<ms>] [start=<n>] [end=<n>]
+//                 [attack=<level>/<ms>] [fade=<level>/<ms>] [samples=<l>,<r>,...]
+//                 [sampleperiod=<ms>] [sampling=<ms>] [axes=x|y|z|rz,...] [direction=<n>,...]
+//                 [play]
+//   0     start <name> [<count>|inf] [solo]
+//   500   stop <name>
+//   500   destroy <name>
+//   600   gain <n>
+//   700   command reset|stopall|pause|continue|on|off
+//   0     ahead <ticks>
+//   0     stream <name> on|off
+//   10    append <name> <l>,<r>,...
+//   0     stick <x>,<y>[,<left trigger>,<right trigger>] [<ms>]
+//   50    expect <big>,<little>[,<left trigger>,<right trigger>]|idle
+//
+// Types are constant, ramp, square, sine, triangle, sawup, sawdown, custom, spring, damper,
+// inertia and friction. Conditions take [coefficient=<n>] [saturation=<n>] [deadband=<n>]
+// and [offset=<n>], the same for every axis. Stick moves the controller's input there, in a
+// straight line over the milliseconds given, for the conditions to follow. Lines starting
+// with # are ignored. Axes pick the motors, x and y the big ones and z and rz the triggers, and
+// a direction is cartesian. Sampling is how often the effect is worked out, its levels held in
+// between, while sampleperiod steps a custom force's samples. The trace has one "<milliseconds>
+// <big> <little> <left trigger> <right trigger>" line per tick. Expect is only checked with -s,
+// against the levels last sent to the motors as of the first tick at or after it, or that the
+// controller has gone idle.
+//
+// A streaming custom effect plays each sample once, and append downloads only its samples,
+// which are added to the end. Scripts that keep appending while the effect plays measure
+// the cost of streaming, as the time reported includes downloads as well as ticks. It also
+// includes publishing the input, which like the plugin is only done when it changes.
+//
+// With -d, the script plays in real time on that many simulated controllers, each a fraction
+// of a tick behind the last as if they had been plugged in at different moments. It plays
+// once with a timer per controller and once with the plugin's shared scheduler, and the
+// wakeups and CPU time of both are reported instead of a trace.
+//
+// With -s, the script plays on a controller ticked by the plugin's scheduler on a simulated
+// clock, which jumps straight to whenever the scheduler next needs to run. The ticks and their
+// CPU time are reported, with the ticks that came while the controller was idle with no call
+// or deadline due, the longest any call waited for the tick that made it, while idle and while
+// playing, and the effects still playing at the end. The plugin wakes the timer for a call
+// while idle, so any tick while idle or any wait for a call while idle is an error. The
+// scheduler runs on a manual clock, which it mustn't ask to go back, and every expect line has
+// to be met, so scripts can check exactly when effects start, change and stop.
+//
+// With -q, the script plays flat out while a second thread asks for the device state and the
+// status of the first CONTENTION_EFFECTS effects downloaded, as fast as it can. It plays once
+// with every query taking the lock the mixer holds for each tick, as the plugin's queries all
+// went through its queue, and once with queries read from the mixer's status snapshot. The
+// CPU time of a query and of the mixer's ticks is reported for both.
+//
+// With -p, the script plays flat out while that many game threads start and stop the first
+// CONTENTION_EFFECTS effects downloaded, as fast as they can. It plays once with every call
+// taking the lock the mixer holds for each tick, and once with calls pushed onto the plugin's
+// command queue, which each tick empties first. The CPU time of a call, how often the queue was
+// full and the ticks' CPU time are reported, and it fails if any call was lost.
+//
+// With -g, no script is played. Instead each regular type is worked out a millisecond at a
+// time, with and without an envelope, and compared with the level Calc gave before effects
+// were compiled at download. Envelopes and ramps used to step in whole percents and phases in
+// whole degrees, so each case is allowed what those steps can be out by at its magnitudes (see
+// GoldenBound), plus GOLDEN_HEADROOM levels for the rounding of the fixed point kernels, and
+// more fails.
+//
+// With -h, no script is played. Instead the mixer is filled with EFFECT_CAPACITY effects, and
+// handles of destroyed effects and handles made up for free slots have to be refused. Then
+// looking up each effect by its handle is timed, in the effect map and by searching an array
+// of effects as the plugin's vector was searched before, and so are the calls a game makes
+// with a handle.
+//
+// With -e, no script is played either. EFFECT_CAPACITY constant forces with envelopes are
+// downloaded, some destroyed and downloaded again, then all downloaded again with only a new
+// gain, which works them out from the envelopes they kept. Each has to play the same as it does
+// on its own. Effects in the effect map, with some removed and added over and over, have to
+// stay where they were added with their envelope pointers at their own envelopes.
+//
+// With -f, no script is played either. Each periodic type is sampled over two periods, for
+// periods from WAVE_PERIODS and phases from WAVE_PHASES, by its kernel and as CalcForce worked
+// it out before, to the millisecond and the whole degree with sin(). Both are compared with
+// the exact waveform, and with each other away from the jumps of squares and sawtooths. The
+// kernels may be out by WAVE_TOLERANCE, and from the old waveform by what its own steps can
+// be out by. How long each takes for a sample is reported.
+//
+// With -b, no script is played either. 1, 16 and EFFECT_CAPACITY periodic effects are played
+// for BLOCK_TICKS ticks at the default rate, with one stopped and started again every
+// BLOCK_CHANGE ticks so blocks have to be rendered again. Each count is played once working
+// every tick out as it comes and once rendering RENDER_AHEAD_MAX ticks ahead. The CPU time of
+// a tick is reported for both, and the levels have to be the same.
+//
+// With -l, no script is played either. A tick thread posts new levels to a send mailbox every
+// LINK_PERIOD microseconds for LINK_TICKS ticks, and a sender thread, queued the way the
+// plugin queues SendProc, takes them and sends them on a link that takes LINK_DELAYS
+// milliseconds for each send. The levels are numbered, so any sent after newer ones were
+// posted, sent out of order, or a last one never sent, fails. How long a post takes, how late
+// the ticks ran and how many levels were dropped unsent are reported, and how late the ticks
+// ran sending on the tick thread instead, as Device_Send was called before.
+//
+// With -w, the calls the script makes are also recorded as a trace of API calls, the same as
+// the plugin writes with FEEDBACK360_TRACE set, so ffreplay can be checked against fftrace.
+// Gain is recorded as the property, ahead and stream as their escapes and append as a download
+// of the type specific parameters. Stick and expect lines aren't calls, so aren't recorded.
+//
+// With -o and a controller type of 360, original or one, the script plays on two controllers
+// of that type, one with motor overdrive and one without, and the levels each sends are run
+// through the type's motor models to see how closely the motors follow the mixed levels. The
+// lag of each motor with and without overdrive is reported, which is how much speed the motor
+// was short of the levels for, over time, per level the levels moved. A motor that followed
+// with a first order lag has a lag of its time constant. The trace has one "<milliseconds>"
+// line per tick, followed by the mixed level and the modelled speed without and with overdrive
+// for each motor the type has. The motors are simulated with the same models the overdrive
+// uses, so this is how well it does when the models are right. The reports each controller
+// sent are counted too, as overdrive may send at most one more than the mix per change.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Feedback360Mixer.h"
+#include "Feedback360CommandQueue.h"
+#include "Feedback360SendMailbox.h"
+#include "Feedback360Clock.h"
+#include "Feedback360Scheduler.h"
+#include "Feedback360Trace.h"
+
+#define DEFAULT_RATE    100     // Ticks per second, the same as the plugin
+#define DEFAULT_TAIL    1000    // Milliseconds played after the last call
+
+#define CALL_SLACK      0.001   // Milliseconds early a tick can be and still make a call, as
+                                // periods added up in seconds don't land exactly on them
+
+#define CONTENTION_EFFECTS  16  // Effects asked about by each round of -q queries
+
+#define GOLDEN_DURATION     1000    // Milliseconds each -g effect plays for
+#define GOLDEN_HEADROOM     1       // Levels -g allows past GoldenBound, for the fixed point kernels
+
+#define WAVE_SAMPLES        3600    // Samples -f takes of each period
+#define WAVE_ROUNDS         20      // Times -f times each sample
+#define WAVE_TOLERANCE      5       // Units of 10000 -f allows the kernels, see Waveforms
+
+#define BLOCK_TICKS         6000    // Ticks -b plays for each count of effects
+#define BLOCK_CHANGE        50      // Ticks between -b restarting one of its effects
+
+#define LINK_TICKS          500     // Ticks -l posts levels on
+#define LINK_PERIOD         1000    // Microseconds between -l's ticks
+#define LINK_SYNC_TICKS     50      // Ticks -l sends on the tick thread, as they take so long
+
+#define HANDLE_ROUNDS       2000    // Times -h looks up each of its effects
+
+typedef struct {
+    double          Time;   // Milliseconds
+    std::string     Call;
+    std::vector<std::string> Arguments;
+    int             Line;
+} ScriptCall;
+
+// What a name in the script refers to, and the storage its effect points into
+typedef struct {
+    FFEffectDownloadID  Handle;
+    std::vector<LONG>   Samples;
+} ScriptEffect;
+
+// A simulated controller, with its own effects and its input moving from one stick line's
+// positions to the next
+struct ScriptDevice
+{
+    ScriptDevice(UInt32 TickPeriod, const std::vector<ScriptCall> *theCalls) : Mixer(TickPeriod),
+        Calls(theCalls), Next(0), Start(0), Length(0), Ticks(0), Failed(false),
+        Idle(true), Expected(0), Unmet(0), IdleTicks(0), IdleWait(0), PlayingWait(0)
+    {
+        memset(&Stick, 0, sizeof(Stick));
+        memset(Sent, 0, sizeof(Sent));
+        Mixer.SetInput(&Input);
+    }
+
+    Feedback360Mixer            Mixer;
+    Feedback360InputSnapshot    Input;
+    std::map<std::string, ScriptEffect> Effects;
+    struct {
+        LONG    From[FF_CHANNELS], To[FF_CHANNELS];
+        double  Start, End;     // Milliseconds
+        bool    Moving;         // Still to be published at To
+    } Stick;
+
+    // Only used by the benchmark and -s, where the scheduler ticks the device
+    const std::vector<ScriptCall> *Calls;
+    size_t      Next;       // First call not made yet
+    double      Start;      // Seconds on the clock when the script starts
+    double      Length;     // Milliseconds
+    UInt64      Ticks;
+    bool        Failed;
+
+    // Only used by -s
+    bool        Idle;           // As of the last tick
+    unsigned char Sent[FF_CHANNELS];    // Levels last sent to the motors
+    UInt32      Expected, Unmet;        // Expect lines checked, and how many failed
+    UInt64      IdleTicks;      // Came while idle with nothing due
+    double      IdleWait, PlayingWait;  // Longest a call waited for its tick, in milliseconds
+};
+
+// Time spent in the mixer, in seconds
+static double Busy = 0;
+
+// Where the script's calls are recorded with -w
+static Feedback360TraceWriter *Recorder = NULL;
+
+static void Usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-r ticks per second] [-t milliseconds] [-d devices] [-s] [-q] [-p threads] [-w recording] [-o 360|original|one] script [trace|-]\n       %s -g\n       %s -h\n       %s -e\n       %s -f\n       %s -b\n       %s -l\n", name, name, name, name, name, name, name);
+    exit(1);
+}
+
+static bool ReadScript(const char *path, std::vector<ScriptCall> *Calls)
+{
+    FILE *file = fopen(path, "r");
+    char line[4096];
+    int number = 0;
+
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        ScriptCall Call;
+        char *word = strtok(line, " \t\r\n");
+
+        number++;
+        if (word == NULL || word[0] == '#')
+            continue;
+        Call.Time = atof(word);
+        Call.Line = number;
+        word = strtok(NULL, " \t\r\n");
+        if (word == NULL) {
+            fprintf(stderr, "%s:%d: missing call\n", path, number);
+            fclose(file);
+            return false;
+        }
+        Call.Call = word;
+        while ((word = strtok(NULL, " \t\r\n")) != NULL)
+            Call.Arguments.push_back(word);
+        Calls->push_back(Call);
+    }
+    fclose(file);
+    return true;
+}
+
+static CFUUIDRef EffectType(const std::string &name)
+{
+    if (name == "constant") return kFFEffectType_ConstantForce_ID;
+    if (name == "ramp")     return kFFEffectType_RampForce_ID;
+    if (name == "square")   return kFFEffectType_Square_ID;
+    if (name == "sine")     return kFFEffectType_Sine_ID;
+    if (name == "triangle") return kFFEffectType_Triangle_ID;
+    if (name == "sawup")    return kFFEffectType_SawtoothUp_ID;
+    if (name == "sawdown")  return kFFEffectType_SawtoothDown_ID;
+    if (name == "custom")   return kFFEffectType_CustomForce_ID;
+    if (name == "spring")   return kFFEffectType_Spring_ID;
+    if (name == "damper")   return kFFEffectType_Damper_ID;
+    if (name == "inertia")  return kFFEffectType_Inertia_ID;
+    if (name == "friction") return kFFEffectType_Friction_ID;
+    return NULL;
+}
+
+static void ReadSamples(const std::string &Value, std::vector<LONG> *Samples)
+{
+    const char *Sample = Value.c_str();
+    char *End;
+
+    Samples->clear();
+    while (*Sample != '\0')
+    {
+        LONG Level = (LONG)strtol(Sample, &End, 10);
+        if (End == Sample)
+            break;
+        Samples->push_back(Level);
+        Sample = (*End == ',') ? End + 1 : End;
+    }
+}
+
+static HRESULT TimedDownload(Feedback360Mixer &Mixer, CFUUIDRef Type, ScriptEffect &Effect, FFEFFECT *DiEffect, FFEffectParameterFlag Flags, double CurrentTime)
+{
+    FFEffectDownloadID Handle = Effect.Handle;
+    double Started = Feedback360DefaultClock()->Now();
+    HRESULT Result = Mixer.Download(Type, &Effect.Handle, DiEffect, Flags, CurrentTime);
+    Busy += Feedback360DefaultClock()->Now() - Started;
+    if (Recorder != NULL)
+        Recorder->Download(CurrentTime, Result, Type, Handle, Effect.Handle, DiEffect, Flags);
+    return Result;
+}
+
+// Builds the FFEFFECT for a download line and hands it to the mixer
+static bool Download(Feedback360Mixer &Mixer, ScriptEffect &Effect, const ScriptCall &Call, double CurrentTime)
+{
+    FFEFFECT DiEffect;
+    FFENVELOPE Envelope;
+    FFCONSTANTFORCE Constant;
+    FFRAMPFORCE Ramp;
+    FFPERIODIC Periodic;
+    FFCUSTOMFORCE Custom;
+    FFCONDITION Condition;
+    DWORD Axes[FF_CHANNELS];
+    LONG Direction[FF_CHANNELS] = {0};
+    FFEffectParameterFlag Flags = FFEP_ALLPARAMS;
+    CFUUIDRef Type = EffectType(Call.Arguments[1]);
+
+    if (Type == NULL) {
+        fprintf(stderr, "line %d: unknown effect type %s\n", Call.Line, Call.Arguments[1].c_str());
+        return false;
+    }
+    memset(&DiEffect, 0, sizeof(DiEffect));
+    memset(&Envelope, 0, sizeof(Envelope));
+    memset(&Constant, 0, sizeof(Constant));
+    memset(&Ramp, 0, sizeof(Ramp));
+    memset(&Periodic, 0, sizeof(Periodic));
+    memset(&Custom, 0, sizeof(Custom));
+    memset(&Condition, 0, sizeof(Condition));
+    Condition.lPositiveCoefficient = Condition.lNegativeCoefficient = 10000;
+    Condition.dwPositiveSaturation = Condition.dwNegativeSaturation = 10000;
+    DiEffect.dwSize = sizeof(DiEffect);
+    DiEffect.dwDuration = 1000 * 1000;
+    DiEffect.dwGain = 10000;
+    Envelope.dwSize = sizeof(Envelope);
+    Custom.cChannels = 2;
+
+    for (size_t Index = 2; Index < Call.Arguments.size(); Index++)
+    {
+        std::string Key = Call.Arguments[Index];
+        std::string Value;
+        size_t Equals = Key.find('=');
+
+        if (Equals != std::string::npos) {
+            Value = Key.substr(Equals + 1);
+            Key = Key.substr(0, Equals);
+        }
+        long Number = atol(Value.c_str());
+        const char *Slash = strchr(Value.c_str(), '/');
+
+        if (Key == "duration")          DiEffect.dwDuration = (Value == "inf") ? FF_INFINITE : (DWORD)(atof(Value.c_str()) * 1000);
+        else if (Key == "delay")        DiEffect.dwStartDelay = (DWORD)(atof(Value.c_str()) * 1000);
+        else if (Key == "gain")         DiEffect.dwGain = (DWORD)Number;
+        else if (Key == "magnitude")    { Constant.lMagnitude = (LONG)Number; Periodic.dwMagnitude = (DWORD)Number; }
+        else if (Key == "offset")       { Periodic.lOffset = (LONG)Number; Condition.lOffset = (LONG)Number; }
+        else if (Key == "coefficient")  Condition.lPositiveCoefficient = Condition.lNegativeCoefficient = (LONG)Number;
+        else if (Key == "saturation")   Condition.dwPositiveSaturation = Condition.dwNegativeSaturation = (DWORD)Number;
+        else if (Key == "deadband")     Condition.lDeadBand = (LONG)Number;
+        else if (Key == "phase")        Periodic.dwPhase = (DWORD)Number;
+        else if (Key == "period")       Periodic.dwPeriod = (DWORD)(atof(Value.c_str()) * 1000);
+        else if (Key == "start")        Ramp.lStart = (LONG)Number;
+        else if (Key == "end")          Ramp.lEnd = (LONG)Number;
+        else if (Key == "sampleperiod") Custom.dwSamplePeriod = (DWORD)(atof(Value.c_str()) * 1000);
+        else if (Key == "sampling")     DiEffect.dwSamplePeriod = (DWORD)(atof(Value.c_str()) * 1000);
+        else if (Key == "play")         Flags |= FFEP_START;
+        else if ((Key == "attack" || Key == "fade") && Slash != NULL) {
+            DWORD Level = (DWORD)Number;
+            DWORD Time = (DWORD)(atof(Slash + 1) * 1000);
+            if (Key == "attack") {
+                Envelope.dwAttackLevel = Level;
+                Envelope.dwAttackTime = Time;
+            } else {
+                Envelope.dwFadeLevel = Level;
+                Envelope.dwFadeTime = Time;
+            }
+            DiEffect.lpEnvelope = &Envelope;
+        }
+        else if (Key == "samples")      ReadSamples(Value, &Effect.Samples);
+        else if (Key == "axes") {
+            char Names[256];
+            snprintf(Names, sizeof(Names), "%s", Value.c_str());
+            for (char *Axis = strtok(Names, ","); Axis != NULL && DiEffect.cAxes < FF_CHANNELS; Axis = strtok(NULL, ","))
+            {
+                if (strcmp(Axis, "x") == 0)         Axes[DiEffect.cAxes++] = FFJOFS_X;
+                else if (strcmp(Axis, "y") == 0)    Axes[DiEffect.cAxes++] = FFJOFS_Y;
+                else if (strcmp(Axis, "z") == 0)    Axes[DiEffect.cAxes++] = FFJOFS_Z;
+                else if (strcmp(Axis, "rz") == 0)   Axes[DiEffect.cAxes++] = FFJOFS_RZ;
+                else {
+                    fprintf(stderr, "line %d: unknown axis %s\n", Call.Line, Axis);
+                    return false;
+                }
+            }
+            DiEffect.rgdwAxes = Axes;
+        }
+        else if (Key == "direction") {
+            std::vector<LONG> Values;
+            ReadSamples(Value, &Values);
+            for (size_t Axis = 0; Axis < Values.size() && Axis < FF_CHANNELS; Axis++)
+                Direction[Axis] = Values[Axis];
+            DiEffect.dwFlags |= FFEFF_CARTESIAN;
+            DiEffect.rglDirection = Direction;
+        }
+        else {
+            fprintf(stderr, "line %d: unknown parameter %s\n", Call.Line, Key.c_str());
+            return false;
+        }
+    }
+
+    if (Type == kFFEffectType_ConstantForce_ID) {
+        DiEffect.cbTypeSpecificParams = sizeof(Constant);
+        DiEffect.lpvTypeSpecificParams = &Constant;
+    } else if (Type == kFFEffectType_RampForce_ID) {
+        DiEffect.cbTypeSpecificParams = sizeof(Ramp);
+        DiEffect.lpvTypeSpecificParams = &Ramp;
+    } else if (Type == kFFEffectType_Spring_ID || Type == kFFEffectType_Damper_ID || Type == kFFEffectType_Inertia_ID || Type == kFFEffectType_Friction_ID) {
+        DiEffect.cbTypeSpecificParams = sizeof(Condition);
+        DiEffect.lpvTypeSpecificParams = &Condition;
+    } else if (Type == kFFEffectType_CustomForce_ID) {
+        // Samples come in left/right pairs
+        if (Effect.Samples.size() < 2) {
+            fprintf(stderr, "line %d: custom effects need samples\n", Call.Line);
+            return false;
+        }
+        Custom.cSamples = (DWORD)(Effect.Samples.size() & ~1);
+        Custom.rglForceData = &Effect.Samples[0];
+        DiEffect.cbTypeSpecificParams = sizeof(Custom);
+        DiEffect.lpvTypeSpecificParams = &Custom;
+    } else {
+        DiEffect.cbTypeSpecificParams = sizeof(Periodic);
+        DiEffect.lpvTypeSpecificParams = &Periodic;
+    }
+
+    HRESULT Result = TimedDownload(Mixer, Type, Effect, &DiEffect, Flags, CurrentTime);
+    if (Result != FF_OK) {
+        fprintf(stderr, "line %d: download failed (0x%.8x)\n", Call.Line, (unsigned int)Result);
+        return false;
+    }
+    return true;
+}
+
+// Adds samples to a streaming custom effect, the only parameters downloaded
+static bool Append(Feedback360Mixer &Mixer, ScriptEffect &Effect, const ScriptCall &Call, double CurrentTime)
+{
+    FFEFFECT DiEffect;
+    FFCUSTOMFORCE Custom;
+
+    ReadSamples(Call.Arguments[1], &Effect.Samples);
+    if (Effect.Samples.size() < 2) {
+        fprintf(stderr, "line %d: nothing to append\n", Call.Line);
+        return false;
+    }
+    memset(&DiEffect, 0, sizeof(DiEffect));
+    memset(&Custom, 0, sizeof(Custom));
+    DiEffect.dwSize = sizeof(DiEffect);
+    Custom.cChannels = 2;
+    Custom.cSamples = (DWORD)(Effect.Samples.size() & ~1);
+    Custom.rglForceData = &Effect.Samples[0];
+    DiEffect.cbTypeSpecificParams = sizeof(Custom);
+    DiEffect.lpvTypeSpecificParams = &Custom;
+
+    HRESULT Result = TimedDownload(Mixer, kFFEffectType_CustomForce_ID, Effect, &DiEffect, FFEP_TYPESPECIFICPARAMS, CurrentTime);
+    if (Result != FF_OK) {
+        fprintf(stderr, "line %d: append failed (0x%.8x)\n", Call.Line, (unsigned int)Result);
+        return false;
+    }
+    return true;
+}
+
+static bool Command(const std::string &name, FFCommandFlag *State)
+{
+    if (name == "reset")            *State = FFSFFC_RESET;
+    else if (name == "stopall")     *State = FFSFFC_STOPALL;
+    else if (name == "pause")       *State = FFSFFC_PAUSE;
+    else if (name == "continue")    *State = FFSFFC_CONTINUE;
+    else if (name == "on")          *State = FFSFFC_SETACTUATORSON;
+    else if (name == "off")         *State = FFSFFC_SETACTUATORSOFF;
+    else return false;
+    return true;
+}
+
+static bool Apply(ScriptDevice &Device, const ScriptCall &Call, double CurrentTime)
+{
+    Feedback360Mixer &Mixer = Device.Mixer;
+    std::map<std::string, ScriptEffect> &Effects = Device.Effects;
+    const std::vector<std::string> &Arguments = Call.Arguments;
+    FFCommandFlag State;
+
+    if (Call.Call == "download" && Arguments.size() >= 2) {
+        ScriptEffect &Effect = Effects[Arguments[0]];
+        return Download(Mixer, Effect, Call, CurrentTime);
+    }
+    if (Call.Call == "gain" && Arguments.size() == 1) {
+        DWORD Gain = (DWORD)atol(Arguments[0].c_str());
+        Mixer.SetGain(Gain);
+        if (Recorder != NULL)
+            Recorder->Property(CurrentTime, FF_OK, FFPROP_FFGAIN, &Gain);
+        return true;
+    }
+    if (Call.Call == "command" && Arguments.size() == 1 && Command(Arguments[0], &State)) {
+        Mixer.Command(State, CurrentTime);
+        if (Recorder != NULL)
+            Recorder->Command(CurrentTime, FF_OK, State);
+        return true;
+    }
+    if (Call.Call == "stick" && Arguments.size() >= 1) {
+        std::vector<LONG> Positions;
+        ReadSamples(Arguments[0], &Positions);
+        memcpy(Device.Stick.From, Device.Stick.To, sizeof(Device.Stick.From));
+        for (size_t Channel = 0; Channel < Positions.size() && Channel < FF_CHANNELS; Channel++)
+            Device.Stick.To[Channel] = Positions[Channel];
+        Device.Stick.Start = Call.Time;
+        Device.Stick.End = Call.Time + (Arguments.size() > 1 ? atof(Arguments[1].c_str()) : 0);
+        Device.Stick.Moving = true;
+        return true;
+    }
+    // Checked after the tick by DeviceTick
+    if (Call.Call == "expect" && Arguments.size() == 1)
+        return true;
+    if (Call.Call == "ahead" && Arguments.size() == 1) {
+        UInt8 Ahead = (UInt8)atol(Arguments[0].c_str());
+        Mixer.SetRenderAhead(Ahead);
+        if (Recorder != NULL)
+            Recorder->Escape(CurrentTime, FF_OK, 0, 0x04, &Ahead, sizeof(Ahead));
+        return true;
+    }
+    if ((Call.Call == "start" || Call.Call == "stop" || Call.Call == "destroy" || Call.Call == "stream" || Call.Call == "append") && Arguments.size() >= 1) {
+        std::map<std::string, ScriptEffect>::iterator Effect = Effects.find(Arguments[0]);
+        if (Effect == Effects.end()) {
+            fprintf(stderr, "line %d: no effect called %s\n", Call.Line, Arguments[0].c_str());
+            return false;
+        }
+        if (Call.Call == "start") {
+            UInt32 Count = 1;
+            FFEffectStartFlag Mode = 0;
+            for (size_t Index = 1; Index < Arguments.size(); Index++)
+            {
+                if (Arguments[Index] == "solo")
+                    Mode |= FFES_SOLO;
+                else if (Arguments[Index] == "inf")
+                    Count = FF_INFINITE;
+                else
+                    Count = (UInt32)atol(Arguments[Index].c_str());
+            }
+            Mixer.Start(Effect->second.Handle, Mode, Count, CurrentTime);
+            if (Recorder != NULL)
+                Recorder->Start(CurrentTime, FF_OK, Effect->second.Handle, Mode, Count);
+        } else if (Call.Call == "stop") {
+            Mixer.Stop(Effect->second.Handle, CurrentTime);
+            if (Recorder != NULL)
+                Recorder->Stop(CurrentTime, FF_OK, Effect->second.Handle);
+        } else if (Call.Call == "stream" && Arguments.size() == 2) {
+            UInt8 On = (Arguments[1] == "on");
+            if (Mixer.SetStreaming(Effect->second.Handle, On != 0) != FF_OK)
+                fprintf(stderr, "line %d: %s can't stream\n", Call.Line, Arguments[0].c_str());
+            // The plugin queues the escape, so only says whether the effect exists
+            if (Recorder != NULL)
+                Recorder->Escape(CurrentTime, FF_OK, Effect->second.Handle, 0x05, &On, sizeof(On));
+        } else if (Call.Call == "append" && Arguments.size() == 2) {
+            return Append(Mixer, Effect->second, Call, CurrentTime);
+        } else if (Call.Call == "destroy") {
+            HRESULT Result = Mixer.Destroy(Effect->second.Handle);
+            if (Recorder != NULL)
+                Recorder->Destroy(CurrentTime, Result, Effect->second.Handle);
+            Effects.erase(Effect);
+        } else {
+            fprintf(stderr, "line %d: can't understand %s\n", Call.Line, Call.Call.c_str());
+            return false;
+        }
+        return true;
+    }
+    fprintf(stderr, "line %d: can't understand %s\n", Call.Line, Call.Call.c_str());
+    return false;
+}
+
+// The input is published while the stick moves and once when it gets there, as the plugin only
+// publishes when the input changes
+static void PublishInput(ScriptDevice &Device, double Time, double CurrentTime)
+{
+    Feedback360InputState State;
+
+    if (!Device.Stick.Moving && Device.Input.Valid())
+        return;
+    Device.Stick.Moving = (Time < Device.Stick.End);
+    double Progress = (Time >= Device.Stick.End) ? 1 : (Time - Device.Stick.Start) / (Device.Stick.End - Device.Stick.Start);
+
+    State.Time = CurrentTime;
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        State.Position[Channel] = (LONG)(Device.Stick.From[Channel] + (Device.Stick.To[Channel] - Device.Stick.From[Channel]) * Progress);
+    Device.Input.Publish(State);
+}
+
+// Checks an expect line against the levels the motors were last sent, or that the controller is idle
+static void Expect(ScriptDevice &Device, const ScriptCall &Call, double Time)
+{
+    bool Met = true;
+
+    if (Call.Arguments[0] == "idle") {
+        Met = Device.Mixer.Idle();
+    } else {
+        std::vector<LONG> Levels;
+        ReadSamples(Call.Arguments[0], &Levels);
+        for (size_t Channel = 0; Channel < Levels.size() && Channel < FF_CHANNELS; Channel++)
+            Met = Met && (Levels[Channel] == Device.Sent[Channel]);
+    }
+    Device.Expected++;
+    if (!Met) {
+        Device.Unmet++;
+        fprintf(stderr, "line %d: expected %s at %.1f ms, the motors had %d,%d,%d,%d%s\n", Call.Line,
+                Call.Arguments[0].c_str(), Time, Device.Sent[CHANNEL_BIG], Device.Sent[CHANNEL_LITTLE],
+                Device.Sent[CHANNEL_TRIGGER_LEFT], Device.Sent[CHANNEL_TRIGGER_RIGHT], Device.Mixer.Idle() ? " and were idle" : "");
+    }
+}
+
+// What the plugin's EffectProc does for the scheduler, with the script's calls made at the
+// first tick after them. As in the plugin, a call only wakes a device that's idle
+static double DeviceTick(void *Context, double CurrentTime)
+{
+    ScriptDevice *Device = (ScriptDevice *)Context;
+    const std::vector<ScriptCall> &Calls = *Device->Calls;
+    double Time = (CurrentTime - Device->Start) * 1000;
+    unsigned char Levels[FF_CHANNELS];
+    size_t First = Device->Next;
+
+    while (Device->Next < Calls.size() && Calls[Device->Next].Time <= Time + CALL_SLACK)
+    {
+        if (!Apply(*Device, Calls[Device->Next++], CurrentTime)) {
+            Device->Failed = true;
+            return DBL_MAX;
+        }
+    }
+    PublishInput(*Device, Time, CurrentTime);
+    if (Device->Mixer.Tick(CurrentTime, Levels))
+        memcpy(Device->Sent, Levels, sizeof(Device->Sent));
+    Device->Ticks++;
+    for (size_t Call = First; Call < Device->Next; Call++)
+    {
+        if (Calls[Call].Call == "expect")
+            Expect(*Device, Calls[Call], Time);
+    }
+    if (Time >= Device->Length)
+        return DBL_MAX;
+
+    double Due = CurrentTime + Device->Mixer.TickPeriod / 1000000.;
+    if (Device->Mixer.Idle()) {
+        Due = Device->Mixer.NextDeadline();
+        if (Device->Next < Calls.size())
+            Due = std::min(Due, Device->Start + Calls[Device->Next].Time / 1000);
+    }
+    return std::min(Due, Device->Start + Device->Length / 1000);
+}
+
+static double CpuTime(void)
+{
+    struct rusage Usage;
+
+    getrusage(RUSAGE_SELF, &Usage);
+    return Usage.ru_utime.tv_sec + Usage.ru_stime.tv_sec + (Usage.ru_utime.tv_usec + Usage.ru_stime.tv_usec) / 1000. / 1000.;
+}
+
+// Plays the script on every device, sleeping between runs of whichever scheduler is due
+// first, and reports how often it woke and the CPU time it took
+static bool Play(const char *Name, std::vector<Feedback360Scheduler *> &Schedulers, std::vector<ScriptDevice *> &Devices, double Rate, double Length)
+{
+    Feedback360Clock *Clock = Feedback360DefaultClock();
+    double Start = Clock->Now() + 0.01;
+    std::vector<double> Due(Schedulers.size(), Start);
+    UInt64 Wakeups = 0, Ticks = 0;
+
+    for (size_t Index = 0; Index < Devices.size(); Index++)
+    {
+        ScriptDevice *Device = Devices[Index];
+        Device->Start = Start + Index / Rate / Devices.size();
+        Device->Length = Length;
+    }
+    for (size_t Index = 0; Index < Schedulers.size(); Index++)
+    {
+        for (UInt32 Device = 0; Device < Schedulers[Index]->Size(); Device++)
+            Schedulers[Index]->Wake(Schedulers[Index]->Context(Device), ((ScriptDevice *)Schedulers[Index]->Context(Device))->Start);
+    }
+
+    double Cpu = CpuTime();
+    while (true)
+    {
+        size_t First = std::min_element(Due.begin(), Due.end()) - Due.begin();
+        if (Due[First] == DBL_MAX)
+            break;
+
+        double Wait = Due[First] - Clock->Now();
+        if (Wait > 0) {
+            struct timespec Sleep = {(time_t)Wait, (long)((Wait - (time_t)Wait) * 1000 * 1000 * 1000)};
+            nanosleep(&Sleep, NULL);
+        }
+        Due[First] = Schedulers[First]->Run(Clock->Now());
+        Wakeups++;
+    }
+    Cpu = CpuTime() - Cpu;
+
+    for (size_t Index = 0; Index < Devices.size(); Index++)
+    {
+        if (Devices[Index]->Failed)
+            return false;
+        Ticks += Devices[Index]->Ticks;
+    }
+    fprintf(stderr, "%s: %llu wakeups, %llu ticks, %.1f ms CPU, %.0f wakeups/s\n", Name,
+            (unsigned long long)Wakeups, (unsigned long long)Ticks, Cpu * 1000, Wakeups / (Length / 1000));
+    return true;
+}
+
+static int Benchmark(const std::vector<ScriptCall> &Calls, UInt32 Count, double Rate, double Length)
+{
+    UInt32 TickPeriod = (UInt32)(1000 * 1000 / Rate);
+    std::vector<ScriptDevice *> Devices;
+    std::vector<Feedback360Scheduler *> Separate;
+    std::vector<Feedback360Scheduler *> Shared(1, new Feedback360Scheduler(TickPeriod));
+
+    for (UInt32 Index = 0; Index < Count; Index++)
+    {
+        Devices.push_back(new ScriptDevice(TickPeriod, &Calls));
+        Separate.push_back(new Feedback360Scheduler(TickPeriod));
+        Separate.back()->Add(Devices.back(), DeviceTick, TickPeriod, DBL_MAX);
+    }
+    if (!Play("timer per device", Separate, Devices, Rate, Length))
+        return 1;
+
+    for (UInt32 Index = 0; Index < Count; Index++)
+    {
+        delete Devices[Index];
+        Devices[Index] = new ScriptDevice(TickPeriod, &Calls);
+        if (!Shared[0]->Add(Devices[Index], DeviceTick, TickPeriod, DBL_MAX)) {
+            fprintf(stderr, "at most %d devices can share a scheduler\n", SCHEDULER_DEVICES_MAX);
+            return 1;
+        }
+    }
+    if (!Play("shared scheduler", Shared, Devices, Rate, Length))
+        return 1;
+    return 0;
+}
+
+
+// CPU time of the calling thread, so each side is measured alone even on a single core
+static double ThreadTime(void)
+{
+    struct timespec Time;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Time);
+    return Time.tv_sec + Time.tv_nsec / 1000. / 1000. / 1000.;
+}
+
+// DeviceTick, checking the device was only ticked when something needed it. The first tick
+// comes when the device is added and the last when the script ends, so neither counts
+static double CheckedTick(void *Context, double CurrentTime)
+{
+    ScriptDevice *Device = (ScriptDevice *)Context;
+    const std::vector<ScriptCall> &Calls = *Device->Calls;
+    double Time = (CurrentTime - Device->Start) * 1000;
+    bool Needed = (Device->Ticks == 0 || Time >= Device->Length || Device->Mixer.NextDeadline() <= CurrentTime);
+
+    for (size_t Next = Device->Next; Next < Calls.size() && Calls[Next].Time <= Time + CALL_SLACK; Next++)
+    {
+        double &Wait = Device->Idle ? Device->IdleWait : Device->PlayingWait;
+        Wait = std::max(Wait, Time - Calls[Next].Time);
+        Needed = true;
+    }
+    if (Device->Idle && !Needed)
+        Device->IdleTicks++;
+
+    double Due = DeviceTick(Context, CurrentTime);
+    Device->Idle = Device->Mixer.Idle();
+    return Due;
+}
+
+// Plays the script with the scheduler on a manual clock, so it runs flat out
+static int Check(const std::vector<ScriptCall> &Calls, double Rate, double Length)
+{
+    UInt32 TickPeriod = (UInt32)(1000 * 1000 / Rate);
+    static ScriptDevice Device(TickPeriod, &Calls);
+    Feedback360Scheduler Scheduler(TickPeriod);
+    Feedback360ManualClock Clock;
+    UInt64 Wakeups = 0;
+    UInt32 Playing = 0;
+
+    Device.Length = Length;
+    Scheduler.Add(&Device, CheckedTick, TickPeriod, 0);
+    double Cpu = ThreadTime();
+    for (double Due = 0; Due != DBL_MAX; Wakeups++)
+    {
+        if (Due < Clock.Now()) {
+            fprintf(stderr, "the scheduler asked for %.3f ms after running at %.3f ms\n", Due * 1000, Clock.Now() * 1000);
+            return 1;
+        }
+        Clock.Set(Due);
+        Due = Scheduler.Run(Clock.Now());
+    }
+    Cpu = ThreadTime() - Cpu;
+    if (Device.Failed)
+        return 1;
+
+    for (std::map<std::string, ScriptEffect>::iterator Effect = Device.Effects.begin(); Effect != Device.Effects.end(); ++Effect)
+    {
+        FFEffectStatusFlag Status = 0;
+        Device.Mixer.GetEffectStatus(Effect->second.Handle, &Status);
+        if (Status == FFEGES_PLAYING)
+            Playing++;
+    }
+    fprintf(stderr, "%llu ticks in %.3f ms CPU, %.0f%% of the %.0f ticks of the script\n",
+            (unsigned long long)Device.Ticks, Cpu * 1000, Device.Ticks * 100 / (Length * Rate / 1000 + 1), Length * Rate / 1000 + 1);
+    fprintf(stderr, "%llu ticks while idle, calls waited up to %.1f ms while idle and %.1f ms while playing\n",
+            (unsigned long long)Device.IdleTicks, Device.IdleWait, Device.PlayingWait);
+    fprintf(stderr, "%u of %u effects still playing at the end\n", Playing, (UInt32)Device.Effects.size());
+    if (Device.Expected > 0)
+        fprintf(stderr, "%u of %u expectations met\n", Device.Expected - Device.Unmet, Device.Expected);
+    return (Device.IdleTicks == 0 && Device.IdleWait == 0 && Device.Unmet == 0) ? 0 : 1;
+}
+
+// Plays the script flat out, holding a lock for each tick and the calls before it as the plugin
+// does its queue, while another thread queries. Handles are the first generation of the first
+// slots, which is what a script's first downloads get
+static bool Contend(const char *Name, const std::vector<ScriptCall> &Calls, double Rate, double Length, bool Locked)
+{
+    ScriptDevice *Device = new ScriptDevice((UInt32)(1000 * 1000 / Rate), &Calls);
+    std::mutex Lock;
+    std::atomic<bool> Done(false);
+    UInt64 Queries = 0, Ticks = 0;
+    double QueryTime = 0;
+
+    // Counted in the thread's own variables, as sharing a cache line with the ticks' would slow both
+    std::thread Querier([&] {
+        double Started = ThreadTime();
+        UInt64 Asked = 0;
+        while (!Done.load(std::memory_order_relaxed))
+        {
+            FFEffectStatusFlag Status = 0;
+            for (UInt32 Slot = 0; Slot < CONTENTION_EFFECTS; Slot++)
+            {
+                FFEffectDownloadID Handle = ((FFEffectDownloadID)1 << EFFECT_SLOT_BITS) | Slot;
+                if (Locked) {
+                    std::lock_guard<std::mutex> Guard(Lock);
+                    Device->Mixer.GetEffectStatus(Handle, &Status);
+                } else {
+                    Device->Mixer.Snapshot()->GetEffectStatus(Handle, &Status);
+                }
+            }
+            if (Locked) {
+                std::lock_guard<std::mutex> Guard(Lock);
+                Device->Mixer.GetState();
+            } else {
+                Device->Mixer.Snapshot()->GetState();
+            }
+            Asked += CONTENTION_EFFECTS + 1;
+        }
+        QueryTime = ThreadTime() - Started;
+        Queries = Asked;
+    });
+
+    unsigned char Levels[FF_CHANNELS];
+    size_t Next = 0;
+    bool Failed = false;
+    double Started = ThreadTime();
+    for (double Time = 0; Time <= Length && !Failed; Time = ++Ticks * 1000 / Rate)
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        while (Next < Calls.size() && Calls[Next].Time <= Time && !Failed)
+            Failed = !Apply(*Device, Calls[Next++], Time / 1000);
+        PublishInput(*Device, Time, Time / 1000);
+        Device->Mixer.Tick(Time / 1000, Levels);
+    }
+    double TickTime = ThreadTime() - Started;
+    Done = true;
+    Querier.join();
+    delete Device;
+    if (Failed)
+        return false;
+
+    fprintf(stderr, "%s: %llu queries, %.1f ns CPU each, %llu ticks in %.3f ms CPU\n", Name,
+            (unsigned long long)Queries, Queries > 0 ? QueryTime * 1e9 / Queries : 0.,
+            (unsigned long long)Ticks, TickTime * 1000);
+    return true;
+}
+
+// Carries out a start or stop the way the plugin's effect loop does
+static void ApplyCommand(Feedback360Mixer &Mixer, const Feedback360Command &Command, UInt64 *Applied)
+{
+    if (Command.Type == COMMAND_START)
+        Mixer.Start(Command.Handle, Command.Flags, Command.Value, Command.Time);
+    else
+        Mixer.Stop(Command.Handle, Command.Time);
+    (*Applied)++;
+}
+
+// Plays the script flat out while Threads game threads start and stop the first
+// CONTENTION_EFFECTS effects as fast as they can. Calls either take the lock each tick holds, as
+// they did when they went through the plugin's queue synchronously, or are pushed onto a command
+// queue the tick pops first, falling back to the lock as the plugin does when it is full
+static bool Submit(const char *Name, const std::vector<ScriptCall> &Calls, double Rate, double Length, UInt32 Threads, bool Locked)
+{
+    ScriptDevice *Device = new ScriptDevice((UInt32)(1000 * 1000 / Rate), &Calls);
+    Feedback360CommandQueue *Queue = new Feedback360CommandQueue();
+    std::mutex Lock;
+    std::atomic<bool> Done(false);
+    std::atomic<double> Now(0);
+    std::atomic<UInt32> Ready(0);
+    std::vector<std::thread> Games;
+    std::vector<UInt64> Made(Threads, 0), Full(Threads, 0);
+    std::vector<double> CallTime(Threads, 0);
+    UInt64 Applied = 0, Ticks = 0;
+
+    for (UInt32 Game = 0; Game < Threads; Game++)
+    {
+        Games.push_back(std::thread([&, Game] {
+            double Started = ThreadTime();
+            UInt64 Calls = 0, Fallbacks = 0;
+            Ready++;
+            while (!Done.load(std::memory_order_relaxed))
+            {
+                for (UInt32 Slot = 0; Slot < CONTENTION_EFFECTS; Slot++, Calls++)
+                {
+                    Feedback360Command Command = {(Calls & 1) ? (UInt32)COMMAND_STOP : (UInt32)COMMAND_START,
+                        ((FFEffectDownloadID)1 << EFFECT_SLOT_BITS) | Slot, 1, 0, Now.load(std::memory_order_relaxed)};
+                    if (!Locked && Queue->Push(Command))
+                        continue;
+                    std::lock_guard<std::mutex> Guard(Lock);
+                    for (Feedback360Command Waiting; !Locked && Queue->Pop(&Waiting); )
+                        ApplyCommand(Device->Mixer, Waiting, &Applied);
+                    ApplyCommand(Device->Mixer, Command, &Applied);
+                    Fallbacks += Locked ? 0 : 1;
+                }
+            }
+            CallTime[Game] = ThreadTime() - Started;
+            Made[Game] = Calls;
+            Full[Game] = Fallbacks;
+        }));
+    }
+
+    // The script only starts once every game is calling, or a single core may finish it first
+    while (Ready.load() < Threads)
+        std::this_thread::yield();
+
+    unsigned char Levels[FF_CHANNELS];
+    size_t Next = 0;
+    bool Failed = false;
+    double Started = ThreadTime();
+    for (double Time = 0; Time <= Length && !Failed; Time = ++Ticks * 1000 / Rate)
+    {
+        std::lock_guard<std::mutex> Guard(Lock);
+        Now.store(Time / 1000, std::memory_order_relaxed);
+        for (Feedback360Command Command; Queue->Pop(&Command); )
+            ApplyCommand(Device->Mixer, Command, &Applied);
+        while (Next < Calls.size() && Calls[Next].Time <= Time && !Failed)
+            Failed = !Apply(*Device, Calls[Next++], Time / 1000);
+        PublishInput(*Device, Time, Time / 1000);
+        Device->Mixer.Tick(Time / 1000, Levels);
+    }
+    double TickTime = ThreadTime() - Started;
+    Done = true;
+    for (UInt32 Game = 0; Game < Threads; Game++)
+        Games[Game].join();
+    for (Feedback360Command Command; Queue->Pop(&Command); )
+        ApplyCommand(Device->Mixer, Command, &Applied);
+    delete Queue;
+    delete Device;
+    if (Failed)
+        return false;
+
+    UInt64 Total = 0, Fallbacks = 0;
+    double Time = 0;
+    for (UInt32 Game = 0; Game < Threads; Game++)
+    {
+        Total += Made[Game];
+        Fallbacks += Full[Game];
+        Time += CallTime[Game];
+    }
+    fprintf(stderr, "%s: %llu calls, %.1f ns CPU each, %llu found the queue full, %llu ticks in %.3f ms CPU\n", Name,
+            (unsigned long long)Total, Total > 0 ? Time * 1e9 / Total : 0., (unsigned long long)Fallbacks,
+            (unsigned long long)Ticks, TickTime * 1000);
+    if (Applied != Total) {
+        fprintf(stderr, "%s: %llu calls made but %llu carried out\n", Name, (unsigned long long)Total, (unsigned long long)Applied);
+        return false;
+    }
+    return true;
+}
+
+// The regular types -g compares, as the script names them, in the order of their kinds
+static const char *GoldenTypes[] = {"constant", "ramp", "square", "sine", "triangle", "sawup", "sawdown"};
+
+//----------------------------------------------------------------------------------------------
+// GoldenLevel - the level Calc worked out before effects were compiled, at PositionMs of a
+// DurationMs play, with whole percent envelopes and whole degree phases. The envelope applies
+// whenever there is one, as it does now
+//----------------------------------------------------------------------------------------------
+static LONG GoldenLevel(const Feedback360Effect &Effect, UInt8 Kind, LONG Duration, LONG CurrentPos)
+{
+    const FFPERIODIC &Periodic = Effect.DiParams.Periodic;
+    LONG NormalRate = 100, AttackLevel = 0, FadeLevel = 0;
+
+    if (Effect.DiEffect.lpEnvelope != NULL) {
+        LONG AttackRate = 0, FadeRate = 0;
+        LONG AttackTime = std::max( (LONG)1, (LONG)Effect.DiEnvelope.dwAttackTime / 1000 );
+        LONG FadeTime = std::max( (LONG)1, (LONG)Effect.DiEnvelope.dwFadeTime / 1000 );
+        LONG FadePos = Duration - FadeTime;
+        if (CurrentPos < AttackTime)
+            AttackRate = ( AttackTime - CurrentPos ) * 100 / AttackTime;
+        if (FadePos < CurrentPos)
+            FadeRate = ( CurrentPos - FadePos ) * 100 / FadeTime;
+        NormalRate = 100 - AttackRate - FadeRate;
+        AttackLevel = Effect.DiEnvelope.dwAttackLevel * AttackRate;
+        FadeLevel = Effect.DiEnvelope.dwFadeLevel * FadeRate;
+    }
+
+    LONG Period = std::max( (LONG)1, (LONG)Periodic.dwPeriod / 1000 );
+    LONG R = ( ( CurrentPos % Period ) * 360 / Period + (LONG)Periodic.dwPhase / 100 ) % 360;
+    LONG Magnitude = ( (LONG)Periodic.dwMagnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
+    switch (Kind) {
+        case CONSTANT_FORCE:
+            Magnitude = ( Effect.DiParams.ConstantForce.lMagnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
+            break;
+        case RAMP_FORCE:
+        {
+            LONG Rate = ( Duration - CurrentPos ) * 100 / Duration;
+            Magnitude = ( Effect.DiParams.RampForce.lStart * Rate + Effect.DiParams.RampForce.lEnd * ( 100 - Rate ) ) / 100;
+            Magnitude = ( Magnitude * NormalRate + AttackLevel + FadeLevel ) / 100;
+            break;
+        }
+        case SQUARE:
+            Magnitude = ( (180 <= R) ? -Magnitude : Magnitude ) + Periodic.lOffset;
+            break;
+        case SINE:
+            Magnitude = (LONG)( Magnitude * sin( R * M_PI / 180.0 ) ) + Periodic.lOffset;
+            break;
+        case TRIANGLE:
+            if (R < 90)         Magnitude = -Magnitude * ( 90 - R ) / 90;
+            else if (R < 180)   Magnitude = Magnitude * ( R - 90 ) / 90;
+            else if (R < 270)   Magnitude = Magnitude * ( 90 - ( R - 180 ) ) / 90;
+            else                Magnitude = -Magnitude * ( R - 270 ) / 90;
+            Magnitude += Periodic.lOffset;
+            break;
+        case SAWTOOTH_UP:
+            Magnitude = ( (R < 180) ? -Magnitude * ( 180 - R ) / 180 : Magnitude * ( R - 180 ) / 180 ) + Periodic.lOffset;
+            break;
+        default:
+            Magnitude = ( (R < 180) ? Magnitude * ( 180 - R ) / 180 : -Magnitude * ( R - 180 ) / 180 ) + Periodic.lOffset;
+            break;
+    }
+
+    LONG NormalLevel = Magnitude * (LONG)Effect.DiEffect.dwGain / 10000;
+    return std::min( SCALE_MAX, (LONG)abs(NormalLevel) * SCALE_MAX / 10000 );
+}
+
+//----------------------------------------------------------------------------------------------
+// GoldenBound - how many levels GoldenLevel can be out from the exact waveform, so how far the
+// compiled effect may differ from it. Each whole percent step of an envelope is out by under a
+// hundredth of the way from the magnitude to the attack or fade level, and each of a ramp by
+// under a hundredth of the way from start to end. Whole degrees are out by under a degree, and
+// another when the phase isn't whole degrees, which moves the wave by its steepest slope for
+// each. That is scaled by the gain to levels, rounded up, with one more as both sides truncate
+// the level and another for the integer divisions along the way
+//----------------------------------------------------------------------------------------------
+static LONG GoldenBound(const Feedback360Effect &Effect, UInt8 Kind)
+{
+    const FFPERIODIC &Periodic = Effect.DiParams.Periodic;
+    double Magnitude = Periodic.dwMagnitude, Error = 0;
+
+    if (Kind == CONSTANT_FORCE)
+        Magnitude = abs(Effect.DiParams.ConstantForce.lMagnitude);
+    else if (Kind == RAMP_FORCE)
+        Magnitude = std::max(abs(Effect.DiParams.RampForce.lStart), abs(Effect.DiParams.RampForce.lEnd));
+
+    if (Effect.DiEffect.lpEnvelope != NULL)
+        Error += ( Magnitude + std::max(Effect.DiEnvelope.dwAttackLevel, Effect.DiEnvelope.dwFadeLevel) ) / 100;
+    if (Kind == RAMP_FORCE)
+        Error += abs(Effect.DiParams.RampForce.lEnd - Effect.DiParams.RampForce.lStart) / 100.;
+
+    double Degrees = ( Periodic.dwPhase % 100 == 0 ) ? 1 : 2;
+    switch (Kind) {
+        case SINE:          Error += Degrees * Magnitude * M_PI / 180;  break;
+        case TRIANGLE:      Error += Degrees * Magnitude / 90;          break;
+        case SAWTOOTH_UP:
+        case SAWTOOTH_DOWN: Error += Degrees * Magnitude / 180;         break;
+        default:                                                        break;
+    }
+
+    return (LONG)ceil( Error * Effect.DiEffect.dwGain / 10000 * SCALE_MAX / 10000 ) + 2;
+}
+
+// Plays each regular type once with and once without an envelope, a millisecond at a time,
+// comparing the compiled effect with the level it had before effects were compiled
+static int Golden(void)
+{
+    static Feedback360Effect Effect;
+    LONG Worst = 0, Failed = 0;
+
+    for (UInt8 Kind = CONSTANT_FORCE; Kind <= SAWTOOTH_DOWN; Kind++)
+    {
+        for (int Enveloped = 0; Enveloped < 2; Enveloped++)
+        {
+            Effect.Reset(1);
+            Effect.Type = EffectType(GoldenTypes[Kind]);
+            Effect.DiEffect.dwDuration = GOLDEN_DURATION * 1000;
+            Effect.DiEffect.dwGain = 7500;
+            Effect.DiEffect.lpEnvelope = Enveloped ? &Effect.DiEnvelope : NULL;
+            Effect.DiEnvelope.dwAttackLevel = 2000;
+            Effect.DiEnvelope.dwAttackTime = 200 * 1000;
+            Effect.DiEnvelope.dwFadeLevel = 0;
+            Effect.DiEnvelope.dwFadeTime = 300 * 1000;
+            if (Kind == CONSTANT_FORCE) {
+                Effect.DiParams.ConstantForce.lMagnitude = -8000;
+            } else if (Kind == RAMP_FORCE) {
+                Effect.DiParams.RampForce.lStart = -6000;
+                Effect.DiParams.RampForce.lEnd = 9000;
+            } else {
+                // No millisecond lands on an edge of a 210 ms square or sawtooth, where the
+                // slightest difference in phase would flip it
+                Effect.DiParams.Periodic.dwMagnitude = 8000;
+                Effect.DiParams.Periodic.lOffset = 1000;
+                Effect.DiParams.Periodic.dwPhase = 4500;
+                Effect.DiParams.Periodic.dwPeriod = 210 * 1000;
+            }
+            Effect.Compile();
+            Effect.Status = FFEGES_PLAYING;
+            Effect.PlayCount = 1;
+
+            LONG Largest = 0, Allowed = GoldenBound(Effect, Kind) + GOLDEN_HEADROOM;
+            for (LONG Position = 0; Position < GOLDEN_DURATION; Position++)
+            {
+                LONG Levels[FF_CHANNELS] = {0};
+                Effect.Calc(Position / 1000., Levels, NULL);
+                Largest = std::max(Largest, (LONG)abs(Levels[CHANNEL_BIG] - GoldenLevel(Effect, Kind, GOLDEN_DURATION, Position)));
+            }
+            fprintf(stderr, "%-8s %-16s differs by up to %d, %d allowed\n", GoldenTypes[Kind], Enveloped ? "with envelope" : "without envelope", Largest, Allowed);
+            Worst = std::max(Worst, Largest);
+            if (Largest > Allowed)
+                Failed++;
+        }
+    }
+    fprintf(stderr, "largest difference %d of %d, %d cases out of bounds\n", Worst, SCALE_MAX, Failed);
+    return (Failed == 0) ? 0 : 1;
+}
+
+// Downloads a constant force for the handle checks and benchmarks
+static HRESULT DownloadConstant(Feedback360Mixer &Mixer, FFEffectDownloadID *Handle, LONG Magnitude, FFENVELOPE *Envelope)
+{
+    FFEFFECT DiEffect;
+    FFCONSTANTFORCE Constant;
+
+    memset(&DiEffect, 0, sizeof(DiEffect));
+    DiEffect.dwSize = sizeof(DiEffect);
+    DiEffect.dwDuration = FF_INFINITE;
+    DiEffect.dwGain = 10000;
+    DiEffect.lpEnvelope = Envelope;
+    Constant.lMagnitude = Magnitude;
+    DiEffect.cbTypeSpecificParams = sizeof(Constant);
+    DiEffect.lpvTypeSpecificParams = &Constant;
+    return Mixer.Download(kFFEffectType_ConstantForce_ID, Handle, &DiEffect, FFEP_ALLPARAMS, 0);
+}
+
+// Where -h puts its results, so the lookups aren't optimised away
+static volatile UInt32 HandleSink;
+
+// The plugin's effects were kept in a std::vector and searched for each call, as this does
+static Feedback360Effect *ScanEffects(Feedback360Effect *Effects, UInt32 Count, FFEffectDownloadID Handle)
+{
+    for (UInt32 Index = 0; Index < Count; Index++)
+    {
+        if (Effects[Index].Handle == Handle)
+            return &Effects[Index];
+    }
+    return NULL;
+}
+
+// Fills the mixer with effects, checks handles of destroyed effects and handles made up for
+// free slots are refused, then times looking up every effect by its handle, in a shuffled
+// order, in the effect map and by searching as the plugin did before, and times the calls
+// a game makes with a handle
+static int Handles(void)
+{
+    static Feedback360Mixer Mixer(1000 * 1000 / DEFAULT_RATE);
+    static Feedback360EffectMap Map;
+    static Feedback360Effect Scanned[EFFECT_CAPACITY];
+    FFEffectDownloadID Handles[EFFECT_CAPACITY], Order[EFFECT_CAPACITY];
+    FFEffectStatusFlag Status;
+    UInt32 Tried = 0, Wrong = 0, Seed = 12345;
+
+    // Nothing downloaded yet, so no slot's first handle may find anything
+    for (UInt32 Slot = 0; Slot < EFFECT_CAPACITY; Slot++)
+    {
+        FFEffectDownloadID Forged = ((FFEffectDownloadID)1 << EFFECT_SLOT_BITS) | Slot;
+        if (Mixer.Contains(Forged) || Mixer.GetEffectStatus(Forged, &Status) != FFERR_INVALIDDOWNLOADID)
+            Wrong++;
+    }
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+    {
+        Handles[Index] = 0;
+        if (DownloadConstant(Mixer, &Handles[Index], 1000, NULL) != FF_OK)
+            Wrong++;
+    }
+    FFEffectDownloadID Extra = 0;
+    if (DownloadConstant(Mixer, &Extra, 1000, NULL) != FFERR_DEVICEFULL)
+        Wrong++;
+
+    // Destroyed handles, and any handle on the slots they leave free, must be refused, with
+    // the slots' current generation and the ones either side of it
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index += 2)
+    {
+        if (Mixer.Destroy(Handles[Index]) != FF_OK)
+            Wrong++;
+    }
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index += 2)
+    {
+        UInt32 Slot = Handles[Index] & EFFECT_SLOT_MASK, Generation = Handles[Index] >> EFFECT_SLOT_BITS;
+        for (UInt32 Try = Generation - 1; Try <= Generation + 1; Try++)
+        {
+            FFEffectDownloadID Forged = ((FFEffectDownloadID)Try << EFFECT_SLOT_BITS) | Slot;
+            Tried++;
+            if (Mixer.Contains(Forged) || Mixer.GetEffectStatus(Forged, &Status) != FFERR_INVALIDDOWNLOADID)
+                Wrong++;
+        }
+        if (Mixer.Destroy(Handles[Index]) != FFERR_INVALIDDOWNLOADID)
+            Wrong++;
+    }
+    // The effects left must all still be found, and the free slots reused with new handles
+    for (UInt32 Index = 1; Index < EFFECT_CAPACITY; Index += 2)
+    {
+        if (!Mixer.Contains(Handles[Index]) || Mixer.GetEffectStatus(Handles[Index], &Status) != FF_OK)
+            Wrong++;
+    }
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index += 2)
+    {
+        FFEffectDownloadID Old = Handles[Index];
+        Handles[Index] = 0;
+        if (DownloadConstant(Mixer, &Handles[Index], 1000, NULL) != FF_OK || Handles[Index] == Old || Mixer.Contains(Old))
+            Wrong++;
+    }
+    fprintf(stderr, "%d effects, %u made up or destroyed handles tried, %u checks failed\n", EFFECT_CAPACITY, Tried, Wrong);
+
+    // The same effects in the map and in a plain array, as the plugin's vector was
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+    {
+        Feedback360Effect *Effect = Map.Add();
+        Scanned[Index].Reset(Effect->Handle);
+        Order[Index] = Effect->Handle;
+    }
+    for (UInt32 Index = EFFECT_CAPACITY - 1; Index > 0; Index--)
+    {
+        Seed = Seed * 1103515245 + 12345;
+        std::swap(Order[Index], Order[(Seed >> 16) % (Index + 1)]);
+    }
+    UInt32 Sum = 0;
+    double Started = Feedback360DefaultClock()->Now();
+    for (UInt32 Round = 0; Round < HANDLE_ROUNDS; Round++)
+    {
+        for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+            Sum += (UInt32)(Map.Find(Order[Index]) != NULL);
+    }
+    double MapTime = Feedback360DefaultClock()->Now() - Started;
+    Started = Feedback360DefaultClock()->Now();
+    for (UInt32 Round = 0; Round < HANDLE_ROUNDS; Round++)
+    {
+        for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+            Sum += (UInt32)(ScanEffects(Scanned, EFFECT_CAPACITY, Order[Index]) != NULL);
+    }
+    double ScanTime = Feedback360DefaultClock()->Now() - Started;
+    HandleSink = Sum;
+    double Lookups = (double)HANDLE_ROUNDS * EFFECT_CAPACITY;
+    fprintf(stderr, "lookup: %.1f ns in the effect map, %.1f ns searching\n", MapTime * 1e9 / Lookups, ScanTime * 1e9 / Lookups);
+
+    // What a game does with its handles: start, ask after and stop each effect
+    Started = Feedback360DefaultClock()->Now();
+    for (UInt32 Round = 0; Round < HANDLE_ROUNDS; Round++)
+    {
+        for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+        {
+            Mixer.Start(Handles[Index], 0, 1, 0);
+            Mixer.GetEffectStatus(Handles[Index], &Status);
+            Mixer.Stop(Handles[Index], 0);
+        }
+    }
+    double CallTime = Feedback360DefaultClock()->Now() - Started;
+    fprintf(stderr, "start, status and stop: %.1f ns per call\n", CallTime * 1e9 / Lookups / 3);
+    return (Wrong == 0) ? 0 : 1;
+}
+
+// The big motor's level a single enveloped constant force plays at the start, on its own
+static UInt8 EnvelopeLevel(Feedback360Mixer &Mixer, FFEffectDownloadID Handle, double Time, unsigned char *Levels)
+{
+    Mixer.Start(Handle, FFES_SOLO, 1, Time);
+    Mixer.Tick(Time, Levels);
+    return Levels[CHANNEL_BIG];
+}
+
+// Downloads EFFECT_CAPACITY constant forces with envelopes, churns the slots, and checks each
+// effect still plays with its own envelope. The effect map is checked directly too: effects
+// must stay where they were added, with their envelope pointers at their own envelopes
+static int Envelopes(void)
+{
+    static Feedback360Mixer Mixer(1000 * 1000 / DEFAULT_RATE), Reference(1000 * 1000 / DEFAULT_RATE);
+    static Feedback360EffectMap Map;
+    FFEffectDownloadID Handles[EFFECT_CAPACITY];
+    FFENVELOPE Envelopes[EFFECT_CAPACITY];
+    Feedback360Effect *Added[EFFECT_CAPACITY];
+    unsigned char Levels[FF_CHANNELS] = {0}, ReferenceLevels[FF_CHANNELS] = {0};
+    UInt32 Wrong = 0, Moved = 0, Checked = 0;
+
+    // Every attack level is different, and the attack is long enough to play at it
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+    {
+        memset(&Envelopes[Index], 0, sizeof(Envelopes[Index]));
+        Envelopes[Index].dwSize = sizeof(FFENVELOPE);
+        Envelopes[Index].dwAttackLevel = (Index * 97) % EFFECT_CAPACITY * 10000 / EFFECT_CAPACITY;
+        Envelopes[Index].dwAttackTime = 100 * 1000 * 1000;
+        Handles[Index] = 0;
+        if (DownloadConstant(Mixer, &Handles[Index], 10000, &Envelopes[Index]) != FF_OK)
+            Wrong++;
+    }
+    // Every third effect is destroyed and downloaded again with the next one's envelope, so
+    // slots are reused in between effects that stay
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index += 3)
+    {
+        Mixer.Destroy(Handles[Index]);
+        Envelopes[Index].dwAttackLevel = Envelopes[(Index + 1) % EFFECT_CAPACITY].dwAttackLevel / 2;
+        Handles[Index] = 0;
+        if (DownloadConstant(Mixer, &Handles[Index], 10000, &Envelopes[Index]) != FF_OK)
+            Wrong++;
+    }
+    // Changing only the gain works the effect out again from the envelope it kept
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+    {
+        FFEFFECT DiEffect;
+        memset(&DiEffect, 0, sizeof(DiEffect));
+        DiEffect.dwSize = sizeof(DiEffect);
+        DiEffect.dwGain = 10000;
+        if (Mixer.Download(kFFEffectType_ConstantForce_ID, &Handles[Index], &DiEffect, FFEP_GAIN, 0) != FF_OK)
+            Wrong++;
+    }
+    // Each compared with the same effect played alone on a mixer with nothing else downloaded
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+    {
+        FFEffectDownloadID Alone = 0;
+        double Time = Index * 10. / 1000;
+        DownloadConstant(Reference, &Alone, 10000, &Envelopes[Index]);
+        if (EnvelopeLevel(Mixer, Handles[Index], Time, Levels) != EnvelopeLevel(Reference, Alone, Time, ReferenceLevels))
+            Wrong++;
+        Reference.Destroy(Alone);
+    }
+
+    for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+    {
+        Added[Index] = Map.Add();
+        Added[Index]->DiEnvelope.dwAttackLevel = Index;
+        Added[Index]->DiEffect.lpEnvelope = &Added[Index]->DiEnvelope;
+    }
+    for (UInt32 Round = 0; Round < 4; Round++)
+    {
+        for (UInt32 Index = Round; Index < EFFECT_CAPACITY; Index += 5)
+        {
+            Map.Remove(Added[Index]->Handle);
+            Added[Index] = Map.Add();
+            Added[Index]->DiEnvelope.dwAttackLevel = Index;
+            Added[Index]->DiEffect.lpEnvelope = &Added[Index]->DiEnvelope;
+        }
+        for (UInt32 Index = 0; Index < EFFECT_CAPACITY; Index++)
+        {
+            Feedback360Effect *Effect = Map.Find(Added[Index]->Handle);
+            Checked++;
+            if (Effect != Added[Index])
+                Moved++;
+            else if (Effect->DiEffect.lpEnvelope != &Effect->DiEnvelope || Effect->DiEffect.lpEnvelope->dwAttackLevel != Index)
+                Wrong++;
+        }
+    }
+    fprintf(stderr, "%d enveloped effects played, %u effects checked in the map, %u moved, %u checks failed\n",
+            EFFECT_CAPACITY, Checked, Moved, Wrong);
+    return (Wrong == 0 && Moved == 0) ? 0 : 1;
+}
+
+// Periods in milliseconds, so the old position to the millisecond lands on whole periods, and
+// phases in hundredths of a degree
+static const DWORD WavePeriods[] = {10, 33, 210, 1000, 7300};
+static const DWORD WavePhases[] = {0, 4500, 12345, 27000, 35999};
+
+// Where -f's samples go, so the timed loops aren't optimised away
+static volatile LONG WaveSink;
+
+// A periodic wave at R degrees, the way CalcForce shaped it
+static double OldWave(UInt8 Kind, double Magnitude, double R)
+{
+    switch (Kind) {
+        case SQUARE:        return (180 <= R) ? -Magnitude : Magnitude;
+        case SINE:          return Magnitude * sin( R * M_PI / 180.0 );
+        case TRIANGLE:
+            if (R < 90)     return -Magnitude * ( 90 - R ) / 90;
+            if (R < 180)    return Magnitude * ( R - 90 ) / 90;
+            if (R < 270)    return Magnitude * ( 90 - ( R - 180 ) ) / 90;
+            return -Magnitude * ( R - 270 ) / 90;
+        case SAWTOOTH_UP:   return (R < 180) ? -Magnitude * ( 180 - R ) / 180 : Magnitude * ( R - 180 ) / 180;
+        default:            return (R < 180) ? Magnitude * ( 180 - R ) / 180 : -Magnitude * ( R - 180 ) / 180;
+    }
+}
+
+// The steepest the wave gets, in units per degree, 0 for a square, which is flat between jumps
+static double WaveSlope(UInt8 Kind, double Magnitude)
+{
+    switch (Kind) {
+        case SINE:          return Magnitude * M_PI / 180;
+        case TRIANGLE:      return Magnitude / 90;
+        case SAWTOOTH_UP:
+        case SAWTOOTH_DOWN: return Magnitude / 180;
+        default:            return 0;
+    }
+}
+
+// How far R is from the nearest jump of the wave, in degrees, 360 if it has none
+static double JumpDistance(UInt8 Kind, double R)
+{
+    double ToStart = std::min(R, 360 - R);
+    if (Kind == SQUARE)
+        return std::min(ToStart, fabs(R - 180));
+    if (Kind == SAWTOOTH_UP || Kind == SAWTOOTH_DOWN)
+        return ToStart;
+    return 360;
+}
+
+//----------------------------------------------------------------------------------------------
+// Waveforms - compares the periodic kernels with the exact waves and with CalcForce's. The
+// kernels' phase is a 32 bit fraction of the period, too fine to matter, so what is left is
+// under a unit each for the sine table's interpolation, its scale of 32767 and the truncation
+// of the kernel and the offset, which WAVE_TOLERANCE allows with a unit to spare. CalcForce
+// took the position to the millisecond, then the phase to the degree, and the phase offset to
+// the degree too, so is out by under 360 over the period in milliseconds and a degree or two
+// more, at the wave's steepest slope, and a unit for its own truncation
+//----------------------------------------------------------------------------------------------
+static int Waveforms(void)
+{
+    static Feedback360Effect Effect;
+    static LONG Kernel[2 * WAVE_SAMPLES];
+    static double Old[2 * WAVE_SAMPLES];
+    static UInt64 Positions[2 * WAVE_SAMPLES];
+    UInt32 Failed = 0;
+
+    for (UInt8 Kind = SQUARE; Kind <= SAWTOOTH_DOWN; Kind++)
+    {
+        double KernelWorst = 0, OldWorst = 0, Apart = 0, KernelTime = 0, OldTime = 0;
+        UInt32 Samples = 0;
+
+        for (size_t PeriodIndex = 0; PeriodIndex < sizeof(WavePeriods) / sizeof(WavePeriods[0]); PeriodIndex++)
+        {
+            for (size_t PhaseIndex = 0; PhaseIndex < sizeof(WavePhases) / sizeof(WavePhases[0]); PhaseIndex++)
+            {
+                const DWORD Period = WavePeriods[PeriodIndex], Phase = WavePhases[PhaseIndex];
+                const LONG Offset = (PhaseIndex % 2) ? -1500 : 0;
+
+                Effect.Reset(1);
+                Effect.Type = EffectType(GoldenTypes[Kind]);
+                Effect.DiEffect.dwDuration = FF_INFINITE;
+                Effect.DiEffect.dwGain = 10000;
+                Effect.DiParams.Periodic.dwMagnitude = 10000;
+                Effect.DiParams.Periodic.lOffset = Offset;
+                Effect.DiParams.Periodic.dwPhase = Phase;
+                Effect.DiParams.Periodic.dwPeriod = Period * 1000;
+                Effect.Compile();
+
+                for (UInt32 Sample = 0; Sample < 2 * WAVE_SAMPLES; Sample++)
+                    Positions[Sample] = (UInt64)Sample * Period * 1000 / WAVE_SAMPLES;
+
+                double Started = ThreadTime();
+                for (UInt32 Round = 0; Round < WAVE_ROUNDS; Round++)
+                {
+                    for (UInt32 Sample = 0; Sample < 2 * WAVE_SAMPLES; Sample++)
+                    {
+                        UInt32 PhasePos = (UInt32)((Positions[Sample] * Effect.PhaseStep) >> 32) + Effect.PhaseOffset;
+                        Kernel[Sample] = Effect.Kernel(&Effect, Positions[Sample], PhasePos, 1 << 16, 0);
+                    }
+                    WaveSink = Kernel[Round];
+                }
+                KernelTime += ThreadTime() - Started;
+
+                Started = ThreadTime();
+                for (UInt32 Round = 0; Round < WAVE_ROUNDS; Round++)
+                {
+                    for (UInt32 Sample = 0; Sample < 2 * WAVE_SAMPLES; Sample++)
+                    {
+                        LONG CurrentPos = (LONG)(Positions[Sample] / 1000);
+                        LONG R = ( ( CurrentPos % (LONG)Period ) * 360 / (LONG)Period + (LONG)Phase / 100 ) % 360;
+                        Old[Sample] = (LONG)OldWave(Kind, 10000, R) + Offset;
+                    }
+                    WaveSink = (LONG)Old[Round];
+                }
+                OldTime += ThreadTime() - Started;
+
+                double OldSteps = 360. / Period + ( (Phase % 100 == 0) ? 1 : 2 );
+                double OldBound = OldSteps * WaveSlope(Kind, 10000) + 1;
+                for (UInt32 Sample = 0; Sample < 2 * WAVE_SAMPLES; Sample++)
+                {
+                    double R = fmod( Positions[Sample] * 360. / ( Period * 1000. ) + Phase / 100., 360 );
+                    double Exact = OldWave(Kind, 10000, R) + Offset;
+                    double Jump = JumpDistance(Kind, R);
+
+                    // A jump can't be sampled exactly, so only wherever the wave is continuous
+                    if (Jump > 1e-6)
+                        KernelWorst = std::max(KernelWorst, fabs(Kernel[Sample] - Exact));
+                    if (Jump > OldSteps) {
+                        OldWorst = std::max(OldWorst, fabs(Old[Sample] - Exact));
+                        if (fabs(Kernel[Sample] - Old[Sample]) > OldBound + WAVE_TOLERANCE)
+                            Failed++;
+                        Apart = std::max(Apart, fabs(Kernel[Sample] - Old[Sample]));
+                    }
+                    Samples++;
+                }
+            }
+        }
+        if (KernelWorst > WAVE_TOLERANCE)
+            Failed++;
+        fprintf(stderr, "%-8s %u samples: kernel out by up to %.1f, CalcForce by %.1f, %.1f apart, %.1f ns a sample, %.1f ns before\n",
+                GoldenTypes[Kind], Samples, KernelWorst, OldWorst, Apart,
+                KernelTime * 1e9 / Samples / WAVE_ROUNDS, OldTime * 1e9 / Samples / WAVE_ROUNDS);
+    }
+    fprintf(stderr, "%u checks failed, %d allowed out of 10000\n", Failed, WAVE_TOLERANCE);
+    return (Failed == 0) ? 0 : 1;
+}
+
+// The types -b plays, in turn
+static const CFUUIDRef BlockTypes[] = {kFFEffectType_Sine_ID, kFFEffectType_Square_ID, kFFEffectType_Triangle_ID,
+                                       kFFEffectType_SawtoothUp_ID, kFFEffectType_SawtoothDown_ID};
+
+// Plays Count periodic effects for BLOCK_TICKS ticks, rendering Ahead ticks at a time, and
+// returns the CPU time the ticks took. Every fourth effect has an attack
+static double PlayBlocks(UInt32 Count, UInt32 Ahead, unsigned char (*Levels)[FF_CHANNELS], UInt32 *Reports)
+{
+    UInt32 TickPeriod = 1000 * 1000 / DEFAULT_RATE;
+    Feedback360Mixer *Mixer = new Feedback360Mixer(TickPeriod);
+    FFEffectDownloadID Handles[EFFECT_CAPACITY];
+    FFENVELOPE Envelope;
+    FFPERIODIC Periodic;
+    FFEFFECT DiEffect;
+
+    memset(&Envelope, 0, sizeof(Envelope));
+    Envelope.dwSize = sizeof(Envelope);
+    Envelope.dwAttackTime = 500 * 1000;
+    Mixer->SetRenderAhead(Ahead);
+    for (UInt32 Index = 0; Index < Count; Index++)
+    {
+        memset(&DiEffect, 0, sizeof(DiEffect));
+        DiEffect.dwSize = sizeof(DiEffect);
+        DiEffect.dwDuration = FF_INFINITE;
+        DiEffect.dwGain = 10000;
+        DiEffect.lpEnvelope = (Index % 4 == 3) ? &Envelope : NULL;
+        Periodic.dwMagnitude = 2000;
+        Periodic.lOffset = 0;
+        Periodic.dwPhase = Index * 3600 % 36000;
+        Periodic.dwPeriod = ( 50 + Index * 7 ) * 1000;
+        DiEffect.cbTypeSpecificParams = sizeof(Periodic);
+        DiEffect.lpvTypeSpecificParams = &Periodic;
+        Handles[Index] = 0;
+        Mixer->Download(BlockTypes[Index % (sizeof(BlockTypes) / sizeof(BlockTypes[0]))], &Handles[Index], &DiEffect, FFEP_ALLPARAMS, 0);
+        Mixer->Start(Handles[Index], 0, 1, 0);
+    }
+
+    *Reports = 0;
+    double Started = ThreadTime();
+    for (UInt32 Tick = 0; Tick < BLOCK_TICKS; Tick++)
+    {
+        double Time = (double)Tick * TickPeriod / 1000 / 1000;
+        if (Tick % BLOCK_CHANGE == BLOCK_CHANGE - 1) {
+            FFEffectDownloadID Handle = Handles[Tick / BLOCK_CHANGE % Count];
+            Mixer->Stop(Handle, Time);
+            Mixer->Start(Handle, 0, 1, Time);
+        }
+        if (Mixer->Tick(Time, Levels[Tick]))
+            (*Reports)++;
+        else if (Tick > 0)
+            memcpy(Levels[Tick], Levels[Tick - 1], FF_CHANNELS);
+    }
+    double Time = ThreadTime() - Started;
+    delete Mixer;
+    return Time;
+}
+
+// Times ticks with and without render ahead at 1, 16 and EFFECT_CAPACITY effects, checking
+// both play the same levels
+static int Blocks(void)
+{
+    static unsigned char Every[BLOCK_TICKS][FF_CHANNELS], Ahead[BLOCK_TICKS][FF_CHANNELS];
+    static const UInt32 Counts[] = {1, 16, EFFECT_CAPACITY};
+    UInt32 Failed = 0;
+
+    for (size_t Index = 0; Index < sizeof(Counts) / sizeof(Counts[0]); Index++)
+    {
+        UInt32 EveryReports, AheadReports, Differ = 0, Worst = 0;
+        memset(Every, 0, sizeof(Every));
+        memset(Ahead, 0, sizeof(Ahead));
+        double EveryTime = PlayBlocks(Counts[Index], 0, Every, &EveryReports);
+        double AheadTime = PlayBlocks(Counts[Index], RENDER_AHEAD_MAX, Ahead, &AheadReports);
+
+        for (UInt32 Tick = 0; Tick < BLOCK_TICKS; Tick++)
+        {
+            if (memcmp(Every[Tick], Ahead[Tick], FF_CHANNELS) != 0)
+                Differ++;
+            for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+                Worst = std::max(Worst, (UInt32)abs(Every[Tick][Channel] - Ahead[Tick][Channel]));
+        }
+        fprintf(stderr, "%3u effects: %7.1f ns a tick rendering %d ahead, %7.1f ns every tick, %u of %u ticks differ, by up to %u, %u and %u reports\n",
+                Counts[Index], AheadTime * 1e9 / BLOCK_TICKS, RENDER_AHEAD_MAX, EveryTime * 1e9 / BLOCK_TICKS,
+                Differ, BLOCK_TICKS, Worst, AheadReports, EveryReports);
+        if (Differ > 0)
+            Failed++;
+    }
+    return (Failed == 0) ? 0 : 1;
+}
+
+// Milliseconds -l's link takes for each send
+static const UInt32 LinkDelays[] = {0, 2, 20};
+
+// The link -l sends on, taking DelayUs for each send, as a slow USB round trip would
+struct DelayedLink {
+    UInt32 DelayUs;
+    UInt32 Sends;
+    UInt32 LastSent;
+
+    void Send(UInt32 Sequence)
+    {
+        struct timespec Sleep = {(time_t)(DelayUs / 1000000), (long)(DelayUs % 1000000) * 1000};
+        if (DelayUs > 0)
+            nanosleep(&Sleep, NULL);
+        LastSent = Sequence;
+        Sends++;
+    }
+};
+
+// Levels with the tick's number in them, so the sender can tell which it got
+static void SequenceLevels(UInt32 Sequence, unsigned char *Levels)
+{
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        Levels[Channel] = (unsigned char)(Sequence >> (8 * Channel));
+}
+
+static UInt32 LevelsSequence(const unsigned char *Levels)
+{
+    UInt32 Sequence = 0;
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+        Sequence |= (UInt32)Levels[Channel] << (8 * Channel);
+    return Sequence;
+}
+
+// Sleeps until Due on the wall clock, returning how late it woke
+static double SleepUntil(double Due)
+{
+    double Wait = Due - Feedback360DefaultClock()->Now();
+    if (Wait > 0) {
+        struct timespec Sleep = {(time_t)Wait, (long)((Wait - (time_t)Wait) * 1000 * 1000 * 1000)};
+        nanosleep(&Sleep, NULL);
+    }
+    return std::max(0., Feedback360DefaultClock()->Now() - Due);
+}
+
+// Posts LINK_TICKS numbered levels through a mailbox to a sender on its own thread, which sends
+// them on a link taking DelayMs a send. Returns false if a stale or lost level was sent
+static bool PlayLink(UInt32 DelayMs)
+{
+    Feedback360SendMailbox Mailbox;
+    DelayedLink Link = {DelayMs * 1000, 0, 0};
+    std::atomic<UInt32> Latest(0);
+    std::atomic<int32_t> SendsPosted(0);
+    std::mutex Lock;
+    std::condition_variable Queued;
+    UInt32 Waiting = 0, Stale = 0, Disordered = 0;
+    bool Done = false;
+
+    // SendQueue, running one SendProc at a time in the order they were queued
+    std::thread Sender([&] {
+        std::unique_lock<std::mutex> Held(Lock);
+        while (true)
+        {
+            Queued.wait(Held, [&] { return Waiting > 0 || Done; });
+            if (Waiting == 0)
+                break;
+            Waiting--;
+            Held.unlock();
+
+            unsigned char Levels[FF_CHANNELS];
+            int32_t Posted = 1;
+            SendsPosted.compare_exchange_strong(Posted, 0);
+            UInt32 Before = Latest;
+            if (Mailbox.Take(Levels)) {
+                UInt32 Sequence = LevelsSequence(Levels);
+                if (Sequence < Before)
+                    Stale++;
+                if (Sequence <= Link.LastSent)
+                    Disordered++;
+                Link.Send(Sequence);
+            }
+            Held.lock();
+        }
+    });
+
+    double PostTime = 0, WorstPost = 0, WorstLate = 0;
+    double Start = Feedback360DefaultClock()->Now();
+    for (UInt32 Tick = 1; Tick <= LINK_TICKS; Tick++)
+    {
+        unsigned char Levels[FF_CHANNELS];
+
+        WorstLate = std::max(WorstLate, SleepUntil(Start + (double)Tick * LINK_PERIOD / 1000 / 1000));
+        SequenceLevels(Tick, Levels);
+        double Started = ThreadTime();
+        int32_t Idle = 0;
+        if (Mailbox.Post(Levels) && SendsPosted.compare_exchange_strong(Idle, 1)) {
+            std::lock_guard<std::mutex> Held(Lock);
+            Waiting++;
+            Queued.notify_one();
+        }
+        Latest = Tick;
+        double Took = ThreadTime() - Started;
+        PostTime += Took;
+        WorstPost = std::max(WorstPost, Took);
+    }
+    {
+        std::lock_guard<std::mutex> Held(Lock);
+        Done = true;
+        Queued.notify_one();
+    }
+    Sender.join();
+
+    // What the ticks did when they sent themselves, waiting for each send
+    DelayedLink Direct = {DelayMs * 1000, 0, 0};
+    double DirectLate = 0;
+    Start = Feedback360DefaultClock()->Now();
+    for (UInt32 Tick = 1; Tick <= LINK_SYNC_TICKS; Tick++)
+    {
+        DirectLate = std::max(DirectLate, SleepUntil(Start + (double)Tick * LINK_PERIOD / 1000 / 1000));
+        Direct.Send(Tick);
+    }
+
+    fprintf(stderr, "%2u ms link: %u posted, %u sent, %u dropped unsent, post %.2f us CPU, %.2f us at most, ticks late by up to %.1f ms, %.1f ms sending on the tick\n",
+            DelayMs, LINK_TICKS, Link.Sends, LINK_TICKS - Link.Sends, PostTime * 1e6 / LINK_TICKS, WorstPost * 1e6,
+            WorstLate * 1000, DirectLate * 1000);
+    if (Stale > 0 || Disordered > 0 || Link.LastSent != LINK_TICKS) {
+        fprintf(stderr, "%2u ms link: %u stale and %u out of order sent, last sent %u of %u\n",
+                DelayMs, Stale, Disordered, Link.LastSent, LINK_TICKS);
+        return false;
+    }
+    return true;
+}
+
+// Plays the mailbox against each link delay
+static int Links(void)
+{
+    UInt32 Failed = 0;
+
+    for (size_t Index = 0; Index < sizeof(LinkDelays) / sizeof(LinkDelays[0]); Index++)
+    {
+        if (!PlayLink(LinkDelays[Index]))
+            Failed++;
+    }
+    return (Failed == 0) ? 0 : 1;
+}
+
+static const char *ChannelNames[FF_CHANNELS] = {"big", "little", "left trigger", "right trigger"};
+
+static bool ControllerType(const char *name, UInt32 *Type)
+{
+    if (strcmp(name, "360") == 0)               *Type = CONTROLLER_XBOX360;
+    else if (strcmp(name, "original") == 0)     *Type = CONTROLLER_ORIGINAL;
+    else if (strcmp(name, "one") == 0)          *Type = CONTROLLER_XBOXONE;
+    else return false;
+    return true;
+}
+
+// Plays the script on a controller without overdrive and one with it, and runs the motors of
+// each through the model. The speeds are brought up to each tick with the levels sent at the
+// last, and fall short of the levels the mixer wanted over the tick before it
+static int Simulate(const std::vector<ScriptCall> &Calls, double Rate, double Length, UInt32 Type, FILE *Trace)
+{
+    UInt32 TickPeriod = (UInt32)(1000 * 1000 / Rate);
+    static ScriptDevice Plain(TickPeriod, &Calls), Driven(TickPeriod, &Calls);
+    const Feedback360MotorModel *Models = Feedback360MotorModels(Type);
+    unsigned char Wanted[FF_CHANNELS] = {0}, Sent[FF_CHANNELS] = {0};
+    double PlainSpeed[FF_CHANNELS] = {0}, DrivenSpeed[FF_CHANNELS] = {0};
+    double PlainShort[FF_CHANNELS] = {0}, DrivenShort[FF_CHANNELS] = {0};   // Level seconds
+    double Moved[FF_CHANNELS] = {0};                                        // Levels
+    size_t Next = 0;
+    UInt64 Ticks = 0, PlainReports = 0, DrivenReports = 0;
+
+    Driven.Mixer.SetControllerType(Type);
+    Driven.Mixer.SetOverdrive(true);
+    for (double Time = 0; Time <= Length; Time = ++Ticks * 1000 / Rate)
+    {
+        double Seconds = 1 / Rate;
+        for (UInt32 Channel = 0; Ticks > 0 && Channel < FF_CHANNELS; Channel++)
+        {
+            PlainSpeed[Channel] = Feedback360MotorSpeed(&Models[Channel], PlainSpeed[Channel], Wanted[Channel], Seconds);
+            DrivenSpeed[Channel] = Feedback360MotorSpeed(&Models[Channel], DrivenSpeed[Channel], Sent[Channel], Seconds);
+            PlainShort[Channel] += fabs(Wanted[Channel] - PlainSpeed[Channel]) * Seconds;
+            DrivenShort[Channel] += fabs(Wanted[Channel] - DrivenSpeed[Channel]) * Seconds;
+        }
+
+        while (Next < Calls.size() && Calls[Next].Time <= Time)
+        {
+            if (!Apply(Plain, Calls[Next], Time / 1000) || !Apply(Driven, Calls[Next], Time / 1000))
+                return 1;
+            Next++;
+        }
+        unsigned char Previous[FF_CHANNELS];
+        memcpy(Previous, Wanted, sizeof(Previous));
+        PublishInput(Plain, Time, Time / 1000);
+        PublishInput(Driven, Time, Time / 1000);
+        if (Plain.Mixer.Tick(Time / 1000, Wanted))
+            PlainReports++;
+        if (Driven.Mixer.Tick(Time / 1000, Sent))
+            DrivenReports++;
+        for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+            Moved[Channel] += abs(Wanted[Channel] - Previous[Channel]);
+
+        if (Trace != NULL) {
+            fprintf(Trace, "%.1f", Time);
+            for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+            {
+                if (Models[Channel].SpinUp != 0)
+                    fprintf(Trace, " %d %.1f %.1f", Wanted[Channel], PlainSpeed[Channel], DrivenSpeed[Channel]);
+            }
+            fprintf(Trace, "\n");
+        }
+    }
+
+    for (UInt32 Channel = 0; Channel < FF_CHANNELS; Channel++)
+    {
+        if (Models[Channel].SpinUp == 0)
+            continue;
+        if (Moved[Channel] == 0) {
+            fprintf(stderr, "%s motor: the levels never moved\n", ChannelNames[Channel]);
+            continue;
+        }
+        fprintf(stderr, "%s motor: %.1f ms lag without overdrive, %.1f ms with\n", ChannelNames[Channel],
+                PlainShort[Channel] * 1000 / Moved[Channel], DrivenShort[Channel] * 1000 / Moved[Channel]);
+    }
+    fprintf(stderr, "%llu reports without overdrive, %llu with\n",
+            (unsigned long long)PlainReports, (unsigned long long)DrivenReports);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    double Rate = DEFAULT_RATE;
+    double Length = -1;
+    UInt32 Count = 0;
+    bool Query = false;
+    UInt32 Threads = 0;
+    bool Compare = false;
+    bool HandleCheck = false;
+    bool EnvelopeCheck = false;
+    bool WaveCheck = false;
+    bool BlockCheck = false;
+    bool LinkCheck = false;
+    bool Simulated = false;
+    const char *Recording = NULL;
+    UInt32 Type = 0;
+    bool Motors = false;
+    int Option;
+
+    while ((Option = getopt(argc, argv, "r:t:d:sqp:ghefblw:o:")) != -1)
+    {
+        switch (Option) {
+            case 'o':
+                if (!ControllerType(optarg, &Type))
+                    Usage(argv[0]);
+                Motors = true;
+                break;
+            case 'q':
+                Query = true;
+                break;
+            case 'p':
+                Threads = (UInt32)atol(optarg);
+                break;
+            case 'g':
+                Compare = true;
+                break;
+            case 'h':
+                HandleCheck = true;
+                break;
+            case 'e':
+                EnvelopeCheck = true;
+                break;
+            case 'f':
+                WaveCheck = true;
+                break;
+            case 'b':
+                BlockCheck = true;
+                break;
+            case 'l':
+                LinkCheck = true;
+                break;
+            case 's':
+                Simulated = true;
+                break;
+            case 'w':
+                Recording = optarg;
+                break;
+            case 'r':
+                Rate = atof(optarg);
+                break;
+            case 't':
+                Length = atof(optarg);
+                break;
+            case 'd':
+                Count = (UInt32)atol(optarg);
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+    if (Compare)
+        return Golden();
+    if (HandleCheck)
+        return Handles();
+    if (EnvelopeCheck)
+        return Envelopes();
+    if (WaveCheck)
+        return Waveforms();
+    if (BlockCheck)
+        return Blocks();
+    if (LinkCheck)
+        return Links();
+    if (optind >= argc || Rate <= 0)
+        Usage(argv[0]);
+
+    std::vector<ScriptCall> Calls;
+    if (!ReadScript(argv[optind], &Calls))
+        return 1;
+    if (Length < 0)
+        Length = (Calls.empty() ? 0 : Calls.back().Time) + DEFAULT_TAIL;
+    if (Count > 0)
+        return Benchmark(Calls, Count, Rate, Length);
+    if (Simulated)
+        return Check(Calls, Rate, Length);
+    if (Query)
+        return (Contend("queue lock", Calls, Rate, Length, true) && Contend("snapshot", Calls, Rate, Length, false)) ? 0 : 1;
+    if (Threads > 0)
+        return (Submit("queue lock", Calls, Rate, Length, Threads, true) && Submit("command queue", Calls, Rate, Length, Threads, false)) ? 0 : 1;
+
+    FILE *Trace = NULL;
+    if (optind + 1 < argc) {
+        Trace = (strcmp(argv[optind + 1], "-") == 0) ? stdout : fopen(argv[optind + 1], "w");
+        if (Trace == NULL) {
+            perror(argv[optind + 1]);
+            return 1;
+        }
+    }
+    if (Motors) {
+        int Result = Simulate(Calls, Rate, Length, Type, Trace);
+        if (Trace != NULL && Trace != stdout)
+            fclose(Trace);
+        return Result;
+    }
+
+    // The recording starts at 0 on the script's clock, as the trace does
+    static Feedback360TraceWriter Writer(0);
+    if (Recording != NULL) {
+        if (!Writer.Open(Recording)) {
+            perror(Recording);
+            return 1;
+        }
+        Recorder = &Writer;
+    }
+
+    // The mixer is only ever asked for the time it is given, so a manual clock runs it flat out
+    static ScriptDevice Device((UInt32)(1000 * 1000 / Rate), &Calls);
+    Feedback360ManualClock Clock;
+    unsigned char Levels[FF_CHANNELS] = {0};
+    size_t Next = 0;
+    UInt64 Ticks = 0;
+
+    // Reading the clock can cost as much as a tick, so without a trace to write in between,
+    // the ticks from one call to the next are timed together
+    double Started = 0;
+    bool Timing = false;
+
+    for (double Time = 0; Time <= Length; Time = ++Ticks * 1000 / Rate)
+    {
+        Clock.Set(Time / 1000);
+        if (Timing && Next < Calls.size() && Calls[Next].Time <= Time) {
+            Busy += Feedback360DefaultClock()->Now() - Started;
+            Timing = false;
+        }
+        while (Next < Calls.size() && Calls[Next].Time <= Time)
+        {
+            if (!Apply(Device, Calls[Next], Clock.Now()))
+                return 1;
+            Next++;
+        }
+
+        if (!Timing) {
+            Started = Feedback360DefaultClock()->Now();
+            Timing = true;
+        }
+        PublishInput(Device, Time, Clock.Now());
+        Device.Mixer.Tick(Clock.Now(), Levels);
+
+        if (Trace != NULL) {
+            Busy += Feedback360DefaultClock()->Now() - Started;
+            Timing = false;
+            fprintf(Trace, "%.1f %d %d %d %d\n", Time, Levels[CHANNEL_BIG], Levels[CHANNEL_LITTLE],
+                    Levels[CHANNEL_TRIGGER_LEFT], Levels[CHANNEL_TRIGGER_RIGHT]);
+        }
+    }
+    if (Timing)
+        Busy += Feedback360DefaultClock()->Now() - Started;
+    if (Trace != NULL && Trace != stdout)
+        fclose(Trace);
+
+    fprintf(stderr, "%llu ticks in %.3f ms, %.0f ticks/s, %.0fx real time\n",
+            (unsigned long long)Ticks, Busy * 1000, Busy > 0 ? Ticks / Busy : 0.,
+            Busy > 0 ? Ticks / Rate / Busy : 0.);
+    return 0;
+}
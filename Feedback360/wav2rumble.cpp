@@ -0,0 +1,184 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Force Feedback module
+    Copyright (C) 2013 David Ryskalczyk
+    based on xi, Copyright (C) 2011 Masahiko Morii
+
+    wav2rumble.cpp - turns a WAV file into custom force samples
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Xbox360Controller; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+// Runs game audio through the same pipeline the plugin uses for streamed audio, and writes
+// the result as an fftrace script, so the rumble can be checked and tuned offline. Build it
+// without the Apple frameworks with:
+//
+//   c++ -O2 -o wav2rumble wav2rumble.cpp Feedback360AudioRumble.cpp Feedback360Clock.cpp
+//
+// The file must be 16 bit PCM, with any rate and number of channels. The script downloads a
+// streaming custom force and appends the samples in pieces ahead of when they play:
+//
+//   wav2rumble -p 10 explosion.wav explosion.txt && fftrace explosion.txt -
+//
+// The time reported covers the pipeline only, not reading or writing files.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "Feedback360AudioRumble.h"
+#include "Feedback360Clock.h"
+
+#define DEFAULT_PERIOD  10      // Milliseconds per sample pair
+#define APPEND_PAIRS    50      // Pairs per append line
+
+typedef struct {
+    UInt32              SampleRate;
+    UInt32              Channels;
+    std::vector<SInt16> Pcm;
+} WaveFile;
+
+static void Usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-p sample period in milliseconds] wav [script|-]\n", name);
+    exit(1);
+}
+
+static UInt32 Little32(const unsigned char *Bytes)
+{
+    return Bytes[0] | (Bytes[1] << 8) | (Bytes[2] << 16) | ((UInt32)Bytes[3] << 24);
+}
+
+static UInt16 Little16(const unsigned char *Bytes)
+{
+    return Bytes[0] | (Bytes[1] << 8);
+}
+
+// Finds the format and data chunks, skipping any others
+static bool ReadWave(const char *path, WaveFile *Wave)
+{
+    FILE *file = fopen(path, "rb");
+    unsigned char Header[12], Chunk[8], Format[16];
+    bool HaveFormat = false;
+
+    if (file == NULL) {
+        perror(path);
+        return false;
+    }
+    if (fread(Header, 1, sizeof(Header), file) != sizeof(Header) || memcmp(Header, "RIFF", 4) != 0 || memcmp(Header + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "%s: not a WAV file\n", path);
+        fclose(file);
+        return false;
+    }
+    while (fread(Chunk, 1, sizeof(Chunk), file) == sizeof(Chunk))
+    {
+        UInt32 Size = Little32(Chunk + 4);
+
+        if (memcmp(Chunk, "fmt ", 4) == 0 && Size >= sizeof(Format)) {
+            if (fread(Format, 1, sizeof(Format), file) != sizeof(Format))
+                break;
+            if (Little16(Format) != 1 || Little16(Format + 14) != 16) {
+                fprintf(stderr, "%s: only 16 bit PCM is supported\n", path);
+                fclose(file);
+                return false;
+            }
+            Wave->Channels = Little16(Format + 2);
+            Wave->SampleRate = Little32(Format + 4);
+            HaveFormat = true;
+            fseek(file, Size - sizeof(Format) + (Size & 1), SEEK_CUR);
+        } else if (memcmp(Chunk, "data", 4) == 0 && HaveFormat) {
+            std::vector<unsigned char> Data(Size);
+            Size = (UInt32)fread(Data.data(), 1, Size, file);
+            Wave->Pcm.resize(Size / 2);
+            for (size_t Index = 0; Index < Wave->Pcm.size(); Index++)
+                Wave->Pcm[Index] = (SInt16)Little16(&Data[2 * Index]);
+            fclose(file);
+            return Wave->Channels > 0;
+        } else {
+            fseek(file, Size + (Size & 1), SEEK_CUR);
+        }
+    }
+    fprintf(stderr, "%s: no audio found\n", path);
+    fclose(file);
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    double Period = DEFAULT_PERIOD;
+    int Option;
+
+    while ((Option = getopt(argc, argv, "p:")) != -1)
+    {
+        switch (Option) {
+            case 'p':
+                Period = atof(optarg);
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+    if (optind >= argc || Period <= 0)
+        Usage(argv[0]);
+
+    WaveFile Wave;
+    if (!ReadWave(argv[optind], &Wave))
+        return 1;
+
+    FILE *Script = NULL;
+    if (optind + 1 < argc) {
+        Script = (strcmp(argv[optind + 1], "-") == 0) ? stdout : fopen(argv[optind + 1], "w");
+        if (Script == NULL) {
+            perror(argv[optind + 1]);
+            return 1;
+        }
+    }
+
+    static Feedback360AudioRumble Audio;
+    UInt32 Frames = (UInt32)(Wave.Pcm.size() / Wave.Channels);
+    Audio.Configure(Wave.SampleRate, Wave.Channels, (UInt32)(Period * 1000));
+    std::vector<LONG> Pairs(2 * Audio.MaxPairs(Frames));
+
+    double Started = Feedback360DefaultClock()->Now();
+    UInt32 Count = Audio.Process(Wave.Pcm.data(), Frames, Pairs.data());
+    double Busy = Feedback360DefaultClock()->Now() - Started;
+
+    if (Script != NULL) {
+        fprintf(Script, "# %s, %u Hz, %u channels\n", argv[optind], (unsigned int)Wave.SampleRate, (unsigned int)Wave.Channels);
+        fprintf(Script, "0 download audio custom duration=inf samples=0,0 sampleperiod=%g\n", Period);
+        fprintf(Script, "0 stream audio on\n");
+        fprintf(Script, "0 start audio\n");
+        for (UInt32 First = 0; First < Count; First += APPEND_PAIRS)
+        {
+            // Each piece arrives one piece before it is due, as a game would stream it
+            double Due = First * Period;
+            fprintf(Script, "%g append audio ", Due > APPEND_PAIRS * Period ? Due - APPEND_PAIRS * Period : 0);
+            for (UInt32 Pair = First; Pair < Count && Pair < First + APPEND_PAIRS; Pair++)
+                fprintf(Script, "%s%d,%d", Pair > First ? "," : "", (int)Pairs[2 * Pair], (int)Pairs[2 * Pair + 1]);
+            fprintf(Script, "\n");
+        }
+        fprintf(Script, "%g destroy audio\n", Count * Period);
+        if (Script != stdout)
+            fclose(Script);
+    }
+
+    fprintf(stderr, "%u frames in %.3f ms, %.0f samples/s, %.0fx real time, %u pairs\n",
+            (unsigned int)Frames, Busy * 1000, Busy > 0 ? Wave.Pcm.size() / Busy : 0.,
+            Busy > 0 ? (double)Frames / Wave.SampleRate / Busy : 0., (unsigned int)Count);
+    return 0;
+}
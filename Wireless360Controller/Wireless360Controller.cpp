@@ -26,127 +26,43 @@
 #include "../360Controller/ControlStruct.h"
 #include "../360Controller/xbox360hid.h"
 
-#define kDriverSettingKey "DeviceData"
-
 OSDefineMetaClassAndStructors(Wireless360Controller, WirelessHIDDevice)
 #define super WirelessHIDDevice
 
-static inline XBox360_SShort getAbsolute(XBox360_SShort value)
-{
-    XBox360_SShort reverse;
-    
-#ifdef __LITTLE_ENDIAN__
-    reverse=value;
-#elif __BIG_ENDIAN__
-    reverse=((value&0xFF00)>>8)|((value&0x00FF)<<8);
-#else
-#error Unknown CPU byte order
-#endif
-    return (reverse<0)?~reverse:reverse;
-}
-
 bool Wireless360Controller::init(OSDictionary *propTable)
 {
     bool res = super::init(propTable);
     
+    transformLock = IOLockAlloc();
+    if (transformLock == NULL)
+        return false;
+    
     // Default settings
-    invertLeftX = invertLeftY = false;
-    invertRightX = invertRightY = false;
-    deadzoneLeft = deadzoneRight = 0;
-    relativeLeft = relativeRight = false;
-    readSettings();
+    transform.reset();
+    transform.readSettings(OSDynamicCast(OSDictionary, getProperty(kDriverSettingKey)));
     
     // Done
     return res;
 }
 
-// Read the settings from the registry
-void Wireless360Controller::readSettings(void)
+void Wireless360Controller::free(void)
 {
-    OSBoolean *value;
-    OSNumber *number;
-    OSDictionary *dataDictionary = OSDynamicCast(OSDictionary, getProperty(kDriverSettingKey));
-    
-    if(dataDictionary==NULL) return;
-    value=OSDynamicCast(OSBoolean,dataDictionary->getObject("InvertLeftX"));
-    if(value!=NULL) invertLeftX=value->getValue();
-    value=OSDynamicCast(OSBoolean,dataDictionary->getObject("InvertLeftY"));
-    if(value!=NULL) invertLeftY=value->getValue();
-    value=OSDynamicCast(OSBoolean,dataDictionary->getObject("InvertRightX"));
-    if(value!=NULL) invertRightX=value->getValue();
-    value=OSDynamicCast(OSBoolean,dataDictionary->getObject("InvertRightY"));
-    if(value!=NULL) invertRightY=value->getValue();
-    number=OSDynamicCast(OSNumber,dataDictionary->getObject("DeadzoneLeft"));
-    if(number!=NULL) deadzoneLeft=number->unsigned32BitValue();
-    number=OSDynamicCast(OSNumber,dataDictionary->getObject("DeadzoneRight"));
-    if(number!=NULL) deadzoneRight=number->unsigned32BitValue();
-    value=OSDynamicCast(OSBoolean,dataDictionary->getObject("RelativeLeft"));
-    if(value!=NULL) relativeLeft=value->getValue();
-    value=OSDynamicCast(OSBoolean,dataDictionary->getObject("RelativeRight"));
-    if(value!=NULL) relativeRight=value->getValue();
-#if 0
-    IOLog("Xbox360ControllerClass preferences loaded:\n  invertLeft X: %s, Y: %s\n   invertRight X: %s, Y:%s\n  deadzone Left: %d, Right: %d\n\n",
-            invertLeftX?"True":"False",invertLeftY?"True":"False",
-            invertRightX?"True":"False",invertRightY?"True":"False",
-            deadzoneLeft,deadzoneRight);
-#endif
-}
-
-// Adjusts the report for any settings specified by the user
-void Wireless360Controller::fiddleReport(unsigned char *data, int length)
-{
-    XBOX360_IN_REPORT *report = (XBOX360_IN_REPORT*)data;
-    
-    if (invertLeftX)
-        report->left.x = ~report->left.x;
-    if (!invertLeftY)
-        report->left.y = ~report->left.y;
-    if (invertRightX)
-        report->right.x = ~report->right.x;
-    if (!invertRightY)
-        report->right.y = ~report->right.y;
-        
-    if (deadzoneLeft != 0)
+    if (transformLock != NULL)
     {
-        if (relativeLeft)
-        {
-            if ((getAbsolute(report->left.x) < deadzoneLeft) && (getAbsolute(report->left.y) < deadzoneLeft))
-            {
-                report->left.x = 0;
-                report->left.y = 0;
-            }
-        }
-        else
-        {
-            if (getAbsolute(report->left.x) < deadzoneLeft)
-                report->left.x = 0;
-            if (getAbsolute(report->left.y) < deadzoneLeft)
-                report->left.y = 0;
-        }
-    }
-    if (deadzoneRight != 0)
-    {
-        if (relativeRight)
-        {
-            if ((getAbsolute(report->right.x) < deadzoneRight) && (getAbsolute(report->right.y) < deadzoneRight))
-            {
-                report->right.x = 0;
-                report->right.y = 0;
-            }
-        }
-        else
-        {
-            if (getAbsolute(report->right.x) < deadzoneRight)
-                report->right.x = 0;
-            if (getAbsolute(report->right.y) < deadzoneRight)
-                report->right.y = 0;
-        }
+        IOLockFree(transformLock);
+        transformLock = NULL;
     }
+    super::free();
 }
 
 void Wireless360Controller::receivedHIDupdate(unsigned char *data, int length)
 {
-    fiddleReport(data, length);
+    if (length >= (int)sizeof(XBOX360_IN_REPORT))
+    {
+        IOLockLock(transformLock);
+        transform.apply((XBOX360_IN_REPORT*)data);
+        IOLockUnlock(transformLock);
+    }
     super::receivedHIDupdate(data, length);
 }
 
@@ -156,7 +72,7 @@ void Wireless360Controller::SetRumbleMotors(unsigned char large, unsigned char s
     WirelessDevice *device = OSDynamicCast(WirelessDevice, getProvider());
     
     if (device != NULL)
-        device->SendPacket(buf, sizeof(buf));
+        device->SendLatestPacket(buf, sizeof(buf));
 }
 
 IOReturn Wireless360Controller::setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options)
@@ -176,6 +92,16 @@ IOReturn Wireless360Controller::setReport(IOMemoryDescriptor *report, IOHIDRepor
         SetRumbleMotors(data[0], data[1]);
         return kIOReturnSuccess;
     }
+
+    // Rumble with trigger motors, which this controller doesn't have
+    if (data[0] == 0x03)
+    {
+        if ((data[1] != report->getLength()) || (data[1] != 0x06))
+            return kIOReturnUnsupported;
+        report->readBytes(2, data, 2);
+        SetRumbleMotors(data[0], data[1]);
+        return kIOReturnSuccess;
+    }
     
     return super::setReport(report, reportType, options);
 }
@@ -197,8 +123,13 @@ IOReturn Wireless360Controller::setProperties(OSObject *properties)
     OSDictionary *dictionary = OSDynamicCast(OSDictionary,properties);
     
     if(dictionary!=NULL) {
+        ControlTransform updated = transform;
         setProperty(kDriverSettingKey,dictionary);
-        readSettings();
+        // Compile the new settings before swapping them in under the lock
+        updated.readSettings(dictionary);
+        IOLockLock(transformLock);
+        transform = updated;
+        IOLockUnlock(transformLock);
         return kIOReturnSuccess;
     } else return kIOReturnBadArgument;
 }
@@ -24,12 +24,14 @@
 #define __WIRELESS360CONTROLLER_H__
 
 #include "../WirelessGamingReceiver/WirelessHIDDevice.h"
+#include "../360Controller/ControlTransform.h"
 
 class Wireless360Controller : public WirelessHIDDevice
 {
     OSDeclareDefaultStructors(Wireless360Controller);
 public:
     bool init(OSDictionary *propTable = NULL);
+    void free(void);
 
     void SetRumbleMotors(unsigned char large, unsigned char small);
     
@@ -46,16 +48,11 @@ public:
     virtual OSString* newTransportString() const;
     virtual OSNumber* newVendorIDNumber() const;
 protected:
-    void readSettings(void);
     void receivedHIDupdate(unsigned char *data, int length);
 
-    // Settings
-    bool invertLeftX,invertLeftY;
-    bool invertRightX,invertRightY;
-    short deadzoneLeft,deadzoneRight;
-    bool relativeLeft,relativeRight;
-private:
-    void fiddleReport(unsigned char *data, int length);
+    // Settings, swapped under transformLock while reports are being applied
+    ControlTransform transform;
+    IOLock *transformLock;
 };
 
 #endif // __WIRELESS360CONTROLLER_H__
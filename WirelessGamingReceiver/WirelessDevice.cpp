@@ -69,6 +69,28 @@ void WirelessDevice::SendPacket(const void *data, size_t length)
     receiver->QueueWrite(index, data, (UInt32)length);
 }
 
+// Sends a buffer for this controller that replaces any unsent one, for state like rumble
+void WirelessDevice::SendLatestPacket(const void *data, size_t length)
+{
+    if (index == -1)
+        return;
+    WirelessGamingReceiver *receiver = OSDynamicCast(WirelessGamingReceiver, getProvider());
+    if (receiver == NULL)
+        return;
+    receiver->QueueLatest(index, data, (UInt32)length);
+}
+
+// Restarts the idle power-off countdown for this controller
+void WirelessDevice::NoteActivity(void)
+{
+    if (index == -1)
+        return;
+    WirelessGamingReceiver *receiver = OSDynamicCast(WirelessGamingReceiver, getProvider());
+    if (receiver == NULL)
+        return;
+    receiver->NoteActivity(index);
+}
+
 // Registers a callback function
 void WirelessDevice::RegisterWatcher(void *target, WirelessDeviceWatcher function, void *parameter)
 {
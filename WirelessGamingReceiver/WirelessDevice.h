@@ -41,6 +41,8 @@ public:
     IOMemoryDescriptor* NextPacket(void);
     
     void SendPacket(const void *data, size_t length);
+    void SendLatestPacket(const void *data, size_t length);
+    void NoteActivity(void);
     
     void RegisterWatcher(void *target, WirelessDeviceWatcher function, void *parameter);
 
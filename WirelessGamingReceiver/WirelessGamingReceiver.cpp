@@ -26,6 +26,11 @@
 
 //#define PROTOCOL_DEBUG
 
+// Controllers are switched off after this many seconds without a report
+#define POWEROFF_TIMEOUT (15 * 60)
+// Interval between attempts if the controller doesn't respond
+#define POWEROFF_RETRY 1
+
 OSDefineMetaClassAndStructors(WirelessGamingReceiver, IOService)
 
 // Holds data for asynchronous reads
@@ -53,6 +58,14 @@ bool WirelessGamingReceiver::start(IOService *provider)
     IOUSBInterface *interface;
     int iConnection, iOther, i;
     
+    connections = NULL;
+    connectionCount = 0;
+    idleTimer = NULL;
+    idleEntries = NULL;
+    idleLock = NULL;
+    outputSlots = NULL;
+    outputLock = NULL;
+    
     if (!IOService::start(provider))
     {
         // IOLog("start - superclass failed\n");
@@ -95,18 +108,28 @@ bool WirelessGamingReceiver::start(IOService *provider)
         goto fail;
     }
     
-    for (i = 0; i < WIRELESS_CONNECTIONS; i++)
+    // The number of connections depends on the receiver, so count them first
+    interfaceRequest.bInterfaceClass = kIOUSBFindInterfaceDontCare;
+    interfaceRequest.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
+    interfaceRequest.bInterfaceProtocol = 129;
+    interfaceRequest.bAlternateSetting = 0;
+    interface = NULL;
+    iConnection = 0;
+    while ((interface = device->FindNextInterface(interface, &interfaceRequest)) != NULL)
+        iConnection++;
+    if (iConnection == 0)
     {
-        connections[i].controller = NULL;
-        connections[i].controllerIn = NULL;
-        connections[i].controllerOut = NULL;
-        connections[i].other = NULL;
-        connections[i].otherIn = NULL;
-        connections[i].otherOut = NULL;
-        connections[i].inputArray = NULL;
-        connections[i].service = NULL;
-        connections[i].controllerStarted = false;
+        // IOLog("start - no controller interfaces\n");
+        goto fail;
+    }
+    connections = (WIRELESS_CONNECTION*)IOMalloc(sizeof(WIRELESS_CONNECTION) * iConnection);
+    if (connections == NULL)
+    {
+        // IOLog("start - failed to allocate connections\n");
+        goto fail;
     }
+    bzero(connections, sizeof(WIRELESS_CONNECTION) * iConnection);
+    connectionCount = iConnection;
     
     pipeRequest.interval = 0;
     pipeRequest.maxPacketSize = 0;
@@ -123,6 +146,8 @@ bool WirelessGamingReceiver::start(IOService *provider)
         switch (interface->GetInterfaceProtocol())
         {
             case 129:   // Controller
+                if (iConnection >= connectionCount)
+                    break;
                 if (!interface->open(this))
                 {
                     // IOLog("start: Failed to open control interface\n");
@@ -151,6 +176,8 @@ bool WirelessGamingReceiver::start(IOService *provider)
                 break;
 				
             case 130:   // It is a mystery
+                if (iOther >= connectionCount)
+                    break;
                 if (!interface->open(this))
                 {
                     // IOLog("start: Failed to open mystery interface\n");
@@ -186,19 +213,62 @@ bool WirelessGamingReceiver::start(IOService *provider)
     
     if (iConnection != iOther)
         IOLog("start - interface mismatch?\n");
-    connectionCount = iConnection;
+    if (iConnection != connectionCount)
+    {
+        // IOLog("start - controller interfaces changed\n");
+        goto fail;
+    }
+    
+    // Output is shared fairly between the connections
+    outputSlots = (WIRELESS_OUTPUT_SLOT*)IOMalloc(sizeof(WIRELESS_OUTPUT_SLOT) * connectionCount);
+    if (outputSlots == NULL)
+    {
+        // IOLog("start - failed to allocate output queue\n");
+        goto fail;
+    }
+    outputLock = IOLockAlloc();
+    if (outputLock == NULL)
+    {
+        // IOLog("start - failed to allocate output lock\n");
+        goto fail;
+    }
+    {
+        int budget = WIRELESS_OUTPUT_BUDGET;
+        OSNumber *number = OSDynamicCast(OSNumber, getProperty("OutputPacketBudget"));
+        
+        if ((number != NULL) && (number->unsigned32BitValue() > 0))
+            budget = number->unsigned32BitValue();
+        outputQueue.Init(outputSlots, connectionCount, budget);
+    }
+    
+    // One timer serves every connection, it only wakes up for the earliest deadline. Reports
+    // stamp the connections from their own work loops, so the stamps need a lock of their own
+    idleEntries = (WIRELESS_IDLE_ENTRY*)IOMalloc(sizeof(WIRELESS_IDLE_ENTRY) * connectionCount);
+    idleLock = IOLockAlloc();
+    if ((idleEntries == NULL) || (idleLock == NULL))
+    {
+        // IOLog("start - failed to allocate idle queue\n");
+        goto fail;
+    }
+    {
+        UInt64 timeout, retry;
+        
+        nanoseconds_to_absolutetime((UInt64)POWEROFF_TIMEOUT * NSEC_PER_SEC, &timeout);
+        nanoseconds_to_absolutetime((UInt64)POWEROFF_RETRY * NSEC_PER_SEC, &retry);
+        idleQueue.Init(idleEntries, connectionCount, timeout, retry);
+    }
+    idleTimer = IOTimerEventSource::timerEventSource(this, _IdleCheck);
+    if ((idleTimer == NULL) || (getWorkLoop() == NULL) || (getWorkLoop()->addEventSource(idleTimer) != kIOReturnSuccess))
+    {
+        // IOLog("start - failed to create idle timer\n");
+        goto fail;
+    }
     
     for (i = 0; i < connectionCount; i++)
     {
-        connections[i].inputArray = OSArray::withCapacity(5);
-        if (connections[i].inputArray == NULL)
-        {
-            // IOLog("start: Failed to allocate packet buffer %d\n", i);
-            goto fail;
-        }
-        if (!QueueRead(i))
+        if (!StartConnection(i))
         {
-            // IOLog("start: Failed to start read %d\n", i);
+            // IOLog("start: Failed to start connection %d\n", i);
             goto fail;
         }
     }
@@ -211,6 +281,44 @@ fail:
     return false;
 }
 
+// Set up the runtime data of a connection and start reading from it
+bool WirelessGamingReceiver::StartConnection(int index)
+{
+    WIRELESS_CONNECTION *connection = &connections[index];
+    
+    connection->link.Reset();
+    connection->inputLock = IOLockAlloc();
+    connection->pendingArray = OSArray::withCapacity(5);
+    connection->inputArray = OSArray::withCapacity(5);
+    connection->outputArray = OSArray::withCapacity(5);
+    if ((connection->inputLock == NULL) || (connection->pendingArray == NULL) || (connection->inputArray == NULL) || (connection->outputArray == NULL))
+        return false;
+    // Each connection gets its own thread, so a busy pad can't hold up the others
+    connection->workloop = IOWorkLoop::workLoop();
+    if (connection->workloop == NULL)
+        return false;
+    connection->dispatch = IOInterruptEventSource::interruptEventSource(this, _ProcessPending);
+    if (connection->dispatch == NULL)
+        return false;
+    if (connection->workloop->addEventSource(connection->dispatch) != kIOReturnSuccess)
+    {
+        connection->dispatch->release();
+        connection->dispatch = NULL;
+        return false;
+    }
+    // Creating and registering the service is slow, so it has its own event
+    connection->serviceEvent = IOInterruptEventSource::interruptEventSource(this, _UpdateService);
+    if (connection->serviceEvent == NULL)
+        return false;
+    if (connection->workloop->addEventSource(connection->serviceEvent) != kIOReturnSuccess)
+    {
+        connection->serviceEvent->release();
+        connection->serviceEvent = NULL;
+        return false;
+    }
+    return QueueRead(index);
+}
+
 // Stop the device
 void WirelessGamingReceiver::stop(IOService *provider)
 {
@@ -248,17 +356,23 @@ IOReturn WirelessGamingReceiver::message(UInt32 type,IOService *provider,void *a
 // Queue a read on a controller
 bool WirelessGamingReceiver::QueueRead(int index)
 {
+    WIRELESS_CONNECTION *connection = &connections[index];
     IOUSBCompletion complete;
     IOReturn err;
+    bool start;
     WGRREAD *data = (WGRREAD*)IOMalloc(sizeof(WGRREAD));
     
     if (data == NULL)
+    {
+        FinishRead(index);
         return false;
+    }
     data->index = index;
-    data->buffer = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0, GetMaxPacketSize(connections[index].controllerIn));
+    data->buffer = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0, GetMaxPacketSize(connection->controllerIn));
     if (data->buffer == NULL)
     {
         IOFree(data, sizeof(WGRREAD));
+        FinishRead(index);
         return false;
     }
 
@@ -266,31 +380,92 @@ bool WirelessGamingReceiver::QueueRead(int index)
     complete.action = _ReadComplete;
     complete.parameter = data;
     
-    err = connections[index].controllerIn->Read(data->buffer, 0, 0, data->buffer->getLength(), &complete);
-    if (err == kIOReturnSuccess)
-        return true;
+    // Marked before starting, so ReleaseAll waits for it from the moment it could complete
+    IOLockLock(connection->inputLock);
+    start = !connection->inputStopping;
+    if (start)
+        connection->reading = true;
+    IOLockUnlock(connection->inputLock);
+    if (start)
+    {
+        err = connection->controllerIn->Read(data->buffer, 0, 0, data->buffer->getLength(), &complete);
+        if (err == kIOReturnSuccess)
+            return true;
+        // IOLog("read - failed to start (0x%.8x)\n", err);
+    }
         
     data->buffer->release();
     IOFree(data, sizeof(WGRREAD));
-    
-    // IOLog("read - failed to start (0x%.8x)\n", err);
+    FinishRead(index);
     return false;
 }
 
+// Note that a connection has no read outstanding, waking ReleaseAll if it is waiting for that
+void WirelessGamingReceiver::FinishRead(int index)
+{
+    WIRELESS_CONNECTION *connection = &connections[index];
+    
+    IOLockLock(connection->inputLock);
+    connection->reading = false;
+    if (connection->inputStopping)
+        IOLockWakeup(connection->inputLock, &connection->reading, false);
+    IOLockUnlock(connection->inputLock);
+}
+
+// Stop reading from a connection and wait for its last read to come back, so no completion can
+// use the connection once it is released. Returns false if the read never came back
+bool WirelessGamingReceiver::StopInput(int index)
+{
+    WIRELESS_CONNECTION *connection = &connections[index];
+    AbsoluteTime deadline;
+    bool finished = false;
+    
+    if (connection->inputLock == NULL)
+        return true;
+    IOLockLock(connection->inputLock);
+    connection->inputStopping = true;
+    IOLockUnlock(connection->inputLock);
+    // A read started just before inputStopping was set may not have been there for the first
+    // abort, so the pipe is aborted again if it is still outstanding after that
+    for (int attempt = 0; (attempt < 2) && !finished; attempt++)
+    {
+        if (connection->controllerIn != NULL)
+            connection->controllerIn->Abort();
+        if (connection->otherIn != NULL)
+            connection->otherIn->Abort();
+        clock_interval_to_deadline(WIRELESS_INPUT_DRAIN, kMillisecondScale, &deadline);
+        IOLockLock(connection->inputLock);
+        finished = true;
+        while (finished && connection->reading)
+            finished = IOLockSleepDeadline(connection->inputLock, &connection->reading, deadline, THREAD_UNINT) == THREAD_AWAKENED;
+        IOLockUnlock(connection->inputLock);
+    }
+    return finished;
+}
+
 // Handle a completed read on a controller
 void WirelessGamingReceiver::ReadComplete(void *parameter, IOReturn status, UInt32 bufferSizeRemaining)
 {
     WGRREAD *data = (WGRREAD*)parameter;
+    WIRELESS_CONNECTION *connection = &connections[data->index];
     bool reread = true;
     
     switch (status)
     {
         case kIOReturnOverrun:
             // IOLog("read - kIOReturnOverrun, clearing stall\n");
-            connections[data->index].controllerIn->ClearStall();
+            connection->controllerIn->ClearStall();
             // fall through
         case kIOReturnSuccess:
-            ProcessMessage(data->index, (unsigned char*)data->buffer->getBytesNoCopy(), (int)data->buffer->getLength() - bufferSizeRemaining);
+            // Hand the buffer to the connection's own thread, unless it is being released
+            data->buffer->setLength(data->buffer->getLength() - bufferSizeRemaining);
+            IOLockLock(connection->inputLock);
+            reread = !connection->inputStopping;
+            if (reread)
+                connection->pendingArray->setObject(data->buffer);
+            IOLockUnlock(connection->inputLock);
+            if (reread)
+                connection->dispatch->interruptOccurred(NULL, NULL, 0);
             break;
             
         case kIOReturnNotResponding:
@@ -305,17 +480,22 @@ void WirelessGamingReceiver::ReadComplete(void *parameter, IOReturn status, UInt
     data->buffer->release();
     IOFree(data, sizeof(WGRREAD));
     
+    // The read stays outstanding until the next one has started, or none will
     if (reread)
         QueueRead(newIndex);
+    else
+        FinishRead(newIndex);
 }
 
-// Queue an asynchronous write on a controller
+// Queue a packet for a controller, sent after any packets already waiting. Returns true once
+// the packet is queued, which doesn't mean it will be sent: a write that later fails to start
+// or complete is dropped, and only logged
 bool WirelessGamingReceiver::QueueWrite(int index, const void *bytes, UInt32 length)
 {
     IOBufferMemoryDescriptor *outBuffer;
-    IOUSBCompletion complete;
-    IOReturn err;
     
+    if (outputLock == NULL)
+        return false;
     outBuffer = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0, length);
     if (outBuffer == NULL)
     {
@@ -324,17 +504,121 @@ bool WirelessGamingReceiver::QueueWrite(int index, const void *bytes, UInt32 len
     }
     outBuffer->writeBytes(0, bytes, length);
     
-    complete.target = this;
-    complete.action = _WriteComplete;
-    complete.parameter = outBuffer;
+    IOLockLock(outputLock);
+    if (!outputQueue.Stopping() && connections[index].outputArray->setObject(outBuffer))
+        outputQueue.Queued(index);
+    IOLockUnlock(outputLock);
+    outBuffer->release();
     
-    err = connections[index].controllerOut->Write(outBuffer, 0, 0, length, &complete);
-    if (err == kIOReturnSuccess)
-        return true;
-    else
-    {
-        // IOLog("send - failed to start (0x%.8x)\n",err);
+    PumpOutput();
+    return true;
+}
+
+// Queue a packet for a controller that replaces any unsent one given here before
+bool WirelessGamingReceiver::QueueLatest(int index, const void *bytes, UInt32 length)
+{
+    bool queued;
+    
+    if (outputLock == NULL)
         return false;
+    
+    IOLockLock(outputLock);
+    queued = outputQueue.SetLatest(index, bytes, length);
+    IOLockUnlock(outputLock);
+    
+    if (queued)
+        PumpOutput();
+    return queued;
+}
+
+// Start as many writes as the output budget allows, taking one from each waiting connection in turn
+void WirelessGamingReceiver::PumpOutput(void)
+{
+    IOBufferMemoryDescriptor *outBuffer;
+    IOUSBCompletion complete;
+    UInt8 latest[WIRELESS_LATEST_MAX];
+    UInt32 latestLength;
+    IOReturn err;
+    int index;
+    
+    if (outputLock == NULL)
+        return;
+    for (;;)
+    {
+        IOLockLock(outputLock);
+        outBuffer = NULL;
+        index = outputQueue.Next(latest, &latestLength);
+        if ((index != -1) && (latestLength == 0))
+        {
+            outBuffer = OSDynamicCast(IOBufferMemoryDescriptor, connections[index].outputArray->getObject(0));
+            if (outBuffer != NULL)
+                outBuffer->retain();
+            connections[index].outputArray->removeObject(0);
+        }
+        IOLockUnlock(outputLock);
+        if (index == -1)
+            break;
+        if (latestLength != 0)
+        {
+            outBuffer = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0, latestLength);
+            if (outBuffer != NULL)
+                outBuffer->writeBytes(0, latest, latestLength);
+        }
+        if (outBuffer == NULL)
+        {
+            // IOLog("send - unable to allocate buffer\n");
+            FinishOutput();
+            continue;
+        }
+        
+        complete.target = this;
+        complete.action = _WriteComplete;
+        complete.parameter = outBuffer;
+        
+        err = connections[index].controllerOut->Write(outBuffer, 0, 0, outBuffer->getLength(), &complete);
+        if (err != kIOReturnSuccess)
+        {
+            // IOLog("send - failed to start (0x%.8x)\n",err);
+            outBuffer->release();
+            FinishOutput();
+        }
+    }
+}
+
+// Account for a write that has finished, or never started
+void WirelessGamingReceiver::FinishOutput(void)
+{
+    IOLockLock(outputLock);
+    if (outputQueue.Finished())
+        IOLockWakeup(outputLock, &outputQueue, false);
+    IOLockUnlock(outputLock);
+}
+
+// Stop starting writes and wait for the ones in flight to come back, so the lock their
+// completions take can be freed. Aborting the pipes completes them with kIOReturnAborted
+void WirelessGamingReceiver::StopOutput(void)
+{
+    AbsoluteTime deadline;
+    bool finished = true;
+    
+    IOLockLock(outputLock);
+    outputQueue.Stop();
+    IOLockUnlock(outputLock);
+    for (int i = 0; i < connectionCount; i++)
+    {
+        if (connections[i].controllerOut != NULL)
+            connections[i].controllerOut->Abort();
+    }
+    clock_interval_to_deadline(WIRELESS_OUTPUT_DRAIN, kMillisecondScale, &deadline);
+    IOLockLock(outputLock);
+    while (finished && (outputQueue.InFlight() > 0))
+        finished = IOLockSleepDeadline(outputLock, &outputQueue, deadline, THREAD_UNINT) == THREAD_AWAKENED;
+    IOLockUnlock(outputLock);
+    if (!finished)
+    {
+        // A completion may still come, so the lock can't be freed under it
+        IOLog("release - %d writes never completed\n", outputQueue.InFlight());
+        outputLock = NULL;
     }
 }
 
@@ -346,13 +630,67 @@ void WirelessGamingReceiver::WriteComplete(void *parameter,IOReturn status,UInt3
         IOLog("write - Error writing: 0x%.8x\n",status);
     }
     memory->release();
+    if (outputLock != NULL)
+    {
+        FinishOutput();
+        PumpOutput();
+    }
 }
 
 // Release any allocated objects
 void WirelessGamingReceiver::ReleaseAll(void)
 {
-    for (int i = 0; i < connectionCount; i++)
+    bool stuck = false;
+    int i;
+    
+    if (outputLock != NULL)
+        StopOutput();
+    if (idleTimer != NULL)
+    {
+        idleTimer->cancelTimeout();
+        if (getWorkLoop() != NULL)
+            getWorkLoop()->removeEventSource(idleTimer);
+        idleTimer->release();
+        idleTimer = NULL;
+    }
+    // Stop the reads first, so no completion can come in while the rest is released
+    for (i = 0; i < connectionCount; i++)
+    {
+        if (!StopInput(i))
+            stuck = true;
+    }
+    if (stuck)
     {
+        // A completion may still come, so the connections can't be freed under it
+        IOLog("release - a read never completed\n");
+        return;
+    }
+    // With no packets coming in nothing signals the events, and removing them waits for
+    // any that are running
+    for (i = 0; i < connectionCount; i++)
+    {
+        if (connections[i].dispatch != NULL)
+        {
+            connections[i].dispatch->disable();
+            connections[i].workloop->removeEventSource(connections[i].dispatch);
+            connections[i].dispatch->release();
+            connections[i].dispatch = NULL;
+        }
+        if (connections[i].serviceEvent != NULL)
+        {
+            connections[i].serviceEvent->disable();
+            connections[i].workloop->removeEventSource(connections[i].serviceEvent);
+            connections[i].serviceEvent->release();
+            connections[i].serviceEvent = NULL;
+        }
+    }
+    for (i = 0; i < connectionCount; i++)
+    {
+        if (connections[i].workloop != NULL)
+        {
+            connections[i].workloop->release();
+            connections[i].workloop = NULL;
+        }
         if (connections[i].service != NULL)
         {
             connections[i].service->terminate(kIOServiceRequired);
@@ -362,7 +700,6 @@ void WirelessGamingReceiver::ReleaseAll(void)
         }
         if (connections[i].controllerIn != NULL)
         {
-            connections[i].controllerIn->Abort();
             connections[i].controllerIn->release();
             connections[i].controllerIn = NULL;
         }
@@ -379,7 +716,6 @@ void WirelessGamingReceiver::ReleaseAll(void)
         }
         if (connections[i].otherIn != NULL)
         {
-            connections[i].otherIn->Abort();
             connections[i].otherIn->release();
             connections[i].otherIn = NULL;
         }
@@ -399,7 +735,49 @@ void WirelessGamingReceiver::ReleaseAll(void)
             connections[i].inputArray->release();
             connections[i].inputArray = NULL;
         }
+        if (connections[i].outputArray != NULL)
+        {
+            connections[i].outputArray->release();
+            connections[i].outputArray = NULL;
+        }
+        if (connections[i].pendingArray != NULL)
+        {
+            connections[i].pendingArray->release();
+            connections[i].pendingArray = NULL;
+        }
+        if (connections[i].inputLock != NULL)
+        {
+            IOLockFree(connections[i].inputLock);
+            connections[i].inputLock = NULL;
+        }
         connections[i].controllerStarted = false;
+        connections[i].link.Reset();
+    }
+    if (idleLock != NULL)
+    {
+        IOLockFree(idleLock);
+        idleLock = NULL;
+    }
+    if (idleEntries != NULL)
+    {
+        IOFree(idleEntries, sizeof(WIRELESS_IDLE_ENTRY) * connectionCount);
+        idleEntries = NULL;
+    }
+    if (outputLock != NULL)
+    {
+        IOLockFree(outputLock);
+        outputLock = NULL;
+    }
+    if (outputSlots != NULL)
+    {
+        IOFree(outputSlots, sizeof(WIRELESS_OUTPUT_SLOT) * connectionCount);
+        outputSlots = NULL;
+    }
+    if (connections != NULL)
+    {
+        IOFree(connections, sizeof(WIRELESS_CONNECTION) * connectionCount);
+        connections = NULL;
+        connectionCount = 0;
     }
     if (device != NULL)
     {
@@ -422,9 +800,70 @@ void WirelessGamingReceiver::_WriteComplete(void *target, void *parameter, IORet
         ((WirelessGamingReceiver*)target)->WriteComplete(parameter, status, bufferSizeRemaining);
 }
 
+// Static wrapper for packets handed to a connection's thread
+void WirelessGamingReceiver::_ProcessPending(OSObject *owner, IOInterruptEventSource *sender, int count)
+{
+    WirelessGamingReceiver *receiver = OSDynamicCast(WirelessGamingReceiver, owner);
+    
+    if (receiver == NULL)
+        return;
+    for (int i = 0; i < receiver->connectionCount; i++)
+    {
+        if (receiver->connections[i].dispatch == sender)
+        {
+            receiver->ProcessPending(i);
+            break;
+        }
+    }
+}
+
+// Static wrapper for service changes
+void WirelessGamingReceiver::_UpdateService(OSObject *owner, IOInterruptEventSource *sender, int count)
+{
+    WirelessGamingReceiver *receiver = OSDynamicCast(WirelessGamingReceiver, owner);
+    
+    if (receiver == NULL)
+        return;
+    for (int i = 0; i < receiver->connectionCount; i++)
+    {
+        if (receiver->connections[i].serviceEvent == sender)
+        {
+            receiver->UpdateService(i);
+            break;
+        }
+    }
+}
+
+// Processes the packets read for a controller, on that controller's thread
+void WirelessGamingReceiver::ProcessPending(int index)
+{
+    WIRELESS_CONNECTION *connection = &connections[index];
+    IOBufferMemoryDescriptor *data;
+    
+    for (;;)
+    {
+        IOLockLock(connection->inputLock);
+        data = OSDynamicCast(IOBufferMemoryDescriptor, connection->pendingArray->getObject(0));
+        if (data != NULL)
+        {
+            data->retain();
+            connection->pendingArray->removeObject(0);
+        }
+        IOLockUnlock(connection->inputLock);
+        if (data == NULL)
+            break;
+        ProcessMessage(index, data);
+        data->release();
+    }
+}
+
 // Processes a message for a controller
-void WirelessGamingReceiver::ProcessMessage(int index, const unsigned char *data, int length)
+void WirelessGamingReceiver::ProcessMessage(int index, IOBufferMemoryDescriptor *buffer)
 {
+    const unsigned char *data = (const unsigned char*)buffer->getBytesNoCopy();
+    int length = (int)buffer->getLength();
+    int actions;
+
 #ifdef PROTOCOL_DEBUG
     char s[1024];
     int i;
@@ -437,87 +876,67 @@ void WirelessGamingReceiver::ProcessMessage(int index, const unsigned char *data
     s[i * 2] = '\0';
     IOLog("Got data (%d, %d bytes): %s\n", index, length, s);
 #endif
-    // Handle device connections
-    if ((length == 2) && (data[0] == 0x08))
+    actions = connections[index].link.Packet(data, length, connections[index].service != NULL, connections[index].controllerStarted);
+    if (actions & WIRELESS_LINK_DETACH)
     {
-        if (data[1] == 0x00)
-        {
-            // Device disconnected
+        // Device disconnected
 #ifdef PROTOCOL_DEBUG
-            IOLog("process: Device detached\n");
+        IOLog("process: Device detached\n");
 #endif
-            if (connections[index].service != NULL)
-            {
-                connections[index].service->SetIndex(-1);
-                if (connections[index].controllerStarted)
-                    connections[index].service->terminate(kIOServiceRequired | kIOServiceSynchronous);
-                connections[index].service->detach(this);
-                connections[index].service->release();
-                connections[index].service = NULL;
-                connections[index].controllerStarted = false;
-            }
-        }
-        else
+        if (connections[index].service != NULL)
         {
-            // Device connected
-#ifdef PROTOCOL_DEBUG
-            IOLog("process: Attempting to add new device\n");
-#endif
-            if (connections[index].service == NULL)
-            {
-                bool ready;
-                int i, j;
-                IOMemoryDescriptor *data;
-                char c;
-                
-                ready = false;
-                j = connections[index].inputArray->getCount();
-                for (i = 0; !ready && (i < j); i++)
-                {
-                    data = OSDynamicCast(IOMemoryDescriptor, connections[index].inputArray->getObject(i));
-                    data->readBytes(1, &c, 1);
-                    if (c == 0x0f)
-                        ready = true;
-                }
-                InstantiateService(index);
-                if (ready && connections[index].service != NULL)
-                {
-#ifdef PROTOCOL_DEBUG
-                    IOLog("Registering wireless device");
-#endif
-                    connections[index].controllerStarted = true;
-                    connections[index].service->registerService();
-                }
-            }
+            connections[index].service->SetIndex(-1);
+            if (connections[index].controllerStarted)
+                connections[index].service->terminate(kIOServiceRequired | kIOServiceSynchronous);
+            connections[index].service->detach(this);
+            connections[index].service->release();
+            connections[index].service = NULL;
+            connections[index].controllerStarted = false;
         }
-        return;
+        IOLockLock(connections[index].inputLock);
+        connections[index].inputArray->flushCollection();
+        IOLockUnlock(connections[index].inputLock);
+        IOLockLock(idleLock);
+        idleQueue.Remove(index);
+        IOLockUnlock(idleLock);
     }
     
-    // Add anything else to the queue
-    IOMemoryDescriptor *copy = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, 0, length);
-    copy->writeBytes(0, data, length);
-    connections[index].inputArray->setObject(copy);
+    // Add anything else to the queue - the read buffer is ours now, so no copy is needed
+    if (actions & WIRELESS_LINK_QUEUE)
+    {
+        IOLockLock(connections[index].inputLock);
+        connections[index].inputArray->setObject(buffer);
+        IOLockUnlock(connections[index].inputLock);
+        if (connections[index].service != NULL)
+            connections[index].service->NewData();
+    }
+    
+    // Creating the node, or registering it once identified, is left to UpdateService
+    if (actions & WIRELESS_LINK_UPDATE)
+    {
+#ifdef PROTOCOL_DEBUG
+        IOLog("process: Attempting to add new device\n");
+#endif
+        connections[index].serviceEvent->interruptOccurred(NULL, NULL, 0);
+    }
+}
+
+// Create the controller's node if needed, and register it once it has identified itself
+void WirelessGamingReceiver::UpdateService(int index)
+{
+    // The controller may have gone again before the event was handled
+    if (!connections[index].link.Connected())
+        return;
     if (connections[index].service == NULL)
         InstantiateService(index);
-    if (connections[index].service != NULL)
+    if ((connections[index].service != NULL) && !connections[index].controllerStarted && connections[index].link.Ready())
     {
-        connections[index].service->NewData();
-        if (!connections[index].controllerStarted)
-        {
-            char c;
-            
-            copy->readBytes(1, &c, 1);
-            if (c == 0x0f)
-            {
 #ifdef PROTOCOL_DEBUG
-                IOLog("Registering wireless device");
+        IOLog("Registering wireless device");
 #endif
-                connections[index].controllerStarted = true;
-                connections[index].service->registerService();
-            }
-        }
+        connections[index].controllerStarted = true;
+        connections[index].service->registerService();
     }
-    copy->release();
 }
 
 // Create a new node for the attached controller
@@ -555,7 +974,12 @@ void WirelessGamingReceiver::InstantiateService(int index)
 // Check a controller's queue
 bool WirelessGamingReceiver::IsDataQueued(int index)
 {
-    return connections[index].inputArray->getCount() > 0;
+    bool queued;
+    
+    IOLockLock(connections[index].inputLock);
+    queued = connections[index].inputArray->getCount() > 0;
+    IOLockUnlock(connections[index].inputLock);
+    return queued;
 }
 
 // Read a controller's queue
@@ -563,13 +987,85 @@ IOMemoryDescriptor* WirelessGamingReceiver::ReadBuffer(int index)
 {
     IOMemoryDescriptor *data;
     
+    IOLockLock(connections[index].inputLock);
     data = OSDynamicCast(IOMemoryDescriptor, connections[index].inputArray->getObject(0));
     if (data != NULL)
+    {
         data->retain();
-    connections[index].inputArray->removeObject(0);
+        connections[index].inputArray->removeObject(0);
+    }
+    IOLockUnlock(connections[index].inputLock);
     return data;
 }
 
+// Restart a controller's idle countdown
+void WirelessGamingReceiver::NoteActivity(int index)
+{
+    UInt64 now;
+    bool first;
+    
+    if (idleLock == NULL)
+        return;
+    // Stamped under the lock, so the queue's stamps never go backwards
+    IOLockLock(idleLock);
+    clock_get_uptime(&now);
+    first = idleQueue.Touch(index, now);
+    IOLockUnlock(idleLock);
+    // The timer only needs to be touched when the queue was empty, later reports
+    // just move the deadline and IdleCheck picks that up when it wakes
+    if (first)
+        ScheduleIdleCheck();
+}
+
+// Arm the idle timer for the earliest deadline of any connection
+void WirelessGamingReceiver::ScheduleIdleCheck(void)
+{
+    UInt64 deadline;
+    
+    if ((idleTimer == NULL) || (idleLock == NULL))
+        return;
+    IOLockLock(idleLock);
+    deadline = idleQueue.NextDeadline();
+    IOLockUnlock(idleLock);
+    if (deadline != 0)
+        idleTimer->wakeAtTime(deadline);
+}
+
+// Power off any controller that has been idle for too long
+void WirelessGamingReceiver::IdleCheck(void)
+{
+    // Same request as WirelessHIDDevice::PowerOff, sent directly as the pad may be going away
+    static const unsigned char buf[] = {0x00, 0x00, 0x08, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+    UInt64 now;
+    int index;
+    
+    if (idleLock == NULL)
+        return;
+    // Expire moves the controller on to retrying in the same step, so a report that arrives
+    // after it restarts the countdown as usual. The lock is only held for that, the write
+    // is queued outside it
+    for (;;)
+    {
+        IOLockLock(idleLock);
+        clock_get_uptime(&now);
+        index = idleQueue.Expire(now);
+        IOLockUnlock(idleLock);
+        if (index == -1)
+            break;
+        QueueWrite(index, buf, sizeof(buf));
+    }
+    ScheduleIdleCheck();
+}
+
+// Static wrapper for the idle timer
+void WirelessGamingReceiver::_IdleCheck(OSObject *owner, IOTimerEventSource *sender)
+{
+    WirelessGamingReceiver *receiver = OSDynamicCast(WirelessGamingReceiver, owner);
+    
+    if (receiver != NULL)
+        receiver->IdleCheck();
+}
+
 // Get our location ID
 OSNumber* WirelessGamingReceiver::newLocationIDNumber() const
 {
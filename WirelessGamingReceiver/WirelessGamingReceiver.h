@@ -25,9 +25,19 @@
 
 #include <IOKit/usb/IOUSBDevice.h>
 #include <IOKit/usb/IOUSBInterface.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOInterruptEventSource.h>
+#include <IOKit/IOTimerEventSource.h>
+#include "WirelessIdleQueue.h"
+#include "WirelessLink.h"
+#include "WirelessOutputQueue.h"
 
-// This value is defined by the hardware and fixed
-#define WIRELESS_CONNECTIONS        4
+// Default number of output packets the receiver may have in flight at once
+#define WIRELESS_OUTPUT_BUDGET      4
+// Milliseconds to wait for aborted writes to complete when shutting down
+#define WIRELESS_OUTPUT_DRAIN       1000
+// The same for each connection's aborted read
+#define WIRELESS_INPUT_DRAIN        1000
 
 class WirelessDevice;
 
@@ -42,9 +52,20 @@ typedef struct WIRELESS_CONNECTION
     IOUSBPipe *otherIn, *otherOut;
     
     // Runtime data
-    OSArray *inputArray;
+    IOLock *inputLock;
+    bool reading;               // A read is outstanding, protected by inputLock
+    bool inputStopping;         // Set by ReleaseAll, no more reads are started
+    OSArray *pendingArray;      // Packets waiting for ProcessMessage
+    OSArray *inputArray;        // Packets waiting for the service
+    IOWorkLoop *workloop;
+    IOInterruptEventSource *dispatch;
+    IOInterruptEventSource *serviceEvent;
     WirelessDevice *service;
     bool controllerStarted;
+    WirelessLink link;          // Whether the controller is there, used from the work loop
+    
+    // Output, protected by the receiver's outputLock
+    OSArray *outputArray;       // Packets waiting to be sent, in order, counted by outputQueue
 }
 WIRELESS_CONNECTION;
 
@@ -65,20 +86,40 @@ private:
     bool IsDataQueued(int index);
     IOMemoryDescriptor* ReadBuffer(int index);
     bool QueueWrite(int index, const void *bytes, UInt32 length);
+    bool QueueLatest(int index, const void *bytes, UInt32 length);
+    void NoteActivity(int index);
     
 private:
     IOUSBDevice *device;
-    WIRELESS_CONNECTION connections[WIRELESS_CONNECTIONS];
+    WIRELESS_CONNECTION *connections;
     int connectionCount;
+    IOTimerEventSource *idleTimer;
+    WirelessIdleQueue idleQueue;        // Protected by idleLock
+    WIRELESS_IDLE_ENTRY *idleEntries;   // One for each connection, used by idleQueue
+    IOLock *idleLock;
+    WirelessOutputQueue outputQueue;    // Protected by outputLock, stopped by ReleaseAll
+    WIRELESS_OUTPUT_SLOT *outputSlots;  // One for each connection, used by outputQueue
+    IOLock *outputLock;
     
+    bool StartConnection(int index);
     void InstantiateService(int index);
+    void UpdateService(int index);
     
-    void ProcessMessage(int index, const unsigned char *data, int length);
+    void ProcessPending(int index);
+    void ProcessMessage(int index, IOBufferMemoryDescriptor *data);
     
     bool QueueRead(int index);
     void ReadComplete(void *parameter, IOReturn status, UInt32 bufferSizeRemaining);
+    void FinishRead(int index);
+    bool StopInput(int index);
     
     void WriteComplete(void *parameter, IOReturn status, UInt32 bufferSizeRemaining);
+    void PumpOutput(void);
+    void FinishOutput(void);
+    void StopOutput(void);
+    
+    void ScheduleIdleCheck(void);
+    void IdleCheck(void);
     
     void ReleaseAll(void);
 
@@ -86,6 +127,9 @@ private:
     
     static void _ReadComplete(void *target, void *parameter, IOReturn status, UInt32 bufferSizeRemaining);
     static void _WriteComplete(void *target, void *parameter, IOReturn status, UInt32 bufferSizeRemaining);
+    static void _ProcessPending(OSObject *owner, IOInterruptEventSource *sender, int count);
+    static void _UpdateService(OSObject *owner, IOInterruptEventSource *sender, int count);
+    static void _IdleCheck(OSObject *owner, IOTimerEventSource *sender);
 };
 
 #endif // __WIRELESSGAMINGRECEIVER_H__
@@ -21,31 +21,16 @@
     Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 #include <IOKit/IOLib.h>
-#include <IOKit/IOTimerEventSource.h>
 #include "WirelessHIDDevice.h"
 #include "WirelessDevice.h"
 #include "devices.h"
 
-#define POWEROFF_TIMEOUT (15 * 60)
-
 OSDefineMetaClassAndAbstractStructors(WirelessHIDDevice, IOHIDDevice)
 #define super IOHIDDevice
 
 // Some sort of message to send
 const char weirdStart[] = {0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
-void WirelessHIDDevice::ChatPadTimerActionWrapper(OSObject *owner, IOTimerEventSource *sender)
-{
-	WirelessHIDDevice *device = OSDynamicCast(WirelessHIDDevice, owner);
-    
-    // Automatic shutoff
-    device->serialTimerCount++;
-    if (device->serialTimerCount > POWEROFF_TIMEOUT)
-        device->PowerOff();
-    // Reset
-    sender->setTimeoutMS(1000);
-}
-
 // Sets the LED with the same format as the wired controller
 void WirelessHIDDevice::SetLEDs(int mode)
 {
@@ -104,7 +89,6 @@ IOReturn WirelessHIDDevice::setReport(IOMemoryDescriptor *report, IOHIDReportTyp
 bool WirelessHIDDevice::handleStart(IOService *provider)
 {
     WirelessDevice *device;
-    IOWorkLoop *workloop;
     
     if (!super::handleStart(provider))
         goto fail;
@@ -113,26 +97,12 @@ bool WirelessHIDDevice::handleStart(IOService *provider)
     if (device == NULL)
         goto fail;
     
-    serialTimerCount = 0;
-    
-	serialTimer = IOTimerEventSource::timerEventSource(this, ChatPadTimerActionWrapper);
-	if (serialTimer == NULL)
-	{
-		IOLog("start - failed to create timer for chatpad\n");
-		goto fail;
-	}
-    workloop = getWorkLoop();
-	if ((workloop == NULL) || (workloop->addEventSource(serialTimer) != kIOReturnSuccess))
-	{
-		IOLog("start - failed to connect timer for chatpad\n");
-		goto fail;
-	}
-    
     device->RegisterWatcher(this, _receivedData, NULL);
     
     device->SendPacket(weirdStart, sizeof(weirdStart));
-
-    serialTimer->setTimeoutMS(1000);
+    
+    // A controller that never reports still powers off once the countdown runs out
+    device->NoteActivity();
 
     return true;
     
@@ -148,15 +118,6 @@ void WirelessHIDDevice::handleStop(IOService *provider)
     if (device != NULL)
         device->RegisterWatcher(NULL, NULL, NULL);
 
-    if (serialTimer != NULL) {
-        serialTimer->cancelTimeout();
-        IOWorkLoop *workloop = getWorkLoop();
-        if (workloop != NULL)
-            workloop->removeEventSource(serialTimer);
-        serialTimer->release();
-        serialTimer = NULL;
-    }
-    
     super::handleStop(provider);
 }
 
@@ -245,8 +206,11 @@ void WirelessHIDDevice::receivedHIDupdate(unsigned char *data, int length)
 {
     IOReturn err;
     IOMemoryDescriptor *report;
+    WirelessDevice *device = OSDynamicCast(WirelessDevice, getProvider());
     
-    serialTimerCount = 0;
+    // Idle power-off is handled by the receiver, it only needs to know we're in use
+    if (device != NULL)
+        device->NoteActivity();
     report = IOMemoryDescriptor::withAddress(data, length, kIODirectionNone);
     err = handleReport(report);
     report->release();
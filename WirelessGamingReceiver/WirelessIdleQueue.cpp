@@ -0,0 +1,117 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+    
+    WirelessIdleQueue.cpp - when each connection is due to be powered off
+    
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "WirelessIdleQueue.h"
+
+// Set up the queue with nothing counting down
+void WirelessIdleQueue::Init(WIRELESS_IDLE_ENTRY *theEntries, int count, UInt64 theTimeout, UInt64 theRetry)
+{
+    entries = theEntries;
+    for (int i = 0; i < count; i++)
+    {
+        entries[i].list = WIRELESS_IDLE_NONE;
+        entries[i].prev = entries[i].next = -1;
+        entries[i].stamp = 0;
+    }
+    for (int list = 0; list < WIRELESS_IDLE_LISTS; list++)
+        head[list] = tail[list] = -1;
+    wait[WIRELESS_IDLE_NONE] = 0;
+    wait[WIRELESS_IDLE_COUNTING] = theTimeout;
+    wait[WIRELESS_IDLE_RETRYING] = theRetry;
+}
+
+void WirelessIdleQueue::Unlink(int index)
+{
+    WIRELESS_IDLE_ENTRY *entry = &entries[index];
+    
+    if (entry->list == WIRELESS_IDLE_NONE)
+        return;
+    if (entry->prev != -1)
+        entries[entry->prev].next = entry->next;
+    else
+        head[entry->list] = entry->next;
+    if (entry->next != -1)
+        entries[entry->next].prev = entry->prev;
+    else
+        tail[entry->list] = entry->prev;
+    entry->list = WIRELESS_IDLE_NONE;
+    entry->prev = entry->next = -1;
+}
+
+void WirelessIdleQueue::Append(int index, int list, UInt64 now)
+{
+    WIRELESS_IDLE_ENTRY *entry = &entries[index];
+    
+    entry->list = list;
+    entry->stamp = now;
+    entry->prev = tail[list];
+    entry->next = -1;
+    if (tail[list] != -1)
+        entries[tail[list]].next = index;
+    else
+        head[list] = index;
+    tail[list] = index;
+}
+
+bool WirelessIdleQueue::Touch(int index, UInt64 now)
+{
+    bool empty = (head[WIRELESS_IDLE_COUNTING] == -1) && (head[WIRELESS_IDLE_RETRYING] == -1);
+    
+    Unlink(index);
+    Append(index, WIRELESS_IDLE_COUNTING, now);
+    return empty;
+}
+
+void WirelessIdleQueue::Remove(int index)
+{
+    Unlink(index);
+}
+
+UInt64 WirelessIdleQueue::NextDeadline(void) const
+{
+    UInt64 earliest = 0;
+    
+    for (int list = WIRELESS_IDLE_COUNTING; list < WIRELESS_IDLE_LISTS; list++)
+    {
+        if (head[list] == -1)
+            continue;
+        UInt64 deadline = entries[head[list]].stamp + wait[list];
+        if ((earliest == 0) || (deadline < earliest))
+            earliest = deadline;
+    }
+    return earliest;
+}
+
+int WirelessIdleQueue::Expire(UInt64 now)
+{
+    for (int list = WIRELESS_IDLE_COUNTING; list < WIRELESS_IDLE_LISTS; list++)
+    {
+        int index = head[list];
+        
+        if ((index == -1) || (now - entries[index].stamp < wait[list]))
+            continue;
+        Unlink(index);
+        Append(index, WIRELESS_IDLE_RETRYING, now);
+        return index;
+    }
+    return -1;
+}
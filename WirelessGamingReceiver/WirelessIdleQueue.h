@@ -0,0 +1,73 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+    
+    WirelessIdleQueue.h - when each connection is due to be powered off
+    
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef __WIRELESSIDLEQUEUE_H__
+#define __WIRELESSIDLEQUEUE_H__
+
+#include "WirelessHeadless.h"
+
+// Lists a connection can be in
+#define WIRELESS_IDLE_NONE      0   // Not counting down
+#define WIRELESS_IDLE_COUNTING  1   // Reported, powered off once the timeout has passed
+#define WIRELESS_IDLE_RETRYING  2   // Sent a power off, sent again once the retry interval has passed
+#define WIRELESS_IDLE_LISTS     3
+
+// A connection's place in the queue, one for each connection
+typedef struct WIRELESS_IDLE_ENTRY
+{
+    int list;
+    int prev, next;         // Neighbours in the list, -1 at either end
+    UInt64 stamp;           // When the countdown last started
+}
+WIRELESS_IDLE_ENTRY;
+
+// Every connection in a list waits the same time from its stamp, the timeout or the retry
+// interval, and is put at the end when stamped. Each list is therefore in deadline order, and
+// the earliest deadline is at the head of one of the two, however many connections there are.
+// Stamping, expiring and finding the next deadline never look past the heads. Times are in
+// whatever units the caller uses, and must not go backwards. The caller does the locking
+class WirelessIdleQueue
+{
+public:
+    void Init(WIRELESS_IDLE_ENTRY *theEntries, int count, UInt64 theTimeout, UInt64 theRetry);
+    
+    // Restart a connection's countdown at now, returning true if nothing was counting down before
+    bool Touch(int index, UInt64 now);
+    // Stop a connection's countdown
+    void Remove(int index);
+    bool Counting(int index) const { return entries[index].list != WIRELESS_IDLE_NONE; }
+    
+    // The earliest deadline, or 0 if nothing is counting down
+    UInt64 NextDeadline(void) const;
+    // Take a connection whose deadline has passed by now, moving it to retry from now, or -1
+    int Expire(UInt64 now);
+    
+private:
+    void Unlink(int index);
+    void Append(int index, int list, UInt64 now);
+    
+    WIRELESS_IDLE_ENTRY *entries;
+    int head[WIRELESS_IDLE_LISTS], tail[WIRELESS_IDLE_LISTS];
+    UInt64 wait[WIRELESS_IDLE_LISTS];
+};
+
+#endif // __WIRELESSIDLEQUEUE_H__
@@ -0,0 +1,51 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+    
+    WirelessLink.cpp - tracks whether a controller is there, and what to do with its packets
+    
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "WirelessLink.h"
+
+int WirelessLink::Packet(const UInt8 *data, int length, bool haveService, bool serviceStarted)
+{
+    int actions;
+    
+    if ((length == 2) && (data[0] == 0x08))
+    {
+        // Disconnecting drops anything still queued, so the next controller
+        // on this connection doesn't get the last one's packets
+        if (data[1] == 0x00)
+        {
+            Reset();
+            return WIRELESS_LINK_DETACH;
+        }
+        connected = true;
+        return haveService ? 0 : WIRELESS_LINK_UPDATE;
+    }
+    
+    actions = WIRELESS_LINK_QUEUE;
+    connected = true;
+    if ((length > 1) && (data[1] == 0x0f))
+        infoSeen = true;
+    // UpdateService does nothing more once the node is registered, so the event is only
+    // signalled while there is something for it to do
+    if (!haveService || (!serviceStarted && infoSeen))
+        actions |= WIRELESS_LINK_UPDATE;
+    return actions;
+}
@@ -0,0 +1,55 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+    
+    WirelessLink.h - tracks whether a controller is there, and what to do with its packets
+    
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef __WIRELESSLINK_H__
+#define __WIRELESSLINK_H__
+
+#include "WirelessHeadless.h"
+
+// What to do with a packet, any combination of
+#define WIRELESS_LINK_DETACH    0x01    // Remove the controller's node and drop its queued packets
+#define WIRELESS_LINK_QUEUE     0x02    // Queue the packet for the node
+#define WIRELESS_LINK_UPDATE    0x04    // Create the node, or register it, in UpdateService
+
+// A connection's view of its controller, only used from the connection's work loop.
+// The receiver doesn't always see a controller connect: it may have connected before the
+// driver loaded, or the message may be lost. Any other packet counts as connecting then,
+// so the controller isn't left without a node
+class WirelessLink
+{
+public:
+    void Reset(void) { connected = false; infoSeen = false; }
+    
+    // Work out what to do with a packet, given whether the node exists and is registered
+    int Packet(const UInt8 *data, int length, bool haveService, bool serviceStarted);
+    
+    // Between connecting and disconnecting
+    bool Connected(void) const { return connected; }
+    // Connected, and an info packet has been queued since, so the node can be registered
+    bool Ready(void) const { return connected && infoSeen; }
+    
+private:
+    bool connected;
+    bool infoSeen;
+};
+
+#endif // __WIRELESSLINK_H__
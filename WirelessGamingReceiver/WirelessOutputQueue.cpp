@@ -0,0 +1,90 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+    
+    WirelessOutputQueue.cpp - shares the receiver's output between its connections
+    
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "WirelessOutputQueue.h"
+#include <string.h>
+
+// Set up the queue with nothing waiting
+void WirelessOutputQueue::Init(WIRELESS_OUTPUT_SLOT *theSlots, int count, int theBudget)
+{
+    slots = theSlots;
+    slotCount = count;
+    memset(slots, 0, sizeof(WIRELESS_OUTPUT_SLOT) * count);
+    budget = theBudget;
+    inFlight = 0;
+    next = 0;
+    stopping = false;
+}
+
+bool WirelessOutputQueue::Queued(int index)
+{
+    if (stopping)
+        return false;
+    slots[index].queued++;
+    return true;
+}
+
+bool WirelessOutputQueue::SetLatest(int index, const void *bytes, UInt32 length)
+{
+    if (stopping || (length == 0) || (length > sizeof(slots[index].latest)))
+        return false;
+    memcpy(slots[index].latest, bytes, length);
+    slots[index].latestLength = length;
+    slots[index].latestPending = true;
+    return true;
+}
+
+int WirelessOutputQueue::Next(UInt8 bytes[WIRELESS_LATEST_MAX], UInt32 *length)
+{
+    if (stopping || (inFlight >= budget))
+        return -1;
+    for (int i = 0; i < slotCount; i++)
+    {
+        int index = (next + i) % slotCount;
+        WIRELESS_OUTPUT_SLOT *slot = &slots[index];
+        
+        // Queued packets keep their order, so they go before the latest state
+        if (slot->queued > 0)
+        {
+            slot->queued--;
+            *length = 0;
+        }
+        else if (slot->latestPending)
+        {
+            memcpy(bytes, slot->latest, slot->latestLength);
+            *length = slot->latestLength;
+            slot->latestPending = false;
+        }
+        else
+            continue;
+        inFlight++;
+        next = index + 1;
+        return index;
+    }
+    return -1;
+}
+
+bool WirelessOutputQueue::Finished(void)
+{
+    inFlight--;
+    return stopping && (inFlight == 0);
+}
@@ -0,0 +1,74 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+    
+    WirelessOutputQueue.h - shares the receiver's output between its connections
+    
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#ifndef __WIRELESSOUTPUTQUEUE_H__
+#define __WIRELESSOUTPUTQUEUE_H__
+
+#include "WirelessHeadless.h"
+
+// Largest packet that replaces, rather than follows, the previous one
+#define WIRELESS_LATEST_MAX         12
+
+// What a connection has waiting to be sent
+typedef struct WIRELESS_OUTPUT_SLOT
+{
+    UInt32 queued;              // Packets the caller is holding for it, in order
+    bool latestPending;         // Only the newest rumble state is worth sending
+    UInt8 latest[WIRELESS_LATEST_MAX];
+    UInt32 latestLength;
+}
+WIRELESS_OUTPUT_SLOT;
+
+// Decides which connection sends next, taking one packet from each waiting connection in turn,
+// and keeps no more than the budget in flight. Queued packets are only counted here, the caller
+// keeps them and sends the oldest when its connection is picked. The caller does the locking
+class WirelessOutputQueue
+{
+public:
+    void Init(WIRELESS_OUTPUT_SLOT *theSlots, int count, int theBudget);
+    
+    // A packet has been queued for a connection, returning false once stopping
+    bool Queued(int index);
+    // Replace a connection's unsent latest state, returning false if it is too long or stopping
+    bool SetLatest(int index, const void *bytes, UInt32 length);
+    
+    // Pick the connection to send next, or -1 if nothing may be sent now. If its latest state
+    // was picked, it is copied to bytes and *length set, otherwise *length is 0 and the caller
+    // sends its oldest queued packet. Either way the packet counts as in flight
+    int Next(UInt8 bytes[WIRELESS_LATEST_MAX], UInt32 *length);
+    // A packet picked by Next has been sent, or failed to be, returning true if that
+    // was the last one in flight after Stop
+    bool Finished(void);
+    
+    // Stop picking packets, the ones already in flight still have to finish
+    void Stop(void) { stopping = true; }
+    bool Stopping(void) const { return stopping; }
+    int InFlight(void) const { return inFlight; }
+    
+private:
+    WIRELESS_OUTPUT_SLOT *slots;
+    int slotCount;
+    int budget, inFlight, next;
+    bool stopping;
+};
+
+#endif // __WIRELESSOUTPUTQUEUE_H__
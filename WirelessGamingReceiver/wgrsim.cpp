@@ -0,0 +1,993 @@
+/*
+    MICE Xbox 360 Controller driver for Mac OS X
+    Copyright (C) 2006-2013 Colin Munro
+
+    wgrsim.cpp - simulates the wireless receiver outside the kernel
+
+    This file is part of Xbox360Controller.
+
+    Xbox360Controller is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    Xbox360Controller is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Foobar; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+// The receiver driver needs IOKit, so this runs models of it, and the parts of it that are
+// plain C++, on any machine. Build it with:
+//
+//   c++ -O2 -pthread -o wgrsim wgrsim.cpp WirelessIdleQueue.cpp WirelessOutputQueue.cpp WirelessLink.cpp ../360Controller/ControlTransform.cpp
+//
+// With -b, receivers with pads each report at full rate for a few seconds. Each receiver's
+// completion thread hands every report to a worker through a locked queue and a wakeup, the
+// way ReadComplete hands packets to a connection's work loop, and the worker runs it through
+// the report transform and then waits a while as if handing it to HID. This runs once with a
+// worker per pad, as the driver has now, and once with one per receiver, as all of a receiver's
+// connections shared one before, and the spread of time from a report arriving to it being
+// handled is printed for both. With -l, the first pad of each receiver also blocks for that
+// long on each report, as a pad does while its node is being registered, to show how much it
+// holds up the others. Its own reports aren't counted then.
+//
+// With -i, pads stop reporting at different times on a simulated clock, and the receiver's idle
+// handling is run against it with the real WirelessIdleQueue and a one-shot timer standing in
+// for the IOTimerEventSource. Each idle pad has to be powered off exactly the timeout after its
+// last report, then every retry interval until it disconnects, and pads still reporting never.
+// Some pads report again after the first power off, which has to restart their countdown.
+//
+// With -o, connections compete for the receiver's output on a simulated clock through the real
+// WirelessOutputQueue: one floods it with queued packets, some send rumble states faster than
+// they can go out, and the rest a little of both. Every pick has to be the next connection in
+// turn with something waiting, queued packets have to go out in order and before the rumble
+// state, and a rumble state that is sent has to be the newest given, with none sent twice and
+// the last one never lost. How long each connection waited is printed, and once a connection
+// has nothing queued no rumble state may wait longer than it takes every connection to be
+// picked once. With -u the budget is changed from the driver's default.
+//
+// With -c, controllers connect to a connection on a simulated clock, and the receiver's handling
+// of their packets is run through the real WirelessLink on a model of the connection's work loop,
+// where creating and registering the node take a while. The time from the first packet to the
+// node being registered is printed for a controller that connects as usual, one that connected
+// before the driver loaded, one whose connect message is lost, and ones that disconnect and come
+// back, both before and after their node was registered. Each has to be registered soon after
+// its info packet is handled, and the node must only ever be handed packets from the controller
+// that is connected now. The same is run with the handling as it was before, for comparison.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "../360Controller/ControlTransform.h"
+#include "WirelessIdleQueue.h"
+#include "WirelessLink.h"
+#include "WirelessOutputQueue.h"
+
+#define DEFAULT_RECEIVERS   4
+#define DEFAULT_PADS        4       // Per receiver
+#define DEFAULT_RATE        250     // Reports per second from each pad
+#define DEFAULT_WORK        20      // Microseconds each report takes past the transform
+#define DEFAULT_SECONDS     2
+#define DEFAULT_BLOCKED     0       // Microseconds the first pad of each receiver blocks for
+
+// -i works in simulated milliseconds, with the driver's own timeout and retry interval
+#define IDLE_PADS           64
+#define IDLE_TIMEOUT        (15 * 60 * 1000)
+#define IDLE_RETRY          1000
+#define IDLE_PERIOD         250     // Between reports from a pad that is in use
+#define IDLE_RESUME         500     // After the first power off, for the pads that report again
+#define IDLE_DISCONNECT     5       // From the last power off a pad answers to its disconnect
+#define IDLE_END            (40 * 60 * 1000)
+
+// -o works in simulated microseconds
+#define OUTPUT_SLOTS        8
+#define OUTPUT_BUDGET       4       // The driver's WIRELESS_OUTPUT_BUDGET
+#define OUTPUT_WRITE        1000    // For a write to complete
+#define OUTPUT_END          (2 * 1000 * 1000)
+#define OUTPUT_GIVE_UP      (60 * 1000 * 1000)  // Still sending by then, something is never taken off
+
+// -c works in simulated microseconds, on one connection
+#define CONNECT_PROCESS     20      // ProcessMessage
+#define CONNECT_CREATE      30000   // InstantiateService
+#define CONNECT_REGISTER    10000   // registerService, and the HID device starting on it
+#define CONNECT_PERIOD      4000    // Between reports
+#define CONNECT_INFO        3000    // From connecting to the first info packet
+#define CONNECT_INFO_EVERY  1000000 // Between info packets after that
+#define CONNECT_END         (5 * 1000 * 1000)
+
+typedef std::chrono::steady_clock Clock;
+
+static void Usage(const char *name)
+{
+    fprintf(stderr, "usage: %s -b [-n receivers] [-p pads] [-r reports per second] [-w microseconds] [-l microseconds] [-t seconds]\n"
+                    "       %s -i\n"
+                    "       %s -o [-u budget]\n"
+                    "       %s -c\n", name, name, name, name);
+    exit(1);
+}
+
+//----------------------------------------------------------------------------------------------
+// -b: per-report latency with a worker per pad or per receiver
+//----------------------------------------------------------------------------------------------
+
+typedef struct {
+    int pad;
+    Clock::time_point arrived;
+    XBOX360_IN_REPORT report;
+} SimReport;
+
+// Stands in for a connection's pendingArray, inputLock and dispatch event
+struct SimWorker
+{
+    std::mutex lock;
+    std::condition_variable wakeup;
+    std::deque<SimReport> pending;
+    std::vector<double> latencies;      // Microseconds
+    bool stopping;
+
+    SimWorker() : stopping(false) {}
+};
+
+static void Spin(double microseconds)
+{
+    Clock::time_point until = Clock::now() + std::chrono::nanoseconds((long long)(microseconds * 1000));
+
+    while (Clock::now() < until)
+        ;
+}
+
+static void WorkerMain(SimWorker *worker, const ControlTransform *transform, double work, double blocked)
+{
+    std::unique_lock<std::mutex> guard(worker->lock);
+
+    for (;;)
+    {
+        while (worker->pending.empty() && !worker->stopping)
+            worker->wakeup.wait(guard);
+        if (worker->pending.empty())
+            break;
+        SimReport report = worker->pending.front();
+        worker->pending.pop_front();
+        guard.unlock();
+        transform->apply(&report.report);
+        Spin(work);
+        if (report.pad == 0 && blocked > 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds((long long)(blocked * 1000)));
+            guard.lock();
+            continue;
+        }
+        double latency = std::chrono::duration<double, std::micro>(Clock::now() - report.arrived).count();
+        guard.lock();
+        worker->latencies.push_back(latency);
+    }
+}
+
+// Each receiver's completions come in one at a time, a report from each of its pads per period
+static void ReceiverMain(std::vector<SimWorker *> workers, int pads, double rate, double seconds)
+{
+    Clock::time_point start = Clock::now();
+    Clock::duration period = std::chrono::nanoseconds((long long)(1e9 / rate));
+    XBOX360_IN_REPORT report;
+
+    memset(&report, 0, sizeof(report));
+    for (Clock::time_point next = start; next < start + std::chrono::nanoseconds((long long)(seconds * 1e9)); next += period)
+    {
+        std::this_thread::sleep_until(next);
+        for (int pad = 0; pad < pads; pad++)
+        {
+            SimWorker *worker = workers[pad % workers.size()];
+            SimReport queued = {pad, Clock::now(), report};
+
+            report.left.x += 97;
+            report.buttons ^= 1 << (pad & 15);
+            {
+                std::lock_guard<std::mutex> guard(worker->lock);
+                worker->pending.push_back(queued);
+            }
+            worker->wakeup.notify_one();
+        }
+    }
+}
+
+static void Percentiles(const char *name, std::vector<double> &latencies)
+{
+    if (latencies.empty())
+    {
+        printf("%s: no reports handled\n", name);
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    size_t count = latencies.size();
+    printf("%s: %zu reports, median %.1f us, 90%% %.1f us, 99%% %.1f us, worst %.1f us\n", name, count,
+           latencies[count / 2], latencies[count * 9 / 10], latencies[count * 99 / 100], latencies[count - 1]);
+}
+
+static void Scale(const char *name, int receivers, int pads, double rate, double work, double blocked, double seconds, bool perPad)
+{
+    ControlTransform transform;
+    std::vector<SimWorker *> workers;
+    std::vector<std::thread> workerThreads, receiverThreads;
+    std::vector<double> latencies;
+
+    transform.reset();
+    transform.left.deadzone = transform.right.deadzone = 4000;
+    transform.left.deadOff = true;
+    transform.compile();
+    for (int r = 0; r < receivers; r++)
+    {
+        std::vector<SimWorker *> mine;
+        for (int w = 0; w < (perPad ? pads : 1); w++)
+        {
+            SimWorker *worker = new SimWorker;
+            workers.push_back(worker);
+            mine.push_back(worker);
+            workerThreads.push_back(std::thread(WorkerMain, worker, &transform, work, blocked));
+        }
+        receiverThreads.push_back(std::thread(ReceiverMain, mine, pads, rate, seconds));
+    }
+    for (size_t i = 0; i < receiverThreads.size(); i++)
+        receiverThreads[i].join();
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        {
+            std::lock_guard<std::mutex> guard(workers[i]->lock);
+            workers[i]->stopping = true;
+        }
+        workers[i]->wakeup.notify_one();
+        workerThreads[i].join();
+        latencies.insert(latencies.end(), workers[i]->latencies.begin(), workers[i]->latencies.end());
+        delete workers[i];
+    }
+    Percentiles(name, latencies);
+}
+
+//----------------------------------------------------------------------------------------------
+// -i: power off timing on a simulated clock
+//----------------------------------------------------------------------------------------------
+
+enum { IDLE_REPORT, IDLE_GONE };
+
+typedef struct {
+    UInt64 time;
+    int order;                          // Keeps events at the same time in the order they were made
+    int kind;
+    int pad;
+} IdleEvent;
+
+struct IdleLater
+{
+    bool operator()(const IdleEvent &a, const IdleEvent &b) const
+    {
+        return (a.time != b.time) ? (a.time > b.time) : (a.order > b.order);
+    }
+};
+
+typedef struct {
+    bool active;                        // Reports until the end
+    bool resumes;                       // Reports once more after the first power off
+    int reports;                        // Before going idle
+    int answersAfter;                   // Power offs before it disconnects
+    UInt64 first;                       // Time of its first report
+    int powerOffs;
+    std::vector<UInt64> sent, expected;
+} IdlePad;
+
+// The receiver's NoteActivity, ScheduleIdleCheck and IdleCheck with the clock, timer and
+// write replaced
+struct IdleReceiver
+{
+    WirelessIdleQueue queue;
+    std::vector<WIRELESS_IDLE_ENTRY> entries;
+    UInt64 timerAt;                     // 0 while not armed
+    int wakeups, idleWakeups;
+
+    IdleReceiver(int count) : entries(count), timerAt(0), wakeups(0), idleWakeups(0)
+    {
+        queue.Init(&entries[0], count, IDLE_TIMEOUT, IDLE_RETRY);
+    }
+
+    void NoteActivity(int index, UInt64 now)
+    {
+        if (queue.Touch(index, now))
+            ScheduleIdleCheck();
+    }
+
+    void ScheduleIdleCheck(void)
+    {
+        UInt64 deadline = queue.NextDeadline();
+
+        if (deadline != 0)
+            timerAt = deadline;
+    }
+
+    template <typename Write> void IdleCheck(UInt64 now, Write write)
+    {
+        int index;
+        bool any = false;
+
+        wakeups++;
+        while ((index = queue.Expire(now)) != -1)
+        {
+            write(index);
+            any = true;
+        }
+        if (!any)
+            idleWakeups++;
+        ScheduleIdleCheck();
+    }
+};
+
+static int IdleTest(void)
+{
+    std::priority_queue<IdleEvent, std::vector<IdleEvent>, IdleLater> events;
+    std::vector<IdlePad> pads(IDLE_PADS);
+    IdleReceiver receiver(IDLE_PADS);
+    int order = 0, failed = 0, sent = 0;
+
+    for (int i = 0; i < IDLE_PADS; i++)
+    {
+        IdlePad *pad = &pads[i];
+
+        pad->active = (i % 5) == 0;
+        pad->resumes = (i % 7) == 3;
+        pad->reports = 240 * (i % 8) + (i % 13) + 1;
+        pad->answersAfter = (i % 4) + 1;
+        pad->first = 1 + (i * 37) % IDLE_PERIOD;
+        pad->powerOffs = 0;
+        IdleEvent event = {pad->first, order++, IDLE_REPORT, i};
+        events.push(event);
+        if (pad->active)
+            continue;
+        // Worked out directly, rather than with anything the receiver does
+        UInt64 last = pad->first + (UInt64)IDLE_PERIOD * (pad->reports - 1);
+        if (pad->resumes)
+        {
+            pad->expected.push_back(last + IDLE_TIMEOUT);
+            last += IDLE_TIMEOUT + IDLE_RESUME;
+        }
+        for (int j = 0; j < pad->answersAfter; j++)
+            pad->expected.push_back(last + IDLE_TIMEOUT + (UInt64)IDLE_RETRY * j);
+    }
+
+    for (;;)
+    {
+        UInt64 next = events.empty() ? 0 : events.top().time;
+        if ((receiver.timerAt != 0) && ((next == 0) || (receiver.timerAt < next)))
+            next = receiver.timerAt;
+        if ((next == 0) || (next > IDLE_END))
+            break;
+        if (next == receiver.timerAt)
+        {
+            receiver.timerAt = 0;
+            receiver.IdleCheck(next, [&](int index) {
+                IdlePad *pad = &pads[index];
+
+                pad->sent.push_back(next);
+                pad->powerOffs++;
+                sent++;
+                if (pad->resumes && (pad->powerOffs == 1))
+                {
+                    IdleEvent event = {next + IDLE_RESUME, order++, IDLE_REPORT, index};
+                    events.push(event);
+                }
+                else if (pad->powerOffs == pad->answersAfter + (pad->resumes ? 1 : 0))
+                {
+                    IdleEvent event = {next + IDLE_DISCONNECT, order++, IDLE_GONE, index};
+                    events.push(event);
+                }
+            });
+            continue;
+        }
+        IdleEvent event = events.top();
+        IdlePad *pad = &pads[event.pad];
+        events.pop();
+        if (event.kind == IDLE_GONE)
+        {
+            receiver.queue.Remove(event.pad);
+            continue;
+        }
+        receiver.NoteActivity(event.pad, event.time);
+        // The report after a power off is a one off
+        if ((pad->powerOffs == 0) && (pad->active || (--pad->reports > 0)))
+        {
+            IdleEvent report = {event.time + IDLE_PERIOD, order++, IDLE_REPORT, event.pad};
+            events.push(report);
+        }
+    }
+
+    for (int i = 0; i < IDLE_PADS; i++)
+    {
+        if (pads[i].sent == pads[i].expected)
+            continue;
+        printf("pad %d: %zu power offs, expected %zu", i, pads[i].sent.size(), pads[i].expected.size());
+        for (size_t j = 0; j < pads[i].sent.size() && j < pads[i].expected.size(); j++)
+        {
+            if (pads[i].sent[j] != pads[i].expected[j])
+            {
+                printf(", number %zu at %llu ms instead of %llu ms", j + 1,
+                       (unsigned long long)pads[i].sent[j], (unsigned long long)pads[i].expected[j]);
+                break;
+            }
+        }
+        printf("\n");
+        failed = 1;
+    }
+    // Before, each pad had a timer of its own checking it every retry interval
+    printf("%d pads, %d power offs, %d timer wakeups (%d with nothing due), %d with a timer per pad\n",
+           IDLE_PADS, sent, receiver.wakeups, receiver.idleWakeups, IDLE_PADS * (IDLE_END / IDLE_RETRY));
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
+
+//----------------------------------------------------------------------------------------------
+// -o: sharing output between connections on a simulated clock
+//----------------------------------------------------------------------------------------------
+
+enum { OUTPUT_QUEUE, OUTPUT_LATEST, OUTPUT_DONE };
+
+typedef struct {
+    UInt64 time;
+    int order;
+    int kind;
+    int slot;
+} OutputEvent;
+
+struct OutputLater
+{
+    bool operator()(const OutputEvent &a, const OutputEvent &b) const
+    {
+        return (a.time != b.time) ? (a.time > b.time) : (a.order > b.order);
+    }
+};
+
+typedef struct {
+    const char *name;
+    UInt64 queueEvery, latestEvery;     // Microseconds, 0 for never
+    int queueBurst;                     // Packets queued each time
+} OutputLoad;
+
+static const OutputLoad outputLoads[OUTPUT_SLOTS] = {
+    {"flood",           1000,   0,      3},
+    {"rumble",          0,      300,    0},
+    {"rumble",          0,      450,    0},
+    {"mixed",           4000,   2000,   1},
+    {"light rumble",    0,      5000,   0},
+    {"light rumble",    0,      7000,   0},
+    {"light mixed",     9000,   3000,   1},
+    {"quiet",           0,      0,      0},
+};
+
+// The test's own idea of what each connection has waiting, kept apart from the queue's
+typedef struct {
+    std::deque<std::pair<UInt32, UInt64> > queued;  // Sequence number and when it was queued
+    UInt32 queueSequence, latestSequence;
+    bool latestWaiting;
+    UInt64 latestReady;                 // When the rumble state was waiting with nothing queued ahead
+    UInt32 lastLatestSent;
+    int sent;
+    UInt64 worstQueued, worstLatest;
+} OutputShadow;
+
+static void PutSequence(UInt8 *bytes, UInt32 sequence)
+{
+    memset(bytes, 0, WIRELESS_LATEST_MAX);
+    memcpy(bytes, &sequence, sizeof(sequence));
+}
+
+static int OutputTest(int budget)
+{
+    std::priority_queue<OutputEvent, std::vector<OutputEvent>, OutputLater> events;
+    WIRELESS_OUTPUT_SLOT slots[OUTPUT_SLOTS];
+    OutputShadow shadows[OUTPUT_SLOTS];
+    WirelessOutputQueue queue;
+    int order = 0, failed = 0, last = -1, picks = 0, inFlight = 0;
+    UInt8 bytes[WIRELESS_LATEST_MAX + 1];
+    UInt64 now = 0;
+
+    queue.Init(slots, OUTPUT_SLOTS, budget);
+    for (int i = 0; i < OUTPUT_SLOTS; i++)
+    {
+        OutputShadow *shadow = &shadows[i];
+
+        shadow->queueSequence = shadow->latestSequence = shadow->lastLatestSent = 0;
+        shadow->latestWaiting = false;
+        shadow->latestReady = 0;
+        shadow->sent = 0;
+        shadow->worstQueued = shadow->worstLatest = 0;
+        // Spread out, so the connections don't all start together
+        if (outputLoads[i].queueEvery != 0)
+        {
+            OutputEvent event = {(UInt64)i * 37, order++, OUTPUT_QUEUE, i};
+            events.push(event);
+        }
+        if (outputLoads[i].latestEvery != 0)
+        {
+            OutputEvent event = {(UInt64)i * 53, order++, OUTPUT_LATEST, i};
+            events.push(event);
+        }
+    }
+    // Only the driver's largest rumble packet fits
+    if (queue.SetLatest(0, bytes, WIRELESS_LATEST_MAX + 1))
+    {
+        printf("a %d byte latest state was taken\n", WIRELESS_LATEST_MAX + 1);
+        failed = 1;
+    }
+
+    // PumpOutput, checking each pick against the shadows
+    auto pump = [&](void) {
+        UInt32 length;
+        int slot;
+
+        while ((slot = queue.Next(bytes, &length)) != -1)
+        {
+            OutputShadow *shadow = &shadows[slot];
+            int expected = -1;
+
+            for (int i = 1; i <= OUTPUT_SLOTS; i++)
+            {
+                int candidate = (last + i) % OUTPUT_SLOTS;
+                if (!shadows[candidate].queued.empty() || shadows[candidate].latestWaiting)
+                {
+                    expected = candidate;
+                    break;
+                }
+            }
+            if (slot != expected)
+            {
+                printf("at %llu us connection %d was picked, but %d was next in turn\n", (unsigned long long)now, slot, expected);
+                failed = 1;
+            }
+            if (length == 0)
+            {
+                if (shadow->queued.empty())
+                {
+                    printf("at %llu us connection %d sent a queued packet it didn't have\n", (unsigned long long)now, slot);
+                    failed = 1;
+                }
+                else
+                {
+                    shadow->worstQueued = std::max(shadow->worstQueued, now - shadow->queued.front().second);
+                    shadow->queued.pop_front();
+                    if (shadow->queued.empty())
+                        shadow->latestReady = now;
+                }
+            }
+            else
+            {
+                UInt32 sequence;
+
+                memcpy(&sequence, bytes, sizeof(sequence));
+                if (!shadow->queued.empty())
+                {
+                    printf("at %llu us connection %d sent its rumble state before its queued packets\n", (unsigned long long)now, slot);
+                    failed = 1;
+                }
+                if ((length != WIRELESS_LATEST_MAX) || !shadow->latestWaiting || (sequence != shadow->latestSequence) || (sequence == shadow->lastLatestSent))
+                {
+                    printf("at %llu us connection %d sent rumble state %u, the newest is %u and %u was sent last\n",
+                           (unsigned long long)now, slot, sequence, shadow->latestSequence, shadow->lastLatestSent);
+                    failed = 1;
+                }
+                shadow->worstLatest = std::max(shadow->worstLatest, now - shadow->latestReady);
+                shadow->lastLatestSent = sequence;
+                shadow->latestWaiting = false;
+            }
+            shadow->sent++;
+            last = slot;
+            picks++;
+            inFlight++;
+            if (inFlight > budget)
+            {
+                printf("at %llu us %d writes are in flight\n", (unsigned long long)now, inFlight);
+                failed = 1;
+            }
+            OutputEvent event = {now + OUTPUT_WRITE, order++, OUTPUT_DONE, slot};
+            events.push(event);
+        }
+    };
+
+    while (!events.empty())
+    {
+        OutputEvent event = events.top();
+        OutputShadow *shadow = &shadows[event.slot];
+        const OutputLoad *load = &outputLoads[event.slot];
+
+        events.pop();
+        now = event.time;
+        if (now > OUTPUT_GIVE_UP)
+        {
+            printf("still sending after %d s\n", OUTPUT_GIVE_UP / 1000000);
+            failed = 1;
+            break;
+        }
+        switch (event.kind)
+        {
+            case OUTPUT_QUEUE:
+                // Queued packets are held by the caller, the queue only counts them
+                for (int i = 0; i < load->queueBurst; i++)
+                {
+                    shadow->queued.push_back(std::make_pair(++shadow->queueSequence, now));
+                    queue.Queued(event.slot);
+                }
+                if (now + load->queueEvery < OUTPUT_END)
+                {
+                    OutputEvent again = {now + load->queueEvery, order++, OUTPUT_QUEUE, event.slot};
+                    events.push(again);
+                }
+                break;
+            case OUTPUT_LATEST:
+                PutSequence(bytes, ++shadow->latestSequence);
+                queue.SetLatest(event.slot, bytes, WIRELESS_LATEST_MAX);
+                if (!shadow->latestWaiting && shadow->queued.empty())
+                    shadow->latestReady = now;
+                shadow->latestWaiting = true;
+                if (now + load->latestEvery < OUTPUT_END)
+                {
+                    OutputEvent again = {now + load->latestEvery, order++, OUTPUT_LATEST, event.slot};
+                    events.push(again);
+                }
+                break;
+            case OUTPUT_DONE:
+                queue.Finished();
+                inFlight--;
+                break;
+        }
+        pump();
+    }
+
+    for (int i = 0; i < OUTPUT_SLOTS; i++)
+    {
+        OutputShadow *shadow = &shadows[i];
+
+        if (shadow->latestWaiting || (shadow->latestSequence != shadow->lastLatestSent))
+        {
+            printf("connection %d never sent its last rumble state\n", i);
+            failed = 1;
+        }
+        // A rumble state only waits for its own queued packets to go, and then for every other
+        // connection to be picked once, budget at a time
+        UInt64 bound = (UInt64)OUTPUT_WRITE * ((OUTPUT_SLOTS + budget - 1) / budget + 1);
+        if (shadow->worstLatest > bound)
+        {
+            printf("connection %d waited %llu us to send rumble, more than %llu us\n", i,
+                   (unsigned long long)shadow->worstLatest, (unsigned long long)bound);
+            failed = 1;
+        }
+        printf("%d %-13s %5d sent, longest wait %7llu us queued, %5llu us rumble\n", i, outputLoads[i].name,
+               shadow->sent, (unsigned long long)shadow->worstQueued, (unsigned long long)shadow->worstLatest);
+    }
+    if (inFlight != 0 || queue.InFlight() != 0)
+    {
+        printf("%d writes still in flight\n", queue.InFlight());
+        failed = 1;
+    }
+    // Nothing more goes out once stopped, even with packets waiting
+    queue.Stop();
+    UInt32 length;
+    if ((queue.Next(bytes, &length) != -1) || queue.Queued(0) || queue.SetLatest(0, bytes, 1))
+    {
+        printf("the queue still took packets after stopping\n");
+        failed = 1;
+    }
+    printf("%d connections, budget %d, %d packets sent\n", OUTPUT_SLOTS, budget, picks);
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed;
+}
+
+//----------------------------------------------------------------------------------------------
+// -c: connect latency, and packets kept across a reconnect, on a simulated clock
+//----------------------------------------------------------------------------------------------
+
+// ProcessMessage and UpdateService as they were before: only the connect message created the
+// node, and disconnecting left the queued packets for the next controller
+class OldLink
+{
+public:
+    void Reset(void) { connected = false; infoSeen = false; }
+    int Packet(const UInt8 *data, int length, bool haveService, bool serviceStarted)
+    {
+        if ((length == 2) && (data[0] == 0x08))
+        {
+            if (data[1] == 0x00)
+            {
+                Reset();
+                return WIRELESS_LINK_DETACH;
+            }
+            connected = true;
+            return haveService ? 0 : WIRELESS_LINK_UPDATE;
+        }
+        if ((length > 1) && (data[1] == 0x0f))
+            infoSeen = true;
+        return WIRELESS_LINK_QUEUE | ((haveService && !serviceStarted && infoSeen) ? WIRELESS_LINK_UPDATE : 0);
+    }
+    bool Connected(void) const { return connected; }
+    bool Ready(void) const { return connected && infoSeen; }
+    bool FlushesOnDetach(void) const { return false; }
+
+private:
+    bool connected;
+    bool infoSeen;
+};
+
+// The real one, flushing the node's queue when told to detach
+class NewLink : public WirelessLink
+{
+public:
+    bool FlushesOnDetach(void) const { return true; }
+};
+
+typedef struct {
+    bool update;                        // The service event rather than a packet
+    UInt8 data[2];
+    int length;
+    int controller;                     // Which one sent it, counting reconnects
+    UInt64 arrived;
+} ConnectItem;
+
+typedef struct {
+    const char *name;
+    UInt64 start;                       // When the controller connects, before 0 if already there
+    bool lostConnect;                   // The connect message never arrives
+    UInt64 leave, back;                 // Disconnects then, and another connects later, 0 for never
+} ConnectScenario;
+
+static const ConnectScenario connectScenarios[] = {
+    {"connects",                    100000,     false,  0,          0},
+    {"there before loading",        0,          false,  0,          0},
+    {"connect message lost",        100000,     true,   0,          0},
+    {"back before registered",      100000,     false,  120000,     300000},
+    {"back after registered",       100000,     false,  2000000,    2500000},
+};
+
+typedef struct {
+    int controller;
+    UInt64 firstPacket, registered;     // 0 for never
+} ConnectResult;
+
+// Run one scenario through the receiver's handling with the given link
+template <typename Link> static int ConnectRun(const ConnectScenario *scenario, std::vector<ConnectResult> *results)
+{
+    std::vector<ConnectItem> arrivals;
+    std::deque<ConnectItem> pending;    // The work loop's events
+    std::deque<ConnectItem> input;      // inputArray
+    Link link;
+    bool haveService = false, started = false, updatePending = false;
+    int stale = 0, controller = 0;
+
+    link.Reset();
+    // What the receiver is sent, in order
+    for (int which = 0; which < 2; which++)
+    {
+        UInt64 from = (which == 0) ? scenario->start : scenario->back;
+        UInt64 until = (which == 0 && scenario->leave != 0) ? scenario->leave : CONNECT_END;
+
+        if ((which == 1) && (scenario->back == 0))
+            break;
+        ConnectResult result = {which, 0, 0};
+        results->push_back(result);
+        // Already there at loading means the connect message and first info came long ago
+        if ((from != 0) && !scenario->lostConnect)
+        {
+            ConnectItem item = {false, {0x08, 0x80}, 2, which, from};
+            arrivals.push_back(item);
+        }
+        UInt64 info = (from != 0) ? from + CONNECT_INFO : CONNECT_INFO_EVERY / 2;
+        for (UInt64 t = from + CONNECT_PERIOD; t < until; t += CONNECT_PERIOD)
+        {
+            while (info <= t)
+            {
+                ConnectItem item = {false, {0x00, 0x0f}, 2, which, info};
+                arrivals.push_back(item);
+                info += CONNECT_INFO_EVERY;
+            }
+            ConnectItem item = {false, {0x00, 0x01}, 2, which, t};
+            arrivals.push_back(item);
+        }
+        if (until != CONNECT_END)
+        {
+            ConnectItem item = {false, {0x08, 0x00}, 2, which, until};
+            arrivals.push_back(item);
+        }
+    }
+
+    // The work loop handles one event at a time, while packets keep arriving
+    size_t next = 0;
+    UInt64 now = 0;
+    while ((next < arrivals.size()) || !pending.empty())
+    {
+        if (pending.empty() || ((next < arrivals.size()) && (arrivals[next].arrived <= now)))
+        {
+            if (now < arrivals[next].arrived)
+                now = arrivals[next].arrived;
+            pending.push_back(arrivals[next++]);
+            continue;
+        }
+        ConnectItem item = pending.front();
+        pending.pop_front();
+        if (item.update)
+        {
+            // UpdateService
+            updatePending = false;
+            if (!link.Connected())
+                continue;
+            if (!haveService)
+            {
+                now += CONNECT_CREATE;
+                haveService = true;
+            }
+            if (!started && link.Ready())
+            {
+                now += CONNECT_REGISTER;
+                started = true;
+                (*results)[controller].registered = now;
+            }
+        }
+        else
+        {
+            // ProcessMessage
+            now += CONNECT_PROCESS;
+            if ((item.data[0] != 0x08) || (item.data[1] != 0x00))
+            {
+                controller = item.controller;
+                if ((*results)[controller].firstPacket == 0)
+                    (*results)[controller].firstPacket = item.arrived;
+            }
+            int actions = link.Packet(item.data, item.length, haveService, started);
+            if (actions & WIRELESS_LINK_DETACH)
+            {
+                haveService = started = false;
+                if (link.FlushesOnDetach())
+                    input.clear();
+            }
+            if (actions & WIRELESS_LINK_QUEUE)
+                input.push_back(item);
+            if ((actions & WIRELESS_LINK_UPDATE) && !updatePending)
+            {
+                ConnectItem update = {true, {0, 0}, 0, item.controller, now};
+                pending.push_back(update);
+                updatePending = true;
+            }
+        }
+        // A registered node reads everything queued for it
+        while (started && !input.empty())
+        {
+            if (input.front().controller != controller)
+                stale++;
+            input.pop_front();
+        }
+    }
+    return stale;
+}
+
+template <typename Link> static bool ConnectScenarios(const char *name, bool check)
+{
+    bool failed = false;
+
+    printf("%s:\n", name);
+    for (size_t i = 0; i < sizeof(connectScenarios) / sizeof(connectScenarios[0]); i++)
+    {
+        const ConnectScenario *scenario = &connectScenarios[i];
+        std::vector<ConnectResult> results;
+        int stale = ConnectRun<Link>(scenario, &results);
+
+        printf("  %-24s", scenario->name);
+        for (size_t j = 0; j < results.size(); j++)
+        {
+            if (results[j].registered == 0)
+                printf("%s never registered", j ? ", then" : "");
+            else
+                printf("%s registered %6.1f ms after its first packet", j ? ", then" : "",
+                       (results[j].registered - results[j].firstPacket) / 1000.0);
+            // Registering waits for the info packet, at worst a whole interval for one that was
+            // already there, and then for the node to be created and registered. One that
+            // leaves before then needn't be registered at all
+            UInt64 wait = (scenario->start == 0) ? CONNECT_INFO_EVERY : CONNECT_INFO;
+            UInt64 bound = wait + CONNECT_CREATE + CONNECT_REGISTER + CONNECT_PERIOD;
+            UInt64 left = ((j == 0) && (scenario->leave != 0)) ? scenario->leave : CONNECT_END;
+            if (check && (left - results[j].firstPacket > bound) &&
+                ((results[j].registered == 0) || (results[j].registered - results[j].firstPacket > bound)))
+                failed = true;
+        }
+        if (stale > 0)
+        {
+            printf(", %d packets from before handed on", stale);
+            if (check)
+                failed = true;
+        }
+        printf("\n");
+    }
+    return failed;
+}
+
+static int ConnectTest(void)
+{
+    bool failed;
+
+    ConnectScenarios<OldLink>("before", false);
+    failed = ConnectScenarios<NewLink>("now", true);
+    printf("%s\n", failed ? "FAILED" : "passed");
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    int receivers = DEFAULT_RECEIVERS, pads = DEFAULT_PADS;
+    double rate = DEFAULT_RATE, work = DEFAULT_WORK, blocked = DEFAULT_BLOCKED, seconds = DEFAULT_SECONDS;
+    int budget = OUTPUT_BUDGET;
+    bool bench = false, idle = false, output = false, connect = false;
+    int option;
+
+    while ((option = getopt(argc, argv, "biocn:p:r:w:l:t:u:")) != -1)
+    {
+        switch (option)
+        {
+            case 'b':
+                bench = true;
+                break;
+            case 'i':
+                idle = true;
+                break;
+            case 'o':
+                output = true;
+                break;
+            case 'c':
+                connect = true;
+                break;
+            case 'u':
+                budget = atoi(optarg);
+                break;
+            case 'n':
+                receivers = atoi(optarg);
+                break;
+            case 'p':
+                pads = atoi(optarg);
+                break;
+            case 'r':
+                rate = atof(optarg);
+                break;
+            case 'w':
+                work = atof(optarg);
+                break;
+            case 'l':
+                blocked = atof(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            default:
+                Usage(argv[0]);
+        }
+    }
+    if (receivers < 1 || pads < 1 || budget < 1 || rate <= 0 || work < 0 || blocked < 0 || seconds <= 0)
+        Usage(argv[0]);
+
+    if (idle)
+        return IdleTest();
+    if (output)
+        return OutputTest(budget);
+    if (connect)
+        return ConnectTest();
+    if (bench)
+    {
+        printf("%d receivers with %d pads, %.0f reports per second each, %.0f us per report, %.0f us blocked\n", receivers, pads, rate, work, blocked);
+        Scale("worker per pad", receivers, pads, rate, work, blocked, seconds, true);
+        Scale("worker per receiver", receivers, pads, rate, work, blocked, seconds, false);
+        return 0;
+    }
+    Usage(argv[0]);
+    return 1;
+}